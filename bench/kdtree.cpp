@@ -0,0 +1,382 @@
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <getopt.h>
+#include <iostream>
+#include <limits>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "../include/kdtree.hpp"
+#include "../include/point.hpp"
+
+/*
+Times tree construction and nearest neighbor, k nearest neighbor, range and radius queries on
+generated data, for every layout and against a linear scan, and writes one record per measurement
+as CSV or JSON lines so that runs can be compared between releases. Every tree query is checked
+against the linear scan on the queries that the scan answers, and the record says whether they
+agreed.
+*/
+
+enum output_format : char {
+	CSV = 0,
+	JSON = 1
+};
+
+output_format FORMAT = CSV;
+std::size_t QUERIES = 1000;
+std::size_t NEIGHBORS = 10;
+// the range and radius queries are sized to hold about this many points of uniform data
+double EXPECTED = 10;
+std::uint32_t SEED = 1;
+
+void usage( char const * program ) {
+	std::cerr << "Usage: " << program << " [OPTION]...                                            \n";
+	std::cerr << "Benchmark k-d tree construction and queries against a linear scan.              \n";
+	std::cerr << "                                                                                \n";
+	std::cerr << "  -n, --sizes=N,N,...       numbers of points; defaults to 10000,100000,1000000  \n";
+	std::cerr << "  -d, --dimensions=D,D,...  any of 2,3,4,8,16; defaults to 2,3,8,16             \n";
+	std::cerr << "  -g, --distributions=...   any of uniform,clustered,lowdim; defaults to all    \n";
+	std::cerr << "  -q, --queries=N           queries per measurement; defaults to 1000           \n";
+	std::cerr << "  -k, --neighbors=N         neighbors for k nearest neighbor queries; defaults  \n";
+	std::cerr << "                            to 10                                               \n";
+	std::cerr << "  -s, --seed=N              seed of the generators; defaults to 1               \n";
+	std::cerr << "  -f, --format=FORMAT       csv or json; defaults to csv                        \n";
+	std::cerr << "  -h, --help                display this help and exit                          \n";
+}
+
+struct measurement {
+	std::string distribution;
+	std::size_t n;
+	std::size_t d;
+	std::string layout;
+	std::string operation;
+	std::size_t count;
+	double seconds;
+	bool verified;
+};
+
+void print_header() {
+	if( FORMAT == CSV ) {
+		std::cout << "distribution,n,d,layout,operation,count,seconds,ns_per_op,verified\n";
+	}
+}
+
+void print_measurement( measurement const & m ) {
+	double ns = m.count > 0 ? 1e9 * m.seconds / m.count : 0;
+	if( FORMAT == CSV ) {
+		std::cout << m.distribution << ',' << m.n << ',' << m.d << ',' << m.layout << ',' << m.operation << ',' << m.count << ',' << m.seconds << ',' << ns << ',' << (m.verified ? "yes" : "no") << '\n';
+	} else {
+		std::cout << "{\"distribution\":\"" << m.distribution << "\",\"n\":" << m.n << ",\"d\":" << m.d << ",\"layout\":\"" << m.layout << "\",\"operation\":\"" << m.operation << "\",\"count\":" << m.count << ",\"seconds\":" << m.seconds << ",\"ns_per_op\":" << ns << ",\"verified\":" << (m.verified ? "true" : "false") << "}\n";
+	}
+	std::cout.flush();
+}
+
+template <class Function>
+double time_it( Function function ) {
+	auto start = std::chrono::steady_clock::now();
+	function();
+	return std::chrono::duration<double>( std::chrono::steady_clock::now() - start ).count();
+}
+
+/*
+uniform fills the unit cube; clustered draws from 20 Gaussian blobs with standard deviation 0.02
+around uniform centers; lowdim maps a uniform unit square linearly into d dimensions and adds
+noise of standard deviation 0.001, so the data has intrinsic dimension two whatever d is.
+*/
+template <std::size_t d>
+class generator {
+	private:
+		using point = kdtree::point<double,d>;
+		std::string _distribution;
+		std::mt19937 _engine;
+		std::vector<point> _centers;
+		std::vector< std::array<double,2> > _basis;
+	public:
+		generator( std::string distribution, std::uint32_t seed ) : _distribution( distribution ), _engine( seed ), _basis( d ) {
+			std::uniform_real_distribution<double> unit( 0.0, 1.0 );
+			std::normal_distribution<double> normal( 0.0, 1.0 / std::sqrt( 2.0 ) );
+			_centers.resize( 20 );
+			for( auto & c : _centers ) {
+				for( std::size_t i = 0; i < d; ++i ) {
+					c[ i ] = unit( _engine );
+				}
+			}
+			for( auto & row : _basis ) {
+				row = { { normal( _engine ), normal( _engine ) } };
+			}
+		}
+		point operator()() {
+			std::uniform_real_distribution<double> unit( 0.0, 1.0 );
+			point p;
+			if( _distribution == "clustered" ) {
+				std::normal_distribution<double> spread( 0.0, 0.02 );
+				point const & c = _centers[ _engine() % _centers.size() ];
+				for( std::size_t i = 0; i < d; ++i ) {
+					p[ i ] = c[ i ] + spread( _engine );
+				}
+			} else if( _distribution == "lowdim" ) {
+				std::normal_distribution<double> noise( 0.0, 0.001 );
+				double s = unit( _engine );
+				double t = unit( _engine );
+				for( std::size_t i = 0; i < d; ++i ) {
+					p[ i ] = _basis[ i ][ 0 ] * s + _basis[ i ][ 1 ] * t + noise( _engine );
+				}
+			} else {
+				for( std::size_t i = 0; i < d; ++i ) {
+					p[ i ] = unit( _engine );
+				}
+			}
+			return p;
+		}
+};
+
+template <std::size_t d>
+double squared_distance( kdtree::point<double,d> const & p, kdtree::point<double,d> const & q ) {
+	double sum = 0;
+	for( std::size_t i = 0; i < d; ++i ) {
+		sum += (p[ i ] - q[ i ]) * (p[ i ] - q[ i ]);
+	}
+	return sum;
+}
+
+/*
+The per-query answers that tree and linear scan must agree on: the distance to the nearest and to
+the k-th nearest neighbor, and the number of points in the box and in the ball.
+*/
+struct answers {
+	std::vector<double> nn;
+	std::vector<double> knn;
+	std::vector<std::size_t> range;
+	std::vector<std::size_t> radius;
+};
+
+template <class Point>
+using query_function = std::function<void( Point const &, std::size_t, answers & )>;
+
+// times each function over the first count queries, in the order nn, knn, range, radius
+template <class Point>
+void run_queries( std::vector<Point> const & queries, std::size_t count, std::vector< query_function<Point> > const & functions, answers & found, std::vector<double> & seconds ) {
+	found.nn.assign( count, 0 );
+	found.knn.assign( count, 0 );
+	found.range.assign( count, 0 );
+	found.radius.assign( count, 0 );
+	seconds.clear();
+	for( auto const & query : functions ) {
+		seconds.push_back( time_it( [ & ]() {
+					for( std::size_t i = 0; i < count; ++i ) {
+						query( queries[ i ], i, found );
+					}
+				} ) );
+	}
+}
+
+template <std::size_t d>
+void benchmark( std::string const & distribution, std::size_t n ) {
+	using point = kdtree::point<double,d>;
+	generator<d> generate( distribution, SEED );
+	std::vector<point> data( n );
+	std::generate( data.begin(), data.end(), std::ref( generate ) );
+	std::vector<point> queries( QUERIES );
+	std::generate( queries.begin(), queries.end(), std::ref( generate ) );
+	double const pi = std::acos( -1.0 );
+	double half_width = 0.5 * std::pow( EXPECTED / n, 1.0 / d );
+	double radius = std::pow( EXPECTED / n * std::tgamma( 0.5 * d + 1 ) / std::pow( pi, 0.5 * d ), 1.0 / d );
+	point offset;
+	std::fill( offset.begin(), offset.end(), half_width );
+	std::size_t const k = std::min( NEIGHBORS, n );
+	std::string const operations[] = { "nn", "knn", "range", "radius" };
+
+	// the linear scan answers as many queries as about 5e7 coordinate reads allow
+	std::size_t checked = std::min( QUERIES, std::max<std::size_t>( 20, 50000000 / (n * d) ) );
+	answers expected;
+	std::vector<double> seconds;
+	std::vector<double> distances( n );
+	run_queries<point>( queries, checked, {
+			[ & ]( point const & q, std::size_t i, answers & a ) {
+				double best = std::numeric_limits<double>::infinity();
+				for( auto const & p : data ) {
+					best = std::min( best, squared_distance( p, q ) );
+				}
+				a.nn[ i ] = best;
+			},
+			[ & ]( point const & q, std::size_t i, answers & a ) {
+				for( std::size_t j = 0; j < n; ++j ) {
+					distances[ j ] = squared_distance( data[ j ], q );
+				}
+				std::nth_element( distances.begin(), distances.begin() + (k - 1), distances.end() );
+				a.knn[ i ] = distances[ k - 1 ];
+			},
+			[ & ]( point const & q, std::size_t i, answers & a ) {
+				point min = q - offset;
+				point max = q + offset;
+				std::size_t count = 0;
+				for( auto const & p : data ) {
+					bool inside = true;
+					for( std::size_t axis = 0; axis < d; ++axis ) {
+						inside = inside && min[ axis ] <= p[ axis ] && p[ axis ] <= max[ axis ];
+					}
+					count += inside ? 1 : 0;
+				}
+				a.range[ i ] = count;
+			},
+			[ & ]( point const & q, std::size_t i, answers & a ) {
+				std::size_t count = 0;
+				for( auto const & p : data ) {
+					count += squared_distance( p, q ) <= radius * radius ? 1 : 0;
+				}
+				a.radius[ i ] = count;
+			} }, expected, seconds );
+	for( std::size_t op = 0; op < 4; ++op ) {
+		print_measurement( { distribution, n, d, "linear_scan", operations[ op ], checked, seconds[ op ], true } );
+	}
+
+	auto run_layout = [ & ]( std::string const & name, auto layout ) {
+		std::vector<point> tree( data );
+		double build = time_it( [ & ]() { kdtree::make_kdtree( tree.begin(), tree.end(), layout ); } );
+		print_measurement( { distribution, n, d, name, "build", n, build, true } );
+		answers found;
+		run_queries<point>( queries, QUERIES, {
+				[ & ]( point const & q, std::size_t i, answers & a ) { a.nn[ i ] = squared_distance( *kdtree::nnsearch_kdtree( tree.cbegin(), tree.cend(), q, layout ), q ); },
+				[ & ]( point const & q, std::size_t i, answers & a ) {
+					double farthest = 0;
+					kdtree::nnsearch_kdtree( tree.cbegin(), tree.cend(), q, k, [ & ]( typename std::vector<point>::const_iterator it ) { farthest = squared_distance( *it, q ); }, layout );
+					a.knn[ i ] = farthest;
+				},
+				[ & ]( point const & q, std::size_t i, answers & a ) { a.range[ i ] = kdtree::rangecount_kdtree( tree.cbegin(), tree.cend(), q - offset, q + offset, layout ); },
+				[ & ]( point const & q, std::size_t i, answers & a ) { a.radius[ i ] = kdtree::radiuscount_kdtree( tree.cbegin(), tree.cend(), q, radius, layout ); } }, found, seconds );
+		bool verified[] = {
+				std::equal( expected.nn.begin(), expected.nn.end(), found.nn.begin() ),
+				std::equal( expected.knn.begin(), expected.knn.end(), found.knn.begin() ),
+				std::equal( expected.range.begin(), expected.range.end(), found.range.begin() ),
+				std::equal( expected.radius.begin(), expected.radius.end(), found.radius.begin() ) };
+		for( std::size_t op = 0; op < 4; ++op ) {
+			print_measurement( { distribution, n, d, name, operations[ op ], QUERIES, seconds[ op ], verified[ op ] } );
+		}
+	};
+	run_layout( "leaf_size_1", kdtree::leaf_size() );
+	run_layout( "leaf_size_8", kdtree::leaf_size( 8 ) );
+	run_layout( "eytzinger", kdtree::eytzinger_layout() );
+
+	std::vector<point> tree( data );
+	kdtree::parallel_policy policy;
+	double build = time_it( [ & ]() { kdtree::make_kdtree( policy, tree.begin(), tree.end() ); } );
+	print_measurement( { distribution, n, d, "leaf_size_1_threads_" + std::to_string( policy.threads() ), "build", n, build, true } );
+}
+
+std::vector<std::string> split_list( char const * list ) {
+	std::vector<std::string> items;
+	std::istringstream is( list );
+	std::string item;
+	while( std::getline( is, item, ',' ) ) {
+		if( !item.empty() ) {
+			items.push_back( item );
+		}
+	}
+	return items;
+}
+
+bool parse_count( char const * text, std::size_t & value ) {
+	char * last = nullptr;
+	unsigned long long parsed = std::strtoull( text, &last, 10 );
+	if( *text == '\0' || *last != '\0' || parsed == 0 ) {
+		return false;
+	}
+	value = static_cast<std::size_t>( parsed );
+	return true;
+}
+
+int main( int argc, char* argv[] ) {
+	std::vector<std::size_t> sizes = { 10000, 100000, 1000000 };
+	std::vector<std::size_t> dimensions = { 2, 3, 8, 16 };
+	std::vector<std::string> distributions = { "uniform", "clustered", "lowdim" };
+
+	while( true ) {
+		static struct option long_options[] = {
+				{ "sizes", required_argument, 0, 'n' },
+				{ "dimensions", required_argument, 0, 'd' },
+				{ "distributions", required_argument, 0, 'g' },
+				{ "queries", required_argument, 0, 'q' },
+				{ "neighbors", required_argument, 0, 'k' },
+				{ "seed", required_argument, 0, 's' },
+				{ "format", required_argument, 0, 'f' },
+				{ "help", no_argument, 0, 'h' },
+				{ 0, 0, 0, 0 }
+				};
+		int option_index = 0;
+		int c = getopt_long( argc, argv, "n:d:g:q:k:s:f:h", long_options, &option_index );
+		if( c == -1 ) {
+			break;
+		}
+		bool valid = true;
+		std::size_t value = 0;
+		switch( c ) {
+			case 'n':
+				sizes.clear();
+				for( auto const & item : split_list( optarg ) ) {
+					valid = valid && parse_count( item.c_str(), value );
+					sizes.push_back( value );
+				}
+				break;
+			case 'd':
+				dimensions.clear();
+				for( auto const & item : split_list( optarg ) ) {
+					valid = valid && parse_count( item.c_str(), value ) && (value == 2 || value == 3 || value == 4 || value == 8 || value == 16);
+					dimensions.push_back( value );
+				}
+				break;
+			case 'g':
+				distributions = split_list( optarg );
+				for( auto const & item : distributions ) {
+					valid = valid && (item == "uniform" || item == "clustered" || item == "lowdim");
+				}
+				break;
+			case 'q':
+				valid = parse_count( optarg, QUERIES );
+				break;
+			case 'k':
+				valid = parse_count( optarg, NEIGHBORS );
+				break;
+			case 's':
+				valid = parse_count( optarg, value );
+				SEED = static_cast<std::uint32_t>( value );
+				break;
+			case 'f':
+				valid = strcmp( optarg, "csv" ) == 0 || strcmp( optarg, "json" ) == 0;
+				FORMAT = strcmp( optarg, "json" ) == 0 ? JSON : CSV;
+				break;
+			case 'h':
+				usage( argv[0] );
+				return 0;
+			default:
+				valid = false;
+		}
+		if( !valid ) {
+			usage( argv[0] );
+			return 1;
+		}
+	}
+
+	print_header();
+	for( auto const & distribution : distributions ) {
+		for( std::size_t d : dimensions ) {
+			for( std::size_t n : sizes ) {
+				switch( d ) {
+					case 2: benchmark<2>( distribution, n ); break;
+					case 3: benchmark<3>( distribution, n ); break;
+					case 4: benchmark<4>( distribution, n ); break;
+					case 8: benchmark<8>( distribution, n ); break;
+					case 16: benchmark<16>( distribution, n ); break;
+				}
+			}
+		}
+	}
+
+	return 0;
+}
@@ -0,0 +1,644 @@
+#ifndef KDTREE_DISTANCE_HPP
+#define KDTREE_DISTANCE_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <type_traits>
+
+#if defined( __GNUC__ ) && ( defined( __x86_64__ ) || defined( __i386__ ) )
+#define KDTREE_X86_DISPATCH 1
+#include <immintrin.h>
+#endif
+
+/*
+Squared Euclidean distance kernels. Coordinates of type float, double and std::int32_t are handled
+by SSE, AVX2 and AVX-512 implementations chosen once at runtime from what the processor supports,
+and every other coordinate type, as well as every other architecture, uses the scalar loop. The
+environment variable KDTREE_SIMD (one of scalar, sse, avx2, avx512) caps the level that is chosen.
+Integer coordinates are accumulated in double, so their distances are exact while the sum of the
+squared differences stays below 2^53, for example for differences below 2^24 in up to 32
+dimensions. Beyond that the partial sums are rounded as they are for floating point coordinates.
+*/
+
+namespace kdtree {
+
+	template <typename T> struct distance_traits {
+		using type = typename std::conditional< std::is_floating_point<T>::value, T, double >::type;
+	};
+
+	enum class simd_level : char {
+		SCALAR = 0,
+		SSE = 1,
+		AVX2 = 2,
+		AVX512 = 3
+	};
+
+	// dimensionality from which statically sized points use the vector kernels instead of the inlined loop
+	std::size_t const simd_dimensionality_threshold = 16;
+
+	template <typename T>
+	typename distance_traits<T>::type squared_euclidean_distance_scalar( T const * lhs, T const * rhs, std::size_t d ) noexcept {
+		using accumulator_type = typename distance_traits<T>::type;
+		accumulator_type dist = 0;
+		for( std::size_t i = 0; i < d; ++i ) {
+			accumulator_type diff = static_cast<accumulator_type>( lhs[ i ] ) - static_cast<accumulator_type>( rhs[ i ] );
+			dist += diff * diff;
+		}
+		return dist;
+	}
+
+}
+
+namespace {
+
+#ifdef KDTREE_X86_DISPATCH
+
+	__attribute__(( target( "sse2" ) )) inline float horizontal_sum( __m128 v ) {
+		__m128 shuffled = _mm_movehl_ps( v, v );
+		__m128 sums = _mm_add_ps( v, shuffled );
+		shuffled = _mm_shuffle_ps( sums, sums, 0x55 );
+		return _mm_cvtss_f32( _mm_add_ss( sums, shuffled ) );
+	}
+
+	__attribute__(( target( "sse2" ) )) inline double horizontal_sum( __m128d v ) {
+		return _mm_cvtsd_f64( _mm_add_sd( v, _mm_unpackhi_pd( v, v ) ) );
+	}
+
+	__attribute__(( target( "avx2" ) )) inline float horizontal_sum( __m256 v ) {
+		return horizontal_sum( _mm_add_ps( _mm256_castps256_ps128( v ), _mm256_extractf128_ps( v, 1 ) ) );
+	}
+
+	__attribute__(( target( "avx2" ) )) inline double horizontal_sum( __m256d v ) {
+		return horizontal_sum( _mm_add_pd( _mm256_castpd256_pd128( v ), _mm256_extractf128_pd( v, 1 ) ) );
+	}
+
+	// the zero-masked extracts and conversions below avoid the undefined-source forms, which GCC reports as uninitialized reads
+	__attribute__(( target( "avx512f" ) )) inline float horizontal_sum( __m512 v ) {
+		__m256 high = _mm256_castpd_ps( _mm512_maskz_extractf64x4_pd( 0xFF, _mm512_castps_pd( v ), 1 ) );
+		__m256 low = _mm256_castpd_ps( _mm512_maskz_extractf64x4_pd( 0xFF, _mm512_castps_pd( v ), 0 ) );
+		return horizontal_sum( _mm256_add_ps( low, high ) );
+	}
+
+	__attribute__(( target( "avx512f" ) )) inline double horizontal_sum( __m512d v ) {
+		return horizontal_sum( _mm256_add_pd( _mm512_maskz_extractf64x4_pd( 0xFF, v, 0 ), _mm512_maskz_extractf64x4_pd( 0xFF, v, 1 ) ) );
+	}
+
+	__attribute__(( target( "sse2" ) )) inline float squared_euclidean_distance_sse( float const * lhs, float const * rhs, std::size_t d ) noexcept {
+		__m128 acc = _mm_setzero_ps();
+		std::size_t i = 0;
+		for( ; i + 4 <= d; i += 4 ) {
+			__m128 diff = _mm_sub_ps( _mm_loadu_ps( lhs + i ), _mm_loadu_ps( rhs + i ) );
+			acc = _mm_add_ps( acc, _mm_mul_ps( diff, diff ) );
+		}
+		return horizontal_sum( acc ) + kdtree::squared_euclidean_distance_scalar( lhs + i, rhs + i, d - i );
+	}
+
+	__attribute__(( target( "sse2" ) )) inline double squared_euclidean_distance_sse( double const * lhs, double const * rhs, std::size_t d ) noexcept {
+		__m128d acc = _mm_setzero_pd();
+		std::size_t i = 0;
+		for( ; i + 2 <= d; i += 2 ) {
+			__m128d diff = _mm_sub_pd( _mm_loadu_pd( lhs + i ), _mm_loadu_pd( rhs + i ) );
+			acc = _mm_add_pd( acc, _mm_mul_pd( diff, diff ) );
+		}
+		return horizontal_sum( acc ) + kdtree::squared_euclidean_distance_scalar( lhs + i, rhs + i, d - i );
+	}
+
+	__attribute__(( target( "sse2" ) )) inline double squared_euclidean_distance_sse( std::int32_t const * lhs, std::int32_t const * rhs, std::size_t d ) noexcept {
+		__m128d acc = _mm_setzero_pd();
+		std::size_t i = 0;
+		for( ; i + 2 <= d; i += 2 ) {
+			__m128d x = _mm_cvtepi32_pd( _mm_loadl_epi64( reinterpret_cast<__m128i const *>( lhs + i ) ) );
+			__m128d y = _mm_cvtepi32_pd( _mm_loadl_epi64( reinterpret_cast<__m128i const *>( rhs + i ) ) );
+			__m128d diff = _mm_sub_pd( x, y );
+			acc = _mm_add_pd( acc, _mm_mul_pd( diff, diff ) );
+		}
+		return horizontal_sum( acc ) + kdtree::squared_euclidean_distance_scalar( lhs + i, rhs + i, d - i );
+	}
+
+	__attribute__(( target( "avx2,fma" ) )) inline float squared_euclidean_distance_avx2( float const * lhs, float const * rhs, std::size_t d ) noexcept {
+		__m256 acc0 = _mm256_setzero_ps();
+		__m256 acc1 = _mm256_setzero_ps();
+		std::size_t i = 0;
+		for( ; i + 16 <= d; i += 16 ) {
+			__m256 diff0 = _mm256_sub_ps( _mm256_loadu_ps( lhs + i ), _mm256_loadu_ps( rhs + i ) );
+			__m256 diff1 = _mm256_sub_ps( _mm256_loadu_ps( lhs + i + 8 ), _mm256_loadu_ps( rhs + i + 8 ) );
+			acc0 = _mm256_fmadd_ps( diff0, diff0, acc0 );
+			acc1 = _mm256_fmadd_ps( diff1, diff1, acc1 );
+		}
+		for( ; i + 8 <= d; i += 8 ) {
+			__m256 diff = _mm256_sub_ps( _mm256_loadu_ps( lhs + i ), _mm256_loadu_ps( rhs + i ) );
+			acc0 = _mm256_fmadd_ps( diff, diff, acc0 );
+		}
+		return horizontal_sum( _mm256_add_ps( acc0, acc1 ) ) + kdtree::squared_euclidean_distance_scalar( lhs + i, rhs + i, d - i );
+	}
+
+	__attribute__(( target( "avx2,fma" ) )) inline double squared_euclidean_distance_avx2( double const * lhs, double const * rhs, std::size_t d ) noexcept {
+		__m256d acc0 = _mm256_setzero_pd();
+		__m256d acc1 = _mm256_setzero_pd();
+		std::size_t i = 0;
+		for( ; i + 8 <= d; i += 8 ) {
+			__m256d diff0 = _mm256_sub_pd( _mm256_loadu_pd( lhs + i ), _mm256_loadu_pd( rhs + i ) );
+			__m256d diff1 = _mm256_sub_pd( _mm256_loadu_pd( lhs + i + 4 ), _mm256_loadu_pd( rhs + i + 4 ) );
+			acc0 = _mm256_fmadd_pd( diff0, diff0, acc0 );
+			acc1 = _mm256_fmadd_pd( diff1, diff1, acc1 );
+		}
+		for( ; i + 4 <= d; i += 4 ) {
+			__m256d diff = _mm256_sub_pd( _mm256_loadu_pd( lhs + i ), _mm256_loadu_pd( rhs + i ) );
+			acc0 = _mm256_fmadd_pd( diff, diff, acc0 );
+		}
+		return horizontal_sum( _mm256_add_pd( acc0, acc1 ) ) + kdtree::squared_euclidean_distance_scalar( lhs + i, rhs + i, d - i );
+	}
+
+	__attribute__(( target( "avx2,fma" ) )) inline double squared_euclidean_distance_avx2( std::int32_t const * lhs, std::int32_t const * rhs, std::size_t d ) noexcept {
+		__m256d acc = _mm256_setzero_pd();
+		std::size_t i = 0;
+		for( ; i + 4 <= d; i += 4 ) {
+			__m256d x = _mm256_cvtepi32_pd( _mm_loadu_si128( reinterpret_cast<__m128i const *>( lhs + i ) ) );
+			__m256d y = _mm256_cvtepi32_pd( _mm_loadu_si128( reinterpret_cast<__m128i const *>( rhs + i ) ) );
+			__m256d diff = _mm256_sub_pd( x, y );
+			acc = _mm256_fmadd_pd( diff, diff, acc );
+		}
+		return horizontal_sum( acc ) + kdtree::squared_euclidean_distance_scalar( lhs + i, rhs + i, d - i );
+	}
+
+	__attribute__(( target( "avx512f" ) )) inline float squared_euclidean_distance_avx512( float const * lhs, float const * rhs, std::size_t d ) noexcept {
+		__m512 acc = _mm512_setzero_ps();
+		std::size_t i = 0;
+		for( ; i + 16 <= d; i += 16 ) {
+			__m512 diff = _mm512_sub_ps( _mm512_loadu_ps( lhs + i ), _mm512_loadu_ps( rhs + i ) );
+			acc = _mm512_fmadd_ps( diff, diff, acc );
+		}
+		if( i < d ) {
+			__mmask16 mask = static_cast<__mmask16>( (1u << (d - i)) - 1 );
+			__m512 diff = _mm512_sub_ps( _mm512_maskz_loadu_ps( mask, lhs + i ), _mm512_maskz_loadu_ps( mask, rhs + i ) );
+			acc = _mm512_fmadd_ps( diff, diff, acc );
+		}
+		return horizontal_sum( acc );
+	}
+
+	__attribute__(( target( "avx512f" ) )) inline double squared_euclidean_distance_avx512( double const * lhs, double const * rhs, std::size_t d ) noexcept {
+		__m512d acc = _mm512_setzero_pd();
+		std::size_t i = 0;
+		for( ; i + 8 <= d; i += 8 ) {
+			__m512d diff = _mm512_sub_pd( _mm512_loadu_pd( lhs + i ), _mm512_loadu_pd( rhs + i ) );
+			acc = _mm512_fmadd_pd( diff, diff, acc );
+		}
+		if( i < d ) {
+			__mmask8 mask = static_cast<__mmask8>( (1u << (d - i)) - 1 );
+			__m512d diff = _mm512_sub_pd( _mm512_maskz_loadu_pd( mask, lhs + i ), _mm512_maskz_loadu_pd( mask, rhs + i ) );
+			acc = _mm512_fmadd_pd( diff, diff, acc );
+		}
+		return horizontal_sum( acc );
+	}
+
+	__attribute__(( target( "avx512f" ) )) inline double squared_euclidean_distance_avx512( std::int32_t const * lhs, std::int32_t const * rhs, std::size_t d ) noexcept {
+		__m512d acc = _mm512_setzero_pd();
+		std::size_t i = 0;
+		for( ; i + 8 <= d; i += 8 ) {
+			__m512d x = _mm512_maskz_cvtepi32_pd( 0xFF, _mm256_loadu_si256( reinterpret_cast<__m256i const *>( lhs + i ) ) );
+			__m512d y = _mm512_maskz_cvtepi32_pd( 0xFF, _mm256_loadu_si256( reinterpret_cast<__m256i const *>( rhs + i ) ) );
+			__m512d diff = _mm512_sub_pd( x, y );
+			acc = _mm512_fmadd_pd( diff, diff, acc );
+		}
+		return horizontal_sum( acc ) + kdtree::squared_euclidean_distance_scalar( lhs + i, rhs + i, d - i );
+	}
+
+	/*
+	The kernels below take one query against several points at once. Four points share every load of
+	the query and keep four independent sums in flight, and the points left over are handed to the
+	single pair kernel of the same level.
+	*/
+	__attribute__(( target( "sse2" ) )) inline void squared_euclidean_distances_sse( float const * query, float const * points, std::size_t count, std::size_t stride, std::size_t d, float * out ) noexcept {
+		std::size_t row = 0;
+		for( ; row + 4 <= count; row += 4 ) {
+			float const * p0 = points + row * stride;
+			float const * p1 = p0 + stride;
+			float const * p2 = p1 + stride;
+			float const * p3 = p2 + stride;
+			__m128 acc0 = _mm_setzero_ps();
+			__m128 acc1 = _mm_setzero_ps();
+			__m128 acc2 = _mm_setzero_ps();
+			__m128 acc3 = _mm_setzero_ps();
+			std::size_t i = 0;
+			for( ; i + 4 <= d; i += 4 ) {
+				__m128 q = _mm_loadu_ps( query + i );
+				__m128 diff0 = _mm_sub_ps( q, _mm_loadu_ps( p0 + i ) );
+				__m128 diff1 = _mm_sub_ps( q, _mm_loadu_ps( p1 + i ) );
+				__m128 diff2 = _mm_sub_ps( q, _mm_loadu_ps( p2 + i ) );
+				__m128 diff3 = _mm_sub_ps( q, _mm_loadu_ps( p3 + i ) );
+				acc0 = _mm_add_ps( acc0, _mm_mul_ps( diff0, diff0 ) );
+				acc1 = _mm_add_ps( acc1, _mm_mul_ps( diff1, diff1 ) );
+				acc2 = _mm_add_ps( acc2, _mm_mul_ps( diff2, diff2 ) );
+				acc3 = _mm_add_ps( acc3, _mm_mul_ps( diff3, diff3 ) );
+			}
+			out[ row ] = horizontal_sum( acc0 ) + kdtree::squared_euclidean_distance_scalar( query + i, p0 + i, d - i );
+			out[ row + 1 ] = horizontal_sum( acc1 ) + kdtree::squared_euclidean_distance_scalar( query + i, p1 + i, d - i );
+			out[ row + 2 ] = horizontal_sum( acc2 ) + kdtree::squared_euclidean_distance_scalar( query + i, p2 + i, d - i );
+			out[ row + 3 ] = horizontal_sum( acc3 ) + kdtree::squared_euclidean_distance_scalar( query + i, p3 + i, d - i );
+		}
+		for( ; row < count; ++row ) {
+			out[ row ] = squared_euclidean_distance_sse( query, points + row * stride, d );
+		}
+	}
+
+	__attribute__(( target( "sse2" ) )) inline void squared_euclidean_distances_sse( double const * query, double const * points, std::size_t count, std::size_t stride, std::size_t d, double * out ) noexcept {
+		std::size_t row = 0;
+		for( ; row + 4 <= count; row += 4 ) {
+			double const * p0 = points + row * stride;
+			double const * p1 = p0 + stride;
+			double const * p2 = p1 + stride;
+			double const * p3 = p2 + stride;
+			__m128d acc0 = _mm_setzero_pd();
+			__m128d acc1 = _mm_setzero_pd();
+			__m128d acc2 = _mm_setzero_pd();
+			__m128d acc3 = _mm_setzero_pd();
+			std::size_t i = 0;
+			for( ; i + 2 <= d; i += 2 ) {
+				__m128d q = _mm_loadu_pd( query + i );
+				__m128d diff0 = _mm_sub_pd( q, _mm_loadu_pd( p0 + i ) );
+				__m128d diff1 = _mm_sub_pd( q, _mm_loadu_pd( p1 + i ) );
+				__m128d diff2 = _mm_sub_pd( q, _mm_loadu_pd( p2 + i ) );
+				__m128d diff3 = _mm_sub_pd( q, _mm_loadu_pd( p3 + i ) );
+				acc0 = _mm_add_pd( acc0, _mm_mul_pd( diff0, diff0 ) );
+				acc1 = _mm_add_pd( acc1, _mm_mul_pd( diff1, diff1 ) );
+				acc2 = _mm_add_pd( acc2, _mm_mul_pd( diff2, diff2 ) );
+				acc3 = _mm_add_pd( acc3, _mm_mul_pd( diff3, diff3 ) );
+			}
+			out[ row ] = horizontal_sum( acc0 ) + kdtree::squared_euclidean_distance_scalar( query + i, p0 + i, d - i );
+			out[ row + 1 ] = horizontal_sum( acc1 ) + kdtree::squared_euclidean_distance_scalar( query + i, p1 + i, d - i );
+			out[ row + 2 ] = horizontal_sum( acc2 ) + kdtree::squared_euclidean_distance_scalar( query + i, p2 + i, d - i );
+			out[ row + 3 ] = horizontal_sum( acc3 ) + kdtree::squared_euclidean_distance_scalar( query + i, p3 + i, d - i );
+		}
+		for( ; row < count; ++row ) {
+			out[ row ] = squared_euclidean_distance_sse( query, points + row * stride, d );
+		}
+	}
+
+	__attribute__(( target( "sse2" ) )) inline void squared_euclidean_distances_sse( std::int32_t const * query, std::int32_t const * points, std::size_t count, std::size_t stride, std::size_t d, double * out ) noexcept {
+		std::size_t row = 0;
+		for( ; row + 4 <= count; row += 4 ) {
+			std::int32_t const * p0 = points + row * stride;
+			std::int32_t const * p1 = p0 + stride;
+			std::int32_t const * p2 = p1 + stride;
+			std::int32_t const * p3 = p2 + stride;
+			__m128d acc0 = _mm_setzero_pd();
+			__m128d acc1 = _mm_setzero_pd();
+			__m128d acc2 = _mm_setzero_pd();
+			__m128d acc3 = _mm_setzero_pd();
+			std::size_t i = 0;
+			for( ; i + 2 <= d; i += 2 ) {
+				__m128d q = _mm_cvtepi32_pd( _mm_loadl_epi64( reinterpret_cast<__m128i const *>( query + i ) ) );
+				__m128d diff0 = _mm_sub_pd( q, _mm_cvtepi32_pd( _mm_loadl_epi64( reinterpret_cast<__m128i const *>( p0 + i ) ) ) );
+				__m128d diff1 = _mm_sub_pd( q, _mm_cvtepi32_pd( _mm_loadl_epi64( reinterpret_cast<__m128i const *>( p1 + i ) ) ) );
+				__m128d diff2 = _mm_sub_pd( q, _mm_cvtepi32_pd( _mm_loadl_epi64( reinterpret_cast<__m128i const *>( p2 + i ) ) ) );
+				__m128d diff3 = _mm_sub_pd( q, _mm_cvtepi32_pd( _mm_loadl_epi64( reinterpret_cast<__m128i const *>( p3 + i ) ) ) );
+				acc0 = _mm_add_pd( acc0, _mm_mul_pd( diff0, diff0 ) );
+				acc1 = _mm_add_pd( acc1, _mm_mul_pd( diff1, diff1 ) );
+				acc2 = _mm_add_pd( acc2, _mm_mul_pd( diff2, diff2 ) );
+				acc3 = _mm_add_pd( acc3, _mm_mul_pd( diff3, diff3 ) );
+			}
+			out[ row ] = horizontal_sum( acc0 ) + kdtree::squared_euclidean_distance_scalar( query + i, p0 + i, d - i );
+			out[ row + 1 ] = horizontal_sum( acc1 ) + kdtree::squared_euclidean_distance_scalar( query + i, p1 + i, d - i );
+			out[ row + 2 ] = horizontal_sum( acc2 ) + kdtree::squared_euclidean_distance_scalar( query + i, p2 + i, d - i );
+			out[ row + 3 ] = horizontal_sum( acc3 ) + kdtree::squared_euclidean_distance_scalar( query + i, p3 + i, d - i );
+		}
+		for( ; row < count; ++row ) {
+			out[ row ] = squared_euclidean_distance_sse( query, points + row * stride, d );
+		}
+	}
+
+	__attribute__(( target( "avx2,fma" ) )) inline void squared_euclidean_distances_avx2( float const * query, float const * points, std::size_t count, std::size_t stride, std::size_t d, float * out ) noexcept {
+		std::size_t row = 0;
+		for( ; row + 4 <= count; row += 4 ) {
+			float const * p0 = points + row * stride;
+			float const * p1 = p0 + stride;
+			float const * p2 = p1 + stride;
+			float const * p3 = p2 + stride;
+			__m256 acc0 = _mm256_setzero_ps();
+			__m256 acc1 = _mm256_setzero_ps();
+			__m256 acc2 = _mm256_setzero_ps();
+			__m256 acc3 = _mm256_setzero_ps();
+			std::size_t i = 0;
+			for( ; i + 8 <= d; i += 8 ) {
+				__m256 q = _mm256_loadu_ps( query + i );
+				__m256 diff0 = _mm256_sub_ps( q, _mm256_loadu_ps( p0 + i ) );
+				__m256 diff1 = _mm256_sub_ps( q, _mm256_loadu_ps( p1 + i ) );
+				__m256 diff2 = _mm256_sub_ps( q, _mm256_loadu_ps( p2 + i ) );
+				__m256 diff3 = _mm256_sub_ps( q, _mm256_loadu_ps( p3 + i ) );
+				acc0 = _mm256_fmadd_ps( diff0, diff0, acc0 );
+				acc1 = _mm256_fmadd_ps( diff1, diff1, acc1 );
+				acc2 = _mm256_fmadd_ps( diff2, diff2, acc2 );
+				acc3 = _mm256_fmadd_ps( diff3, diff3, acc3 );
+			}
+			out[ row ] = horizontal_sum( acc0 ) + kdtree::squared_euclidean_distance_scalar( query + i, p0 + i, d - i );
+			out[ row + 1 ] = horizontal_sum( acc1 ) + kdtree::squared_euclidean_distance_scalar( query + i, p1 + i, d - i );
+			out[ row + 2 ] = horizontal_sum( acc2 ) + kdtree::squared_euclidean_distance_scalar( query + i, p2 + i, d - i );
+			out[ row + 3 ] = horizontal_sum( acc3 ) + kdtree::squared_euclidean_distance_scalar( query + i, p3 + i, d - i );
+		}
+		for( ; row < count; ++row ) {
+			out[ row ] = squared_euclidean_distance_avx2( query, points + row * stride, d );
+		}
+	}
+
+	__attribute__(( target( "avx2,fma" ) )) inline void squared_euclidean_distances_avx2( double const * query, double const * points, std::size_t count, std::size_t stride, std::size_t d, double * out ) noexcept {
+		std::size_t row = 0;
+		for( ; row + 4 <= count; row += 4 ) {
+			double const * p0 = points + row * stride;
+			double const * p1 = p0 + stride;
+			double const * p2 = p1 + stride;
+			double const * p3 = p2 + stride;
+			__m256d acc0 = _mm256_setzero_pd();
+			__m256d acc1 = _mm256_setzero_pd();
+			__m256d acc2 = _mm256_setzero_pd();
+			__m256d acc3 = _mm256_setzero_pd();
+			std::size_t i = 0;
+			for( ; i + 4 <= d; i += 4 ) {
+				__m256d q = _mm256_loadu_pd( query + i );
+				__m256d diff0 = _mm256_sub_pd( q, _mm256_loadu_pd( p0 + i ) );
+				__m256d diff1 = _mm256_sub_pd( q, _mm256_loadu_pd( p1 + i ) );
+				__m256d diff2 = _mm256_sub_pd( q, _mm256_loadu_pd( p2 + i ) );
+				__m256d diff3 = _mm256_sub_pd( q, _mm256_loadu_pd( p3 + i ) );
+				acc0 = _mm256_fmadd_pd( diff0, diff0, acc0 );
+				acc1 = _mm256_fmadd_pd( diff1, diff1, acc1 );
+				acc2 = _mm256_fmadd_pd( diff2, diff2, acc2 );
+				acc3 = _mm256_fmadd_pd( diff3, diff3, acc3 );
+			}
+			out[ row ] = horizontal_sum( acc0 ) + kdtree::squared_euclidean_distance_scalar( query + i, p0 + i, d - i );
+			out[ row + 1 ] = horizontal_sum( acc1 ) + kdtree::squared_euclidean_distance_scalar( query + i, p1 + i, d - i );
+			out[ row + 2 ] = horizontal_sum( acc2 ) + kdtree::squared_euclidean_distance_scalar( query + i, p2 + i, d - i );
+			out[ row + 3 ] = horizontal_sum( acc3 ) + kdtree::squared_euclidean_distance_scalar( query + i, p3 + i, d - i );
+		}
+		for( ; row < count; ++row ) {
+			out[ row ] = squared_euclidean_distance_avx2( query, points + row * stride, d );
+		}
+	}
+
+	__attribute__(( target( "avx2,fma" ) )) inline void squared_euclidean_distances_avx2( std::int32_t const * query, std::int32_t const * points, std::size_t count, std::size_t stride, std::size_t d, double * out ) noexcept {
+		std::size_t row = 0;
+		for( ; row + 4 <= count; row += 4 ) {
+			std::int32_t const * p0 = points + row * stride;
+			std::int32_t const * p1 = p0 + stride;
+			std::int32_t const * p2 = p1 + stride;
+			std::int32_t const * p3 = p2 + stride;
+			__m256d acc0 = _mm256_setzero_pd();
+			__m256d acc1 = _mm256_setzero_pd();
+			__m256d acc2 = _mm256_setzero_pd();
+			__m256d acc3 = _mm256_setzero_pd();
+			std::size_t i = 0;
+			for( ; i + 4 <= d; i += 4 ) {
+				__m256d q = _mm256_cvtepi32_pd( _mm_loadu_si128( reinterpret_cast<__m128i const *>( query + i ) ) );
+				__m256d diff0 = _mm256_sub_pd( q, _mm256_cvtepi32_pd( _mm_loadu_si128( reinterpret_cast<__m128i const *>( p0 + i ) ) ) );
+				__m256d diff1 = _mm256_sub_pd( q, _mm256_cvtepi32_pd( _mm_loadu_si128( reinterpret_cast<__m128i const *>( p1 + i ) ) ) );
+				__m256d diff2 = _mm256_sub_pd( q, _mm256_cvtepi32_pd( _mm_loadu_si128( reinterpret_cast<__m128i const *>( p2 + i ) ) ) );
+				__m256d diff3 = _mm256_sub_pd( q, _mm256_cvtepi32_pd( _mm_loadu_si128( reinterpret_cast<__m128i const *>( p3 + i ) ) ) );
+				acc0 = _mm256_fmadd_pd( diff0, diff0, acc0 );
+				acc1 = _mm256_fmadd_pd( diff1, diff1, acc1 );
+				acc2 = _mm256_fmadd_pd( diff2, diff2, acc2 );
+				acc3 = _mm256_fmadd_pd( diff3, diff3, acc3 );
+			}
+			out[ row ] = horizontal_sum( acc0 ) + kdtree::squared_euclidean_distance_scalar( query + i, p0 + i, d - i );
+			out[ row + 1 ] = horizontal_sum( acc1 ) + kdtree::squared_euclidean_distance_scalar( query + i, p1 + i, d - i );
+			out[ row + 2 ] = horizontal_sum( acc2 ) + kdtree::squared_euclidean_distance_scalar( query + i, p2 + i, d - i );
+			out[ row + 3 ] = horizontal_sum( acc3 ) + kdtree::squared_euclidean_distance_scalar( query + i, p3 + i, d - i );
+		}
+		for( ; row < count; ++row ) {
+			out[ row ] = squared_euclidean_distance_avx2( query, points + row * stride, d );
+		}
+	}
+
+	__attribute__(( target( "avx512f" ) )) inline void squared_euclidean_distances_avx512( float const * query, float const * points, std::size_t count, std::size_t stride, std::size_t d, float * out ) noexcept {
+		std::size_t full = d & ~std::size_t( 15 );
+		__mmask16 mask = static_cast<__mmask16>( (1u << (d - full)) - 1 );
+		std::size_t row = 0;
+		for( ; row + 4 <= count; row += 4 ) {
+			float const * p0 = points + row * stride;
+			float const * p1 = p0 + stride;
+			float const * p2 = p1 + stride;
+			float const * p3 = p2 + stride;
+			__m512 acc0 = _mm512_setzero_ps();
+			__m512 acc1 = _mm512_setzero_ps();
+			__m512 acc2 = _mm512_setzero_ps();
+			__m512 acc3 = _mm512_setzero_ps();
+			for( std::size_t i = 0; i < d; i += 16 ) {
+				__mmask16 lanes = i < full ? static_cast<__mmask16>( 0xFFFF ) : mask;
+				__m512 q = _mm512_maskz_loadu_ps( lanes, query + i );
+				__m512 diff0 = _mm512_sub_ps( q, _mm512_maskz_loadu_ps( lanes, p0 + i ) );
+				__m512 diff1 = _mm512_sub_ps( q, _mm512_maskz_loadu_ps( lanes, p1 + i ) );
+				__m512 diff2 = _mm512_sub_ps( q, _mm512_maskz_loadu_ps( lanes, p2 + i ) );
+				__m512 diff3 = _mm512_sub_ps( q, _mm512_maskz_loadu_ps( lanes, p3 + i ) );
+				acc0 = _mm512_fmadd_ps( diff0, diff0, acc0 );
+				acc1 = _mm512_fmadd_ps( diff1, diff1, acc1 );
+				acc2 = _mm512_fmadd_ps( diff2, diff2, acc2 );
+				acc3 = _mm512_fmadd_ps( diff3, diff3, acc3 );
+			}
+			out[ row ] = horizontal_sum( acc0 );
+			out[ row + 1 ] = horizontal_sum( acc1 );
+			out[ row + 2 ] = horizontal_sum( acc2 );
+			out[ row + 3 ] = horizontal_sum( acc3 );
+		}
+		for( ; row < count; ++row ) {
+			out[ row ] = squared_euclidean_distance_avx512( query, points + row * stride, d );
+		}
+	}
+
+	__attribute__(( target( "avx512f" ) )) inline void squared_euclidean_distances_avx512( double const * query, double const * points, std::size_t count, std::size_t stride, std::size_t d, double * out ) noexcept {
+		std::size_t full = d & ~std::size_t( 7 );
+		__mmask8 mask = static_cast<__mmask8>( (1u << (d - full)) - 1 );
+		std::size_t row = 0;
+		for( ; row + 4 <= count; row += 4 ) {
+			double const * p0 = points + row * stride;
+			double const * p1 = p0 + stride;
+			double const * p2 = p1 + stride;
+			double const * p3 = p2 + stride;
+			__m512d acc0 = _mm512_setzero_pd();
+			__m512d acc1 = _mm512_setzero_pd();
+			__m512d acc2 = _mm512_setzero_pd();
+			__m512d acc3 = _mm512_setzero_pd();
+			for( std::size_t i = 0; i < d; i += 8 ) {
+				__mmask8 lanes = i < full ? static_cast<__mmask8>( 0xFF ) : mask;
+				__m512d q = _mm512_maskz_loadu_pd( lanes, query + i );
+				__m512d diff0 = _mm512_sub_pd( q, _mm512_maskz_loadu_pd( lanes, p0 + i ) );
+				__m512d diff1 = _mm512_sub_pd( q, _mm512_maskz_loadu_pd( lanes, p1 + i ) );
+				__m512d diff2 = _mm512_sub_pd( q, _mm512_maskz_loadu_pd( lanes, p2 + i ) );
+				__m512d diff3 = _mm512_sub_pd( q, _mm512_maskz_loadu_pd( lanes, p3 + i ) );
+				acc0 = _mm512_fmadd_pd( diff0, diff0, acc0 );
+				acc1 = _mm512_fmadd_pd( diff1, diff1, acc1 );
+				acc2 = _mm512_fmadd_pd( diff2, diff2, acc2 );
+				acc3 = _mm512_fmadd_pd( diff3, diff3, acc3 );
+			}
+			out[ row ] = horizontal_sum( acc0 );
+			out[ row + 1 ] = horizontal_sum( acc1 );
+			out[ row + 2 ] = horizontal_sum( acc2 );
+			out[ row + 3 ] = horizontal_sum( acc3 );
+		}
+		for( ; row < count; ++row ) {
+			out[ row ] = squared_euclidean_distance_avx512( query, points + row * stride, d );
+		}
+	}
+
+	__attribute__(( target( "avx512f" ) )) inline void squared_euclidean_distances_avx512( std::int32_t const * query, std::int32_t const * points, std::size_t count, std::size_t stride, std::size_t d, double * out ) noexcept {
+		std::size_t row = 0;
+		for( ; row + 4 <= count; row += 4 ) {
+			std::int32_t const * p0 = points + row * stride;
+			std::int32_t const * p1 = p0 + stride;
+			std::int32_t const * p2 = p1 + stride;
+			std::int32_t const * p3 = p2 + stride;
+			__m512d acc0 = _mm512_setzero_pd();
+			__m512d acc1 = _mm512_setzero_pd();
+			__m512d acc2 = _mm512_setzero_pd();
+			__m512d acc3 = _mm512_setzero_pd();
+			std::size_t i = 0;
+			for( ; i + 8 <= d; i += 8 ) {
+				__m512d q = _mm512_maskz_cvtepi32_pd( 0xFF, _mm256_loadu_si256( reinterpret_cast<__m256i const *>( query + i ) ) );
+				__m512d diff0 = _mm512_sub_pd( q, _mm512_maskz_cvtepi32_pd( 0xFF, _mm256_loadu_si256( reinterpret_cast<__m256i const *>( p0 + i ) ) ) );
+				__m512d diff1 = _mm512_sub_pd( q, _mm512_maskz_cvtepi32_pd( 0xFF, _mm256_loadu_si256( reinterpret_cast<__m256i const *>( p1 + i ) ) ) );
+				__m512d diff2 = _mm512_sub_pd( q, _mm512_maskz_cvtepi32_pd( 0xFF, _mm256_loadu_si256( reinterpret_cast<__m256i const *>( p2 + i ) ) ) );
+				__m512d diff3 = _mm512_sub_pd( q, _mm512_maskz_cvtepi32_pd( 0xFF, _mm256_loadu_si256( reinterpret_cast<__m256i const *>( p3 + i ) ) ) );
+				acc0 = _mm512_fmadd_pd( diff0, diff0, acc0 );
+				acc1 = _mm512_fmadd_pd( diff1, diff1, acc1 );
+				acc2 = _mm512_fmadd_pd( diff2, diff2, acc2 );
+				acc3 = _mm512_fmadd_pd( diff3, diff3, acc3 );
+			}
+			out[ row ] = horizontal_sum( acc0 ) + kdtree::squared_euclidean_distance_scalar( query + i, p0 + i, d - i );
+			out[ row + 1 ] = horizontal_sum( acc1 ) + kdtree::squared_euclidean_distance_scalar( query + i, p1 + i, d - i );
+			out[ row + 2 ] = horizontal_sum( acc2 ) + kdtree::squared_euclidean_distance_scalar( query + i, p2 + i, d - i );
+			out[ row + 3 ] = horizontal_sum( acc3 ) + kdtree::squared_euclidean_distance_scalar( query + i, p3 + i, d - i );
+		}
+		for( ; row < count; ++row ) {
+			out[ row ] = squared_euclidean_distance_avx512( query, points + row * stride, d );
+		}
+	}
+
+#endif
+
+	inline kdtree::simd_level detect_simd_level() noexcept {
+		kdtree::simd_level level = kdtree::simd_level::SCALAR;
+#ifdef KDTREE_X86_DISPATCH
+		__builtin_cpu_init();
+		if( __builtin_cpu_supports( "sse2" ) ) {
+			level = kdtree::simd_level::SSE;
+		}
+		if( __builtin_cpu_supports( "avx2" ) && __builtin_cpu_supports( "fma" ) ) {
+			level = kdtree::simd_level::AVX2;
+		}
+		if( __builtin_cpu_supports( "avx512f" ) ) {
+			level = kdtree::simd_level::AVX512;
+		}
+#endif
+		char const * cap = std::getenv( "KDTREE_SIMD" );
+		if( cap != nullptr ) {
+			kdtree::simd_level limit = level;
+			if( std::strcmp( cap, "scalar" ) == 0 ) {
+				limit = kdtree::simd_level::SCALAR;
+			} else if( std::strcmp( cap, "sse" ) == 0 ) {
+				limit = kdtree::simd_level::SSE;
+			} else if( std::strcmp( cap, "avx2" ) == 0 ) {
+				limit = kdtree::simd_level::AVX2;
+			}
+			level = limit < level ? limit : level;
+		}
+		return level;
+	}
+
+	template <typename T>
+	using distance_kernel = typename kdtree::distance_traits<T>::type (*)( T const *, T const *, std::size_t );
+
+	template <typename T>
+	struct has_simd_kernel : std::integral_constant< bool, std::is_same<T,float>::value || std::is_same<T,double>::value || std::is_same<T,std::int32_t>::value > {};
+
+	template <typename T>
+	distance_kernel<T> select_distance_kernel( kdtree::simd_level level, std::true_type ) noexcept {
+#ifdef KDTREE_X86_DISPATCH
+		switch( level ) {
+			case kdtree::simd_level::AVX512:
+				return &squared_euclidean_distance_avx512;
+			case kdtree::simd_level::AVX2:
+				return &squared_euclidean_distance_avx2;
+			case kdtree::simd_level::SSE:
+				return &squared_euclidean_distance_sse;
+			default:
+				break;
+		}
+#else
+		(void)level;
+#endif
+		return &kdtree::squared_euclidean_distance_scalar<T>;
+	}
+
+	template <typename T>
+	distance_kernel<T> select_distance_kernel( kdtree::simd_level, std::false_type ) noexcept {
+		return &kdtree::squared_euclidean_distance_scalar<T>;
+	}
+
+	template <typename T>
+	void squared_euclidean_distances_scalar( T const * query, T const * points, std::size_t count, std::size_t stride, std::size_t d, typename kdtree::distance_traits<T>::type * out ) noexcept {
+		for( std::size_t i = 0; i < count; ++i ) {
+			out[ i ] = kdtree::squared_euclidean_distance_scalar( query, points + i * stride, d );
+		}
+	}
+
+	template <typename T>
+	using distances_kernel = void (*)( T const *, T const *, std::size_t, std::size_t, std::size_t, typename kdtree::distance_traits<T>::type * );
+
+	template <typename T>
+	distances_kernel<T> select_distances_kernel( kdtree::simd_level level, std::true_type ) noexcept {
+#ifdef KDTREE_X86_DISPATCH
+		switch( level ) {
+			case kdtree::simd_level::AVX512:
+				return &squared_euclidean_distances_avx512;
+			case kdtree::simd_level::AVX2:
+				return &squared_euclidean_distances_avx2;
+			case kdtree::simd_level::SSE:
+				return &squared_euclidean_distances_sse;
+			default:
+				break;
+		}
+#else
+		(void)level;
+#endif
+		return &squared_euclidean_distances_scalar<T>;
+	}
+
+	template <typename T>
+	distances_kernel<T> select_distances_kernel( kdtree::simd_level, std::false_type ) noexcept {
+		return &squared_euclidean_distances_scalar<T>;
+	}
+
+}
+
+namespace kdtree {
+
+	inline simd_level active_simd_level() noexcept {
+		static simd_level const level = detect_simd_level();
+		return level;
+	}
+
+	template <typename T>
+	typename distance_traits<T>::type squared_euclidean_distance( T const * lhs, T const * rhs, std::size_t d ) noexcept {
+		static distance_kernel<T> const kernel = select_distance_kernel<T>( active_simd_level(), has_simd_kernel<T>() );
+		return kernel( lhs, rhs, d );
+	}
+
+	/*
+	One query against count points whose coordinates start stride elements apart, as is the case for
+	the points of a leaf stored contiguously. The vector kernels work through four points at a time,
+	loading each slice of the query once for all four. Low-dimensional points are handled inline, where
+	the call into a vector kernel would cost more than the arithmetic it saves.
+	*/
+	template <typename T>
+	void squared_euclidean_distances( T const * query, T const * points, std::size_t count, std::size_t stride, std::size_t d, typename distance_traits<T>::type * out ) noexcept {
+		if( d < simd_dimensionality_threshold || !has_simd_kernel<T>::value ) {
+			for( std::size_t i = 0; i < count; ++i ) {
+				out[ i ] = squared_euclidean_distance_scalar( query, points + i * stride, d );
+			}
+		} else {
+			static distances_kernel<T> const kernel = select_distances_kernel<T>( active_simd_level(), has_simd_kernel<T>() );
+			kernel( query, points, count, stride, d, out );
+		}
+	}
+
+}
+
+#endif
@@ -0,0 +1,249 @@
+#ifndef KDTREE_DYNAMIC_KDTREE_HPP
+#define KDTREE_DYNAMIC_KDTREE_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <iterator>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include "kdtree.hpp"
+#include "metric.hpp"
+
+namespace kdtree {
+
+	/*
+	A k-d tree that points can be inserted into and erased from, after Bentley and Saxe. The points
+	are kept in a forest of static trees built by make_kdtree, where tree i holds at most 2^i points.
+	An insertion works like incrementing a binary counter: the new point and the points of every
+	tree below the first empty one are rebuilt into that one, so a point takes part in O(log n)
+	builds and an insertion costs amortized O(log^2 n). Erasing marks the point as dead where it is
+	stored; dead points are dropped whenever their tree is rebuilt, and a tree that is more than
+	half dead is rebuilt from its live points on the spot, which keeps erasing at amortized
+	O(log^2 n) too. Queries search every tree and skip dead points. compact() rebuilds the whole
+	forest into a single tree. The layout is kdtree::leaf_size or kdtree::eytzinger_layout.
+	*/
+	template <class Point, class Layout = kdtree::leaf_size>
+	class dynamic_kdtree {
+		static_assert( std::is_same< Layout, kdtree::leaf_size >::value || std::is_same< Layout, kdtree::eytzinger_layout >::value, "kdtree::dynamic_kdtree<Point,Layout> only accepts kdtree::leaf_size or kdtree::eytzinger_layout as its Layout.\n" );
+		private:
+			using coordinate_type = typename std::decay< decltype( *std::declval<Point const &>().begin() ) >::type;
+			using distance_type = typename kdtree::distance_traits<coordinate_type>::type;
+			using iterator = typename std::vector<Point>::const_iterator;
+			struct tree {
+				std::vector<Point> points;
+				std::vector<unsigned char> dead;
+				std::size_t dead_count = 0;
+			};
+			std::vector<tree> _trees;
+			Layout _layout;
+			std::size_t _size;
+			std::size_t _dead;
+			void build( tree & target ) {
+				kdtree::make_kdtree( target.points.begin(), target.points.end(), _layout );
+				target.dead.assign( target.points.size(), 0 );
+				target.dead_count = 0;
+			}
+			// moves the live points of a tree to the back of points and leaves the tree empty
+			void drain( tree & source, std::vector<Point> & points ) {
+				for( std::size_t i = 0; i < source.points.size(); ++i ) {
+					if( !source.dead[ i ] ) {
+						points.push_back( source.points[ i ] );
+					}
+				}
+				_dead -= source.dead_count;
+				source.points.clear();
+				source.dead.clear();
+				source.dead_count = 0;
+			}
+			template <class Visitor>
+			static auto live( tree const & source, Visitor & visit ) {
+				return [ &source, &visit ]( iterator it ) {
+					if( source.dead_count == 0 || !source.dead[ it - source.points.cbegin() ] ) {
+						visit( *it );
+					}
+				};
+			}
+		public:
+			explicit dynamic_kdtree( Layout layout = Layout() ) : _layout( layout ), _size( 0 ), _dead( 0 ) {}
+			std::size_t size() const noexcept { return _size; }
+			bool empty() const noexcept { return _size == 0; }
+			std::size_t tree_count() const noexcept { return _trees.size(); }
+			void clear();
+			void insert( Point const & point );
+			bool erase( Point const & point );
+			void compact();
+			template <class Visitor> void rangequery( Point const & min, Point const & max, Visitor visit ) const;
+			std::vector<Point> rangequery( Point const & min, Point const & max ) const;
+			std::size_t rangecount( Point const & min, Point const & max ) const;
+			template <class Visitor, class Metric = kdtree::euclidean_metric, class = decltype( std::declval<Visitor &>()( std::declval<Point const &>() ) )> void radiusquery( Point const & point, double radius, Visitor visit, Metric metric = Metric() ) const;
+			template <class Metric = kdtree::euclidean_metric> std::vector<Point> radiusquery( Point const & point, double radius, Metric metric = Metric() ) const;
+			template <class Metric = kdtree::euclidean_metric> std::vector<Point> nnsearch( Point const & point, std::size_t k, Metric metric = Metric() ) const;
+	};
+
+	template <class Point, class Layout>
+	void dynamic_kdtree<Point,Layout>::clear() {
+		_trees.clear();
+		_size = 0;
+		_dead = 0;
+	}
+
+	template <class Point, class Layout>
+	void dynamic_kdtree<Point,Layout>::insert( Point const & point ) {
+		std::size_t target = 0;
+		while( target < _trees.size() && !_trees[ target ].points.empty() ) {
+			++target;
+		}
+		if( target == _trees.size() ) {
+			_trees.emplace_back();
+		}
+		std::vector<Point> & points = _trees[ target ].points;
+		points.reserve( std::size_t( 1 ) << target );
+		points.push_back( point );
+		for( std::size_t i = 0; i < target; ++i ) {
+			drain( _trees[ i ], points );
+		}
+		build( _trees[ target ] );
+		++_size;
+	}
+
+	/*
+	Erases one live point equal to the given one and returns whether there was one. Equal points
+	are found by a range query over the degenerate box at the point.
+	*/
+	template <class Point, class Layout>
+	bool dynamic_kdtree<Point,Layout>::erase( Point const & point ) {
+		for( tree & source : _trees ) {
+			bool found = false;
+			kdtree::rangequery_kdtree( source.points.cbegin(), source.points.cend(), point, point, [ & ]( iterator it ) {
+						std::size_t index = it - source.points.cbegin();
+						if( !source.dead[ index ] && *it == point ) {
+							source.dead[ index ] = 1;
+							found = true;
+						}
+						return !found;
+					}, _layout );
+			if( found ) {
+				++source.dead_count;
+				++_dead;
+				--_size;
+				if( 2 * source.dead_count > source.points.size() ) {
+					std::vector<Point> points;
+					points.reserve( source.points.size() - source.dead_count );
+					drain( source, points );
+					source.points = std::move( points );
+					build( source );
+				}
+				return true;
+			}
+		}
+		return false;
+	}
+
+	// rebuilds the live points into the single tree that the binary counter calls for
+	template <class Point, class Layout>
+	void dynamic_kdtree<Point,Layout>::compact() {
+		std::size_t target = 0;
+		while( (std::size_t( 1 ) << target) < _size ) {
+			++target;
+		}
+		std::vector<Point> points;
+		points.reserve( _size );
+		for( tree & source : _trees ) {
+			drain( source, points );
+		}
+		_trees.resize( _size > 0 ? target + 1 : 0 );
+		if( _size > 0 ) {
+			_trees[ target ].points = std::move( points );
+			build( _trees[ target ] );
+		}
+	}
+
+	/*
+	The queries call visit with every live point found, a tree at a time, and otherwise behave like
+	the queries over a static tree. The k nearest neighbor search asks every tree for enough extra
+	neighbors to make up for its share of dead points, doubling the request until k live ones are
+	among them, and merges the results. At most half of every tree is dead, so a single request
+	of about 2k neighbors usually suffices.
+	*/
+	template <class Point, class Layout>
+	template <class Visitor>
+	void dynamic_kdtree<Point,Layout>::rangequery( Point const & min, Point const & max, Visitor visit ) const {
+		for( tree const & source : _trees ) {
+			kdtree::rangequery_kdtree( source.points.cbegin(), source.points.cend(), min, max, live( source, visit ), _layout );
+		}
+	}
+
+	template <class Point, class Layout>
+	std::vector<Point> dynamic_kdtree<Point,Layout>::rangequery( Point const & min, Point const & max ) const {
+		std::vector<Point> points;
+		rangequery( min, max, [ &points ]( Point const & point ) { points.push_back( point ); } );
+		return points;
+	}
+
+	template <class Point, class Layout>
+	std::size_t dynamic_kdtree<Point,Layout>::rangecount( Point const & min, Point const & max ) const {
+		std::size_t count = 0;
+		for( tree const & source : _trees ) {
+			if( source.dead_count == 0 ) {
+				count += kdtree::rangecount_kdtree( source.points.cbegin(), source.points.cend(), min, max, _layout );
+			} else {
+				auto visit = [ &count ]( Point const & ) { ++count; };
+				kdtree::rangequery_kdtree( source.points.cbegin(), source.points.cend(), min, max, live( source, visit ), _layout );
+			}
+		}
+		return count;
+	}
+
+	template <class Point, class Layout>
+	template <class Visitor, class Metric, class>
+	void dynamic_kdtree<Point,Layout>::radiusquery( Point const & point, double radius, Visitor visit, Metric metric ) const {
+		for( tree const & source : _trees ) {
+			kdtree::radiusquery_kdtree( source.points.cbegin(), source.points.cend(), point, radius, live( source, visit ), _layout, metric );
+		}
+	}
+
+	template <class Point, class Layout>
+	template <class Metric>
+	std::vector<Point> dynamic_kdtree<Point,Layout>::radiusquery( Point const & point, double radius, Metric metric ) const {
+		std::vector<Point> points;
+		radiusquery( point, radius, [ &points ]( Point const & found ) { points.push_back( found ); }, metric );
+		return points;
+	}
+
+	template <class Point, class Layout>
+	template <class Metric>
+	std::vector<Point> dynamic_kdtree<Point,Layout>::nnsearch( Point const & point, std::size_t k, Metric metric ) const {
+		std::vector< std::pair<distance_type,Point const *> > candidates;
+		for( tree const & source : _trees ) {
+			std::size_t live_count = source.points.size() - source.dead_count;
+			std::size_t wanted = std::min( k, live_count );
+			if( wanted == 0 ) {
+				continue;
+			}
+			std::size_t first = candidates.size();
+			std::size_t request = std::min( source.points.size(), wanted + wanted * source.dead_count / live_count + 1 );
+			auto visit = [ & ]( Point const & found ) { candidates.emplace_back( kdtree::reduced_distance<distance_type>( metric, found, point ), &found ); };
+			while( true ) {
+				kdtree::nnsearch_kdtree( source.points.cbegin(), source.points.cend(), point, request, live( source, visit ), _layout, metric );
+				if( candidates.size() - first >= wanted || request == source.points.size() ) {
+					break;
+				}
+				candidates.resize( first );
+				request = std::min( source.points.size(), 2 * request );
+			}
+		}
+		auto closer = []( auto const & lhs, auto const & rhs ) { return lhs.first < rhs.first; };
+		std::size_t count = std::min( k, candidates.size() );
+		std::partial_sort( candidates.begin(), candidates.begin() + count, candidates.end(), closer );
+		std::vector<Point> points;
+		points.reserve( count );
+		for( std::size_t i = 0; i < count; ++i ) {
+			points.push_back( *candidates[ i ].second );
+		}
+		return points;
+	}
+
+}
+
+#endif
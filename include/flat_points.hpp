@@ -0,0 +1,200 @@
+#ifndef KDTREE_FLAT_POINTS_HPP
+#define KDTREE_FLAT_POINTS_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <iostream>
+#include <iterator>
+#include <memory>
+#include <type_traits>
+#include <utility>
+#include "distance.hpp"
+
+/*
+Points whose dimensionality is only known at runtime, stored as the rows of a single buffer.
+kdtree::point fixes d at compile time, so every embedding size needs its own instantiation of the
+tree and every point is a separate object. A kdtree::flat_points<T> instead holds n rows of d
+coordinates back to back in one allocation aligned to kdtree::row_alignment bytes. Rows long
+enough for the vector kernels in distance.hpp are padded with zeros to a multiple of that
+alignment, so that every row starts on a cache line and no vector load straddles two rows;
+shorter rows, which are compared inline, are packed. stride() is the distance between rows in
+coordinates.
+
+Indexing and iterating yield kdtree::row_view<T>, a pointer and a dimensionality that reads and
+writes the coordinates in place. The iterators of flat_points are random access iterators over
+row views, and make_kdtree and every search accept them where they accept ranges of points: a
+build rearranges whole rows, and searches take a row_view, of the same or of another buffer, as
+the query point.
+*/
+
+namespace kdtree {
+
+	std::size_t const row_alignment = 64;
+
+	template <class T>
+	class row_view {
+		private:
+			T * _data;
+			std::size_t _dimensionality;
+		public:
+			using coordinate_type = typename std::remove_const<T>::type;
+			using iterator = T *;
+			using const_iterator = T const *;
+
+			row_view() noexcept : _data( nullptr ), _dimensionality( 0 ) {}
+			row_view( T * data, std::size_t dimensionality ) noexcept : _data( data ), _dimensionality( dimensionality ) {}
+			template <class U, class = typename std::enable_if< std::is_convertible<U *,T *>::value >::type>
+			row_view( row_view<U> const & other ) noexcept : _data( other.data() ), _dimensionality( other.dimensionality() ) {}
+
+			std::size_t dimensionality() const noexcept { return _dimensionality; }
+			T & operator[]( std::size_t dimension ) const noexcept { return _data[ dimension ]; }
+			T * data() const noexcept { return _data; }
+			T * begin() const noexcept { return _data; }
+			T * end() const noexcept { return _data + _dimensionality; }
+	};
+
+	template <class T, class U>
+	bool operator==( row_view<T> const & lhs, row_view<U> const & rhs ) {
+		return std::equal( lhs.begin(), lhs.end(), rhs.begin(), rhs.end() );
+	}
+
+	template <class T, class U>
+	bool operator!=( row_view<T> const & lhs, row_view<U> const & rhs ) {
+		return !(lhs == rhs);
+	}
+
+	template <class T>
+	std::ostream & operator<<( std::ostream & os, row_view<T> const & p ) {
+		os << '(';
+		for( std::size_t i = 0; i < p.dimensionality(); ++i ) {
+			os << (i > 0 ? "," : "") << p[ i ];
+		}
+		os << ')';
+		return os;
+	}
+
+	// dereferences to a row_view, so it is a random access iterator in everything but the reference type
+	template <class T>
+	class row_iterator {
+		private:
+			T * _data;
+			std::size_t _stride;
+			std::size_t _dimensionality;
+		public:
+			using iterator_category = std::random_access_iterator_tag;
+			using value_type = row_view<T>;
+			using difference_type = std::ptrdiff_t;
+			using reference = row_view<T>;
+			using pointer = void;
+			row_iterator() noexcept : _data( nullptr ), _stride( 0 ), _dimensionality( 0 ) {}
+			row_iterator( T * data, std::size_t stride, std::size_t dimensionality ) noexcept : _data( data ), _stride( stride ), _dimensionality( dimensionality ) {}
+			template <class U, class = typename std::enable_if< std::is_convertible<U *,T *>::value >::type>
+			row_iterator( row_iterator<U> const & other ) noexcept : _data( other.data() ), _stride( other.stride() ), _dimensionality( other.dimensionality() ) {}
+			T * data() const noexcept { return _data; }
+			std::size_t stride() const noexcept { return _stride; }
+			std::size_t dimensionality() const noexcept { return _dimensionality; }
+			reference operator*() const noexcept { return reference( _data, _dimensionality ); }
+			reference operator[]( difference_type n ) const noexcept { return reference( _data + n * static_cast<difference_type>( _stride ), _dimensionality ); }
+			row_iterator & operator++() noexcept { _data += _stride; return *this; }
+			row_iterator operator++( int ) noexcept { row_iterator it( *this ); _data += _stride; return it; }
+			row_iterator & operator--() noexcept { _data -= _stride; return *this; }
+			row_iterator operator--( int ) noexcept { row_iterator it( *this ); _data -= _stride; return it; }
+			row_iterator & operator+=( difference_type n ) noexcept { _data += n * static_cast<difference_type>( _stride ); return *this; }
+			row_iterator & operator-=( difference_type n ) noexcept { _data -= n * static_cast<difference_type>( _stride ); return *this; }
+			row_iterator operator+( difference_type n ) const noexcept { return row_iterator( _data + n * static_cast<difference_type>( _stride ), _stride, _dimensionality ); }
+			row_iterator operator-( difference_type n ) const noexcept { return row_iterator( _data - n * static_cast<difference_type>( _stride ), _stride, _dimensionality ); }
+			friend row_iterator operator+( difference_type n, row_iterator const & it ) noexcept { return it + n; }
+			difference_type operator-( row_iterator const & other ) const noexcept { return (_data - other._data) / static_cast<difference_type>( _stride ); }
+			bool operator==( row_iterator const & other ) const noexcept { return _data == other._data; }
+			bool operator!=( row_iterator const & other ) const noexcept { return _data != other._data; }
+			bool operator<( row_iterator const & other ) const noexcept { return _data < other._data; }
+			bool operator>( row_iterator const & other ) const noexcept { return _data > other._data; }
+			bool operator<=( row_iterator const & other ) const noexcept { return _data <= other._data; }
+			bool operator>=( row_iterator const & other ) const noexcept { return _data >= other._data; }
+	};
+
+	template <class T>
+	class flat_points {
+		static_assert( std::is_arithmetic<T>::value, "kdtree::flat_points<T> only accepts arithmetic coordinate types.\n" );
+		private:
+			std::size_t _size;
+			std::size_t _dimensionality;
+			std::size_t _stride;
+			std::unique_ptr<unsigned char[]> _storage;
+			T * _data;
+
+			static std::size_t padded_stride( std::size_t dimensionality ) noexcept {
+				std::size_t const lanes = row_alignment / sizeof( T );
+				return dimensionality < kdtree::simd_dimensionality_threshold ? std::max<std::size_t>( dimensionality, 1 ) : (dimensionality + lanes - 1) / lanes * lanes;
+			}
+
+			void allocate() {
+				std::size_t bytes = _size * _stride * sizeof( T );
+				_storage.reset( new unsigned char[ bytes + row_alignment ]() );
+				void * aligned = _storage.get();
+				std::size_t space = bytes + row_alignment;
+				_data = static_cast<T *>( std::align( row_alignment, bytes, aligned, space ) );
+			}
+		public:
+			using iterator = row_iterator<T>;
+			using const_iterator = row_iterator<T const>;
+
+			flat_points() noexcept : _size( 0 ), _dimensionality( 0 ), _stride( 1 ), _data( nullptr ) {}
+
+			// n rows of d zero coordinates
+			flat_points( std::size_t size, std::size_t dimensionality ) : _size( size ), _dimensionality( dimensionality ), _stride( padded_stride( dimensionality ) ) {
+				allocate();
+			}
+
+			// copies n rows of d coordinates stored back to back without padding
+			flat_points( T const * packed, std::size_t size, std::size_t dimensionality ) : flat_points( size, dimensionality ) {
+				for( std::size_t i = 0; i < _size; ++i ) {
+					std::copy( packed + i * _dimensionality, packed + (i + 1) * _dimensionality, _data + i * _stride );
+				}
+			}
+
+			flat_points( flat_points const & other ) : flat_points( other._size, other._dimensionality ) {
+				if( _size > 0 ) {
+					std::memcpy( _data, other._data, _size * _stride * sizeof( T ) );
+				}
+			}
+
+			flat_points( flat_points && other ) noexcept : flat_points() {
+				swap( other );
+			}
+
+			flat_points & operator=( flat_points other ) noexcept {
+				swap( other );
+				return *this;
+			}
+
+			void swap( flat_points & other ) noexcept {
+				std::swap( _size, other._size );
+				std::swap( _dimensionality, other._dimensionality );
+				std::swap( _stride, other._stride );
+				std::swap( _storage, other._storage );
+				std::swap( _data, other._data );
+			}
+
+			std::size_t size() const noexcept { return _size; }
+			bool empty() const noexcept { return _size == 0; }
+			std::size_t dimensionality() const noexcept { return _dimensionality; }
+			std::size_t stride() const noexcept { return _stride; }
+			T * data() noexcept { return _data; }
+			T const * data() const noexcept { return _data; }
+
+			row_view<T> operator[]( std::size_t i ) noexcept { return row_view<T>( _data + i * _stride, _dimensionality ); }
+			row_view<T const> operator[]( std::size_t i ) const noexcept { return row_view<T const>( _data + i * _stride, _dimensionality ); }
+
+			iterator begin() noexcept { return iterator( _data, _stride, _dimensionality ); }
+			const_iterator begin() const noexcept { return cbegin(); }
+			const_iterator cbegin() const noexcept { return const_iterator( _data, _stride, _dimensionality ); }
+			iterator end() noexcept { return iterator( _data + _size * _stride, _stride, _dimensionality ); }
+			const_iterator end() const noexcept { return cend(); }
+			const_iterator cend() const noexcept { return const_iterator( _data + _size * _stride, _stride, _dimensionality ); }
+	};
+
+}
+
+#endif
@@ -2,310 +2,2853 @@
 #define KDTREE_KDTREE_HPP
 
 #include <algorithm>
-#include <cmath>
+#include <array>
+#include <atomic>
 #include <cstddef>
+#include <cstdint>
 #include <iostream>
 #include <iterator>
 #include <limits>
-#include <queue>
+#include <memory>
+#include <new>
+#include <numeric>
+#include <random>
 #include <string>
 #include <type_traits>
 #include <utility>
+#include <vector>
+#include "flat_points.hpp"
+#include "metric.hpp"
 #include "point.hpp"
+#include "thread_pool.hpp"
 
-/*
-Eventually, because it's really easy to implement, the nearest neighbor functions should accept a
-distance function parameter.
-*/
+namespace kdtree {
+
+	/*
+	Subtrees of at most this many points are left unpartitioned as leaf buckets, which searches scan
+	linearly instead of descending further. The default of 1 yields the classic one-point-per-node
+	tree. A tree must be searched with a leaf size at least as large as the one it was built with;
+	searching with a larger one is still correct, because every bucket is then simply scanned.
+	*/
+	class leaf_size {
+		private:
+			std::size_t _value;
+		public:
+			constexpr explicit leaf_size( std::size_t value = 1 ) noexcept : _value( value > 0 ? value : 1 ) {}
+			constexpr std::size_t value() const noexcept { return _value; }
+	};
+
+	/*
+	Lays the tree out in breadth-first (Eytzinger) order: the root is stored first, the children of
+	the node at index i at 2i + 1 and 2i + 2, and every node holds a single point. The tree is shaped
+	as a complete binary tree, so that the order has no gaps. The top levels that every search
+	passes through then occupy a few adjacent cache lines instead of points spread across the whole
+	range, at the cost of a permutation pass after construction and of leaf buckets. A tree built
+	with this layout must be searched with it, and vice versa.
+	*/
+	struct eytzinger_layout {};
+
+	/*
+	A tree built with leaf buckets whose split values are read from a separate dense array instead of
+	from the median points. The split of the root is stored first and the splits of the children of
+	the node at index i at 2i + 1 and 2i + 2, so descending touches a single array, and whole points
+	are read only to compute distances. This matters when points are large: finding one coordinate of
+	a point<double,64> otherwise brings 512 bytes of it into cache. The view does not own the array;
+	see split_skeleton.
+	*/
+	template <class Coordinate>
+	class skeleton_view {
+		private:
+			Coordinate const * _splits;
+			std::uint16_t const * _dimensions;
+			leaf_size _leaf;
+		public:
+			constexpr skeleton_view( Coordinate const * splits, std::uint16_t const * dimensions, leaf_size leaf ) noexcept : _splits( splits ), _dimensions( dimensions ), _leaf( leaf ) {}
+			constexpr Coordinate const * splits() const noexcept { return _splits; }
+			constexpr std::uint16_t const * dimensions() const noexcept { return _dimensions; }
+			constexpr leaf_size leaf() const noexcept { return _leaf; }
+	};
+
+	/*
+	How a skeleton tree picks the axis to split each node on. round_robin cycles through the axes by
+	depth like every other layout. widest_spread picks the axis along which the points of the node
+	extend furthest and max_variance the one along which their coordinates vary most, which keeps
+	cells from growing long and thin on data that is stretched along a few axes. The chosen axes are
+	stored in the skeleton, so only skeleton trees can use them. Neither choice depends on the order
+	in which a build left the points of a node, so parallel builds pick the same axes as sequential
+	ones.
+	*/
+	enum class split_rule { round_robin, widest_spread, max_variance };
+
+	/*
+	Owns the split values, and for adaptive split rules the split dimensions, of a tree. It is filled
+	by make_kdtree and must be rebuilt whenever the tree is; searches take its view() in place of the
+	layout.
+	*/
+	template <class Coordinate>
+	class split_skeleton {
+		private:
+			std::vector<Coordinate> _splits;
+			std::vector<std::uint16_t> _dimensions;
+			leaf_size _leaf;
+			split_rule _rule;
+		public:
+			explicit split_skeleton( leaf_size leaf = leaf_size(), split_rule rule = split_rule::round_robin ) : _leaf( leaf ), _rule( rule ) {}
+			leaf_size leaf() const noexcept { return _leaf; }
+			split_rule rule() const noexcept { return _rule; }
+			std::vector<Coordinate> & splits() noexcept { return _splits; }
+			std::vector<Coordinate> const & splits() const noexcept { return _splits; }
+			std::vector<std::uint16_t> & dimensions() noexcept { return _dimensions; }
+			std::vector<std::uint16_t> const & dimensions() const noexcept { return _dimensions; }
+			skeleton_view<Coordinate> view() const noexcept { return skeleton_view<Coordinate>( _splits.data(), _dimensions.empty() ? nullptr : _dimensions.data(), _leaf ); }
+	};
+
+	/*
+	Presents a range of indices into point storage as the range of the points they refer to. A tree
+	built over such a range permutes the indices only, so the points stay where they are and every
+	swap moves an index instead of a whole point. This is the cheaper way to build over large points,
+	and the only way to build over storage that must not be written to. Searches return
+	index_iterators, whose index() is the position of the found point in the storage, and batch
+	searches report positions in the index range as usual.
+	*/
+	template <class IndexIterator, class PointIterator>
+	class index_iterator {
+		private:
+			IndexIterator _index;
+			PointIterator _points;
+		public:
+			using iterator_category = std::random_access_iterator_tag;
+			using value_type = typename std::iterator_traits<PointIterator>::value_type;
+			using difference_type = typename std::iterator_traits<IndexIterator>::difference_type;
+			using reference = typename std::iterator_traits<PointIterator>::reference;
+			using pointer = typename std::remove_reference<reference>::type *;
+			index_iterator() = default;
+			index_iterator( IndexIterator index, PointIterator points ) : _index( index ), _points( points ) {}
+			IndexIterator base() const { return _index; }
+			PointIterator points() const { return _points; }
+			typename std::iterator_traits<IndexIterator>::value_type index() const { return *_index; }
+			reference operator*() const { return _points[ *_index ]; }
+			pointer operator->() const { return std::addressof( _points[ *_index ] ); }
+			reference operator[]( difference_type n ) const { return _points[ _index[ n ] ]; }
+			index_iterator & operator++() { ++_index; return *this; }
+			index_iterator operator++( int ) { index_iterator it( *this ); ++_index; return it; }
+			index_iterator & operator--() { --_index; return *this; }
+			index_iterator operator--( int ) { index_iterator it( *this ); --_index; return it; }
+			index_iterator & operator+=( difference_type n ) { _index += n; return *this; }
+			index_iterator & operator-=( difference_type n ) { _index -= n; return *this; }
+			index_iterator operator+( difference_type n ) const { return index_iterator( _index + n, _points ); }
+			index_iterator operator-( difference_type n ) const { return index_iterator( _index - n, _points ); }
+			friend index_iterator operator+( difference_type n, index_iterator const & it ) { return it + n; }
+			difference_type operator-( index_iterator const & other ) const { return _index - other._index; }
+			bool operator==( index_iterator const & other ) const { return _index == other._index; }
+			bool operator!=( index_iterator const & other ) const { return _index != other._index; }
+			bool operator<( index_iterator const & other ) const { return _index < other._index; }
+			bool operator>( index_iterator const & other ) const { return _index > other._index; }
+			bool operator<=( index_iterator const & other ) const { return _index <= other._index; }
+			bool operator>=( index_iterator const & other ) const { return _index >= other._index; }
+	};
+
+	template <class IndexIterator, class PointIterator>
+	index_iterator<IndexIterator,PointIterator> make_index_iterator( IndexIterator index, PointIterator points ) {
+		return index_iterator<IndexIterator,PointIterator>( index, points );
+	}
+
+	// the layouts accepted by construction and search, in the position of the optional leaf size
+	template <class T> struct is_tree_layout : std::false_type {};
+	template <> struct is_tree_layout<leaf_size> : std::true_type {};
+	template <> struct is_tree_layout<eytzinger_layout> : std::true_type {};
+	template <class Coordinate> struct is_tree_layout< skeleton_view<Coordinate> > : std::true_type {};
+
+	/*
+	Traversal statistics of searches. A search records into a kdtree::query_stats when its layout is
+	wrapped as kdtree::with_stats( layout, stats ), and otherwise into kdtree::no_stats, whose members
+	do nothing and compile away. Counts accumulate over all queries recorded; batch queries record
+	per thread and merge when the batch is done. A node is visited when the search enters it, and a
+	branch is pruned when a child is skipped without being entered. distances counts the points
+	tested against the query: distance evaluations for the nearest neighbor and radius searches,
+	and box tests for range searches. results counts the points found, where a subtree inside a
+	range or radius is counted in full, even by a query that stops inside it.
+	*/
+	class query_stats {
+		private:
+			std::size_t _queries;
+			std::size_t _nodes_visited;
+			std::size_t _pruned;
+			std::size_t _distances;
+			std::size_t _max_depth;
+			std::size_t _results;
+		public:
+			query_stats() noexcept : _queries( 0 ), _nodes_visited( 0 ), _pruned( 0 ), _distances( 0 ), _max_depth( 0 ), _results( 0 ) {}
+			std::size_t queries() const noexcept { return _queries; }
+			std::size_t nodes_visited() const noexcept { return _nodes_visited; }
+			std::size_t pruned() const noexcept { return _pruned; }
+			std::size_t distances() const noexcept { return _distances; }
+			std::size_t max_depth() const noexcept { return _max_depth; }
+			std::size_t results() const noexcept { return _results; }
+			void record_query() noexcept { ++_queries; }
+			void record_visit( std::size_t depth ) noexcept { ++_nodes_visited; _max_depth = std::max( _max_depth, depth ); }
+			void record_prune( std::size_t count = 1 ) noexcept { _pruned += count; }
+			void record_distances( std::size_t count ) noexcept { _distances += count; }
+			void record_results( std::size_t count ) noexcept { _results += count; }
+			template <class Node> void record_subtree( Node const & node ) { _results += node.size(); }
+			void merge( query_stats const & other ) noexcept {
+				_queries += other._queries;
+				_nodes_visited += other._nodes_visited;
+				_pruned += other._pruned;
+				_distances += other._distances;
+				_max_depth = std::max( _max_depth, other._max_depth );
+				_results += other._results;
+			}
+	};
+
+	struct no_stats {
+		void record_query() const noexcept {}
+		void record_visit( std::size_t ) const noexcept {}
+		void record_prune( std::size_t = 1 ) const noexcept {}
+		void record_distances( std::size_t ) const noexcept {}
+		void record_results( std::size_t ) const noexcept {}
+		template <class Node> void record_subtree( Node const & ) const noexcept {}
+		void merge( no_stats const & ) const noexcept {}
+	};
+
+	template <class Layout>
+	class stats_layout {
+		private:
+			Layout _layout;
+			kdtree::query_stats * _stats;
+		public:
+			stats_layout( Layout layout, kdtree::query_stats & stats ) noexcept : _layout( layout ), _stats( &stats ) {}
+			Layout layout() const noexcept { return _layout; }
+			kdtree::query_stats & stats() const noexcept { return *_stats; }
+	};
+
+	template <class Layout> struct is_tree_layout< stats_layout<Layout> > : is_tree_layout<Layout> {};
+
+	template <class Layout>
+	stats_layout<Layout> with_stats( Layout layout, kdtree::query_stats & stats ) noexcept {
+		static_assert( is_tree_layout<Layout>::value, "kdtree::with_stats( Layout layout, query_stats & stats ) only accepts kdtree::leaf_size, kdtree::eytzinger_layout or kdtree::skeleton_view as its layout.\n" );
+		return stats_layout<Layout>( layout, stats );
+	}
+
+	/*
+	Parameters of an approximate k nearest neighbor search. A subtree is skipped once its distance to
+	the query, multiplied by 1 + epsilon, is no longer smaller than the current kth best, so every
+	reported neighbor is within a factor 1 + epsilon of the true neighbor of the same rank. The search
+	also stops after computing max_checks distances, once it holds k candidates, which bounds its
+	latency at the cost of any guarantee.
+	*/
+	class approximation {
+		private:
+			double _epsilon;
+			std::size_t _max_checks;
+		public:
+			explicit approximation( double epsilon = 0, std::size_t max_checks = std::numeric_limits<std::size_t>::max() ) noexcept : _epsilon( epsilon > 0 ? epsilon : 0 ), _max_checks( max_checks ) {}
+			double epsilon() const noexcept { return _epsilon; }
+			std::size_t max_checks() const noexcept { return _max_checks; }
+	};
+
+	/*
+	The number of points in a query region and the per-axis sums of their coordinates, accumulated in
+	double so that integer coordinates cannot overflow. The centroid of an empty region is undefined.
+	*/
+	template <std::size_t d>
+	class point_aggregate {
+		private:
+			std::size_t _count;
+			std::array<double,d> _sum;
+		public:
+			point_aggregate() noexcept : _count( 0 ), _sum{} {}
+			template <class Point> void add( Point const & p ) {
+				++_count;
+				for( std::size_t dim = 0; dim < d; ++dim ) {
+					_sum[ dim ] += static_cast<double>( p[ dim ] );
+				}
+			}
+			std::size_t count() const noexcept { return _count; }
+			double sum( std::size_t dim ) const noexcept { return _sum[ dim ]; }
+			double mean( std::size_t dim ) const noexcept { return _sum[ dim ] / static_cast<double>( _count ); }
+			kdtree::point<double,d> centroid() const noexcept {
+				kdtree::point<double,d> result;
+				for( std::size_t dim = 0; dim < d; ++dim ) {
+					result[ dim ] = mean( dim );
+				}
+				return result;
+			}
+	};
+
+	// the aggregate of rows of flat storage, whose dimensionality is only known at runtime
+	template <>
+	class point_aggregate<0> {
+		private:
+			std::size_t _count;
+			std::vector<double> _sum;
+		public:
+			explicit point_aggregate( std::size_t dimensionality = 0 ) : _count( 0 ), _sum( dimensionality, 0.0 ) {}
+			template <class Point> void add( Point const & p ) {
+				++_count;
+				for( std::size_t dim = 0; dim < _sum.size(); ++dim ) {
+					_sum[ dim ] += static_cast<double>( p[ dim ] );
+				}
+			}
+			std::size_t dimensionality() const noexcept { return _sum.size(); }
+			std::size_t count() const noexcept { return _count; }
+			double sum( std::size_t dim ) const noexcept { return _sum[ dim ]; }
+			double mean( std::size_t dim ) const noexcept { return _sum[ dim ] / static_cast<double>( _count ); }
+			std::vector<double> centroid() const {
+				std::vector<double> result( _sum.size() );
+				for( std::size_t dim = 0; dim < _sum.size(); ++dim ) {
+					result[ dim ] = mean( dim );
+				}
+				return result;
+			}
+	};
+
+	/*
+	Construction strategies for the sequential make_kdtree, passed after the leaf size. All of them
+	build exactly the tree that the default std::nth_element based construction does: every
+	layout finds the median of a range at a fixed position in it, so a split that is only roughly
+	balanced would leave the searches looking in the wrong place.
+
+	presorted_construction sorts the points along every axis once, and then splits each of those
+	orders stably around the median of a node, so that they stay sorted for its subtrees. No
+	comparisons are made after the initial sorts, and every point is moved exactly once, at the
+	end, at the price of d + 2 words of temporary storage per point.
+
+	sampled_construction selects medians in the style of Floyd and Rivest: two pivots drawn from a
+	random sample bracket the median, partitioning around them leaves a short middle range, and the
+	exact selection finishes there. Larger samples bracket the median more tightly.
+	*/
+	struct presorted_construction {};
+
+	class sampled_construction {
+		private:
+			std::size_t _sample_size;
+		public:
+			explicit sampled_construction( std::size_t sample_size = 1024 ) noexcept : _sample_size( std::max<std::size_t>( sample_size, 16 ) ) {}
+			std::size_t sample_size() const noexcept { return _sample_size; }
+	};
+
+}
+
+namespace {
+
+	using dimension_type = std::size_t;
+	using depth_type = std::size_t;
+
+	template <class Point>
+	using coordinate_type = typename std::decay< decltype( *std::declval<Point const &>().begin() ) >::type;
+
+	// squared distances are accumulated in the coordinate type if it is floating point and in double otherwise
+	template <class Point>
+	using distance_type = typename kdtree::distance_traits< coordinate_type<Point> >::type;
+
+	// the number of coordinates of a point type, or 0 for rows of flat storage, which only know theirs at runtime
+	template <class Point>
+	struct static_dimensionality : std::integral_constant< std::size_t, Point::dimensionality() > {};
+	template <class T>
+	struct static_dimensionality< kdtree::row_view<T> > : std::integral_constant< std::size_t, 0 > {};
+
+	/*
+	A per-thread stack of memory for the per-axis state of searches of rows, whose size is only known
+	at runtime. A search takes its state on entry and gives it back on exit, and a search started by
+	a visitor finishes before the one that called it, so memory is returned in the reverse order it
+	was taken and the arena only moves a mark. Blocks stay with the thread once allocated, so a
+	thread allocates only until it has seen its largest dimensionality and deepest nesting.
+	*/
+	class axis_arena {
+		public:
+			struct mark {
+				std::size_t block;
+				std::size_t used;
+			};
+		private:
+			std::vector< std::unique_ptr<std::max_align_t[]> > _blocks;
+			std::vector<std::size_t> _capacities;
+			mark _top;
+			axis_arena() noexcept : _top{ 0, 0 } {}
+		public:
+			static axis_arena & local() {
+				static thread_local axis_arena arena;
+				return arena;
+			}
+			mark top() const noexcept { return _top; }
+			void * allocate( std::size_t bytes ) {
+				std::size_t const min_units = 512;
+				std::size_t units = (bytes + sizeof( std::max_align_t ) - 1) / sizeof( std::max_align_t );
+				while( _top.block < _blocks.size() && _capacities[ _top.block ] - _top.used < units ) {
+					_top = mark{ _top.block + 1, 0 };
+				}
+				if( _top.block == _blocks.size() ) {
+					std::size_t capacity = std::max( units, min_units );
+					_blocks.emplace_back( new std::max_align_t[ capacity ] );
+					_capacities.push_back( capacity );
+				}
+				void * data = _blocks[ _top.block ].get() + _top.used;
+				_top.used += units;
+				return data;
+			}
+			void release( mark const & to ) noexcept { _top = to; }
+	};
+
+	// an array of the axes of one row, sized once and held until the end of its scope
+	template <class T>
+	class axis_scratch {
+		static_assert( std::is_trivially_destructible<T>::value, "kdtree::axis_scratch<T> only holds trivially destructible values.\n" );
+		private:
+			T * _data;
+			std::size_t _size;
+			axis_arena::mark _mark;
+		public:
+			axis_scratch() noexcept : _data( nullptr ), _size( 0 ), _mark{ 0, 0 } {}
+			axis_scratch( axis_scratch && other ) noexcept : _data( other._data ), _size( other._size ), _mark( other._mark ) {
+				other._data = nullptr;
+				other._size = 0;
+			}
+			axis_scratch & operator=( axis_scratch && ) = delete;
+			~axis_scratch() {
+				if( _data != nullptr ) {
+					axis_arena::local().release( _mark );
+				}
+			}
+			void assign( std::size_t size, T value ) {
+				if( _data == nullptr ) {
+					axis_arena & arena = axis_arena::local();
+					_mark = arena.top();
+					_data = static_cast<T *>( arena.allocate( std::max<std::size_t>( size, 1 ) * sizeof( T ) ) );
+					_size = size;
+				}
+				std::fill( _data, _data + _size, value );
+			}
+			std::size_t size() const noexcept { return _size; }
+			T & operator[]( std::size_t i ) noexcept { return _data[ i ]; }
+			T const & operator[]( std::size_t i ) const noexcept { return _data[ i ]; }
+	};
+
+	/*
+	Per-axis state of a search, such as the terms of the distance to a cell or the bounds of that
+	cell: a std::array for points of static dimensionality, and for rows an axis_scratch sized once
+	per query, so that neither kind of search allocates per query.
+	*/
+	template <class T, class Point>
+	using axis_array = typename std::conditional< static_dimensionality<Point>::value != 0, std::array< T, static_dimensionality<Point>::value >, axis_scratch<T> >::type;
+
+	template <class T, std::size_t d>
+	void fill_axes( std::array<T,d> & axes, dimension_type, T value ) {
+		axes.fill( value );
+	}
+
+	template <class T>
+	void fill_axes( axis_scratch<T> & axes, dimension_type dimensionality, T value ) {
+		axes.assign( dimensionality, value );
+	}
+
+	/*
+	Points of up to three dimensions, geographic ones above all, make up much of the traffic, and in
+	so few dimensions the bookkeeping around a comparison costs as much as the comparison. Their
+	distances and box tests are unrolled by recursion on the axis, the box test without branches
+	since which axis fails is unpredictable. Their searches step the split axis at run time, wrapping
+	against the compile-time d, instead of taking the depth modulo d at every node.
+	*/
+	dimension_type const max_fixed_axes = 3;
+
+	template <class Point>
+	using has_fixed_axes = std::integral_constant< bool, static_dimensionality<Point>::value != 0 && static_dimensionality<Point>::value <= max_fixed_axes >;
+
+	template <dimension_type Axis, dimension_type d>
+	struct fixed_axes {
+		template <class Distance, class Point, class Other>
+		static Distance squared_distance( Point const & p1, Other const & p2, Distance sum ) {
+			Distance diff = static_cast<Distance>( p1[ Axis ] ) - static_cast<Distance>( p2[ Axis ] );
+			return fixed_axes< Axis + 1, d >::squared_distance( p1, p2, sum + diff * diff );
+		}
+		template <class Point, class Other>
+		static bool contains( Point const & lower, Point const & upper, Other const & needle ) {
+			return !(needle[ Axis ] < lower[ Axis ]) & !(needle[ Axis ] > upper[ Axis ]) & fixed_axes< Axis + 1, d >::contains( lower, upper, needle );
+		}
+	};
+
+	template <dimension_type d>
+	struct fixed_axes<d,d> {
+		template <class Distance, class Point, class Other>
+		static Distance squared_distance( Point const &, Other const &, Distance sum ) { return sum; }
+		template <class Point, class Other>
+		static bool contains( Point const &, Point const &, Other const & ) { return true; }
+	};
+
+	template <class Layout>
+	using if_tree_layout = typename std::enable_if< kdtree::is_tree_layout<Layout>::value >::type;
+
+	// minimum number of elements per chunk when a partition is split across threads
+	std::size_t const parallel_grain = 8192;
+
+	dimension_type dimension( dimension_type dimensionality, depth_type depth ) {
+		return depth % dimensionality;
+	}
+
+	template <class InputIt1, class InputIt2>
+	auto squared_euclidean_distance( InputIt1 first1, InputIt1 last1, InputIt2 first2 ) {
+		using accumulator_type = typename kdtree::distance_traits< typename std::iterator_traits<InputIt1>::value_type >::type;
+		accumulator_type dist = 0;
+		while( first1 != last1 ) {
+			accumulator_type diff = static_cast<accumulator_type>( *first1 ) - static_cast<accumulator_type>( *first2 );
+			dist += diff * diff;
+			++first1;
+			++first2;
+		}
+		return dist;
+	}
+
+	// kdtree::point has contiguous storage and dispatches to the vector kernels in distance.hpp
+	template <class T, std::size_t d>
+	auto point_distance( kdtree::point<T,d> const & p1, kdtree::point<T,d> const & p2, std::false_type ) {
+		return kdtree::squared_euclidean_distance( p1, p2 );
+	}
+
+	template <class T, std::size_t d>
+	auto point_distance( kdtree::point<T,d> const & p1, kdtree::point<T,d> const & p2, std::true_type ) {
+		return fixed_axes<0,d>::squared_distance( p1, p2, distance_type< kdtree::point<T,d> >( 0 ) );
+	}
+
+	template <class T, std::size_t d>
+	auto point_distance( kdtree::point<T,d> const & p1, kdtree::point<T,d> const & p2 ) {
+		return point_distance( p1, p2, has_fixed_axes< kdtree::point<T,d> >() );
+	}
+
+	// and so do rows, above the same dimensionality as kdtree::point
+	template <class T, class U>
+	auto point_distance( kdtree::row_view<T> const & p1, kdtree::row_view<U> const & p2 ) {
+		using coordinate = typename std::remove_const<T>::type;
+		static_assert( std::is_same< coordinate, typename std::remove_const<U>::type >::value, "kdtree::row_view distances are only computed between rows of the same coordinate type\n" );
+		coordinate const * lhs = p1.data();
+		coordinate const * rhs = p2.data();
+		if( p1.dimensionality() < kdtree::simd_dimensionality_threshold ) {
+			return kdtree::squared_euclidean_distance_scalar( lhs, rhs, p1.dimensionality() );
+		}
+		return kdtree::squared_euclidean_distance( lhs, rhs, p1.dimensionality() );
+	}
+
+	template <class Point1, class Point2>
+	auto point_distance( Point1 const & p1, Point2 const & p2 ) {
+		return squared_euclidean_distance( p1.begin(), p1.end(), p2.begin() );
+	}
+
+	// the Euclidean metric keeps the vector kernels; other metrics accumulate one axis at a time
+	template <class Point, class Other>
+	distance_type<Point> metric_distance( kdtree::euclidean_metric const &, Other const & p, Point const & point ) {
+		return point_distance( p, point );
+	}
+
+	template <class Point, class Other, class Metric>
+	distance_type<Point> metric_distance( Metric const & metric, Other const & p, Point const & point ) {
+		return kdtree::reduced_distance< distance_type<Point> >( metric, p, point );
+	}
+
+	template <class T> struct is_kdtree_point : std::false_type {};
+	template <class T, std::size_t d> struct is_kdtree_point< kdtree::point<T,d> > : std::true_type {};
+
+	template <class Iterator, class Value = typename std::iterator_traits<Iterator>::value_type>
+	struct is_contiguous_iterator : std::integral_constant< bool, std::is_pointer<Iterator>::value || std::is_same< Iterator, typename std::vector<Value>::iterator >::value || std::is_same< Iterator, typename std::vector<Value>::const_iterator >::value > {};
+
+	template <class Iterator, class Point>
+	struct is_row_leaf : std::false_type {};
+	template <class T, class U>
+	struct is_row_leaf< kdtree::row_iterator<T>, kdtree::row_view<U> > : std::is_same< typename std::remove_const<T>::type, typename std::remove_const<U>::type > {};
+
+	template <class RandomAccessIterator, class Point>
+	using is_contiguous_leaf = std::integral_constant< bool, (is_kdtree_point<Point>::value && is_contiguous_iterator<RandomAccessIterator>::value && std::is_same< typename std::iterator_traits<RandomAccessIterator>::value_type, Point >::value) || is_row_leaf<RandomAccessIterator,Point>::value >;
+
+	// the distance between the starts of consecutive points of a contiguous leaf, in coordinates
+	template <class RandomAccessIterator, class Point>
+	std::size_t leaf_stride( RandomAccessIterator, Point const & point ) noexcept {
+		return point.dimensionality();
+	}
+
+	template <class T, class Point>
+	std::size_t leaf_stride( kdtree::row_iterator<T> it, Point const & ) noexcept {
+		return it.stride();
+	}
+
+	template <class RandomAccessIterator, class Point, class Metric, class Visitor>
+	void scan_leaf( RandomAccessIterator begin, RandomAccessIterator end, Point const & point, Metric const & metric, Visitor visit, std::false_type ) {
+		for( RandomAccessIterator it = begin; it != end; ++it ) {
+			visit( it, metric_distance( metric, *it, point ) );
+		}
+	}
+
+	// leaf points stored back to back are handed to the one-to-many kernel a block at a time
+	template <class RandomAccessIterator, class Point, class Metric, class Visitor>
+	void scan_leaf( RandomAccessIterator begin, RandomAccessIterator end, Point const & point, Metric const &, Visitor visit, std::true_type ) {
+		using coordinate_type = typename Point::coordinate_type;
+		static_assert( !is_kdtree_point<Point>::value || sizeof( Point ) == sizeof( coordinate_type ) * static_dimensionality<Point>::value, "kdtree::point is expected to store its coordinates without padding" );
+		std::size_t const block_size = 64;
+		distance_type<Point> distances[ block_size ];
+		std::size_t n = end - begin;
+		std::size_t stride = leaf_stride( begin, point );
+		coordinate_type const * query = point.data();
+		for( std::size_t first = 0; first < n; first += block_size ) {
+			std::size_t count = std::min( block_size, n - first );
+			coordinate_type const * points = (*(begin + first)).data();
+			kdtree::squared_euclidean_distances( query, points, count, stride, point.dimensionality(), distances );
+			for( std::size_t i = 0; i < count; ++i ) {
+				visit( begin + first + i, distances[ i ] );
+			}
+		}
+	}
+
+	// the unrolled distance of points with fixed axes beats a round trip through the block of distances
+	template <class RandomAccessIterator, class Point, class Metric, class Visitor>
+	void scan_leaf( RandomAccessIterator begin, RandomAccessIterator end, Point const & point, Metric const & metric, Visitor visit ) {
+		scan_leaf( begin, end, point, metric, visit, std::integral_constant< bool, is_contiguous_leaf<RandomAccessIterator,Point>::value && std::is_same< Metric, kdtree::euclidean_metric >::value && !has_fixed_axes<Point>::value >() );
+	}
+
+	template <class RandomAccessIterator, class Distance>
+	void offer_minimum_distance( RandomAccessIterator it, Distance dist, Distance & mindist, RandomAccessIterator & closest ) {
+		if( dist < mindist ) {
+			mindist = dist;
+			closest = it;
+		}
+	}
+
+	template <class RandomAccessIterator, class Point, class Metric>
+	void update_minimum_distance( RandomAccessIterator it, Point const & p, Metric const & metric, distance_type<Point> & mindist, RandomAccessIterator & closest ) {
+		offer_minimum_distance( it, metric_distance( metric, *it, p ), mindist, closest );
+	}
+
+	template <class RandomAccessIterator, class Distance, class PriorityQueue>
+	void offer_priority_queue( RandomAccessIterator it, Distance dist, PriorityQueue & pq, std::size_t k ) {
+		if( pq.size() < k ) {
+			pq.emplace( dist, it );
+		} else {
+			if( dist < pq.top().first ) {
+				pq.pop();
+				pq.emplace( dist, it );
+			}
+		}
+	}
+
+	template <class RandomAccessIterator, class Point, class Metric, class PriorityQueue>
+	void update_priority_queue( RandomAccessIterator it, Point const & p, Metric const & metric, PriorityQueue & pq, std::size_t k ) {
+		offer_priority_queue( it, metric_distance( metric, *it, p ), pq, k );
+	}
+
+	/*
+	Max-heap with the priority queue interface used by the k-nearest neighbor helpers, kept in
+	caller-owned storage so that a batch of queries can reuse a single allocation.
+	*/
+	template <class T, class Compare>
+	class vector_heap {
+		private:
+			std::vector<T> & _storage;
+			Compare _comp;
+		public:
+			vector_heap( std::vector<T> & storage, Compare comp ) : _storage( storage ), _comp( comp ) { _storage.clear(); }
+			T const & top() const { return _storage.front(); }
+			std::size_t size() const noexcept { return _storage.size(); }
+			void pop() { std::pop_heap( _storage.begin(), _storage.end(), _comp ); _storage.pop_back(); }
+			template <class...Args> void emplace( Args&&... args ) { _storage.emplace_back( std::forward<Args>( args )... ); std::push_heap( _storage.begin(), _storage.end(), _comp ); }
+	};
+
+	template <class Point, class Other>
+	bool hypercube_contains( Point const & lower, Point const & upper, Other const & needle, std::false_type ) {
+		for( std::size_t i = 0; i < lower.dimensionality(); ++i ) {
+			if( needle[ i ] < lower[ i ]  || needle[ i ] > upper[ i ] ) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	template <class Point, class Other>
+	bool hypercube_contains( Point const & lower, Point const & upper, Other const & needle, std::true_type ) {
+		return fixed_axes< 0, static_dimensionality<Point>::value >::contains( lower, upper, needle );
+	}
+
+	template <class Point, class Other>
+	bool hypercube_contains( Point const & lower, Point const & upper, Other const & needle ) {
+		return hypercube_contains( lower, upper, needle, has_fixed_axes<Point>() );
+	}
+	
+	/*
+	Orders points by the splitting coordinate and breaks ties on the coordinates that follow it. This
+	makes the median of every subtree, and therefore the entire tree layout, a function of the input
+	multiset alone, which is what allows differently scheduled builds to produce identical trees.
+	*/
+	template <class Point>
+	bool split_less( Point const & lhs, Point const & rhs, dimension_type dim ) {
+		auto lhs_xi = *(lhs.begin() + dim);
+		auto rhs_xi = *(rhs.begin() + dim);
+		if( lhs_xi < rhs_xi ) {
+			return true;
+		} else if( rhs_xi < lhs_xi ) {
+			return false;
+		}
+		dimension_type dimensionality = lhs.dimensionality();
+		for( dimension_type i = 1; i < dimensionality; ++i ) {
+			dimension_type j = dim + i < dimensionality ? dim + i : dim + i - dimensionality;
+			if( *(lhs.begin() + j) < *(rhs.begin() + j) ) {
+				return true;
+			} else if( *(rhs.begin() + j) < *(lhs.begin() + j) ) {
+				return false;
+			}
+		}
+		return false;
+	}
+
+	// number of points left of the median: half of them for the classic layout
+	struct median_split {
+		std::size_t operator()( std::size_t n ) const noexcept { return n / 2; }
+	};
+
+	inline std::size_t floor_log2( std::size_t n ) noexcept {
+		std::size_t log = 0;
+		while( n >>= 1 ) {
+			++log;
+		}
+		return log;
+	}
+
+	// and the size of the left subtree of a complete binary tree of n nodes for the breadth-first one
+	struct complete_split {
+		std::size_t operator()( std::size_t n ) const noexcept {
+			if( n < 2 ) {
+				return 0;
+			}
+			std::size_t levels = floor_log2( n + 1 );
+			std::size_t last_level = n - ((std::size_t( 1 ) << levels) - 1);
+			std::size_t half = std::size_t( 1 ) << (levels - 1);
+			return (half - 1) + std::min( last_level, half );
+		}
+	};
+
+	// position in the in-order layout of the complete tree of n nodes of the node at breadth-first index
+	inline std::size_t inorder_position( std::size_t index, std::size_t n ) noexcept {
+		complete_split split;
+		std::size_t position = 0;
+		std::size_t size = n;
+		for( std::size_t level = floor_log2( index + 1 ); level > 0; --level ) {
+			std::size_t left = split( size );
+			if( ((index + 1) >> (level - 1)) & 1 ) {
+				position += left + 1;
+				size -= left + 1;
+			} else {
+				size = left;
+			}
+		}
+		return position + split( size );
+	}
+
+	/*
+	Moves the element at source( i ) to position i for every i by following the cycles of the
+	permutation, which takes a bit per element of extra storage rather than a copy of the range.
+	*/
+	template <class RandomAccessIterator, class Source>
+	void permute( RandomAccessIterator begin, RandomAccessIterator end, Source source ) {
+		std::size_t n = end - begin;
+		std::vector<bool> placed( n, false );
+		for( std::size_t start = 0; start < n; ++start ) {
+			if( placed[ start ] ) {
+				continue;
+			}
+			auto value = std::move( *(begin + start) );
+			for( std::size_t i = start; ; ) {
+				placed[ i ] = true;
+				std::size_t from = source( i );
+				if( from == start ) {
+					*(begin + i) = std::move( value );
+					break;
+				}
+				*(begin + i) = std::move( *(begin + from) );
+				i = from;
+			}
+		}
+	}
+
+	// moves a complete tree from the in-order layout into breadth-first order
+	template <class RandomAccessIterator>
+	void breadth_first_permute( RandomAccessIterator begin, RandomAccessIterator end ) {
+		std::size_t n = end - begin;
+		permute( begin, end, [ n ]( std::size_t i ) { return inorder_position( i, n ); } );
+	}
+
+	/*
+	Construction rearranges a storage range and reaches the point behind each element through a
+	projection: the element itself for ranges of points, the indexed point for index_iterators.
+	*/
+	struct identity_projection {
+		template <class T> T const & operator()( T const & x ) const noexcept { return x; }
+	};
+
+	template <class PointIterator>
+	struct index_projection {
+		PointIterator points;
+		template <class Index> decltype( auto ) operator()( Index index ) const { return points[ index ]; }
+	};
+
+	template <class RandomAccessIterator>
+	RandomAccessIterator storage_iterator( RandomAccessIterator it ) {
+		return it;
+	}
+
+	template <class IndexIterator, class PointIterator>
+	IndexIterator storage_iterator( kdtree::index_iterator<IndexIterator,PointIterator> it ) {
+		return it.base();
+	}
+
+	template <class RandomAccessIterator>
+	identity_projection storage_projection( RandomAccessIterator ) {
+		return identity_projection();
+	}
+
+	template <class IndexIterator, class PointIterator>
+	index_projection<PointIterator> storage_projection( kdtree::index_iterator<IndexIterator,PointIterator> it ) {
+		return index_projection<PointIterator>{ it.points() };
+	}
+
+	/*
+	The storage a public make_kdtree rearranges. Rows of flat storage are views that cannot be
+	swapped like values, so their trees are built over the row numbers, and commit() then moves
+	every row into its place in a single pass, through one row of temporary storage.
+	*/
+	template <class RandomAccessIterator>
+	class build_storage {
+		private:
+			RandomAccessIterator _begin;
+			RandomAccessIterator _end;
+		public:
+			build_storage( RandomAccessIterator begin, RandomAccessIterator end ) : _begin( begin ), _end( end ) {}
+			auto begin() const { return storage_iterator( _begin ); }
+			auto end() const { return storage_iterator( _end ); }
+			auto projection() const { return storage_projection( _begin ); }
+			void commit() {}
+	};
+
+	template <class T>
+	class build_storage< kdtree::row_iterator<T> > {
+		private:
+			kdtree::row_iterator<T> _rows;
+			std::vector<std::size_t> _order;
+		public:
+			build_storage( kdtree::row_iterator<T> begin, kdtree::row_iterator<T> end ) : _rows( begin ), _order( end - begin ) {
+				std::iota( _order.begin(), _order.end(), std::size_t( 0 ) );
+			}
+			std::vector<std::size_t>::iterator begin() { return _order.begin(); }
+			std::vector<std::size_t>::iterator end() { return _order.end(); }
+			index_projection< kdtree::row_iterator<T> > projection() const { return index_projection< kdtree::row_iterator<T> >{ _rows }; }
+			void commit() {
+				std::size_t n = _order.size();
+				std::size_t d = _rows.dimensionality();
+				std::vector<T> row( d );
+				std::vector<bool> placed( n, false );
+				for( std::size_t start = 0; start < n; ++start ) {
+					if( placed[ start ] ) {
+						continue;
+					}
+					std::copy_n( _rows[ start ].data(), d, row.data() );
+					for( std::size_t i = start; ; ) {
+						placed[ i ] = true;
+						std::size_t from = _order[ i ];
+						if( from == start ) {
+							std::copy_n( row.data(), d, _rows[ i ].data() );
+							break;
+						}
+						std::copy_n( _rows[ from ].data(), d, _rows[ i ].data() );
+						i = from;
+					}
+				}
+			}
+	};
+
+	template <class Projection>
+	auto split_compare( dimension_type dim, Projection const & project ) {
+		return [ dim, &project ]( auto const & lhs, auto const & rhs ) { return split_less( project( lhs ), project( rhs ), dim ); };
+	}
+
+	/*
+	Choosers of the split dimension of a node, given its range, its depth and its breadth-first index.
+	The adaptive one records its choice at that index for the searches to read back.
+	*/
+	struct round_robin_dimension {
+		template <class RandomAccessIterator, class Projection>
+		dimension_type operator()( RandomAccessIterator begin, RandomAccessIterator, depth_type depth, std::size_t, Projection const & project ) const {
+			return dimension( project( *begin ).dimensionality(), depth );
+		}
+	};
+
+	template <class RandomAccessIterator, class Projection>
+	dimension_type widest_spread_dimension( RandomAccessIterator begin, RandomAccessIterator end, Projection const & project ) {
+		auto const & first = project( *begin );
+		dimension_type dimensionality = first.dimensionality();
+		using coordinate_type = typename std::decay< decltype( *first.begin() ) >::type;
+		std::vector<coordinate_type> lower( first.begin(), first.end() );
+		std::vector<coordinate_type> upper( first.begin(), first.end() );
+		for( RandomAccessIterator it = begin + 1; it != end; ++it ) {
+			auto const & p = project( *it );
+			for( dimension_type i = 0; i < dimensionality; ++i ) {
+				lower[ i ] = std::min( lower[ i ], p[ i ] );
+				upper[ i ] = std::max( upper[ i ], p[ i ] );
+			}
+		}
+		dimension_type widest = 0;
+		for( dimension_type i = 1; i < dimensionality; ++i ) {
+			if( static_cast<double>( upper[ i ] ) - static_cast<double>( lower[ i ] ) > static_cast<double>( upper[ widest ] ) - static_cast<double>( lower[ widest ] ) ) {
+				widest = i;
+			}
+		}
+		return widest;
+	}
+
+	/*
+	Floating point sums depend on the order of their terms, and sequential and parallel builds leave
+	the points of a node in different orders. Each coordinate is therefore rounded to a 16 bit fixed
+	point fraction of the spread along its axis, and the fractions and their squares are summed as
+	integers, which is exact in any order. That is ample resolution to rank the axes, and the sums
+	cannot overflow below 2^32 points.
+	*/
+	template <class RandomAccessIterator, class Projection>
+	dimension_type max_variance_dimension( RandomAccessIterator begin, RandomAccessIterator end, Projection const & project ) {
+		using point_type = typename std::decay< decltype( project( *begin ) ) >::type;
+		auto const & first = project( *begin );
+		dimension_type dimensionality = first.dimensionality();
+		axis_array<double,point_type> lower;
+		axis_array<double,point_type> upper;
+		axis_array<double,point_type> scale;
+		axis_array<std::uint64_t,point_type> sums;
+		axis_array<std::uint64_t,point_type> squares;
+		fill_axes( lower, dimensionality, 0.0 );
+		fill_axes( upper, dimensionality, 0.0 );
+		fill_axes( scale, dimensionality, 0.0 );
+		fill_axes( sums, dimensionality, std::uint64_t( 0 ) );
+		fill_axes( squares, dimensionality, std::uint64_t( 0 ) );
+		for( dimension_type i = 0; i < dimensionality; ++i ) {
+			lower[ i ] = upper[ i ] = static_cast<double>( first[ i ] );
+		}
+		for( RandomAccessIterator it = begin + 1; it != end; ++it ) {
+			auto const & p = project( *it );
+			for( dimension_type i = 0; i < dimensionality; ++i ) {
+				lower[ i ] = std::min( lower[ i ], static_cast<double>( p[ i ] ) );
+				upper[ i ] = std::max( upper[ i ], static_cast<double>( p[ i ] ) );
+			}
+		}
+		double const resolution = 65535;
+		for( dimension_type i = 0; i < dimensionality; ++i ) {
+			double spread = upper[ i ] - lower[ i ];
+			scale[ i ] = spread > 0 && spread < std::numeric_limits<double>::infinity() ? resolution / spread : 0;
+		}
+		for( RandomAccessIterator it = begin; it != end; ++it ) {
+			auto const & p = project( *it );
+			for( dimension_type i = 0; i < dimensionality; ++i ) {
+				std::uint64_t fraction = static_cast<std::uint64_t>( (static_cast<double>( p[ i ] ) - lower[ i ]) * scale[ i ] + 0.5 );
+				sums[ i ] += fraction;
+				squares[ i ] += fraction * fraction;
+			}
+		}
+		double n = static_cast<double>( end - begin );
+		auto variance = [ & ]( dimension_type i ) {
+			double mean = static_cast<double>( sums[ i ] ) / n;
+			return scale[ i ] > 0 ? (static_cast<double>( squares[ i ] ) / n - mean * mean) / (scale[ i ] * scale[ i ]) : 0.0;
+		};
+		dimension_type widest = 0;
+		double widest_variance = variance( 0 );
+		for( dimension_type i = 1; i < dimensionality; ++i ) {
+			double v = variance( i );
+			if( v > widest_variance ) {
+				widest = i;
+				widest_variance = v;
+			}
+		}
+		return widest;
+	}
+
+	struct skeleton_dimension {
+		kdtree::split_rule rule;
+		std::uint16_t * dimensions;
+		template <class RandomAccessIterator, class Projection>
+		dimension_type operator()( RandomAccessIterator begin, RandomAccessIterator end, depth_type depth, std::size_t index, Projection const & project ) const {
+			dimension_type dim;
+			switch( rule ) {
+				case kdtree::split_rule::widest_spread:
+					dim = widest_spread_dimension( begin, end, project );
+					break;
+				case kdtree::split_rule::max_variance:
+					dim = max_variance_dimension( begin, end, project );
+					break;
+				default:
+					return round_robin_dimension()( begin, end, depth, index, project );
+			}
+			dimensions[ index ] = static_cast<std::uint16_t>( dim );
+			return dim;
+		}
+	};
+
+	struct introselect {
+		template <class RandomAccessIterator, class Compare>
+		void operator()( RandomAccessIterator begin, RandomAccessIterator nth, RandomAccessIterator end, Compare comp ) const { std::nth_element( begin, nth, end, comp ); }
+	};
+
+	/*
+	The depth-first searches, the sequential builds and the extraction of split skeletons walk the
+	tree with an explicit stack of frames instead of recursing, which saves a call per node and keeps
+	the state of the walk in one small array. Parallel builds still recurse above their cutoff, where
+	each level waits on its tasks. Every layout builds a balanced tree, at most one level deeper than
+	the base 2 logarithm of its size, so a stack with a frame per bit of std::size_t cannot overflow;
+	it lives in the caller's frame and never allocates.
+	*/
+	template <class Frame>
+	class traversal_stack {
+		private:
+			static std::size_t const capacity = std::numeric_limits<std::size_t>::digits + 1;
+			typename std::aligned_storage< sizeof( Frame ), alignof( Frame ) >::type _frames[ capacity ];
+			Frame * _end;
+			Frame * bottom() noexcept { return reinterpret_cast<Frame *>( &_frames[ 0 ] ); }
+		public:
+			traversal_stack() noexcept : _end( bottom() ) {}
+			traversal_stack( traversal_stack const & ) = delete;
+			traversal_stack & operator=( traversal_stack const & ) = delete;
+			~traversal_stack() {
+				while( !empty() ) {
+					pop();
+				}
+			}
+			bool empty() noexcept { return _end == bottom(); }
+			Frame & top() noexcept { return *(_end - 1); }
+			void push( Frame const & frame ) { new( _end++ ) Frame( frame ); }
+			void pop() noexcept { (--_end)->~Frame(); }
+	};
+
+	// the range, or the positions, of a subtree still to be built
+	template <class RandomAccessIterator>
+	struct build_frame {
+		RandomAccessIterator begin;
+		RandomAccessIterator end;
+		depth_type depth;
+		std::size_t index;
+	};
+
+	/*
+	Leaf buckets are sorted by the same total order used for splitting, so that their contents, too,
+	do not depend on the order in which earlier partitioning steps left them.
+	*/
+	template <class RandomAccessIterator, class Split, class Projection, class Choose = round_robin_dimension, class Select = introselect>
+	void make_kdtree_helper( RandomAccessIterator begin, RandomAccessIterator end, depth_type depth, std::size_t leaf, Split split, Projection project, Choose choose = Choose(), std::size_t index = 0, Select select = Select() ) {
+		traversal_stack< build_frame<RandomAccessIterator> > stack;
+		stack.push( build_frame<RandomAccessIterator>{ begin, end, depth, index } );
+		while( !stack.empty() ) {
+			build_frame<RandomAccessIterator> frame = stack.top();
+			stack.pop();
+			std::size_t n = frame.end - frame.begin;
+			if( n > leaf ) {
+				RandomAccessIterator median = frame.begin + split( n );
+				select( frame.begin, median, frame.end, split_compare( choose( frame.begin, frame.end, frame.depth, frame.index, project ), project ) );
+				// the right subtree waits under the left one, so nodes are built in the same order as by recursion
+				stack.push( build_frame<RandomAccessIterator>{ median + 1, frame.end, frame.depth + 1, 2 * frame.index + 2 } );
+				stack.push( build_frame<RandomAccessIterator>{ frame.begin, median, frame.depth + 1, 2 * frame.index + 1 } );
+			} else if( n > 1 ) {
+				std::sort( frame.begin, frame.end, split_compare( dimension( project( *frame.begin ).dimensionality(), frame.depth ), project ) );
+			}
+		}
+	}
+
+	/*
+	Builds the tree of make_kdtree_helper over orders, which holds, for every axis, the positions of
+	the points in the storage sorted by split_less along that axis. The median of a node is read off
+	the order of its split axis, and the orders of the other axes are split stably around it with a
+	linear pass each, which keeps them sorted for the subtrees. source[ i ] receives the storage
+	position of the point that belongs at position i of the tree.
+	*/
+	inline void presorted_kdtree_helper( std::vector< std::vector<std::size_t> > & orders, std::vector<std::size_t> & scratch, std::vector<unsigned char> & side, std::size_t first, std::size_t last, depth_type depth, std::size_t leaf, std::vector<std::size_t> & source ) {
+		traversal_stack< build_frame<std::size_t> > stack;
+		stack.push( build_frame<std::size_t>{ first, last, depth, 0 } );
+		while( !stack.empty() ) {
+			build_frame<std::size_t> frame = stack.top();
+			stack.pop();
+			std::vector<std::size_t> const & order = orders[ dimension( orders.size(), frame.depth ) ];
+			std::size_t n = frame.end - frame.begin;
+			if( n <= leaf ) {
+				std::copy( order.begin() + frame.begin, order.begin() + frame.end, source.begin() + frame.begin );
+				continue;
+			}
+			std::size_t median = frame.begin + n / 2;
+			for( std::size_t i = frame.begin; i < frame.end; ++i ) {
+				side[ order[ i ] ] = i < median ? 0 : (i == median ? 1 : 2);
+			}
+			source[ median ] = order[ median ];
+			for( auto & other : orders ) {
+				if( &other == &order ) {
+					continue;
+				}
+				std::size_t left = frame.begin;
+				std::size_t right = median + 1;
+				for( std::size_t i = frame.begin; i < frame.end; ++i ) {
+					std::size_t position = other[ i ];
+					if( side[ position ] == 0 ) {
+						scratch[ left++ ] = position;
+					} else if( side[ position ] == 2 ) {
+						scratch[ right++ ] = position;
+					}
+				}
+				scratch[ median ] = order[ median ];
+				std::copy( scratch.begin() + frame.begin, scratch.begin() + frame.end, other.begin() + frame.begin );
+			}
+			stack.push( build_frame<std::size_t>{ median + 1, frame.end, frame.depth + 1, 0 } );
+			stack.push( build_frame<std::size_t>{ frame.begin, median, frame.depth + 1, 0 } );
+		}
+	}
+
+	template <class RandomAccessIterator, class Projection>
+	void make_kdtree_presorted( RandomAccessIterator begin, RandomAccessIterator end, std::size_t leaf, Projection project ) {
+		std::size_t n = end - begin;
+		if( n < 2 ) {
+			return;
+		}
+		using coordinate_type = typename std::decay< decltype( *project( *begin ).begin() ) >::type;
+		std::vector< std::vector<std::size_t> > orders( project( *begin ).dimensionality(), std::vector<std::size_t>( n ) );
+		// sorting the coordinate along with the position only reaches for the points to break ties
+		std::vector< std::pair<coordinate_type,std::size_t> > keys( n );
+		for( dimension_type dim = 0; dim < orders.size(); ++dim ) {
+			auto comp = split_compare( dim, project );
+			for( std::size_t i = 0; i < n; ++i ) {
+				keys[ i ] = std::make_pair( project( *(begin + i) )[ dim ], i );
+			}
+			std::sort( keys.begin(), keys.end(), [ begin, &comp ]( auto const & lhs, auto const & rhs ) { return lhs.first < rhs.first || (!(rhs.first < lhs.first) && comp( *(begin + lhs.second), *(begin + rhs.second) )); } );
+			std::transform( keys.begin(), keys.end(), orders[ dim ].begin(), []( auto const & key ) { return key.second; } );
+		}
+		keys.clear();
+		keys.shrink_to_fit();
+		std::vector<std::size_t> scratch( n );
+		std::vector<unsigned char> side( n );
+		std::vector<std::size_t> source( n );
+		presorted_kdtree_helper( orders, scratch, side, 0, n, 0, leaf, source );
+		orders.clear();
+		permute( begin, end, [ &source ]( std::size_t i ) { return source[ i ]; } );
+	}
+
+	/*
+	Swaps the i-th misplaced element of one interval list with the i-th misplaced element of the
+	other for i in [first, last). Both lists hold offsets from begin and have equal total length.
+	*/
+	template <class RandomAccessIterator>
+	void swap_misplaced( RandomAccessIterator begin, std::vector<std::pair<std::size_t,std::size_t>> const & lhs, std::vector<std::pair<std::size_t,std::size_t>> const & rhs, std::size_t first, std::size_t last ) {
+		auto seek = []( std::vector<std::pair<std::size_t,std::size_t>> const & intervals, std::size_t rank, std::size_t & interval ) {
+					interval = 0;
+					while( rank >= intervals[ interval ].second - intervals[ interval ].first ) {
+						rank -= intervals[ interval ].second - intervals[ interval ].first;
+						++interval;
+					}
+					return intervals[ interval ].first + rank;
+				};
+		if( first == last ) {
+			return;
+		}
+		std::size_t lhs_interval;
+		std::size_t rhs_interval;
+		std::size_t lhs_position = seek( lhs, first, lhs_interval );
+		std::size_t rhs_position = seek( rhs, first, rhs_interval );
+		for( std::size_t i = first; i < last; ++i ) {
+			if( lhs_position == lhs[ lhs_interval ].second ) {
+				lhs_position = lhs[ ++lhs_interval ].first;
+			}
+			if( rhs_position == rhs[ rhs_interval ].second ) {
+				rhs_position = rhs[ ++rhs_interval ].first;
+			}
+			std::iter_swap( begin + lhs_position++, begin + rhs_position++ );
+		}
+	}
+
+	/*
+	In-place parallel partition: every thread partitions its own chunk, and then the elements that
+	ended up on the wrong side of the global partition point are exchanged pairwise in parallel.
+	*/
+	template <class RandomAccessIterator, class Predicate>
+	RandomAccessIterator parallel_partition( kdtree::thread_pool & pool, RandomAccessIterator begin, RandomAccessIterator end, Predicate pred ) {
+		std::size_t n = end - begin;
+		std::size_t chunks = std::min( pool.concurrency(), n / parallel_grain );
+		if( chunks < 2 ) {
+			return std::partition( begin, end, pred );
+		}
+		std::vector<std::size_t> bounds( chunks + 1 );
+		std::vector<std::size_t> middles( chunks );
+		for( std::size_t i = 0; i <= chunks; ++i ) {
+			bounds[ i ] = n / chunks * i + std::min( i, n % chunks );
+		}
+		{
+			kdtree::task_group group( pool );
+			for( std::size_t i = 0; i < chunks; ++i ) {
+				group.run( [ &, i ]() { middles[ i ] = std::partition( begin + bounds[ i ], begin + bounds[ i + 1 ], pred ) - begin; } );
+			}
+			group.wait();
+		}
+		std::size_t split = 0;
+		for( std::size_t i = 0; i < chunks; ++i ) {
+			split += middles[ i ] - bounds[ i ];
+		}
+		std::vector<std::pair<std::size_t,std::size_t>> false_before_split;
+		std::vector<std::pair<std::size_t,std::size_t>> true_after_split;
+		std::size_t misplaced = 0;
+		for( std::size_t i = 0; i < chunks; ++i ) {
+			if( middles[ i ] < std::min( bounds[ i + 1 ], split ) ) {
+				false_before_split.emplace_back( middles[ i ], std::min( bounds[ i + 1 ], split ) );
+				misplaced += false_before_split.back().second - false_before_split.back().first;
+			}
+			if( std::max( bounds[ i ], split ) < middles[ i ] ) {
+				true_after_split.emplace_back( std::max( bounds[ i ], split ), middles[ i ] );
+			}
+		}
+		std::size_t pieces = std::min( chunks, misplaced / parallel_grain + 1 );
+		kdtree::task_group group( pool );
+		for( std::size_t i = 0; i < pieces; ++i ) {
+			group.run( [ &, i ]() { swap_misplaced( begin, false_before_split, true_after_split, misplaced / pieces * i + std::min( i, misplaced % pieces ), misplaced / pieces * (i + 1) + std::min( i + 1, misplaced % pieces ) ); } );
+		}
+		group.wait();
+		return begin + split;
+	}
+
+	/*
+	Selection in the style of Floyd and Rivest: two pivots drawn from a random sample bracket the
+	target rank, two partition passes isolate the elements between them, and the exact selection is
+	finished with std::nth_element on that much smaller middle range, or on any range shorter than
+	min_size.
+	*/
+	template <class RandomAccessIterator, class Compare, class Partition>
+	void sampled_nth_element( RandomAccessIterator begin, RandomAccessIterator nth, RandomAccessIterator end, Compare comp, std::size_t sample_size, std::size_t min_size, Partition partition ) {
+		using value_type = typename std::iterator_traits<RandomAccessIterator>::value_type;
+		std::size_t const margin = std::max<std::size_t>( sample_size / 16, 1 );
+		std::minstd_rand generator( 20170112 );
+		std::vector<RandomAccessIterator> sample;
+		sample.reserve( sample_size );
+		while( static_cast<std::size_t>( end - begin ) >= std::max( min_size, sample_size ) ) {
+			std::size_t n = end - begin;
+			std::uniform_int_distribution<std::size_t> position( 0, n - 1 );
+			sample.clear();
+			for( std::size_t i = 0; i < sample_size; ++i ) {
+				sample.push_back( begin + position( generator ) );
+			}
+			std::sort( sample.begin(), sample.end(), [ &comp ]( RandomAccessIterator lhs, RandomAccessIterator rhs ) { return comp( *lhs, *rhs ); } );
+			std::size_t target = (nth - begin) * sample_size / n;
+			value_type const lower = *sample[ target > margin ? target - margin : 0 ];
+			value_type const upper = *sample[ std::min( target + margin, sample_size - 1 ) ];
+			RandomAccessIterator first = partition( begin, end, [ &comp, &lower ]( value_type const & x ) { return comp( x, lower ); } );
+			if( nth < first ) {
+				end = first;
+				continue;
+			}
+			RandomAccessIterator last = partition( first, end, [ &comp, &upper ]( value_type const & x ) { return !comp( upper, x ); } );
+			if( nth >= last ) {
+				begin = last;
+				continue;
+			}
+			begin = first;
+			end = last;
+			break;
+		}
+		std::nth_element( begin, nth, end, comp );
+	}
+
+	// the partition passes are themselves split across the pool
+	template <class RandomAccessIterator, class Compare>
+	void parallel_nth_element( kdtree::thread_pool & pool, RandomAccessIterator begin, RandomAccessIterator nth, RandomAccessIterator end, Compare comp ) {
+		std::size_t min_size = pool.concurrency() > 1 ? 2 * parallel_grain * pool.concurrency() : std::numeric_limits<std::size_t>::max();
+		sampled_nth_element( begin, nth, end, comp, 1024, min_size, [ &pool ]( RandomAccessIterator first, RandomAccessIterator last, auto pred ) { return parallel_partition( pool, first, last, pred ); } );
+	}
+
+	/*
+	Sequential sampled selection. Below a few samples' worth of elements, bracketing the median no
+	longer saves enough work to pay for sorting the sample.
+	*/
+	struct sampled_select {
+		std::size_t sample_size;
+		template <class RandomAccessIterator, class Compare>
+		void operator()( RandomAccessIterator begin, RandomAccessIterator nth, RandomAccessIterator end, Compare comp ) const {
+			sampled_nth_element( begin, nth, end, comp, sample_size, 8 * sample_size, []( RandomAccessIterator first, RandomAccessIterator last, auto pred ) { return std::partition( first, last, pred ); } );
+		}
+	};
+
+	/*
+	Subtrees larger than the cutoff are handed to the pool as they are split off, and while fewer
+	subtrees than threads are in flight, the partitioning step itself is parallelized as well.
+	Because split_less is a total order, the result is identical to that of make_kdtree_helper.
+	*/
+	template <class RandomAccessIterator, class Split, class Projection, class Choose = round_robin_dimension>
+	void make_kdtree_parallel_helper( kdtree::thread_pool & pool, std::size_t cutoff, RandomAccessIterator begin, RandomAccessIterator end, depth_type depth, std::size_t leaf, Split split, Projection project, std::size_t width, Choose choose = Choose(), std::size_t index = 0 ) {
+		std::size_t n = end - begin;
+		if( n <= cutoff || n <= leaf ) {
+			make_kdtree_helper( begin, end, depth, leaf, split, project, choose, index );
+			return;
+		}
+		RandomAccessIterator median = begin + split( n );
+		auto comp = split_compare( choose( begin, end, depth, index, project ), project );
+		if( width < pool.concurrency() ) {
+			parallel_nth_element( pool, begin, median, end, comp );
+		} else {
+			std::nth_element( begin, median, end, comp );
+		}
+		kdtree::task_group group( pool );
+		group.run( [ &pool, cutoff, median, end, depth, leaf, split, project, width, choose, index ]() { make_kdtree_parallel_helper( pool, cutoff, median + 1, end, depth + 1, leaf, split, project, width * 2, choose, 2 * index + 2 ); } );
+		make_kdtree_parallel_helper( pool, cutoff, begin, median, depth + 1, leaf, split, project, width * 2, choose, 2 * index + 1 );
+		group.wait();
+	}
+
+	/*
+	Handles on subtrees of the two layouts. An inorder_node is the range of a subtree whose median
+	sits in the middle of that range and whose ranges of at most leaf points are buckets. A
+	breadth_first_node is the index of a subtree root in a complete tree stored in breadth-first
+	order, whose children are found at 2i + 1 and 2i + 2 and whose every node holds a single point.
+	The searches are written once against the interface the two share.
+	*/
+	template <class RandomAccessIterator>
+	class inorder_node {
+		private:
+			RandomAccessIterator _begin;
+			RandomAccessIterator _end;
+			std::size_t _leaf;
+			depth_type _depth;
+		public:
+			using iterator = RandomAccessIterator;
+			inorder_node( RandomAccessIterator begin, RandomAccessIterator end, std::size_t leaf, depth_type depth ) : _begin( begin ), _end( end ), _leaf( leaf ), _depth( depth ) {}
+			bool empty() const { return _begin == _end; }
+			std::size_t size() const { return _end - _begin; }
+			bool is_leaf() const { return size() <= _leaf; }
+			depth_type depth() const noexcept { return _depth; }
+			RandomAccessIterator median() const { return _begin + (size() / 2); }
+			dimension_type split_dimension( dimension_type dimensionality ) const noexcept { return dimension( dimensionality, _depth ); }
+			auto split( dimension_type dim ) const { return (*median())[ dim ]; }
+			RandomAccessIterator begin() const { return _begin; }
+			RandomAccessIterator end() const { return _end; }
+			inorder_node left() const { return inorder_node( _begin, median(), _leaf, _depth + 1 ); }
+			inorder_node right() const { return inorder_node( median() + 1, _end, _leaf, _depth + 1 ); }
+	};
+
+	template <class RandomAccessIterator>
+	class breadth_first_node {
+		private:
+			RandomAccessIterator _base;
+			std::size_t _count;
+			std::size_t _index;
+			depth_type _depth;
+		public:
+			using iterator = RandomAccessIterator;
+			breadth_first_node( RandomAccessIterator base, std::size_t count, std::size_t index, depth_type depth ) : _base( base ), _count( count ), _index( index ), _depth( depth ) {}
+			bool empty() const noexcept { return _index >= _count; }
+			std::size_t size() const noexcept {
+				std::size_t n = 0;
+				for( std::size_t first = _index, width = 1; first < _count; first = 2 * first + 1, width *= 2 ) {
+					n += std::min( width, _count - first );
+				}
+				return n;
+			}
+			bool is_leaf() const noexcept { return 2 * _index + 1 >= _count; }
+			depth_type depth() const noexcept { return _depth; }
+			RandomAccessIterator median() const { return _base + _index; }
+			dimension_type split_dimension( dimension_type dimensionality ) const noexcept { return dimension( dimensionality, _depth ); }
+			auto split( dimension_type dim ) const { return (*median())[ dim ]; }
+			RandomAccessIterator begin() const { return _base + _index; }
+			RandomAccessIterator end() const { return _base + _index + 1; }
+			breadth_first_node left() const { return breadth_first_node( _base, _count, 2 * _index + 1, _depth + 1 ); }
+			breadth_first_node right() const { return breadth_first_node( _base, _count, 2 * _index + 2, _depth + 1 ); }
+	};
+
+	/*
+	An inorder_node that takes its split values, and split dimensions unless they cycle by depth, from
+	skeleton arrays in breadth-first order.
+	*/
+	template <class RandomAccessIterator, class Coordinate>
+	class skeleton_node {
+		private:
+			inorder_node<RandomAccessIterator> _node;
+			Coordinate const * _splits;
+			std::uint16_t const * _dimensions;
+			std::size_t _index;
+		public:
+			using iterator = RandomAccessIterator;
+			skeleton_node( inorder_node<RandomAccessIterator> const & node, Coordinate const * splits, std::uint16_t const * dimensions, std::size_t index ) : _node( node ), _splits( splits ), _dimensions( dimensions ), _index( index ) {}
+			bool empty() const { return _node.empty(); }
+			std::size_t size() const { return _node.size(); }
+			bool is_leaf() const { return _node.is_leaf(); }
+			depth_type depth() const noexcept { return _node.depth(); }
+			RandomAccessIterator median() const { return _node.median(); }
+			dimension_type split_dimension( dimension_type dimensionality ) const noexcept { return _dimensions != nullptr ? _dimensions[ _index ] : _node.split_dimension( dimensionality ); }
+			Coordinate split( dimension_type ) const { return _splits[ _index ]; }
+			RandomAccessIterator begin() const { return _node.begin(); }
+			RandomAccessIterator end() const { return _node.end(); }
+			skeleton_node left() const { return skeleton_node( _node.left(), _splits, _dimensions, 2 * _index + 1 ); }
+			skeleton_node right() const { return skeleton_node( _node.right(), _splits, _dimensions, 2 * _index + 2 ); }
+	};
+
+	/*
+	The left subtree of an inorder_node is never smaller than the right one, so the leftmost path is
+	the longest and the number of splits above the buckets bounds the breadth-first indices in use.
+	*/
+	inline std::size_t skeleton_size( std::size_t n, std::size_t leaf ) noexcept {
+		std::size_t size = 0;
+		for( std::size_t width = 1; n > leaf; n /= 2, width *= 2 ) {
+			size += width;
+		}
+		return size;
+	}
+
+	template <class RandomAccessIterator, class Coordinate>
+	void make_skeleton_helper( RandomAccessIterator begin, RandomAccessIterator end, std::size_t leaf, std::vector<Coordinate> & splits, std::vector<std::uint16_t> const & dimensions ) {
+		traversal_stack< build_frame<RandomAccessIterator> > stack;
+		stack.push( build_frame<RandomAccessIterator>{ begin, end, 0, 0 } );
+		while( !stack.empty() ) {
+			build_frame<RandomAccessIterator> frame = stack.top();
+			stack.pop();
+			inorder_node<RandomAccessIterator> node( frame.begin, frame.end, leaf, frame.depth );
+			if( !node.empty() && !node.is_leaf() ) {
+				splits[ frame.index ] = node.split( dimensions.empty() ? node.split_dimension( (*node.median()).dimensionality() ) : dimensions[ frame.index ] );
+				stack.push( build_frame<RandomAccessIterator>{ node.median() + 1, frame.end, frame.depth + 1, 2 * frame.index + 2 } );
+				stack.push( build_frame<RandomAccessIterator>{ frame.begin, node.median(), frame.depth + 1, 2 * frame.index + 1 } );
+			}
+		}
+	}
+
+	// sizes the dimension array that the build fills in and returns the chooser that fills it
+	template <class Coordinate>
+	skeleton_dimension prepare_skeleton( std::size_t n, kdtree::split_skeleton<Coordinate> & skeleton ) {
+		if( skeleton.rule() == kdtree::split_rule::round_robin ) {
+			skeleton.dimensions().clear();
+		} else {
+			skeleton.dimensions().assign( skeleton_size( n, skeleton.leaf().value() ), 0 );
+		}
+		return skeleton_dimension{ skeleton.rule(), skeleton.dimensions().data() };
+	}
+
+	template <class RandomAccessIterator, class Coordinate>
+	void make_skeleton( RandomAccessIterator begin, RandomAccessIterator end, kdtree::split_skeleton<Coordinate> & skeleton ) {
+		skeleton.splits().assign( skeleton_size( end - begin, skeleton.leaf().value() ), Coordinate() );
+		make_skeleton_helper( begin, end, skeleton.leaf().value(), skeleton.splits(), skeleton.dimensions() );
+	}
+
+	template <class RandomAccessIterator>
+	inorder_node<RandomAccessIterator> root_node( RandomAccessIterator begin, RandomAccessIterator end, kdtree::leaf_size leaf ) {
+		return inorder_node<RandomAccessIterator>( begin, end, leaf.value(), 0 );
+	}
+
+	template <class RandomAccessIterator>
+	breadth_first_node<RandomAccessIterator> root_node( RandomAccessIterator begin, RandomAccessIterator end, kdtree::eytzinger_layout ) {
+		return breadth_first_node<RandomAccessIterator>( begin, end - begin, 0, 0 );
+	}
+
+	template <class RandomAccessIterator, class Coordinate>
+	skeleton_node<RandomAccessIterator,Coordinate> root_node( RandomAccessIterator begin, RandomAccessIterator end, kdtree::skeleton_view<Coordinate> skeleton ) {
+		return skeleton_node<RandomAccessIterator,Coordinate>( inorder_node<RandomAccessIterator>( begin, end, skeleton.leaf().value(), 0 ), skeleton.splits(), skeleton.dimensions(), 0 );
+	}
+
+	template <class RandomAccessIterator, class Layout>
+	auto root_node( RandomAccessIterator begin, RandomAccessIterator end, kdtree::stats_layout<Layout> layout ) {
+		return root_node( begin, end, layout.layout() );
+	}
+
+	/*
+	The root of a layout whose split dimensions cycle by depth, for a point type with d fixed axes.
+	It marks the search from it to start on axis 0 and step the split axis at run time from one
+	level to the next, wrapping against the d known to the compiler, so that no node takes its depth
+	modulo d. Layouts that choose the split dimension of each node keep the plain nodes.
+	*/
+	template <class Node, dimension_type d>
+	class fixed_axis_node {
+		private:
+			Node _node;
+		public:
+			using iterator = typename Node::iterator;
+			explicit fixed_axis_node( Node const & node ) : _node( node ) {}
+			Node const & base() const noexcept { return _node; }
+	};
+
+	template <class Node> struct cycles_by_depth : std::false_type {};
+	template <class RandomAccessIterator> struct cycles_by_depth< inorder_node<RandomAccessIterator> > : std::true_type {};
+	template <class RandomAccessIterator> struct cycles_by_depth< breadth_first_node<RandomAccessIterator> > : std::true_type {};
+
+	template <class Node, class Point>
+	Node fixed_axis_root( Node const & root, Point const &, std::false_type ) {
+		return root;
+	}
+
+	template <class Node, class Point>
+	fixed_axis_node< Node, static_dimensionality<Point>::value > fixed_axis_root( Node const & root, Point const &, std::true_type ) {
+		return fixed_axis_node< Node, static_dimensionality<Point>::value >( root );
+	}
+
+	// the root a depth-first search of point starts from
+	template <class Node, class Point>
+	auto search_root( Node const & root, Point const & point ) {
+		return fixed_axis_root( root, point, std::integral_constant< bool, cycles_by_depth<Node>::value && has_fixed_axes<Point>::value >() );
+	}
+
+	// where a search records its statistics: nowhere, unless the layout is wrapped by kdtree::with_stats
+	template <class Layout>
+	kdtree::no_stats layout_stats( Layout ) noexcept {
+		return kdtree::no_stats();
+	}
+
+	template <class Layout>
+	kdtree::query_stats & layout_stats( kdtree::stats_layout<Layout> layout ) noexcept {
+		return layout.stats();
+	}
+
+	template <class Layout>
+	using stats_type = typename std::decay< decltype( layout_stats( std::declval<Layout>() ) ) >::type;
+
+	template <class RandomAccessIterator>
+	void print_kdtree_node_helper( std::ostream & os, RandomAccessIterator median, depth_type depth, std::size_t node_count ) {
+		using coordinate_type = decltype( *(median->cbegin()) );
+		os << "(";
+		std::copy( median->cbegin(), median->cend() - 1, std::ostream_iterator<coordinate_type>( os, "," ) );
+		os << *(median->cend() - 1) << ") [d=" << depth << ",n=" << node_count << "]";
+	}
+
+	template <class RandomAccessIterator>
+	void print_kdtree_leaf_helper( std::ostream & os, RandomAccessIterator begin, RandomAccessIterator end, depth_type depth ) {
+		using coordinate_type = decltype( *(begin->cbegin()) );
+		os << "{";
+		for( RandomAccessIterator it = begin; it != end; ++it ) {
+			os << (it == begin ? "(" : ",(");
+			std::copy( it->cbegin(), it->cend() - 1, std::ostream_iterator<coordinate_type>( os, "," ) );
+			os << *(it->cend() - 1) << ")";
+		}
+		os << "} [d=" << depth << ",n=" << (end - begin) << "]";
+	}
+
+	template <class Node>
+	void print_kdtree_helper( std::ostream & os, Node const & node ) {
+		if( !node.empty() ) {
+			std::size_t n = node.size();
+			std::fill_n( std::ostream_iterator<std::string>( os ), node.depth(), " | " );
+			if( !node.is_leaf() || n == 1 ) {
+				print_kdtree_node_helper( os, node.median(), node.depth(), n );
+				os << "\n";
+				if( !node.is_leaf() ) {
+					print_kdtree_helper( os, node.left() );
+					print_kdtree_helper( os, node.right() );
+				}
+			} else {
+				print_kdtree_leaf_helper( os, node.begin(), node.end(), node.depth() );
+				os << "\n";
+			}
+		}
+	}
+
+	template <class Point>
+	using axis_terms = axis_array< distance_type<Point>, Point >;
+
+	template <class Point>
+	axis_terms<Point> make_axis_terms( Point const & point ) {
+		axis_terms<Point> terms;
+		fill_axes( terms, point.dimensionality(), distance_type<Point>( 0 ) );
+		return terms;
+	}
+
+	/*
+	Incremental distance to the far cell, after Arya and Mount. terms holds, per axis, the metric's
+	contribution of the offset from the query to the current cell (zero where the query lies inside
+	it) and celldist their combined reduced distance. Crossing a split on axis dim only replaces that
+	axis' term, so the distance from the query to the far child's cell costs O(1) rather than O(d) to
+	compute. The median lies in the closure of that cell, so it is only examined if the far cell
+	could be.
+	*/
+	template <class Point, class Coordinate, class Metric>
+	distance_type<Point> far_cell_distance( Point const & point, Coordinate const & split, dimension_type dim, Metric const & metric, distance_type<Point> celldist, axis_terms<Point> const & terms, distance_type<Point> & term ) {
+		term = metric.axis( static_cast< distance_type<Point> >( point[ dim ] ) - static_cast< distance_type<Point> >( split ), dim );
+		return metric.replace( celldist, terms[ dim ], term );
+	}
+
+	// how a traversal finds the split axis of a node: by asking it, or below a fixed_axis_node by stepping the parent's
+	template <class Node>
+	struct traversal_axes {
+		using node_type = Node;
+		static Node const & base( Node const & node ) noexcept { return node; }
+		static dimension_type first( Node const & ) noexcept { return 0; }
+		static dimension_type next( dimension_type axis ) noexcept { return axis; }
+		static dimension_type split_dimension( Node const & node, dimension_type, dimension_type dimensionality ) { return node.split_dimension( dimensionality ); }
+	};
+
+	template <class Node, std::size_t d>
+	struct traversal_axes< fixed_axis_node<Node,d> > {
+		using node_type = Node;
+		static Node const & base( fixed_axis_node<Node,d> const & node ) noexcept { return node.base(); }
+		static dimension_type first( fixed_axis_node<Node,d> const & ) noexcept { return 0; }
+		static dimension_type next( dimension_type axis ) noexcept { return axis + 1 == d ? 0 : axis + 1; }
+		static dimension_type split_dimension( Node const &, dimension_type axis, dimension_type ) noexcept { return axis; }
+	};
+
+	inline void prefetch_address( void const * address ) noexcept {
+#if defined( __GNUC__ )
+		__builtin_prefetch( address );
+#else
+		(void)address;
+#endif
+	}
+
+	template <class RandomAccessIterator>
+	void prefetch_point( RandomAccessIterator const & it, std::true_type ) noexcept {
+		prefetch_address( std::addressof( *it ) );
+	}
+
+	template <class RandomAccessIterator>
+	void prefetch_point( RandomAccessIterator const &, std::false_type ) noexcept {}
+
+	template <class T>
+	void prefetch_point( kdtree::row_iterator<T> const & it, std::false_type ) noexcept {
+		prefetch_address( it.data() );
+	}
+
+	template <class Node>
+	void prefetch_median( Node const & node ) noexcept {
+		using reference = typename std::iterator_traits< typename Node::iterator >::reference;
+		if( !node.empty() ) {
+			prefetch_point( node.median(), std::is_lvalue_reference<reference>() );
+		}
+	}
+
+	// a node whose far child is still to be decided, or, once it is being searched, whose term to restore
+	template <class Node, class Distance>
+	struct nearest_frame {
+		Node node;
+		Distance celldist;
+		Distance saved;
+		dimension_type dim;
+		bool left;
+		bool restore;
+	};
+
+	/*
+	The traversal behind the nearest neighbor searches: descend to the leaf whose cell holds the
+	query, then unwind, searching the far child of a split, and examining its median, whenever within
+	accepts the distance to its cell. offer receives medians and scan the leaves.
+	*/
+	template <class Root, class Point, class Metric, class Within, class Offer, class Scan, class Stats>
+	void nearest_traversal( Root const & root, Point const & point, Metric const & metric, distance_type<Point> celldist, axis_terms<Point> & terms, Within within, Offer offer, Scan scan, Stats & stats ) {
+		using axes = traversal_axes<Root>;
+		using node_type = typename axes::node_type;
+		traversal_stack< nearest_frame< node_type, distance_type<Point> > > stack;
+		node_type node = axes::base( root );
+		dimension_type axis = axes::first( root );
+		for( ;; ) {
+			while( !node.empty() ) {
+				stats.record_visit( node.depth() );
+				if( node.is_leaf() ) {
+					scan( node );
+					stats.record_distances( node.end() - node.begin() );
+					break;
+				}
+				dimension_type dim = axes::split_dimension( node, axis, point.dimensionality() );
+				bool left = point[ dim ] <= node.split( dim );
+				stack.push( nearest_frame< node_type, distance_type<Point> >{ node, celldist, 0, dim, left, false } );
+				prefetch_median( left ? node.right() : node.left() );
+				node = left ? node.left() : node.right();
+				axis = axes::next( dim );
+			}
+			for( ;; ) {
+				if( stack.empty() ) {
+					return;
+				}
+				auto & frame = stack.top();
+				if( frame.restore ) {
+					terms[ frame.dim ] = frame.saved;
+					stack.pop();
+					continue;
+				}
+				distance_type<Point> term;
+				distance_type<Point> fardist = far_cell_distance( point, frame.node.split( frame.dim ), frame.dim, metric, frame.celldist, terms, term );
+				if( within( fardist ) ) {
+					offer( frame.node.median() );
+					stats.record_distances( 1 );
+					frame.restore = true;
+					frame.saved = terms[ frame.dim ];
+					terms[ frame.dim ] = term;
+					node = frame.left ? frame.node.right() : frame.node.left();
+					axis = axes::next( frame.dim );
+					celldist = fardist;
+					break;
+				}
+				stats.record_prune();
+				stack.pop();
+			}
+		}
+	}
 
-namespace {
+	template <class Node, class Point, class Metric, class Stats>
+	void nnsearch_kdtree_helper( Node const & node, Point const & point, Metric const & metric, distance_type<Point> & mindist, typename Node::iterator & closest, distance_type<Point> celldist, axis_terms<Point> & terms, Stats & stats ) {
+		using iterator = typename Node::iterator;
+		nearest_traversal( node, point, metric, celldist, terms,
+				[ &mindist ]( distance_type<Point> fardist ) { return fardist < mindist; },
+				[ &point, &metric, &mindist, &closest ]( iterator median ) { update_minimum_distance( median, point, metric, mindist, closest ); },
+				[ &point, &metric, &mindist, &closest ]( typename traversal_axes<Node>::node_type const & leaf ) {
+					scan_leaf( leaf.begin(), leaf.end(), point, metric, [ &mindist, &closest ]( iterator it, distance_type<Point> dist ) { offer_minimum_distance( it, dist, mindist, closest ); } );
+				}, stats );
+	}
 
-	using dimension_type = std::size_t;
-	using depth_type = std::size_t;
-	using distance_type = float;
+	/*
+	The pruning bound is the kth smallest distance seen so far, or unbounded until k have been seen.
+	Approximate searches scale the distance to a cell by a factor before comparing it to the bound.
+	*/
+	template <class Distance, class PriorityQueue>
+	Distance priority_queue_bound( PriorityQueue const & pq, std::size_t k ) {
+		return pq.size() < k ? std::numeric_limits<Distance>::max() : pq.top().first;
+	}
 
-	dimension_type dimension( dimension_type dimensionality, depth_type depth ) {
-		return depth % dimensionality;
+	template <class Node, class Point, class Metric, class PriorityQueue, class Stats>
+	void nnsearch_kdtree_helper( Node const & node, Point const & point, std::size_t k, Metric const & metric, PriorityQueue & pq, distance_type<Point> celldist, axis_terms<Point> & terms, Stats & stats, distance_type<Point> factor = 1 ) {
+		using iterator = typename Node::iterator;
+		nearest_traversal( node, point, metric, celldist, terms,
+				[ &pq, k, factor ]( distance_type<Point> fardist ) { return fardist * factor < priority_queue_bound< distance_type<Point> >( pq, k ); },
+				[ &point, &metric, &pq, k ]( iterator median ) { update_priority_queue( median, point, metric, pq, k ); },
+				[ &point, &metric, &pq, k ]( typename traversal_axes<Node>::node_type const & leaf ) {
+					scan_leaf( leaf.begin(), leaf.end(), point, metric, [ &pq, k ]( iterator it, distance_type<Point> dist ) { offer_priority_queue( it, dist, pq, k ); } );
+				}, stats );
 	}
 
-	template <class InputIt1, class InputIt2>
-	distance_type squared_euclidean_distance( InputIt1 first1, InputIt1 last1, InputIt2 first2 ) {
-		/* AWAIT BETTER C++ 2020 SUPPORT
-		auto sum_function = []( auto accum, auto element ) { return accum + element; };
-		auto product_function = []( auto xi1, auto xi2 ) { return std::pow( xi1 - xi2, 2 ); };
-		return std::inner_product( first1, last1, first2, static_cast<distance_type>( 0 ), sum_function, product_function )
-		*/
-		distance_type dist = 0;
-		while( first1 != last1 ) {
-			dist += std::pow( *first1 - *first2, 2 );
-			++first1;
-			++first2;
+	/*
+	Best-bin-first search, after Arya and Mount's priority search and Beis and Lowe. Every far child
+	passed on the way down to a leaf is queued by its distance to the query, and the nearest queued
+	subtree is descended next. Instead of a copy of the per-axis terms, a queued subtree records the
+	axis and term of its last split and a link to the record of its parent, and the terms are rebuilt
+	from that chain when it is dequeued. Terms only grow along a path, so the largest per axis wins.
+	*/
+	template <class Node, class Distance>
+	struct search_branch {
+		Distance celldist;
+		Node node;
+		typename Node::iterator median;
+		bool has_median;
+		std::size_t path;
+	};
+
+	template <class Distance>
+	struct search_path {
+		std::size_t parent;
+		dimension_type dim;
+		Distance term;
+	};
+
+	template <class Node, class Distance>
+	struct best_bin_first_scratch {
+		std::vector< search_branch<Node,Distance> > branches;
+		std::vector< search_path<Distance> > paths;
+	};
+
+	// without a budget on checks the search order does not matter, and depth-first search is cheaper
+	template <class Node, class Point, class Metric, class PriorityQueue, class Stats>
+	void approximate_nnsearch_kdtree_helper( Node const & root, Point const & point, std::size_t k, kdtree::approximation const & approx, Metric const & metric, PriorityQueue & pq, best_bin_first_scratch< Node, distance_type<Point> > & scratch, Stats & stats ) {
+		using distance = distance_type<Point>;
+		using branch_type = search_branch<Node,distance>;
+		std::size_t const none = std::numeric_limits<std::size_t>::max();
+		distance factor = metric.reduce( static_cast<distance>( 1 + approx.epsilon() ) );
+		if( approx.max_checks() == none ) {
+			axis_terms<Point> terms = make_axis_terms( point );
+			nnsearch_kdtree_helper( search_root( root, point ), point, k, metric, pq, 0, terms, stats, factor );
+			return;
 		}
-		return dist;
-	}
-	
-	template <class RandomAccessIterator, class Point>
-	void update_minimum_distance( RandomAccessIterator it, Point const & p, distance_type & mindist, RandomAccessIterator & closest ) {
-		distance_type dist = squared_euclidean_distance( it->begin(), it->end(), p.begin() );
-		if( dist < mindist ) {
-			mindist = dist;
-			closest = it;
+		auto farther = []( branch_type const & lhs, branch_type const & rhs ) { return rhs.celldist < lhs.celldist; };
+		auto & branches = scratch.branches;
+		auto & paths = scratch.paths;
+		branches.clear();
+		paths.clear();
+		branches.push_back( branch_type{ 0, root, root.begin(), false, none } );
+		axis_terms<Point> terms = make_axis_terms( point );
+		std::size_t checks = 0;
+		while( !branches.empty() && (checks < approx.max_checks() || pq.size() < k) ) {
+			std::pop_heap( branches.begin(), branches.end(), farther );
+			branch_type branch = branches.back();
+			branches.pop_back();
+			if( !(branch.celldist * factor < priority_queue_bound<distance>( pq, k )) ) {
+				stats.record_prune( branches.size() + 1 );
+				break;
+			}
+			fill_axes( terms, point.dimensionality(), distance( 0 ) );
+			for( std::size_t path = branch.path; path != none; path = paths[ path ].parent ) {
+				terms[ paths[ path ].dim ] = std::max( terms[ paths[ path ].dim ], paths[ path ].term );
+			}
+			if( branch.has_median ) {
+				update_priority_queue( branch.median, point, metric, pq, k );
+				stats.record_distances( 1 );
+				++checks;
+			}
+			Node node = branch.node;
+			while( !node.empty() && !node.is_leaf() ) {
+				stats.record_visit( node.depth() );
+				dimension_type dim = node.split_dimension( point.dimensionality() );
+				typename Node::iterator median = node.median();
+				bool left = point[ dim ] <= node.split( dim );
+				distance term;
+				distance fardist = far_cell_distance( point, node.split( dim ), dim, metric, branch.celldist, terms, term );
+				if( fardist * factor < priority_queue_bound<distance>( pq, k ) ) {
+					paths.push_back( search_path<distance>{ branch.path, dim, term } );
+					branches.push_back( branch_type{ fardist, left ? node.right() : node.left(), median, true, paths.size() - 1 } );
+					std::push_heap( branches.begin(), branches.end(), farther );
+				} else {
+					stats.record_prune();
+				}
+				node = left ? node.left() : node.right();
+			}
+			if( !node.empty() ) {
+				stats.record_visit( node.depth() );
+				scan_leaf( node.begin(), node.end(), point, metric, [ &pq, k ]( typename Node::iterator it, distance dist ) { offer_priority_queue( it, dist, pq, k ); } );
+				stats.record_distances( node.end() - node.begin() );
+				checks += node.end() - node.begin();
+			}
 		}
 	}
 
-	template <class RandomAccessIterator, class Point, class PriorityQueue>
-	void update_priority_queue( RandomAccessIterator it, Point const & p, PriorityQueue & pq, std::size_t k ) {
-		distance_type dist = squared_euclidean_distance( it->begin(), it->end(), p.begin() );
-		if( pq.size() < k ) {
-			pq.emplace( dist, it );
-		} else {
-			if( dist < pq.top().first ) {
-				pq.pop();
-				pq.emplace( dist, it );
+	/*
+	Reports every point of a subtree without testing it, in the order of the tree: left subtree,
+	median, right subtree. The in-order layouts store that order as a contiguous range. The visitor
+	returns false to stop, and so does visit_subtree once it has.
+	*/
+	template <class RandomAccessIterator, class Visitor>
+	bool visit_subtree( inorder_node<RandomAccessIterator> const & node, Visitor visit ) {
+		for( RandomAccessIterator it = node.begin(); it != node.end(); ++it ) {
+			if( !visit( it ) ) {
+				return false;
 			}
 		}
-//		std::cerr << "\npq.size(): " << pq.size() << " - pq.top().first: " << pq.top().first << " - dist: " << dist << '\n';
+		return true;
 	}
 
-	template <class Point>
-	bool hypercube_contains( Point const & lower, Point const & upper, Point const & needle ) {
-		for( std::size_t i = 0; i < Point::dimensionality(); ++i ) {
-			if( needle[ i ] < lower[ i ]  || needle[ i ] > upper[ i ] ) {
+	template <class RandomAccessIterator, class Coordinate, class Visitor>
+	bool visit_subtree( skeleton_node<RandomAccessIterator,Coordinate> const & node, Visitor visit ) {
+		for( RandomAccessIterator it = node.begin(); it != node.end(); ++it ) {
+			if( !visit( it ) ) {
 				return false;
 			}
 		}
 		return true;
 	}
-	
-	template <class RandomAccessIterator>
-	void make_kdtree_helper( RandomAccessIterator begin, RandomAccessIterator end, depth_type depth ) {
-		dimension_type dim = dimension( begin->dimensionality(), depth );
-		std::size_t n = end - begin;
-		if( n > 1 ) {
-			RandomAccessIterator median = begin + (n / 2);
-			auto comp = [ dim ]( auto lhs, auto rhs ) { return *(lhs.begin() + dim) < *(rhs.begin() + dim); };
-			std::nth_element( begin, median, end, comp );
-			make_kdtree_helper( begin, median, depth + 1 );
-			make_kdtree_helper( median + 1, end, depth + 1 );
+
+	// the Eytzinger layout scatters a subtree, which is walked in order with the left spine on the stack
+	template <class RandomAccessIterator, class Visitor>
+	bool visit_subtree( breadth_first_node<RandomAccessIterator> const & node, Visitor visit ) {
+		traversal_stack< breadth_first_node<RandomAccessIterator> > stack;
+		breadth_first_node<RandomAccessIterator> current = node;
+		while( true ) {
+			for( ; !current.empty(); current = current.left() ) {
+				stack.push( current );
+			}
+			if( stack.empty() ) {
+				return true;
+			}
+			breadth_first_node<RandomAccessIterator> parent = stack.top();
+			stack.pop();
+			if( !visit( parent.median() ) ) {
+				return false;
+			}
+			current = parent.right();
 		}
 	}
 
-	template <class RandomAccessIterator>
-	void print_kdtree_node_helper( std::ostream & os, RandomAccessIterator median, depth_type depth, std::size_t node_count ) {
-		using coordinate_type = decltype( *(median->cbegin()) );
-		os << "(";
-		std::copy( median->cbegin(), median->cend() - 1, std::ostream_iterator<coordinate_type>( os, "," ) );
-		os << *(median->cend() - 1) << ") [d=" << depth << ",n=" << node_count << "]";
+	/*
+	What the range and radius queries do with the points they find: point( it ) is called for every
+	point that passed a test, subtree( node ) for every subtree that lies entirely inside the query
+	region. Collecting walks such subtrees, counting only adds their sizes, so a count costs
+	nothing per contained point and neither of the aggregating reports allocates. Both return false
+	to end the query early.
+	*/
+	template <class Iterator>
+	class collect_report {
+		private:
+			std::vector<Iterator> & _locations;
+		public:
+			explicit collect_report( std::vector<Iterator> & locations ) : _locations( locations ) {}
+			bool point( Iterator it ) { _locations.push_back( it ); return true; }
+			template <class Node> bool subtree( Node const & node ) { return visit_subtree( node, [ this ]( Iterator it ) { _locations.push_back( it ); return true; } ); }
+	};
+
+	class count_report {
+		private:
+			std::size_t _count;
+		public:
+			count_report() : _count( 0 ) {}
+			std::size_t count() const noexcept { return _count; }
+			template <class Iterator> bool point( Iterator ) { ++_count; return true; }
+			template <class Node> bool subtree( Node const & node ) { _count += node.size(); return true; }
+	};
+
+	template <std::size_t d>
+	kdtree::point_aggregate<d> make_point_aggregate( dimension_type ) {
+		return kdtree::point_aggregate<d>();
 	}
 
-	template <class RandomAccessIterator>
-	void print_kdtree_helper( std::ostream & os, RandomAccessIterator begin, RandomAccessIterator end, depth_type depth ) {
-		std::size_t n = end - begin;
-		if( n > 0 ) {
-			RandomAccessIterator median = begin + (n / 2);
-			std::fill_n( std::ostream_iterator<std::string>( os ), depth, " | " );
-			print_kdtree_node_helper( os, median, depth, n );
-			os << "\n";
-			print_kdtree_helper( os, begin, median, depth + 1 );
-			print_kdtree_helper( os, median + 1, end, depth + 1 );
-		}
+	template <>
+	inline kdtree::point_aggregate<0> make_point_aggregate<0>( dimension_type dimensionality ) {
+		return kdtree::point_aggregate<0>( dimensionality );
 	}
 
-	template <class RandomAccessIterator, class Point>
-	void nnsearch_kdtree_helper( RandomAccessIterator begin, RandomAccessIterator end, Point const & point, depth_type depth, distance_type & mindist, RandomAccessIterator & closest ) {
-		dimension_type dim = dimension( Point::dimensionality(), depth );
-		std::size_t n = end - begin;
-		if( n > 0 ) {
-			RandomAccessIterator median = begin + (n / 2);
-//			print_kdtree_node_helper( std::cerr, median, depth, n );
-			if( n > 1 ) {
-				if( point[ dim ] <= (*median)[ dim ] ) {
-//					std::cerr << " - heading left\n";
-					nnsearch_kdtree_helper( begin, median, point, depth + 1, mindist, closest );
-					if( point[ dim ] + mindist >= (*median)[ dim ] ) {
-						update_minimum_distance( median, point, mindist, closest );
-//						print_kdtree_node_helper( std::cerr, median, depth, n );
-//						std::cerr << " - mindist: " << mindist << " - heading right\n";
-						nnsearch_kdtree_helper( median + 1, end, point, depth + 1, mindist, closest );
+	template <std::size_t d>
+	class aggregate_report {
+		private:
+			kdtree::point_aggregate<d> _aggregate;
+		public:
+			explicit aggregate_report( dimension_type dimensionality ) : _aggregate( make_point_aggregate<d>( dimensionality ) ) {}
+			kdtree::point_aggregate<d> const & aggregate() const noexcept { return _aggregate; }
+			template <class Iterator> bool point( Iterator it ) { _aggregate.add( *it ); return true; }
+			template <class Node> bool subtree( Node const & node ) { return visit_subtree( node, [ this ]( typename Node::iterator it ) { _aggregate.add( *it ); return true; } ); }
+	};
+
+	// ends a query at the first point found, or at the first non-empty subtree inside the region
+	class any_report {
+		private:
+			bool _found;
+		public:
+			any_report() : _found( false ) {}
+			bool found() const noexcept { return _found; }
+			template <class Iterator> bool point( Iterator ) { _found = true; return false; }
+			template <class Node> bool subtree( Node const & ) { _found = true; return false; }
+	};
+
+	/*
+	Calls a user visitor with every iterator found. A visitor returning bool ends the query by
+	returning false; one returning void sees every result.
+	*/
+	template <class Visitor, class Iterator>
+	bool call_visitor( Visitor & visit, Iterator it, std::true_type ) {
+		return static_cast<bool>( visit( it ) );
+	}
+
+	template <class Visitor, class Iterator>
+	bool call_visitor( Visitor & visit, Iterator it, std::false_type ) {
+		visit( it );
+		return true;
+	}
+
+	template <class Visitor, class Iterator>
+	bool call_visitor( Visitor & visit, Iterator it ) {
+		return call_visitor( visit, it, std::integral_constant< bool, !std::is_void< decltype( visit( it ) ) >::value >() );
+	}
+
+	template <class Iterator, class Visitor>
+	class visitor_report {
+		private:
+			Visitor & _visit;
+		public:
+			explicit visitor_report( Visitor & visit ) : _visit( visit ) {}
+			bool point( Iterator it ) { return call_visitor( _visit, it ); }
+			template <class Node> bool subtree( Node const & node ) { return visit_subtree( node, [ this ]( Iterator it ) { return call_visitor( _visit, it ); } ); }
+	};
+
+	// writes every iterator found to an output iterator
+	template <class OutputIterator>
+	class output_visitor {
+		private:
+			OutputIterator _output;
+		public:
+			explicit output_visitor( OutputIterator output ) : _output( output ) {}
+			OutputIterator output() const { return _output; }
+			template <class Iterator> void operator()( Iterator it ) { *_output++ = it; }
+	};
+
+	// a visitor is anything callable with a tree iterator, an output target anything else
+	template <class Visitor, class Iterator, class = void>
+	struct is_query_visitor : std::false_type {};
+	template <class Visitor, class Iterator>
+	struct is_query_visitor< Visitor, Iterator, decltype( void( std::declval<Visitor &>()( std::declval<Iterator>() ) ) ) > : std::true_type {};
+
+	template <class Visitor, class Iterator>
+	using if_query_visitor = typename std::enable_if< is_query_visitor<Visitor,Iterator>::value >::type;
+
+	template <class Output, class Iterator>
+	using if_query_output = typename std::enable_if< !is_query_visitor<Output,Iterator>::value && !kdtree::is_tree_layout<Output>::value && !std::is_same< Output, kdtree::approximation >::value >::type;
+
+	/*
+	The bounds of the cell of the node being visited, narrowed at every split on the way down. Points
+	equal to a split value may lie on either side of it, so the bounds are closed. Axes that no split
+	has bounded yet keep the limits of the coordinate type.
+	*/
+	template <class Point>
+	class cell_bounds {
+		private:
+			using bounds_type = axis_array< coordinate_type<Point>, Point >;
+			bounds_type _lower;
+			bounds_type _upper;
+		public:
+			explicit cell_bounds( dimension_type dimensionality ) {
+				fill_axes( _lower, dimensionality, std::numeric_limits< coordinate_type<Point> >::lowest() );
+				fill_axes( _upper, dimensionality, std::numeric_limits< coordinate_type<Point> >::max() );
+			}
+			coordinate_type<Point> lower( dimension_type dim ) const { return _lower[ dim ]; }
+			coordinate_type<Point> upper( dimension_type dim ) const { return _upper[ dim ]; }
+			void narrow( dimension_type dim, coordinate_type<Point> lower, coordinate_type<Point> upper ) {
+				_lower[ dim ] = lower;
+				_upper[ dim ] = upper;
+			}
+	};
+
+	/*
+	A cell_bounds that also counts the axes along which the cell lies within the query box. Splitting
+	changes one axis, so the count is kept current in O(1) per node, and once it reaches d the whole
+	subtree is inside the box.
+	*/
+	template <class Point>
+	class box_cell {
+		private:
+			Point const & _min;
+			Point const & _max;
+			cell_bounds<Point> _bounds;
+			dimension_type _contained;
+			bool axis_contained( dimension_type dim ) const { return !(_bounds.lower( dim ) < _min[ dim ]) && !(_max[ dim ] < _bounds.upper( dim )); }
+		public:
+			box_cell( Point const & min, Point const & max ) : _min( min ), _max( max ), _bounds( min.dimensionality() ), _contained( 0 ) {
+				for( dimension_type dim = 0; dim < min.dimensionality(); ++dim ) {
+					_contained += axis_contained( dim ) ? 1 : 0;
+				}
+			}
+			bool contained() const noexcept { return _contained == _min.dimensionality(); }
+			coordinate_type<Point> lower( dimension_type dim ) const { return _bounds.lower( dim ); }
+			coordinate_type<Point> upper( dimension_type dim ) const { return _bounds.upper( dim ); }
+			void narrow( dimension_type dim, coordinate_type<Point> lower, coordinate_type<Point> upper ) {
+				_contained -= axis_contained( dim ) ? 1 : 0;
+				_bounds.narrow( dim, lower, upper );
+				_contained += axis_contained( dim ) ? 1 : 0;
+			}
+	};
+
+	/*
+	A cell_bounds that counts the axes bounded on both sides. Only a cell bounded along every axis can
+	lie inside a ball, which is the case when the distance from the query to its farthest corner is
+	within the radius. That distance shrinks as the cell does, so unlike the distance to the near
+	side of the cell it cannot be updated from a single axis under every metric, and costs O(d).
+	*/
+	template <class Point>
+	class ball_cell {
+		private:
+			cell_bounds<Point> _bounds;
+			dimension_type _bounded;
+			bool axis_bounded( dimension_type dim ) const { return _bounds.lower( dim ) != std::numeric_limits< coordinate_type<Point> >::lowest() && _bounds.upper( dim ) != std::numeric_limits< coordinate_type<Point> >::max(); }
+		public:
+			explicit ball_cell( dimension_type dimensionality ) : _bounds( dimensionality ), _bounded( 0 ) {}
+			template <class Metric>
+			bool contained( Point const & point, distance_type<Point> radius, Metric const & metric ) const {
+				if( _bounded < point.dimensionality() ) {
+					return false;
+				}
+				distance_type<Point> reduced = 0;
+				for( dimension_type dim = 0; dim < point.dimensionality(); ++dim ) {
+					distance_type<Point> below = static_cast< distance_type<Point> >( point[ dim ] ) - static_cast< distance_type<Point> >( _bounds.lower( dim ) );
+					distance_type<Point> above = static_cast< distance_type<Point> >( _bounds.upper( dim ) ) - static_cast< distance_type<Point> >( point[ dim ] );
+					distance_type<Point> offset = std::max( below < 0 ? -below : below, above < 0 ? -above : above );
+					reduced = metric.accumulate( reduced, metric.axis( offset, dim ) );
+				}
+				return reduced <= radius;
+			}
+			coordinate_type<Point> lower( dimension_type dim ) const { return _bounds.lower( dim ); }
+			coordinate_type<Point> upper( dimension_type dim ) const { return _bounds.upper( dim ); }
+			void narrow( dimension_type dim, coordinate_type<Point> lower, coordinate_type<Point> upper ) {
+				_bounded -= axis_bounded( dim ) ? 1 : 0;
+				_bounds.narrow( dim, lower, upper );
+				_bounded += axis_bounded( dim ) ? 1 : 0;
+			}
+	};
+
+	/*
+	A node whose left or, once right is set, right child is being searched, and the bound of its cell
+	that the child replaced with the split: the upper one for the left child, the lower for the right.
+	*/
+	template <class Node, class Point>
+	struct box_frame {
+		Node node;
+		coordinate_type<Point> bound;
+		dimension_type dim;
+		bool right_oob;
+		bool right;
+	};
+
+	// the same, with what the radius query needs to decide on the median and the right child
+	template <class Node, class Point>
+	struct ball_frame {
+		Node node;
+		coordinate_type<Point> split;
+		coordinate_type<Point> lower;
+		coordinate_type<Point> upper;
+		distance_type<Point> celldist;
+		distance_type<Point> fardist;
+		distance_type<Point> term;
+		distance_type<Point> saved;
+		dimension_type dim;
+		bool left;
+		bool right;
+	};
+
+	/*
+	Reports points within a reduced radius in the order of the tree, prunes every subtree whose cell
+	lies outside the ball and reports every subtree whose cell lies inside it without testing it.
+	*/
+	template <class Node, class Point, class Metric, class Report, class Stats>
+	bool radiusquery_kdtree_helper( Node const & root, Point const & point, distance_type<Point> radius, Metric const & metric, distance_type<Point> celldist, axis_terms<Point> & terms, ball_cell<Point> & cell, Report & report, Stats & stats ) {
+		using axes = traversal_axes<Node>;
+		using node_type = typename axes::node_type;
+		using iterator = typename Node::iterator;
+		traversal_stack< ball_frame< node_type, Point > > stack;
+		node_type node = axes::base( root );
+		dimension_type axis = axes::first( root );
+		bool proceed = true;
+		for( ;; ) {
+			while( !node.empty() ) {
+				stats.record_visit( node.depth() );
+				if( cell.contained( point, radius, metric ) ) {
+					stats.record_subtree( node );
+					proceed = report.subtree( node );
+					break;
+				}
+				if( node.is_leaf() ) {
+					// the distance kernel runs a block at a time, so the rest of a leaf is only skipped over
+					scan_leaf( node.begin(), node.end(), point, metric, [ radius, &report, &proceed, &stats ]( iterator it, distance_type<Point> dist ) {
+								if( proceed && dist <= radius ) {
+									stats.record_results( 1 );
+									proceed = report.point( it );
+								}
+							} );
+					stats.record_distances( node.end() - node.begin() );
+					break;
+				}
+				dimension_type dim = axes::split_dimension( node, axis, point.dimensionality() );
+				ball_frame< node_type, Point > frame{ node, static_cast< coordinate_type<Point> >( node.split( dim ) ), cell.lower( dim ), cell.upper( dim ), celldist, 0, 0, terms[ dim ], dim, point[ dim ] <= node.split( dim ), false };
+				frame.fardist = far_cell_distance( point, node.split( dim ), dim, metric, celldist, terms, frame.term );
+				axis = axes::next( dim );
+				if( frame.left || frame.fardist <= radius ) {
+					if( !frame.left ) {
+						terms[ dim ] = frame.term;
+						celldist = frame.fardist;
 					}
-//					print_kdtree_node_helper( std::cerr, median, depth, n );
-//					std::cerr << " - mindist: " << mindist << " - heading up\n";
-				} else {
-//					std::cerr << " - heading right\n";
-					nnsearch_kdtree_helper( median + 1, end, point, depth + 1, mindist, closest );
-					if( point[ dim ] - mindist <= (*median)[ dim ] ) {
-						update_minimum_distance( median, point, mindist, closest );
-//						print_kdtree_node_helper( std::cerr, median, depth, n );
-//						std::cerr << " - mindist: " << mindist << " - heading left\n";
-						nnsearch_kdtree_helper( begin, median, point, depth + 1, mindist, closest );
+					cell.narrow( dim, frame.lower, frame.split );
+					stack.push( frame );
+					if( !frame.left || frame.fardist <= radius ) {
+						prefetch_median( node.right() );
 					}
-//					print_kdtree_node_helper( std::cerr, median, depth, n );
-//					std::cerr << " - mindist: " << mindist << " - heading up\n";
+					node = node.left();
+					continue;
 				}
-			} else if( n == 1 ) {
-				update_minimum_distance( median, point, mindist, closest );
-//				std::cerr << " - mindist: " << mindist << " - heading up\n";
+				// the query lies right of the split and the left cell is out of reach, so is the median
+				stats.record_prune();
+				cell.narrow( dim, frame.split, frame.upper );
+				frame.right = true;
+				stack.push( frame );
+				node = node.right();
 			}
-		}
-	}
-
-	template <class RandomAccessIterator, class Point, class PriorityQueue>
-	void nnsearch_kdtree_helper( RandomAccessIterator begin, RandomAccessIterator end, Point const & point, std::size_t k, depth_type depth, PriorityQueue & pq ) {
-		dimension_type dim = dimension( Point::dimensionality(), depth );
-		std::size_t n = end - begin;
-		if( n > 0 ) {
-			RandomAccessIterator median = begin + (n / 2);
-//			print_kdtree_node_helper( std::cerr, median, depth, n );
-			if( n > 1 ) {
-				if( point[ dim ] <= (*median)[ dim ] ) {
-//					std::cerr << " - heading left\n";
-					nnsearch_kdtree_helper( begin, median, point, k, depth + 1, pq );
-					if( point[ dim ] + pq.top().first >= (*median)[ dim ] ) {
-						update_priority_queue( median, point, pq, k );
-//						print_kdtree_node_helper( std::cerr, median, depth, n );
-//						std::cerr << " - pq.top().first: " << pq.top().first << " - heading right\n";
-						nnsearch_kdtree_helper( median + 1, end, point, k, depth + 1, pq );
+			for( ;; ) {
+				if( stack.empty() ) {
+					return proceed;
+				}
+				auto & frame = stack.top();
+				cell.narrow( frame.dim, frame.lower, frame.upper );
+				terms[ frame.dim ] = frame.saved;
+				if( !proceed || frame.right ) {
+					stack.pop();
+					continue;
+				}
+				if( frame.fardist <= radius ) {
+					stats.record_distances( 1 );
+					if( metric_distance( metric, *frame.node.median(), point ) <= radius ) {
+						stats.record_results( 1 );
+						proceed = report.point( frame.node.median() );
 					}
-//					print_kdtree_node_helper( std::cerr, median, depth, n );
-//					std::cerr << " - pq.top().first: " << pq.top().first << " - heading up\n";
-				} else {
-//					std::cerr << " - heading right\n";
-					nnsearch_kdtree_helper( median + 1, end, point, k, depth + 1, pq );
-					if( point[ dim ] - pq.top().first <= (*median)[ dim ] ) {
-						update_priority_queue( median, point, pq, k );
-//						print_kdtree_node_helper( std::cerr, median, depth, n );
-//						std::cerr << " - pq.top().first: " << pq.top().first << " - heading left\n";
-						nnsearch_kdtree_helper( begin, median, point, k, depth + 1, pq );
+				}
+				if( proceed && (!frame.left || frame.fardist <= radius) ) {
+					if( frame.left ) {
+						terms[ frame.dim ] = frame.term;
 					}
-//					print_kdtree_node_helper( std::cerr, median, depth, n );
-//					std::cerr << " - pq.top().first: " << pq.top().first << " - heading up\n";
+					cell.narrow( frame.dim, frame.split, frame.upper );
+					frame.right = true;
+					node = frame.node.right();
+					axis = axes::next( frame.dim );
+					celldist = frame.left ? frame.fardist : frame.celldist;
+					break;
+				} else if( proceed ) {
+					stats.record_prune();
 				}
-			} else if( n == 1 ) {
-				update_priority_queue( median, point, pq, k );
-//				std::cerr << " - pq.top().first: " << pq.top().first << " - heading up\n";
+				stack.pop();
 			}
 		}
 	}
 
-	template <class RandomAccessIterator, class Point>
-	void rangequery_kdtree_helper( RandomAccessIterator begin, RandomAccessIterator end, Point const & min, Point const & max, depth_type depth, std::vector<RandomAccessIterator> & locations ) {
-		dimension_type dim = dimension( Point::dimensionality(), depth );
-		std::size_t n = end - begin;
-		if( n > 0 ) {
-			RandomAccessIterator median = begin + (n / 2);
-			bool left_oob = min[ dim ] > (*median)[ dim ];
-			bool right_oob = max[ dim ] < (*median)[ dim ];
-			if( !left_oob ) {
-				rangequery_kdtree_helper( begin, median, min, max, depth + 1, locations );
-			}
-			if( !right_oob ) {
-				rangequery_kdtree_helper( median + 1, end, min, max, depth + 1, locations );
+	template <class Node, class Point, class Report, class Stats>
+	bool rangequery_kdtree_helper( Node const & root, Point const & min, Point const & max, box_cell<Point> & cell, Report & report, Stats & stats ) {
+		using axes = traversal_axes<Node>;
+		using node_type = typename axes::node_type;
+		using iterator = typename Node::iterator;
+		traversal_stack< box_frame< node_type, Point > > stack;
+		node_type node = axes::base( root );
+		dimension_type axis = axes::first( root );
+		bool proceed = true;
+		for( ;; ) {
+			while( !node.empty() ) {
+				stats.record_visit( node.depth() );
+				if( cell.contained() ) {
+					stats.record_subtree( node );
+					proceed = report.subtree( node );
+					break;
+				}
+				if( node.is_leaf() ) {
+					for( iterator it = node.begin(); proceed && it != node.end(); ++it ) {
+						stats.record_distances( 1 );
+						if( hypercube_contains( min, max, *it ) ) {
+							stats.record_results( 1 );
+							proceed = report.point( it );
+						}
+					}
+					break;
+				}
+				dimension_type dim = axes::split_dimension( node, axis, min.dimensionality() );
+				coordinate_type<Point> split = static_cast< coordinate_type<Point> >( node.split( dim ) );
+				bool right_oob = max[ dim ] < split;
+				axis = axes::next( dim );
+				if( !(min[ dim ] > split) ) {
+					stack.push( box_frame< node_type, Point >{ node, cell.upper( dim ), dim, right_oob, false } );
+					if( !right_oob ) {
+						prefetch_median( node.right() );
+					}
+					cell.narrow( dim, cell.lower( dim ), split );
+					node = node.left();
+					continue;
+				}
+				// the box lies right of the split, so the median is outside it too
+				stats.record_prune();
+				if( right_oob ) {
+					stats.record_prune();
+					break;
+				}
+				stack.push( box_frame< node_type, Point >{ node, cell.lower( dim ), dim, false, true } );
+				cell.narrow( dim, split, cell.upper( dim ) );
+				node = node.right();
 			}
-			if( !left_oob && !right_oob ) {
-				if( hypercube_contains( min, max, *median ) ) {
-					locations.push_back( median );
+			for( ;; ) {
+				if( stack.empty() ) {
+					return proceed;
+				}
+				auto & frame = stack.top();
+				dimension_type dim = frame.dim;
+				if( frame.right ) {
+					cell.narrow( dim, frame.bound, cell.upper( dim ) );
+					stack.pop();
+					continue;
 				}
+				// back from the left child, whose cell ends at the split
+				coordinate_type<Point> split = cell.upper( dim );
+				cell.narrow( dim, cell.lower( dim ), frame.bound );
+				if( proceed && !frame.right_oob ) {
+					stats.record_distances( 1 );
+					if( hypercube_contains( min, max, *frame.node.median() ) ) {
+						stats.record_results( 1 );
+						proceed = report.point( frame.node.median() );
+					}
+					if( proceed ) {
+						frame.bound = cell.lower( dim );
+						frame.right = true;
+						cell.narrow( dim, split, cell.upper( dim ) );
+						node = frame.node.right();
+						axis = axes::next( dim );
+						break;
+					}
+				} else if( proceed ) {
+					stats.record_prune();
+				}
+				stack.pop();
 			}
 		}
 	}
 	
+	/*
+	The queries behind the public range, radius and k nearest neighbor searches, reporting to a
+	visitor held by reference so that an output iterator can be read back from it afterwards. They
+	return false if the visitor ended the query.
+	*/
+	template <class RandomAccessIterator, class Point, class Visitor, class Layout>
+	bool rangequery_kdtree_visit( RandomAccessIterator begin, RandomAccessIterator end, Point const & min, Point const & max, Visitor & visit, Layout layout ) {
+		box_cell<Point> cell( min, max );
+		visitor_report<RandomAccessIterator,Visitor> report( visit );
+		auto && stats = layout_stats( layout );
+		stats.record_query();
+		return rangequery_kdtree_helper( search_root( root_node( begin, end, layout ), min ), min, max, cell, report, stats );
+	}
+
+	template <class RandomAccessIterator, class Point, class Visitor, class Layout, class Metric>
+	bool radiusquery_kdtree_visit( RandomAccessIterator begin, RandomAccessIterator end, Point const & point, double radius, Visitor & visit, Layout layout, Metric const & metric ) {
+		auto && stats = layout_stats( layout );
+		stats.record_query();
+		if( radius <= 0 ) {
+			return true;
+		}
+		axis_terms<Point> terms = make_axis_terms( point );
+		ball_cell<Point> cell( point.dimensionality() );
+		visitor_report<RandomAccessIterator,Visitor> report( visit );
+		return radiusquery_kdtree_helper( search_root( root_node( begin, end, layout ), point ), point, metric.reduce( static_cast< distance_type<Point> >( radius ) ), metric, 0, terms, cell, report, stats );
+	}
+
+	// reports the contents of a k nearest neighbor heap in order of increasing distance
+	template <class Distance, class RandomAccessIterator, class Compare, class Visitor>
+	bool visit_sorted_heap( std::vector< std::pair<Distance,RandomAccessIterator> > & storage, Compare compare, Visitor & visit ) {
+		std::sort_heap( storage.begin(), storage.end(), compare );
+		for( auto const & val : storage ) {
+			if( !call_visitor( visit, val.second ) ) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	template <class RandomAccessIterator, class Point, class Visitor, class Layout, class Metric>
+	bool nnsearch_kdtree_visit( RandomAccessIterator begin, RandomAccessIterator end, Point const & point, std::size_t k, Visitor & visit, Layout layout, Metric const & metric ) {
+		using pq_data_package = typename std::pair<distance_type<Point>,RandomAccessIterator>;
+		auto pq_compare = []( pq_data_package const & lhs, pq_data_package const & rhs ) { return lhs.first < rhs.first; };
+		std::vector<pq_data_package> pq_storage;
+		pq_storage.reserve( std::min<std::size_t>( k, end - begin ) );
+		vector_heap<pq_data_package,decltype(pq_compare)> pq( pq_storage, pq_compare );
+		axis_terms<Point> terms = make_axis_terms( point );
+		auto && stats = layout_stats( layout );
+		stats.record_query();
+		if( k > 0 ) {
+			nnsearch_kdtree_helper( search_root( root_node( begin, end, layout ), point ), point, k, metric, pq, 0, terms, stats );
+		}
+		stats.record_results( pq_storage.size() );
+		return visit_sorted_heap( pq_storage, pq_compare, visit );
+	}
+
+	template <class RandomAccessIterator, class Point, class Visitor, class Layout, class Metric>
+	bool nnsearch_kdtree_visit( RandomAccessIterator begin, RandomAccessIterator end, Point const & point, std::size_t k, kdtree::approximation const & approx, Visitor & visit, Layout layout, Metric const & metric ) {
+		using pq_data_package = typename std::pair<distance_type<Point>,RandomAccessIterator>;
+		auto pq_compare = []( pq_data_package const & lhs, pq_data_package const & rhs ) { return lhs.first < rhs.first; };
+		std::vector<pq_data_package> pq_storage;
+		pq_storage.reserve( std::min<std::size_t>( k, end - begin ) );
+		vector_heap<pq_data_package,decltype(pq_compare)> pq( pq_storage, pq_compare );
+		auto root = root_node( begin, end, layout );
+		best_bin_first_scratch< decltype( root ), distance_type<Point> > scratch;
+		auto && stats = layout_stats( layout );
+		stats.record_query();
+		if( k > 0 ) {
+			approximate_nnsearch_kdtree_helper( root, point, k, approx, metric, pq, scratch, stats );
+		}
+		stats.record_results( pq_storage.size() );
+		return visit_sorted_heap( pq_storage, pq_compare, visit );
+	}
+
+	/*
+	Hands out fixed-size blocks of query indices to one task per thread. Each task appends its results
+	to its own scratch vector and records per-query counts in offsets[ i + 1 ]; the counts are then
+	turned into CSR offsets and every block is copied to its final position in the output. Every task
+	records statistics into its own sink, and the sinks are merged into that of the layout.
+	*/
+	template <class Scratch, class QueryFunction, class OffsetIterator, class Layout>
+	void batch_query_helper( kdtree::parallel_policy const & policy, std::size_t count, QueryFunction query, OffsetIterator offsets, std::vector<std::size_t> & indices, Layout layout ) {
+		std::size_t const block_size = 64;
+		std::size_t block_count = (count + block_size - 1) / block_size;
+		struct worker_state {
+			Scratch scratch;
+			stats_type<Layout> stats;
+			std::vector<std::size_t> results;
+			std::vector<std::pair<std::size_t,std::size_t>> blocks;
+		};
+		kdtree::with_thread_pool( policy, [ & ]( kdtree::thread_pool & pool ) {
+					std::size_t workers = std::min( pool.concurrency(), block_count );
+					std::vector<worker_state> states( workers );
+					std::atomic<std::size_t> next_block( 0 );
+					{
+						kdtree::task_group group( pool );
+						for( std::size_t t = 0; t < workers; ++t ) {
+							group.run( [ &, t ]() {
+										worker_state & state = states[ t ];
+										for( std::size_t block = next_block++; block < block_count; block = next_block++ ) {
+											state.blocks.emplace_back( block, state.results.size() );
+											for( std::size_t i = block * block_size; i < std::min( count, (block + 1) * block_size ); ++i ) {
+												std::size_t before = state.results.size();
+												state.stats.record_query();
+												query( i, state.scratch, state.stats, state.results );
+												offsets[ i + 1 ] = state.results.size() - before;
+											}
+										}
+									} );
+						}
+						group.wait();
+					}
+					auto && stats = layout_stats( layout );
+					for( worker_state const & state : states ) {
+						stats.merge( state.stats );
+					}
+					offsets[ 0 ] = 0;
+					for( std::size_t i = 0; i < count; ++i ) {
+						offsets[ i + 1 ] += offsets[ i ];
+					}
+					indices.resize( offsets[ count ] );
+					kdtree::task_group group( pool );
+					for( std::size_t t = 0; t < workers; ++t ) {
+						group.run( [ &, t ]() {
+									worker_state const & state = states[ t ];
+									for( std::size_t b = 0; b < state.blocks.size(); ++b ) {
+										std::size_t first = state.blocks[ b ].second;
+										std::size_t last = b + 1 < state.blocks.size() ? state.blocks[ b + 1 ].second : state.results.size();
+										std::copy( state.results.begin() + first, state.results.begin() + last, indices.begin() + offsets[ state.blocks[ b ].first * block_size ] );
+									}
+								} );
+					}
+					group.wait();
+				} );
+	}
+
 }
 
 namespace kdtree {
 
 	template <class RandomAccessIterator>
-	void make_kdtree( RandomAccessIterator begin, RandomAccessIterator end ) {
+	void make_kdtree( RandomAccessIterator begin, RandomAccessIterator end, kdtree::leaf_size leaf = kdtree::leaf_size() ) {
 		using iterator_tag = typename std::iterator_traits<RandomAccessIterator>::iterator_category;
 		using value_type = typename std::iterator_traits<RandomAccessIterator>::value_type;
 		static_assert( std::is_convertible< iterator_tag, std::random_access_iterator_tag >::value, "kdtree::make_kdtree( RandomAccessIterator begin, RandomAccessIterator end ) only accepts random access iterators or raw pointers to an array.\n" );
-		make_kdtree_helper( begin, end, 0 );
+		build_storage<RandomAccessIterator> storage( begin, end );
+		make_kdtree_helper( storage.begin(), storage.end(), 0, leaf.value(), median_split(), storage.projection() );
+		storage.commit();
 	}
 
 	template <class RandomAccessIterator>
-	void print_kdtree( std::ostream & os, RandomAccessIterator begin, RandomAccessIterator end ) {
-		print_kdtree_helper( os, begin, end, 0 );
+	void make_kdtree( RandomAccessIterator begin, RandomAccessIterator end, kdtree::eytzinger_layout ) {
+		using iterator_tag = typename std::iterator_traits<RandomAccessIterator>::iterator_category;
+		static_assert( std::is_convertible< iterator_tag, std::random_access_iterator_tag >::value, "kdtree::make_kdtree( RandomAccessIterator begin, RandomAccessIterator end, eytzinger_layout ) only accepts random access iterators or raw pointers to an array.\n" );
+		build_storage<RandomAccessIterator> storage( begin, end );
+		make_kdtree_helper( storage.begin(), storage.end(), 0, 1, complete_split(), storage.projection() );
+		breadth_first_permute( storage.begin(), storage.end() );
+		storage.commit();
 	}
 
-	template <class RandomAccessIterator, class Point>
-	RandomAccessIterator search_kdtree( RandomAccessIterator begin, RandomAccessIterator end, Point const & point ) {
+	template <class RandomAccessIterator>
+	void make_kdtree( RandomAccessIterator begin, RandomAccessIterator end, kdtree::leaf_size leaf, kdtree::presorted_construction ) {
+		using iterator_tag = typename std::iterator_traits<RandomAccessIterator>::iterator_category;
+		static_assert( std::is_convertible< iterator_tag, std::random_access_iterator_tag >::value, "kdtree::make_kdtree( RandomAccessIterator begin, RandomAccessIterator end, leaf_size leaf, presorted_construction ) only accepts random access iterators or raw pointers to an array.\n" );
+		build_storage<RandomAccessIterator> storage( begin, end );
+		make_kdtree_presorted( storage.begin(), storage.end(), leaf.value(), storage.projection() );
+		storage.commit();
+	}
+
+	template <class RandomAccessIterator>
+	void make_kdtree( RandomAccessIterator begin, RandomAccessIterator end, kdtree::leaf_size leaf, kdtree::sampled_construction sampling ) {
+		using iterator_tag = typename std::iterator_traits<RandomAccessIterator>::iterator_category;
+		static_assert( std::is_convertible< iterator_tag, std::random_access_iterator_tag >::value, "kdtree::make_kdtree( RandomAccessIterator begin, RandomAccessIterator end, leaf_size leaf, sampled_construction sampling ) only accepts random access iterators or raw pointers to an array.\n" );
+		build_storage<RandomAccessIterator> storage( begin, end );
+		make_kdtree_helper( storage.begin(), storage.end(), 0, leaf.value(), median_split(), storage.projection(), round_robin_dimension(), 0, sampled_select{ sampling.sample_size() } );
+		storage.commit();
+	}
+
+	template <class RandomAccessIterator, class Coordinate>
+	void make_kdtree( RandomAccessIterator begin, RandomAccessIterator end, kdtree::split_skeleton<Coordinate> & skeleton ) {
+		using value_type = typename std::iterator_traits<RandomAccessIterator>::value_type;
+		static_assert( std::is_same< Coordinate, typename std::decay< decltype( *std::declval<value_type const &>().begin() ) >::type >::value, "kdtree::make_kdtree( RandomAccessIterator begin, RandomAccessIterator end, split_skeleton<Coordinate> & skeleton ) only accepts skeletons of the coordinate type of the passed points.\n" );
+		static_assert( static_dimensionality<value_type>::value <= std::numeric_limits<std::uint16_t>::max() + std::size_t( 1 ), "kdtree::make_kdtree( RandomAccessIterator begin, RandomAccessIterator end, split_skeleton<Coordinate> & skeleton ) stores split dimensions in 16 bits.\n" );
+		build_storage<RandomAccessIterator> storage( begin, end );
+		make_kdtree_helper( storage.begin(), storage.end(), 0, skeleton.leaf().value(), median_split(), storage.projection(), prepare_skeleton( end - begin, skeleton ) );
+		storage.commit();
+		make_skeleton( begin, end, skeleton );
+	}
+
+	template <class RandomAccessIterator, class Layout = kdtree::leaf_size, class = if_tree_layout<Layout>>
+	void make_kdtree( kdtree::sequential_policy, RandomAccessIterator begin, RandomAccessIterator end, Layout layout = Layout() ) {
+		make_kdtree( begin, end, layout );
+	}
+
+	template <class RandomAccessIterator, class Coordinate>
+	void make_kdtree( kdtree::sequential_policy, RandomAccessIterator begin, RandomAccessIterator end, kdtree::split_skeleton<Coordinate> & skeleton ) {
+		make_kdtree( begin, end, skeleton );
+	}
+
+	template <class RandomAccessIterator>
+	void make_kdtree( kdtree::parallel_policy const & policy, RandomAccessIterator begin, RandomAccessIterator end, kdtree::leaf_size leaf = kdtree::leaf_size() ) {
+		using iterator_tag = typename std::iterator_traits<RandomAccessIterator>::iterator_category;
+		static_assert( std::is_convertible< iterator_tag, std::random_access_iterator_tag >::value, "kdtree::make_kdtree( Policy policy, RandomAccessIterator begin, RandomAccessIterator end ) only accepts random access iterators or raw pointers to an array.\n" );
+		build_storage<RandomAccessIterator> storage( begin, end );
+		kdtree::with_thread_pool( policy, [ & ]( kdtree::thread_pool & pool ) { make_kdtree_parallel_helper( pool, policy.cutoff(), storage.begin(), storage.end(), 0, leaf.value(), median_split(), storage.projection(), 1 ); } );
+		storage.commit();
+	}
+
+	// the permutation into breadth-first order runs on the calling thread
+	template <class RandomAccessIterator>
+	void make_kdtree( kdtree::parallel_policy const & policy, RandomAccessIterator begin, RandomAccessIterator end, kdtree::eytzinger_layout ) {
+		using iterator_tag = typename std::iterator_traits<RandomAccessIterator>::iterator_category;
+		static_assert( std::is_convertible< iterator_tag, std::random_access_iterator_tag >::value, "kdtree::make_kdtree( Policy policy, RandomAccessIterator begin, RandomAccessIterator end, eytzinger_layout ) only accepts random access iterators or raw pointers to an array.\n" );
+		build_storage<RandomAccessIterator> storage( begin, end );
+		kdtree::with_thread_pool( policy, [ & ]( kdtree::thread_pool & pool ) { make_kdtree_parallel_helper( pool, policy.cutoff(), storage.begin(), storage.end(), 0, 1, complete_split(), storage.projection(), 1 ); } );
+		breadth_first_permute( storage.begin(), storage.end() );
+		storage.commit();
+	}
+
+	// the skeleton is filled in a single pass over the medians on the calling thread
+	template <class RandomAccessIterator, class Coordinate>
+	void make_kdtree( kdtree::parallel_policy const & policy, RandomAccessIterator begin, RandomAccessIterator end, kdtree::split_skeleton<Coordinate> & skeleton ) {
+		using value_type = typename std::iterator_traits<RandomAccessIterator>::value_type;
+		static_assert( std::is_same< Coordinate, typename std::decay< decltype( *std::declval<value_type const &>().begin() ) >::type >::value, "kdtree::make_kdtree( Policy policy, RandomAccessIterator begin, RandomAccessIterator end, split_skeleton<Coordinate> & skeleton ) only accepts skeletons of the coordinate type of the passed points.\n" );
+		static_assert( static_dimensionality<value_type>::value <= std::numeric_limits<std::uint16_t>::max() + std::size_t( 1 ), "kdtree::make_kdtree( Policy policy, RandomAccessIterator begin, RandomAccessIterator end, split_skeleton<Coordinate> & skeleton ) stores split dimensions in 16 bits.\n" );
+		skeleton_dimension choose = prepare_skeleton( end - begin, skeleton );
+		build_storage<RandomAccessIterator> storage( begin, end );
+		kdtree::with_thread_pool( policy, [ & ]( kdtree::thread_pool & pool ) { make_kdtree_parallel_helper( pool, policy.cutoff(), storage.begin(), storage.end(), 0, skeleton.leaf().value(), median_split(), storage.projection(), 1, choose ); } );
+		storage.commit();
+		make_skeleton( begin, end, skeleton );
+	}
+
+	template <class RandomAccessIterator, class Layout = kdtree::leaf_size, class = if_tree_layout<Layout>>
+	void print_kdtree( std::ostream & os, RandomAccessIterator begin, RandomAccessIterator end, Layout layout = Layout() ) {
+		print_kdtree_helper( os, root_node( begin, end, layout ) );
+	}
+
+	template <class RandomAccessIterator, class Point, class Layout = kdtree::leaf_size, class = if_tree_layout<Layout>>
+	RandomAccessIterator search_kdtree( RandomAccessIterator begin, RandomAccessIterator end, Point const & point, Layout layout = Layout() ) {
 		using iterator_tag = typename std::iterator_traits<RandomAccessIterator>::iterator_category;
 		using value_type = typename std::iterator_traits<RandomAccessIterator>::value_type;
 		static_assert( std::is_convertible< iterator_tag, std::random_access_iterator_tag >::value, "kdtree::search_kdtree( RandomAccessIterator begin, RandomAccessIterator end, Point const & point ) only accepts random access iterators or raw pointers to an array.\n" );
 		static_assert( std::is_convertible< Point, value_type >::value, "kdtree::search_kdtree( RandomAccessIterator begin, RandomAccessIterator end, Point point ) only accepts Point types that are convertible to the value_type of the passed RandomAccessIterators.\n" );
 //		using point_iterator_tag = typename std::iterator_traits<Point>::iterator_category;
 //		static_assert( std::is_convertible< point_iterator_tag, std::random_access_iterator_tag >::value, "kdtree::search_kdtree( RandomAccessIterator begin, RandomAccessIterator end, Point const & point ) only accepts Point types that offer random access iterators or raw pointers to an array.\n" );
-		RandomAccessIterator it = nnsearch_kdtree( begin, end, point );
-		return point == *it ? it : end;
+		RandomAccessIterator it = nnsearch_kdtree( begin, end, point, layout );
+		return it != end && point == *it ? it : end;
 	}
 
-	template <class RandomAccessIterator, class Point>
-	RandomAccessIterator nnsearch_kdtree( RandomAccessIterator begin, RandomAccessIterator end, Point const & point ) {
+	/*
+	The nearest neighbor, k nearest neighbor and radius searches, and their batch forms, take an
+	optional distance metric from metric.hpp after the layout; the default is Euclidean.
+	*/
+	template <class RandomAccessIterator, class Point, class Layout = kdtree::leaf_size, class Metric = kdtree::euclidean_metric, class = if_tree_layout<Layout>>
+	RandomAccessIterator nnsearch_kdtree( RandomAccessIterator begin, RandomAccessIterator end, Point const & point, Layout layout = Layout(), Metric metric = Metric() ) {
 		using iterator_tag = typename std::iterator_traits<RandomAccessIterator>::iterator_category;
 		using value_type = typename std::iterator_traits<RandomAccessIterator>::value_type;
 		static_assert( std::is_convertible< iterator_tag, std::random_access_iterator_tag >::value, "kdtree::nnsearch_kdtree( RandomAccessIterator begin, RandomAccessIterator end, Point const & point ) only accepts random access iterators or raw pointers to an array.\n" );
 		static_assert( std::is_convertible< Point, value_type >::value, "kdtree::nnsearch_kdtree( RandomAccessIterator begin, RandomAccessIterator end, Point point ) only accepts Point types that are convertible to the value_type of the passed RandomAccessIterators.\n" );
-		distance_type distance = std::numeric_limits<distance_type>::max();
+		distance_type<Point> distance = std::numeric_limits<distance_type<Point>>::max();
 		RandomAccessIterator location = end;
-		nnsearch_kdtree_helper( begin, end, point, 0, distance, location );
+		axis_terms<Point> terms = make_axis_terms( point );
+		auto && stats = layout_stats( layout );
+		stats.record_query();
+		nnsearch_kdtree_helper( search_root( root_node( begin, end, layout ), point ), point, metric, distance, location, 0, terms, stats );
+		stats.record_results( location != end ? 1 : 0 );
 		return location;
 	}
 
-	template <class RandomAccessIterator, class Point>
-	std::vector<RandomAccessIterator> nnsearch_kdtree( RandomAccessIterator begin, RandomAccessIterator end, Point const & point, std::size_t k ) {
+	/*
+	Returns the min( k, end - begin ) nearest points in order of increasing distance.
+	*/
+	template <class RandomAccessIterator, class Point, class Layout = kdtree::leaf_size, class Metric = kdtree::euclidean_metric, class = if_tree_layout<Layout>>
+	std::vector<RandomAccessIterator> nnsearch_kdtree( RandomAccessIterator begin, RandomAccessIterator end, Point const & point, std::size_t k, Layout layout = Layout(), Metric metric = Metric() ) {
 		using iterator_tag = typename std::iterator_traits<RandomAccessIterator>::iterator_category;
 		using value_type = typename std::iterator_traits<RandomAccessIterator>::value_type;
 		static_assert( std::is_convertible< iterator_tag, std::random_access_iterator_tag >::value, "kdtree::nnsearch_kdtree( RandomAccessIterator begin, RandomAccessIterator end, Point const & point, std::size_t k ) only accepts random access iterators or raw pointers to an array.\n" );
 		static_assert( std::is_convertible< Point, value_type >::value, "kdtree::nnsearch_kdtree( RandomAccessIterator begin, RandomAccessIterator end, Point point, std::size_t k ) only accepts Point types that are convertible to the value_type of the passed RandomAccessIterators.\n" );
-		using pq_data_package = typename std::pair<distance_type,RandomAccessIterator>;
-		auto pq_compare = []( pq_data_package const & lhs, pq_data_package const & rhs ) { return lhs.first < rhs.first; };
-		using vector = std::vector<pq_data_package>;
-		using pq_type = std::priority_queue< pq_data_package, vector, decltype(pq_compare) >;
-		vector pq_storage;
-		pq_storage.reserve( k );
-		pq_data_package const * cheap_access = &pq_storage[0];
-		pq_type pq( pq_compare, std::move( pq_storage ) );
-		pq.emplace( std::numeric_limits<distance_type>::max(), end );
-		nnsearch_kdtree_helper( begin, end, point, k, 0, pq );
-//		std::cerr << "FINAL pq.size(): " << pq.size() << " - FINAL pq.top().first: " << pq.top().first << "\n";
-//		std::cerr << "pq_storage.size(): " << pq_storage.size() << "\n";
 		std::vector<RandomAccessIterator> result;
-		result.reserve( pq.size() );
-		std::transform( cheap_access, cheap_access + pq.size(), std::back_inserter( result ), []( auto const & val ) { return val.second; } );
+		result.reserve( std::min<std::size_t>( k, end - begin ) );
+		output_visitor< std::back_insert_iterator< std::vector<RandomAccessIterator> > > visit( std::back_inserter( result ) );
+		nnsearch_kdtree_visit( begin, end, point, k, visit, layout, metric );
 		return result;
 	}
 
-	template <class RandomAccessIterator, class Point>
-	std::vector<RandomAccessIterator> rangequery_kdtree( RandomAccessIterator begin, RandomAccessIterator end, Point const & min, Point const & max ) {
+	template <class RandomAccessIterator, class Point, class Visitor, class Layout = kdtree::leaf_size, class Metric = kdtree::euclidean_metric, class = if_tree_layout<Layout>, class = if_query_visitor<Visitor,RandomAccessIterator>>
+	bool nnsearch_kdtree( RandomAccessIterator begin, RandomAccessIterator end, Point const & point, std::size_t k, Visitor visit, Layout layout = Layout(), Metric metric = Metric() ) {
+		return nnsearch_kdtree_visit( begin, end, point, k, visit, layout, metric );
+	}
+
+	template <class RandomAccessIterator, class Point, class OutputIterator, class Layout = kdtree::leaf_size, class Metric = kdtree::euclidean_metric, class = if_tree_layout<Layout>, class = if_query_output<OutputIterator,RandomAccessIterator>>
+	OutputIterator nnsearch_kdtree( RandomAccessIterator begin, RandomAccessIterator end, Point const & point, std::size_t k, OutputIterator output, Layout layout = Layout(), Metric metric = Metric() ) {
+		output_visitor<OutputIterator> visit( output );
+		nnsearch_kdtree_visit( begin, end, point, k, visit, layout, metric );
+		return visit.output();
+	}
+
+	/*
+	Approximate k nearest neighbors by best-bin-first search; see kdtree::approximation. With the
+	default approximation, the results equal those of the exact search above.
+	*/
+	template <class RandomAccessIterator, class Point, class Layout = kdtree::leaf_size, class Metric = kdtree::euclidean_metric, class = if_tree_layout<Layout>>
+	std::vector<RandomAccessIterator> nnsearch_kdtree( RandomAccessIterator begin, RandomAccessIterator end, Point const & point, std::size_t k, kdtree::approximation approx, Layout layout = Layout(), Metric metric = Metric() ) {
+		using iterator_tag = typename std::iterator_traits<RandomAccessIterator>::iterator_category;
+		using value_type = typename std::iterator_traits<RandomAccessIterator>::value_type;
+		static_assert( std::is_convertible< iterator_tag, std::random_access_iterator_tag >::value, "kdtree::nnsearch_kdtree( RandomAccessIterator begin, RandomAccessIterator end, Point const & point, std::size_t k, approximation approx ) only accepts random access iterators or raw pointers to an array.\n" );
+		static_assert( std::is_convertible< Point, value_type >::value, "kdtree::nnsearch_kdtree( RandomAccessIterator begin, RandomAccessIterator end, Point point, std::size_t k, approximation approx ) only accepts Point types that are convertible to the value_type of the passed RandomAccessIterators.\n" );
+		std::vector<RandomAccessIterator> result;
+		result.reserve( std::min<std::size_t>( k, end - begin ) );
+		output_visitor< std::back_insert_iterator< std::vector<RandomAccessIterator> > > visit( std::back_inserter( result ) );
+		nnsearch_kdtree_visit( begin, end, point, k, approx, visit, layout, metric );
+		return result;
+	}
+
+	template <class RandomAccessIterator, class Point, class Visitor, class Layout = kdtree::leaf_size, class Metric = kdtree::euclidean_metric, class = if_tree_layout<Layout>, class = if_query_visitor<Visitor,RandomAccessIterator>>
+	bool nnsearch_kdtree( RandomAccessIterator begin, RandomAccessIterator end, Point const & point, std::size_t k, kdtree::approximation approx, Visitor visit, Layout layout = Layout(), Metric metric = Metric() ) {
+		return nnsearch_kdtree_visit( begin, end, point, k, approx, visit, layout, metric );
+	}
+
+	template <class RandomAccessIterator, class Point, class OutputIterator, class Layout = kdtree::leaf_size, class Metric = kdtree::euclidean_metric, class = if_tree_layout<Layout>, class = if_query_output<OutputIterator,RandomAccessIterator>>
+	OutputIterator nnsearch_kdtree( RandomAccessIterator begin, RandomAccessIterator end, Point const & point, std::size_t k, kdtree::approximation approx, OutputIterator output, Layout layout = Layout(), Metric metric = Metric() ) {
+		output_visitor<OutputIterator> visit( output );
+		nnsearch_kdtree_visit( begin, end, point, k, approx, visit, layout, metric );
+		return visit.output();
+	}
+
+	template <class RandomAccessIterator, class Point, class Layout = kdtree::leaf_size, class = if_tree_layout<Layout>>
+	std::vector<RandomAccessIterator> rangequery_kdtree( RandomAccessIterator begin, RandomAccessIterator end, Point const & min, Point const & max, Layout layout = Layout() ) {
 		std::vector<RandomAccessIterator> locations;
-		rangequery_kdtree_helper( begin, end, min, max, 0, locations );
+		box_cell<Point> cell( min, max );
+		collect_report<RandomAccessIterator> report( locations );
+		auto && stats = layout_stats( layout );
+		stats.record_query();
+		rangequery_kdtree_helper( search_root( root_node( begin, end, layout ), min ), min, max, cell, report, stats );
 		return locations;
 	}
 
-	template <class RandomAccessIterator, class Point>
-	std::vector<RandomAccessIterator> radiusquery_kdtree( RandomAccessIterator begin, RandomAccessIterator end, Point const & point, double radius ) {
+	/*
+	Range, radius and k nearest neighbor searches also take, before the layout, either an output
+	iterator to write the found iterators to, which they return advanced, or a visitor to call with
+	each of them, in the order the vector forms would hold them. A visitor returning bool can end the
+	search by returning false, in which case the search returns false as well.
+	*/
+	template <class RandomAccessIterator, class Point, class Visitor, class Layout = kdtree::leaf_size, class = if_tree_layout<Layout>, class = if_query_visitor<Visitor,RandomAccessIterator>>
+	bool rangequery_kdtree( RandomAccessIterator begin, RandomAccessIterator end, Point const & min, Point const & max, Visitor visit, Layout layout = Layout() ) {
+		return rangequery_kdtree_visit( begin, end, min, max, visit, layout );
+	}
+
+	template <class RandomAccessIterator, class Point, class OutputIterator, class Layout = kdtree::leaf_size, class = if_tree_layout<Layout>, class = if_query_output<OutputIterator,RandomAccessIterator>>
+	OutputIterator rangequery_kdtree( RandomAccessIterator begin, RandomAccessIterator end, Point const & min, Point const & max, OutputIterator output, Layout layout = Layout() ) {
+		output_visitor<OutputIterator> visit( output );
+		rangequery_kdtree_visit( begin, end, min, max, visit, layout );
+		return visit.output();
+	}
+
+	template <class RandomAccessIterator, class Point, class Layout = kdtree::leaf_size, class Metric = kdtree::euclidean_metric, class = if_tree_layout<Layout>>
+	std::vector<RandomAccessIterator> radiusquery_kdtree( RandomAccessIterator begin, RandomAccessIterator end, Point const & point, double radius, Layout layout = Layout(), Metric metric = Metric() ) {
 		std::vector<RandomAccessIterator> locations;
+		auto && stats = layout_stats( layout );
+		stats.record_query();
 		if( radius > 0 ) {
-			auto squared_radius = radius * radius;
-			// compute points for range query
-			if( std::is_integral<typename Point::coordinate_type>::value ) {
-				radius = std::ceil( radius );
-			}
-			Point min( point );
-			Point max( point );
-			for( auto & val : min ) {
-				val -= radius;
-			}
-			for( auto & val : max ) {
-				val += radius;
-			}
-			locations = rangequery_kdtree( begin, end, min, max );
-			auto postlast = std::remove_if( locations.begin(), locations.end(), [&point,squared_radius](auto const & p) { return kdtree::squared_euclidean_distance( point, *p ) > squared_radius; } );
-			// resize the container to exclude removed elements
-			locations.resize( postlast - locations.cbegin() );
+			axis_terms<Point> terms = make_axis_terms( point );
+			ball_cell<Point> cell( point.dimensionality() );
+			collect_report<RandomAccessIterator> report( locations );
+			radiusquery_kdtree_helper( search_root( root_node( begin, end, layout ), point ), point, metric.reduce( static_cast< distance_type<Point> >( radius ) ), metric, 0, terms, cell, report, stats );
+		}
+		return locations;
+	}
+
+	template <class RandomAccessIterator, class Point, class Visitor, class Layout = kdtree::leaf_size, class Metric = kdtree::euclidean_metric, class = if_tree_layout<Layout>, class = if_query_visitor<Visitor,RandomAccessIterator>>
+	bool radiusquery_kdtree( RandomAccessIterator begin, RandomAccessIterator end, Point const & point, double radius, Visitor visit, Layout layout = Layout(), Metric metric = Metric() ) {
+		return radiusquery_kdtree_visit( begin, end, point, radius, visit, layout, metric );
+	}
+
+	template <class RandomAccessIterator, class Point, class OutputIterator, class Layout = kdtree::leaf_size, class Metric = kdtree::euclidean_metric, class = if_tree_layout<Layout>, class = if_query_output<OutputIterator,RandomAccessIterator>>
+	OutputIterator radiusquery_kdtree( RandomAccessIterator begin, RandomAccessIterator end, Point const & point, double radius, OutputIterator output, Layout layout = Layout(), Metric metric = Metric() ) {
+		output_visitor<OutputIterator> visit( output );
+		radiusquery_kdtree_visit( begin, end, point, radius, visit, layout, metric );
+		return visit.output();
+	}
+
+	/*
+	Early exits from the radius search. radiusquery_kdtree_first returns the first n points the
+	search finds, which are the first n of those radiusquery_kdtree returns, and
+	radiusquery_kdtree_any whether there is a point within the radius at all. Both stop descending
+	as soon as they have their answer, and radiusquery_kdtree_any accepts a subtree lying inside the
+	ball without looking at any of its points.
+	*/
+	template <class RandomAccessIterator, class Point, class Layout = kdtree::leaf_size, class Metric = kdtree::euclidean_metric, class = if_tree_layout<Layout>>
+	std::vector<RandomAccessIterator> radiusquery_kdtree_first( RandomAccessIterator begin, RandomAccessIterator end, Point const & point, double radius, std::size_t n, Layout layout = Layout(), Metric metric = Metric() ) {
+		std::vector<RandomAccessIterator> locations;
+		if( n > 0 ) {
+			auto visit = [ &locations, n ]( RandomAccessIterator it ) { locations.push_back( it ); return locations.size() < n; };
+			radiusquery_kdtree_visit( begin, end, point, radius, visit, layout, metric );
 		}
 		return locations;
 	}
-		
+
+	template <class RandomAccessIterator, class Point, class Layout = kdtree::leaf_size, class Metric = kdtree::euclidean_metric, class = if_tree_layout<Layout>>
+	bool radiusquery_kdtree_any( RandomAccessIterator begin, RandomAccessIterator end, Point const & point, double radius, Layout layout = Layout(), Metric metric = Metric() ) {
+		any_report report;
+		auto && stats = layout_stats( layout );
+		stats.record_query();
+		if( radius > 0 ) {
+			axis_terms<Point> terms = make_axis_terms( point );
+			ball_cell<Point> cell( point.dimensionality() );
+			radiusquery_kdtree_helper( search_root( root_node( begin, end, layout ), point ), point, metric.reduce( static_cast< distance_type<Point> >( radius ) ), metric, 0, terms, cell, report, stats );
+		}
+		return report.found();
+	}
+
+	/*
+	Count and aggregate queries report the same points as the range and radius queries without
+	collecting them. Subtrees inside the query region are counted by their size, without visiting
+	their points, and neither query allocates.
+	*/
+	template <class RandomAccessIterator, class Point, class Layout = kdtree::leaf_size, class = if_tree_layout<Layout>>
+	std::size_t rangecount_kdtree( RandomAccessIterator begin, RandomAccessIterator end, Point const & min, Point const & max, Layout layout = Layout() ) {
+		box_cell<Point> cell( min, max );
+		count_report report;
+		auto && stats = layout_stats( layout );
+		stats.record_query();
+		rangequery_kdtree_helper( search_root( root_node( begin, end, layout ), min ), min, max, cell, report, stats );
+		return report.count();
+	}
+
+	template <class RandomAccessIterator, class Point, class Layout = kdtree::leaf_size, class Metric = kdtree::euclidean_metric, class = if_tree_layout<Layout>>
+	std::size_t radiuscount_kdtree( RandomAccessIterator begin, RandomAccessIterator end, Point const & point, double radius, Layout layout = Layout(), Metric metric = Metric() ) {
+		count_report report;
+		auto && stats = layout_stats( layout );
+		stats.record_query();
+		if( radius > 0 ) {
+			axis_terms<Point> terms = make_axis_terms( point );
+			ball_cell<Point> cell( point.dimensionality() );
+			radiusquery_kdtree_helper( search_root( root_node( begin, end, layout ), point ), point, metric.reduce( static_cast< distance_type<Point> >( radius ) ), metric, 0, terms, cell, report, stats );
+		}
+		return report.count();
+	}
+
+	template <class RandomAccessIterator, class Point, class Layout = kdtree::leaf_size, class = if_tree_layout<Layout>>
+	kdtree::point_aggregate< static_dimensionality<Point>::value > rangeaggregate_kdtree( RandomAccessIterator begin, RandomAccessIterator end, Point const & min, Point const & max, Layout layout = Layout() ) {
+		box_cell<Point> cell( min, max );
+		aggregate_report< static_dimensionality<Point>::value > report( min.dimensionality() );
+		auto && stats = layout_stats( layout );
+		stats.record_query();
+		rangequery_kdtree_helper( search_root( root_node( begin, end, layout ), min ), min, max, cell, report, stats );
+		return report.aggregate();
+	}
+
+	template <class RandomAccessIterator, class Point, class Layout = kdtree::leaf_size, class Metric = kdtree::euclidean_metric, class = if_tree_layout<Layout>>
+	kdtree::point_aggregate< static_dimensionality<Point>::value > radiusaggregate_kdtree( RandomAccessIterator begin, RandomAccessIterator end, Point const & point, double radius, Layout layout = Layout(), Metric metric = Metric() ) {
+		aggregate_report< static_dimensionality<Point>::value > report( point.dimensionality() );
+		auto && stats = layout_stats( layout );
+		stats.record_query();
+		if( radius > 0 ) {
+			axis_terms<Point> terms = make_axis_terms( point );
+			ball_cell<Point> cell( point.dimensionality() );
+			radiusquery_kdtree_helper( search_root( root_node( begin, end, layout ), point ), point, metric.reduce( static_cast< distance_type<Point> >( radius ) ), metric, 0, terms, cell, report, stats );
+		}
+		return report.aggregate();
+	}
+
+	/*
+	Batch queries. Queries are spread across the threads of the policy and every thread reuses its
+	own scratch storage, so no allocation happens per query. Single nearest neighbor results are
+	written as one index per query (end - begin for an empty tree). All other results are written in
+	CSR form: the results of query i are indices[ offsets[ i ] ] through indices[ offsets[ i + 1 ] ],
+	where offsets must have room for one more element than there are queries and indices is resized
+	as needed, so passing the same vector to successive batches reuses its capacity.
+	*/
+	template <class RandomAccessIterator, class QueryIterator, class ResultIterator, class Layout = kdtree::leaf_size, class Metric = kdtree::euclidean_metric, class = if_tree_layout<Layout>>
+	void nnsearch_kdtree_batch( kdtree::parallel_policy const & policy, RandomAccessIterator begin, RandomAccessIterator end, QueryIterator first, QueryIterator last, ResultIterator results, Layout layout = Layout(), Metric metric = Metric() ) {
+		using iterator_tag = typename std::iterator_traits<RandomAccessIterator>::iterator_category;
+		using query_iterator_tag = typename std::iterator_traits<QueryIterator>::iterator_category;
+		static_assert( std::is_convertible< iterator_tag, std::random_access_iterator_tag >::value, "kdtree::nnsearch_kdtree_batch( Policy policy, RandomAccessIterator begin, RandomAccessIterator end, QueryIterator first, QueryIterator last, ResultIterator results ) only accepts random access iterators or raw pointers to an array.\n" );
+		static_assert( std::is_convertible< query_iterator_tag, std::random_access_iterator_tag >::value, "kdtree::nnsearch_kdtree_batch( Policy policy, RandomAccessIterator begin, RandomAccessIterator end, QueryIterator first, QueryIterator last, ResultIterator results ) only accepts random access query iterators or raw pointers to an array.\n" );
+		std::size_t count = last - first;
+		std::size_t const block_size = 64;
+		std::size_t block_count = (count + block_size - 1) / block_size;
+		using point_type = typename std::iterator_traits<QueryIterator>::value_type;
+		kdtree::with_thread_pool( policy, [ & ]( kdtree::thread_pool & pool ) {
+					std::size_t workers = std::min( pool.concurrency(), block_count );
+					std::vector< stats_type<Layout> > stats( workers );
+					std::atomic<std::size_t> next_block( 0 );
+					{
+						kdtree::task_group group( pool );
+						for( std::size_t t = 0; t < workers; ++t ) {
+							group.run( [ &, t ]() {
+										for( std::size_t block = next_block++; block < block_count; block = next_block++ ) {
+											for( std::size_t i = block * block_size; i < std::min( count, (block + 1) * block_size ); ++i ) {
+												distance_type<point_type> distance = std::numeric_limits<distance_type<point_type>>::max();
+												RandomAccessIterator location = end;
+												axis_terms<point_type> terms = make_axis_terms<point_type>( first[ i ] );
+												stats[ t ].record_query();
+												nnsearch_kdtree_helper( search_root( root_node( begin, end, layout ), first[ i ] ), first[ i ], metric, distance, location, 0, terms, stats[ t ] );
+												stats[ t ].record_results( location != end ? 1 : 0 );
+												results[ i ] = location - begin;
+											}
+										}
+									} );
+						}
+						group.wait();
+					}
+					auto && total = layout_stats( layout );
+					for( auto const & worker : stats ) {
+						total.merge( worker );
+					}
+				} );
+	}
+
+	template <class RandomAccessIterator, class QueryIterator, class OffsetIterator, class Layout = kdtree::leaf_size, class Metric = kdtree::euclidean_metric, class = if_tree_layout<Layout>>
+	void nnsearch_kdtree_batch( kdtree::parallel_policy const & policy, RandomAccessIterator begin, RandomAccessIterator end, QueryIterator first, QueryIterator last, std::size_t k, OffsetIterator offsets, std::vector<std::size_t> & indices, Layout layout = Layout(), Metric metric = Metric() ) {
+		using iterator_tag = typename std::iterator_traits<RandomAccessIterator>::iterator_category;
+		using query_iterator_tag = typename std::iterator_traits<QueryIterator>::iterator_category;
+		static_assert( std::is_convertible< iterator_tag, std::random_access_iterator_tag >::value, "kdtree::nnsearch_kdtree_batch( Policy policy, RandomAccessIterator begin, RandomAccessIterator end, QueryIterator first, QueryIterator last, std::size_t k, OffsetIterator offsets, std::vector<std::size_t> & indices ) only accepts random access iterators or raw pointers to an array.\n" );
+		static_assert( std::is_convertible< query_iterator_tag, std::random_access_iterator_tag >::value, "kdtree::nnsearch_kdtree_batch( Policy policy, RandomAccessIterator begin, RandomAccessIterator end, QueryIterator first, QueryIterator last, std::size_t k, OffsetIterator offsets, std::vector<std::size_t> & indices ) only accepts random access query iterators or raw pointers to an array.\n" );
+		using point_type = typename std::iterator_traits<QueryIterator>::value_type;
+		using pq_data_package = typename std::pair<distance_type<point_type>,RandomAccessIterator>;
+		auto pq_compare = []( pq_data_package const & lhs, pq_data_package const & rhs ) { return lhs.first < rhs.first; };
+		auto query = [ & ]( std::size_t i, std::vector<pq_data_package> & storage, stats_type<Layout> & stats, std::vector<std::size_t> & results ) {
+					vector_heap<pq_data_package,decltype(pq_compare)> pq( storage, pq_compare );
+					axis_terms<point_type> terms = make_axis_terms<point_type>( first[ i ] );
+					if( k > 0 ) {
+						nnsearch_kdtree_helper( search_root( root_node( begin, end, layout ), first[ i ] ), first[ i ], k, metric, pq, 0, terms, stats );
+					}
+					stats.record_results( storage.size() );
+					std::sort_heap( storage.begin(), storage.end(), pq_compare );
+					for( auto const & val : storage ) {
+						results.push_back( val.second - begin );
+					}
+				};
+		batch_query_helper<std::vector<pq_data_package>>( policy, last - first, query, offsets, indices, layout );
+	}
+
+	template <class RandomAccessIterator, class QueryIterator, class OffsetIterator, class Layout = kdtree::leaf_size, class Metric = kdtree::euclidean_metric, class = if_tree_layout<Layout>>
+	void nnsearch_kdtree_batch( kdtree::parallel_policy const & policy, RandomAccessIterator begin, RandomAccessIterator end, QueryIterator first, QueryIterator last, std::size_t k, kdtree::approximation approx, OffsetIterator offsets, std::vector<std::size_t> & indices, Layout layout = Layout(), Metric metric = Metric() ) {
+		using iterator_tag = typename std::iterator_traits<RandomAccessIterator>::iterator_category;
+		using query_iterator_tag = typename std::iterator_traits<QueryIterator>::iterator_category;
+		static_assert( std::is_convertible< iterator_tag, std::random_access_iterator_tag >::value, "kdtree::nnsearch_kdtree_batch( Policy policy, RandomAccessIterator begin, RandomAccessIterator end, QueryIterator first, QueryIterator last, std::size_t k, approximation approx, OffsetIterator offsets, std::vector<std::size_t> & indices ) only accepts random access iterators or raw pointers to an array.\n" );
+		static_assert( std::is_convertible< query_iterator_tag, std::random_access_iterator_tag >::value, "kdtree::nnsearch_kdtree_batch( Policy policy, RandomAccessIterator begin, RandomAccessIterator end, QueryIterator first, QueryIterator last, std::size_t k, approximation approx, OffsetIterator offsets, std::vector<std::size_t> & indices ) only accepts random access query iterators or raw pointers to an array.\n" );
+		using point_type = typename std::iterator_traits<QueryIterator>::value_type;
+		using pq_data_package = typename std::pair<distance_type<point_type>,RandomAccessIterator>;
+		using node_type = decltype( root_node( begin, end, layout ) );
+		using scratch_type = std::pair< std::vector<pq_data_package>, best_bin_first_scratch< node_type, distance_type<point_type> > >;
+		auto pq_compare = []( pq_data_package const & lhs, pq_data_package const & rhs ) { return lhs.first < rhs.first; };
+		auto query = [ & ]( std::size_t i, scratch_type & scratch, stats_type<Layout> & stats, std::vector<std::size_t> & results ) {
+					vector_heap<pq_data_package,decltype(pq_compare)> pq( scratch.first, pq_compare );
+					if( k > 0 ) {
+						approximate_nnsearch_kdtree_helper( root_node( begin, end, layout ), first[ i ], k, approx, metric, pq, scratch.second, stats );
+					}
+					stats.record_results( scratch.first.size() );
+					std::sort_heap( scratch.first.begin(), scratch.first.end(), pq_compare );
+					for( auto const & val : scratch.first ) {
+						results.push_back( val.second - begin );
+					}
+				};
+		batch_query_helper<scratch_type>( policy, last - first, query, offsets, indices, layout );
+	}
+
+	template <class RandomAccessIterator, class QueryIterator, class OffsetIterator, class Layout = kdtree::leaf_size, class = if_tree_layout<Layout>>
+	void rangequery_kdtree_batch( kdtree::parallel_policy const & policy, RandomAccessIterator begin, RandomAccessIterator end, QueryIterator min_first, QueryIterator min_last, QueryIterator max_first, OffsetIterator offsets, std::vector<std::size_t> & indices, Layout layout = Layout() ) {
+		using iterator_tag = typename std::iterator_traits<RandomAccessIterator>::iterator_category;
+		using query_iterator_tag = typename std::iterator_traits<QueryIterator>::iterator_category;
+		static_assert( std::is_convertible< iterator_tag, std::random_access_iterator_tag >::value, "kdtree::rangequery_kdtree_batch( Policy policy, RandomAccessIterator begin, RandomAccessIterator end, QueryIterator min_first, QueryIterator min_last, QueryIterator max_first, OffsetIterator offsets, std::vector<std::size_t> & indices ) only accepts random access iterators or raw pointers to an array.\n" );
+		static_assert( std::is_convertible< query_iterator_tag, std::random_access_iterator_tag >::value, "kdtree::rangequery_kdtree_batch( Policy policy, RandomAccessIterator begin, RandomAccessIterator end, QueryIterator min_first, QueryIterator min_last, QueryIterator max_first, OffsetIterator offsets, std::vector<std::size_t> & indices ) only accepts random access query iterators or raw pointers to an array.\n" );
+		auto query = [ & ]( std::size_t i, std::vector<RandomAccessIterator> & locations, stats_type<Layout> & stats, std::vector<std::size_t> & results ) {
+					using point_type = typename std::iterator_traits<QueryIterator>::value_type;
+					// the cell keeps references, and rows of flat storage are dereferenced as temporaries
+					point_type const & min = min_first[ i ];
+					point_type const & max = max_first[ i ];
+					box_cell<point_type> cell( min, max );
+					collect_report<RandomAccessIterator> report( locations );
+					locations.clear();
+					rangequery_kdtree_helper( search_root( root_node( begin, end, layout ), min ), min, max, cell, report, stats );
+					for( auto location : locations ) {
+						results.push_back( location - begin );
+					}
+				};
+		batch_query_helper<std::vector<RandomAccessIterator>>( policy, min_last - min_first, query, offsets, indices, layout );
+	}
+
+	template <class RandomAccessIterator, class QueryIterator, class OffsetIterator, class Layout = kdtree::leaf_size, class Metric = kdtree::euclidean_metric, class = if_tree_layout<Layout>>
+	void radiusquery_kdtree_batch( kdtree::parallel_policy const & policy, RandomAccessIterator begin, RandomAccessIterator end, QueryIterator first, QueryIterator last, double radius, OffsetIterator offsets, std::vector<std::size_t> & indices, Layout layout = Layout(), Metric metric = Metric() ) {
+		using iterator_tag = typename std::iterator_traits<RandomAccessIterator>::iterator_category;
+		using query_iterator_tag = typename std::iterator_traits<QueryIterator>::iterator_category;
+		using point_type = typename std::iterator_traits<QueryIterator>::value_type;
+		static_assert( std::is_convertible< iterator_tag, std::random_access_iterator_tag >::value, "kdtree::radiusquery_kdtree_batch( Policy policy, RandomAccessIterator begin, RandomAccessIterator end, QueryIterator first, QueryIterator last, double radius, OffsetIterator offsets, std::vector<std::size_t> & indices ) only accepts random access iterators or raw pointers to an array.\n" );
+		static_assert( std::is_convertible< query_iterator_tag, std::random_access_iterator_tag >::value, "kdtree::radiusquery_kdtree_batch( Policy policy, RandomAccessIterator begin, RandomAccessIterator end, QueryIterator first, QueryIterator last, double radius, OffsetIterator offsets, std::vector<std::size_t> & indices ) only accepts random access query iterators or raw pointers to an array.\n" );
+		distance_type<point_type> reduced_radius = metric.reduce( static_cast< distance_type<point_type> >( radius ) );
+		auto query = [ & ]( std::size_t i, std::vector<RandomAccessIterator> & locations, stats_type<Layout> & stats, std::vector<std::size_t> & results ) {
+					if( radius > 0 ) {
+						point_type const & point = first[ i ];
+						axis_terms<point_type> terms = make_axis_terms( point );
+						ball_cell<point_type> cell( point.dimensionality() );
+						collect_report<RandomAccessIterator> report( locations );
+						locations.clear();
+						radiusquery_kdtree_helper( search_root( root_node( begin, end, layout ), point ), point, reduced_radius, metric, 0, terms, cell, report, stats );
+						for( auto location : locations ) {
+							results.push_back( location - begin );
+						}
+					}
+				};
+		batch_query_helper<std::vector<RandomAccessIterator>>( policy, last - first, query, offsets, indices, layout );
+	}
+
 }
 
 #endif
@@ -0,0 +1,123 @@
+#ifndef KDTREE_METRIC_HPP
+#define KDTREE_METRIC_HPP
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <stdexcept>
+
+/*
+Distance metrics for the k-d tree searches. A metric is a small policy type that the searches take
+by value and call with the coordinate offset along a single axis, so that every call can be
+inlined. Searches never compare true distances, only reduced ones that order points the same way
+and are cheaper to compute: the squared distance for the Euclidean metrics, the sum of p-th powers
+of the offsets for Minkowski metrics. Each metric provides
+
+	axis( offset, dim )                  the reduced contribution of an offset along axis dim
+	accumulate( reduced, term )          folds an axis contribution into a reduced distance
+	replace( reduced, old_term, term )   the reduced distance after one axis' contribution grows
+	                                     from old_term to term, used to bound the distance to a cell
+	reduce( radius )                     the reduced distance corresponding to a true distance
+*/
+
+namespace kdtree {
+
+	struct euclidean_metric {
+		template <class Distance> Distance axis( Distance offset, std::size_t ) const noexcept { return offset * offset; }
+		template <class Distance> Distance accumulate( Distance reduced, Distance term ) const noexcept { return reduced + term; }
+		template <class Distance> Distance replace( Distance reduced, Distance old_term, Distance term ) const noexcept { return reduced - old_term + term; }
+		template <class Distance> Distance reduce( Distance radius ) const noexcept { return radius * radius; }
+	};
+
+	struct manhattan_metric {
+		template <class Distance> Distance axis( Distance offset, std::size_t ) const noexcept { return offset < 0 ? -offset : offset; }
+		template <class Distance> Distance accumulate( Distance reduced, Distance term ) const noexcept { return reduced + term; }
+		template <class Distance> Distance replace( Distance reduced, Distance old_term, Distance term ) const noexcept { return reduced - old_term + term; }
+		template <class Distance> Distance reduce( Distance radius ) const noexcept { return radius; }
+	};
+
+	/*
+	The Chebyshev distance to a cell is the largest axis offset. Descending into a far child only
+	ever moves the cell boundary on the split axis away from the query, so the larger of the old
+	distance and the new axis offset is exact.
+	*/
+	struct chebyshev_metric {
+		template <class Distance> Distance axis( Distance offset, std::size_t ) const noexcept { return offset < 0 ? -offset : offset; }
+		template <class Distance> Distance accumulate( Distance reduced, Distance term ) const noexcept { return std::max( reduced, term ); }
+		template <class Distance> Distance replace( Distance reduced, Distance, Distance term ) const noexcept { return std::max( reduced, term ); }
+		template <class Distance> Distance reduce( Distance radius ) const noexcept { return radius; }
+	};
+
+	// p is a compile-time constant so that the powers unroll into multiplications
+	template <unsigned p>
+	struct minkowski_metric {
+		static_assert( p > 0, "kdtree::minkowski_metric<p> requires p >= 1.\n" );
+		template <class Distance> static Distance power( Distance base ) noexcept {
+			Distance result = base;
+			for( unsigned i = 1; i < p; ++i ) {
+				result *= base;
+			}
+			return result;
+		}
+		template <class Distance> Distance axis( Distance offset, std::size_t ) const noexcept { return power( offset < 0 ? -offset : offset ); }
+		template <class Distance> Distance accumulate( Distance reduced, Distance term ) const noexcept { return reduced + term; }
+		template <class Distance> Distance replace( Distance reduced, Distance old_term, Distance term ) const noexcept { return reduced - old_term + term; }
+		template <class Distance> Distance reduce( Distance radius ) const noexcept { return power( radius ); }
+	};
+
+	/*
+	Minkowski distance of an order chosen at runtime, which need not be an integer. Every axis costs a
+	call to std::pow, so minkowski_metric<p> stays the better choice for integral orders.
+	*/
+	class real_minkowski_metric {
+		private:
+			double _p;
+		public:
+			explicit real_minkowski_metric( double p ) : _p( p ) {
+				if( !( p >= 1 ) ) {
+					throw std::domain_error( "kdtree::real_minkowski_metric requires p >= 1" );
+				}
+			}
+			double order() const noexcept { return _p; }
+			template <class Distance> Distance axis( Distance offset, std::size_t ) const noexcept { return static_cast<Distance>( std::pow( offset < 0 ? -offset : offset, _p ) ); }
+			template <class Distance> Distance accumulate( Distance reduced, Distance term ) const noexcept { return reduced + term; }
+			template <class Distance> Distance replace( Distance reduced, Distance old_term, Distance term ) const noexcept { return reduced - old_term + term; }
+			template <class Distance> Distance reduce( Distance radius ) const noexcept { return static_cast<Distance>( std::pow( radius, _p ) ); }
+	};
+
+	/*
+	Euclidean distance with a non-negative weight applied to each squared axis offset. The weights are
+	held by value, so the metric is cheap to pass around for the small dimensionalities k-d trees suit.
+	*/
+	template <class T, std::size_t d>
+	class weighted_euclidean_metric {
+		private:
+			std::array<T,d> _weights;
+		public:
+			explicit weighted_euclidean_metric( std::array<T,d> const & weights ) noexcept : _weights( weights ) {}
+			T weight( std::size_t dim ) const noexcept { return _weights[ dim ]; }
+			template <class Distance> Distance axis( Distance offset, std::size_t dim ) const noexcept { return static_cast<Distance>( _weights[ dim ] ) * offset * offset; }
+			template <class Distance> Distance accumulate( Distance reduced, Distance term ) const noexcept { return reduced + term; }
+			template <class Distance> Distance replace( Distance reduced, Distance old_term, Distance term ) const noexcept { return reduced - old_term + term; }
+			template <class Distance> Distance reduce( Distance radius ) const noexcept { return radius * radius; }
+	};
+
+	/*
+	The reduced distance between two points under a metric. Coordinates are converted to Distance
+	before they are subtracted, so unsigned and narrow integer types cannot wrap around.
+	*/
+	template <class Distance, class Metric, class Point1, class Point2>
+	Distance reduced_distance( Metric const & metric, Point1 const & p1, Point2 const & p2 ) {
+		Distance reduced = 0;
+		auto first2 = p2.begin();
+		std::size_t dim = 0;
+		for( auto first1 = p1.begin(); first1 != p1.end(); ++first1, ++first2, ++dim ) {
+			reduced = metric.accumulate( reduced, metric.axis( static_cast<Distance>( *first1 ) - static_cast<Distance>( *first2 ), dim ) );
+		}
+		return reduced;
+	}
+
+}
+
+#endif
@@ -0,0 +1,406 @@
+#ifndef KDTREE_PARSE_HPP
+#define KDTREE_PARSE_HPP
+
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
+#include <fcntl.h>
+#include <locale.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#ifdef __APPLE__
+#include <xlocale.h>
+#endif
+#include "point.hpp"
+#include "thread_pool.hpp"
+
+/*
+Fast parsing of points from text, one point per line. A line holds the d coordinates of a point
+separated by a delimiter character or by commas, optionally enclosed in parentheses, so both the
+"(x1,x2,...)" form that operator<< writes and plain delimited columns are read. Spaces, tabs and
+carriage returns around coordinates are ignored, so a run of space or tab delimiters separates
+two coordinates once, and blank lines are skipped.
+
+The input is cut into chunks at line boundaries, and the chunks are parsed concurrently on the
+threads of a kdtree::parallel_policy. Numbers are read without streams or exceptions, and the
+global locale never changes how they are read: decimal numbers whose digits and exponent are
+small enough to be converted exactly, which is nearly all of them, are built from an integer
+mantissa and an exact power of ten, after Clinger, and only the others are handed to strtod_l in
+the C locale. Malformed input is reported once, as a std::runtime_error naming the first
+offending line.
+*/
+
+namespace {
+
+	inline bool is_blank( char c ) noexcept {
+		return c == ' ' || c == '\t' || c == '\r';
+	}
+
+	inline bool ends_token( char c, char delimiter ) noexcept {
+		return c == delimiter || c == ',' || c == ')' || c == '\n' || c == ' ' || c == '\t' || c == '\r';
+	}
+
+	// the fallback converts in the C locale, so that LC_NUMERIC cannot change the decimal point
+	inline locale_t c_locale() {
+		static locale_t const locale = ::newlocale( LC_NUMERIC_MASK, "C", static_cast<locale_t>( 0 ) );
+		return locale;
+	}
+
+	template <class T> T parse_fallback( char const * token, char ** last );
+	template <> inline float parse_fallback<float>( char const * token, char ** last ) { return ::strtof_l( token, last, c_locale() ); }
+	template <> inline double parse_fallback<double>( char const * token, char ** last ) { return ::strtod_l( token, last, c_locale() ); }
+	template <> inline long double parse_fallback<long double>( char const * token, char ** last ) { return ::strtold_l( token, last, c_locale() ); }
+
+	// the largest power of ten whose powers up to it T represents exactly
+	template <class T>
+	constexpr int exact_power_limit() noexcept {
+		return std::numeric_limits<T>::digits >= 53 ? 22 : std::numeric_limits<T>::digits >= 24 ? 10 : 0;
+	}
+
+	template <class T>
+	T exact_power_of_ten( int exponent ) noexcept {
+		T power = 1;
+		for( int i = 0; i < exponent; ++i ) {
+			power *= 10;
+		}
+		return power;
+	}
+
+	/*
+	Parses a floating point number starting at it and leaves it after the number. The fast path
+	applies when the mantissa has at most 19 significant digits and fits in the significand of T,
+	and the decimal exponent is within exact_power_limit, so that one correctly rounded
+	multiplication or division yields the correctly rounded result.
+	*/
+	template <class T>
+	bool parse_number( char const *& it, char const * end, char delimiter, T & value, std::true_type ) {
+		char const * start = it;
+		char const * p = it;
+		bool negative = false;
+		if( p != end && (*p == '-' || *p == '+') ) {
+			negative = *p == '-';
+			++p;
+		}
+		std::uint64_t mantissa = 0;
+		int significant = 0;
+		int exponent = 0;
+		int digits = 0;
+		bool truncated = false;
+		for( ; p != end && *p >= '0' && *p <= '9'; ++p, ++digits ) {
+			if( significant < 19 ) {
+				mantissa = mantissa * 10 + static_cast<std::uint64_t>( *p - '0' );
+				significant += mantissa > 0 ? 1 : 0;
+			} else {
+				++exponent;
+				truncated = truncated || *p != '0';
+			}
+		}
+		if( p != end && *p == '.' ) {
+			for( ++p; p != end && *p >= '0' && *p <= '9'; ++p, ++digits ) {
+				if( significant < 19 ) {
+					mantissa = mantissa * 10 + static_cast<std::uint64_t>( *p - '0' );
+					significant += mantissa > 0 ? 1 : 0;
+					--exponent;
+				} else {
+					truncated = truncated || *p != '0';
+				}
+			}
+		}
+		bool fast = digits > 0;
+		if( fast && p != end && (*p == 'e' || *p == 'E') ) {
+			char const * q = p + 1;
+			bool negative_exponent = false;
+			if( q != end && (*q == '-' || *q == '+') ) {
+				negative_exponent = *q == '-';
+				++q;
+			}
+			int written = 0;
+			int digits_seen = 0;
+			for( ; q != end && *q >= '0' && *q <= '9'; ++q, ++digits_seen ) {
+				written = std::min( written * 10 + (*q - '0'), 100000 );
+			}
+			fast = digits_seen > 0;
+			exponent += negative_exponent ? -written : written;
+			p = q;
+		}
+		int const limit = exact_power_limit<T>();
+		fast = fast && !truncated && (p == end || ends_token( *p, delimiter )) && mantissa <= (std::uint64_t( 1 ) << std::min( std::numeric_limits<T>::digits, 63 )) && exponent >= -limit && exponent <= limit;
+		if( fast ) {
+			T result = static_cast<T>( mantissa );
+			result = exponent < 0 ? result / exact_power_of_ten<T>( -exponent ) : result * exact_power_of_ten<T>( exponent );
+			value = negative ? -result : result;
+			it = p;
+			return true;
+		}
+		// strtod_l needs a terminated copy, since the input need not end after the token
+		char const * last = start;
+		while( last != end && !ends_token( *last, delimiter ) ) {
+			++last;
+		}
+		if( last == start || last - start > 128 ) {
+			return false;
+		}
+		char token[ 129 ];
+		std::memcpy( token, start, last - start );
+		token[ last - start ] = '\0';
+		char * parsed = nullptr;
+		errno = 0;
+		value = parse_fallback<T>( token, &parsed );
+		// underflow yields zero or a subnormal, which is accepted, whereas overflow is an error
+		if( parsed != token + (last - start) || (errno == ERANGE && (value > 1 || value < -1)) ) {
+			return false;
+		}
+		it = last;
+		return true;
+	}
+
+	template <class T>
+	bool parse_number( char const *& it, char const * end, char const, T & value, std::false_type ) {
+		char const * p = it;
+		bool negative = false;
+		if( p != end && (*p == '-' || *p == '+') ) {
+			negative = *p == '-';
+			++p;
+		}
+		if( negative && std::is_unsigned<T>::value ) {
+			return false;
+		}
+		using magnitude_type = typename std::make_unsigned< typename std::conditional< std::is_same<T,bool>::value, unsigned char, T >::type >::type;
+		magnitude_type const maximum = static_cast<magnitude_type>( std::numeric_limits<T>::max() ) + (negative ? 1 : 0);
+		magnitude_type magnitude = 0;
+		char const * digits = p;
+		for( ; p != end && *p >= '0' && *p <= '9'; ++p ) {
+			magnitude_type digit = static_cast<magnitude_type>( *p - '0' );
+			if( magnitude > (maximum - digit) / 10 ) {
+				return false;
+			}
+			magnitude = static_cast<magnitude_type>( magnitude * 10 + digit );
+		}
+		if( p == digits ) {
+			return false;
+		}
+		value = negative ? static_cast<T>( 0 - magnitude ) : static_cast<T>( magnitude );
+		it = p;
+		return true;
+	}
+
+	template <class T>
+	bool parse_number( char const *& it, char const * end, char delimiter, T & value ) {
+		return parse_number( it, end, delimiter, value, std::is_floating_point<T>() );
+	}
+
+	/*
+	Parses the lines from begin to end into points. Returns null on success, and otherwise the
+	position of the offending line, with a description in message.
+	*/
+	template <class T, std::size_t d>
+	char const * parse_lines( char const * begin, char const * end, char delimiter, std::vector< kdtree::point<T,d> > & points, char const *& message ) {
+		kdtree::point<T,d> p;
+		for( char const * line = begin; line != end; ) {
+			char const * it = line;
+			while( it != end && is_blank( *it ) ) {
+				++it;
+			}
+			if( it == end || *it == '\n' ) {
+				line = it == end ? end : it + 1;
+				continue;
+			}
+			bool enclosed = *it == '(';
+			it += enclosed ? 1 : 0;
+			for( std::size_t i = 0; i < d; ++i ) {
+				while( it != end && is_blank( *it ) ) {
+					++it;
+				}
+				if( !parse_number( it, end, delimiter, p[ i ] ) ) {
+					message = "expected a coordinate";
+					return line;
+				}
+				char const * after = it;
+				while( it != end && is_blank( *it ) ) {
+					++it;
+				}
+				if( i + 1 < d ) {
+					// a blank delimiter was consumed with the padding, and a run of them separates once
+					bool separated = is_blank( delimiter ) && it != after;
+					if( it != end && (*it == delimiter || *it == ',') ) {
+						++it;
+					} else if( !separated ) {
+						message = "expected a delimiter between coordinates";
+						return line;
+					}
+				}
+			}
+			if( enclosed ) {
+				if( it == end || *it != ')' ) {
+					message = "expected ')'";
+					return line;
+				}
+				++it;
+			}
+			while( it != end && is_blank( *it ) ) {
+				++it;
+			}
+			if( it != end && *it != '\n' ) {
+				message = "unexpected characters after the last coordinate";
+				return line;
+			}
+			points.push_back( p );
+			line = it == end ? end : it + 1;
+		}
+		return nullptr;
+	}
+
+	/*
+	Parses complete lines in chunks of roughly equal size, one task per chunk, and appends the points
+	to the result in input order. first_line is the number of the line at begin, used in messages.
+	*/
+	template <class T, std::size_t d>
+	void parse_points_helper( kdtree::thread_pool & pool, char const * begin, char const * end, char delimiter, std::size_t first_line, std::vector< kdtree::point<T,d> > & points ) {
+		std::size_t const min_chunk = 1 << 20;
+		std::size_t length = end - begin;
+		std::size_t chunk_count = std::max<std::size_t>( 1, std::min( 4 * pool.concurrency(), length / min_chunk ) );
+		std::vector<char const *> bounds( chunk_count + 1, end );
+		bounds[ 0 ] = begin;
+		for( std::size_t i = 1; i < chunk_count; ++i ) {
+			char const * cut = std::max( bounds[ i - 1 ], begin + length / chunk_count * i );
+			char const * newline = static_cast<char const *>( std::memchr( cut, '\n', end - cut ) );
+			bounds[ i ] = newline == nullptr ? end : newline + 1;
+		}
+		struct chunk_result {
+			std::vector< kdtree::point<T,d> > points;
+			char const * error = nullptr;
+			char const * message = nullptr;
+		};
+		std::vector<chunk_result> chunks( chunk_count );
+		{
+			kdtree::task_group group( pool );
+			for( std::size_t i = 0; i < chunk_count; ++i ) {
+				group.run( [ &, i ]() {
+							chunks[ i ].points.reserve( (bounds[ i + 1 ] - bounds[ i ]) / (4 * d + 2) );
+							chunks[ i ].error = parse_lines( bounds[ i ], bounds[ i + 1 ], delimiter, chunks[ i ].points, chunks[ i ].message );
+						} );
+			}
+			group.wait();
+		}
+		for( auto const & chunk : chunks ) {
+			if( chunk.error != nullptr ) {
+				std::size_t line = first_line + static_cast<std::size_t>( std::count( begin, chunk.error, '\n' ) );
+				throw std::runtime_error( "line " + std::to_string( line ) + ": " + chunk.message );
+			}
+		}
+		std::size_t total = points.size();
+		for( auto const & chunk : chunks ) {
+			total += chunk.points.size();
+		}
+		points.reserve( total );
+		for( auto const & chunk : chunks ) {
+			points.insert( points.end(), chunk.points.begin(), chunk.points.end() );
+		}
+	}
+
+}
+
+namespace kdtree {
+
+	// first_line numbers the line at begin in error messages, for text that continues earlier input
+	template <class T, std::size_t d>
+	std::vector< kdtree::point<T,d> > parse_points( char const * begin, char const * end, char delimiter = '\t', kdtree::parallel_policy const & policy = kdtree::parallel_policy(), std::size_t first_line = 1 ) {
+		std::vector< kdtree::point<T,d> > points;
+		kdtree::with_thread_pool( policy, [ & ]( kdtree::thread_pool & pool ) { parse_points_helper( pool, begin, end, delimiter, first_line, points ); } );
+		return points;
+	}
+
+	/*
+	Reads and parses all points from a file descriptor. Regular files are mapped into memory and
+	parsed in place; pipes and terminals are read in large blocks, each of which is parsed in
+	parallel while its last, incomplete line is carried over to the next block.
+	*/
+	template <class T, std::size_t d>
+	std::vector< kdtree::point<T,d> > read_points( int fd, char delimiter = '\t', kdtree::parallel_policy const & policy = kdtree::parallel_policy() ) {
+		std::vector< kdtree::point<T,d> > points;
+		kdtree::with_thread_pool( policy, [ & ]( kdtree::thread_pool & pool ) {
+					struct stat status;
+					if( ::fstat( fd, &status ) == 0 && S_ISREG( status.st_mode ) && status.st_size > 0 ) {
+						std::size_t length = static_cast<std::size_t>( status.st_size );
+						void * mapping = ::mmap( nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0 );
+						if( mapping != MAP_FAILED ) {
+							::madvise( mapping, length, MADV_SEQUENTIAL );
+							char const * begin = static_cast<char const *>( mapping );
+							try {
+								parse_points_helper( pool, begin, begin + length, delimiter, 1, points );
+							} catch( ... ) {
+								::munmap( mapping, length );
+								throw;
+							}
+							::munmap( mapping, length );
+							return;
+						}
+					}
+					std::size_t const block_size = std::size_t( 64 ) << 20;
+					std::vector<char> buffer( block_size );
+					std::size_t filled = 0;
+					std::size_t line = 1;
+					while( true ) {
+						if( filled == buffer.size() ) {
+							buffer.resize( 2 * buffer.size() );
+						}
+						ssize_t count = ::read( fd, buffer.data() + filled, buffer.size() - filled );
+						if( count < 0 ) {
+							if( errno == EINTR ) {
+								continue;
+							}
+							throw std::runtime_error( std::string( "kdtree::read_points: " ) + std::strerror( errno ) );
+						}
+						filled += static_cast<std::size_t>( count );
+						if( count == 0 ) {
+							parse_points_helper( pool, buffer.data(), buffer.data() + filled, delimiter, line, points );
+							return;
+						}
+						char const * last_newline = nullptr;
+						for( char const * it = buffer.data() + filled; it != buffer.data(); --it ) {
+							if( *(it - 1) == '\n' ) {
+								last_newline = it - 1;
+								break;
+							}
+						}
+						if( last_newline != nullptr && filled >= block_size / 2 ) {
+							char const * complete = last_newline + 1;
+							parse_points_helper( pool, buffer.data(), complete, delimiter, line, points );
+							line += static_cast<std::size_t>( std::count( static_cast<char const *>( buffer.data() ), complete, '\n' ) );
+							std::size_t rest = buffer.data() + filled - complete;
+							std::memmove( buffer.data(), complete, rest );
+							filled = rest;
+						}
+					}
+				} );
+		return points;
+	}
+
+	template <class T, std::size_t d>
+	std::vector< kdtree::point<T,d> > read_points( std::string const & path, char delimiter = '\t', kdtree::parallel_policy const & policy = kdtree::parallel_policy() ) {
+		int fd = ::open( path.c_str(), O_RDONLY );
+		if( fd < 0 ) {
+			throw std::runtime_error( "kdtree::read_points cannot open " + path );
+		}
+		try {
+			std::vector< kdtree::point<T,d> > points = read_points<T,d>( fd, delimiter, policy );
+			::close( fd );
+			return points;
+		} catch( ... ) {
+			::close( fd );
+			throw;
+		}
+	}
+
+}
+
+#endif
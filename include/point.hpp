@@ -10,7 +10,9 @@
 #include <iostream>
 #include <sstream>
 #include <stdexcept>
+#include <type_traits>
 #include <utility>
+#include "distance.hpp"
 
 namespace kdtree {
 
@@ -39,6 +41,9 @@ namespace kdtree {
 			point operator+( point const & other ) const { point result; std::transform( this->begin(), this->end(), other.begin(), result.begin(), []( auto xi1, auto xi2 ) { return xi1 + xi2; } ); return result; }
 			point operator-( point const & other ) const { point result; std::transform( this->begin(), this->end(), other.begin(), result.begin(), []( auto xi1, auto xi2 ) { return xi1 - xi2; } ); return result; }
 
+			coordinate_type * data() noexcept { return _coordinates.data(); }
+			coordinate_type const * data() const noexcept { return _coordinates.data(); }
+
 			iterator begin() noexcept { return _coordinates.begin(); }
 			const_iterator begin() const noexcept { return _coordinates.begin(); }
 			const_iterator cbegin() const noexcept { return _coordinates.cbegin(); }
@@ -54,20 +59,15 @@ namespace kdtree {
 	};
 
 	template <class T, class U, std::size_t d>
-	T squared_euclidean_distance( point<T,d> const & p1, point<U,d> const & p2 ) {
-		/* AWAIT BETTER C++ 2020 SUPPORT
-		auto sum_function = []( auto accum, auto element ) { return accum + element; };
-		auto product_function = []( auto xi1, auto xi2 ) { return std::pow( xi1 - xi2, 2 ); };
-		return std::inner_product( first1, last1, first2, static_cast<distance_type>( 0 ), sum_function, product_function )
-		*/
-		auto first1 = p1.cbegin();
-		auto last1 = p1.cend();
-		auto first2 = p2.cbegin();
-		T dist = 0;
-		while( first1 != last1 ) {
-			dist += std::pow( *first1 - *first2, 2 );
-			++first1;
-			++first2;
+	typename distance_traits<typename std::common_type<T,U>::type>::type squared_euclidean_distance( point<T,d> const & p1, point<U,d> const & p2 ) {
+		using accumulator_type = typename distance_traits<typename std::common_type<T,U>::type>::type;
+		if( std::is_same<T,U>::value && d >= simd_dimensionality_threshold ) {
+			return kdtree::squared_euclidean_distance( p1.data(), reinterpret_cast<T const *>( p2.data() ), d );
+		}
+		accumulator_type dist = 0;
+		for( std::size_t i = 0; i < d; ++i ) {
+			accumulator_type diff = static_cast<accumulator_type>( p1[ i ] ) - static_cast<accumulator_type>( p2[ i ] );
+			dist += diff * diff;
 		}
 		return dist;
 	}
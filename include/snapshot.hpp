@@ -0,0 +1,301 @@
+#ifndef KDTREE_SNAPSHOT_HPP
+#define KDTREE_SNAPSHOT_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "kdtree.hpp"
+#include "point.hpp"
+
+/*
+Binary snapshots of built trees. A snapshot holds the points of a tree in the order make_kdtree
+left them, together with what is needed to search them again: the layout, the leaf size and, for
+skeleton trees, the split array. Loading maps the file read-only and searches the mapped points
+in place, so starting up costs neither parsing nor construction, and the operating system pages
+in only the parts of the tree that searches touch.
+
+The file starts with a fixed 128 byte header, in the byte order of the machine that wrote it:
+
+	offset  size  field
+	     0     8  magic "KDTSNAP" followed by a zero byte
+	     8     4  format version, currently 1
+	    12     4  byte order mark 0x01020304
+	    16     4  dimensionality d
+	    20     1  coordinate type, see snapshot_coordinate
+	    21     1  layout, see snapshot_layout
+	    22     1  split rule of a skeleton tree, see kdtree::split_rule
+	    23     1  reserved, zero
+	    24     8  leaf size
+	    32     8  number of points n
+	    40     8  offset of the points
+	    48     8  offset of the split values
+	    56     8  number of split values
+	    64     8  offset of the split dimensions
+	    72     8  number of split dimensions
+	    80    48  reserved, zero
+
+Every array starts at a multiple of 64 bytes. Points are stored as d coordinates each, split values
+in the coordinate type, and split dimensions as std::uint16_t. Readers reject other versions and
+byte orders rather than converting them.
+*/
+
+namespace kdtree {
+
+	enum class snapshot_coordinate : std::uint8_t { int8 = 1, uint8, int16, uint16, int32, uint32, int64, uint64, float32, float64 };
+
+	enum class snapshot_layout : std::uint8_t { inorder = 0, breadth_first = 1, skeleton = 2 };
+
+	template <class T> struct snapshot_coordinate_of;
+	template <> struct snapshot_coordinate_of<std::int8_t> : std::integral_constant< snapshot_coordinate, snapshot_coordinate::int8 > {};
+	template <> struct snapshot_coordinate_of<std::uint8_t> : std::integral_constant< snapshot_coordinate, snapshot_coordinate::uint8 > {};
+	template <> struct snapshot_coordinate_of<std::int16_t> : std::integral_constant< snapshot_coordinate, snapshot_coordinate::int16 > {};
+	template <> struct snapshot_coordinate_of<std::uint16_t> : std::integral_constant< snapshot_coordinate, snapshot_coordinate::uint16 > {};
+	template <> struct snapshot_coordinate_of<std::int32_t> : std::integral_constant< snapshot_coordinate, snapshot_coordinate::int32 > {};
+	template <> struct snapshot_coordinate_of<std::uint32_t> : std::integral_constant< snapshot_coordinate, snapshot_coordinate::uint32 > {};
+	template <> struct snapshot_coordinate_of<std::int64_t> : std::integral_constant< snapshot_coordinate, snapshot_coordinate::int64 > {};
+	template <> struct snapshot_coordinate_of<std::uint64_t> : std::integral_constant< snapshot_coordinate, snapshot_coordinate::uint64 > {};
+	template <> struct snapshot_coordinate_of<float> : std::integral_constant< snapshot_coordinate, snapshot_coordinate::float32 > {};
+	template <> struct snapshot_coordinate_of<double> : std::integral_constant< snapshot_coordinate, snapshot_coordinate::float64 > {};
+
+	struct snapshot_header {
+		char magic[ 8 ];
+		std::uint32_t version;
+		std::uint32_t byte_order;
+		std::uint32_t dimensionality;
+		std::uint8_t coordinate;
+		std::uint8_t layout;
+		std::uint8_t rule;
+		std::uint8_t reserved;
+		std::uint64_t leaf;
+		std::uint64_t count;
+		std::uint64_t points_offset;
+		std::uint64_t splits_offset;
+		std::uint64_t split_count;
+		std::uint64_t dimensions_offset;
+		std::uint64_t dimension_count;
+		std::uint8_t padding[ 48 ];
+	};
+
+	static_assert( sizeof( snapshot_header ) == 128, "kdtree::snapshot_header is expected to occupy exactly 128 bytes" );
+
+	std::uint32_t const snapshot_version = 1;
+	std::uint32_t const snapshot_byte_order = 0x01020304;
+
+}
+
+namespace {
+
+	inline std::uint64_t snapshot_align( std::uint64_t offset ) noexcept {
+		return (offset + 63) / 64 * 64;
+	}
+
+	inline void write_snapshot_padding( std::ostream & os, std::uint64_t & offset, std::uint64_t target ) {
+		char const zeros[ 64 ] = {};
+		os.write( zeros, static_cast<std::streamsize>( target - offset ) );
+		offset = target;
+	}
+
+	template <class RandomAccessIterator>
+	void write_snapshot_helper( std::ostream & os, RandomAccessIterator begin, RandomAccessIterator end, kdtree::snapshot_layout layout, std::size_t leaf, kdtree::split_rule rule, void const * splits, std::size_t split_count, std::uint16_t const * dimensions, std::size_t dimension_count ) {
+		using point_type = typename std::iterator_traits<RandomAccessIterator>::value_type;
+		using coordinate_type = typename point_type::coordinate_type;
+		static_assert( sizeof( point_type ) == sizeof( coordinate_type ) * point_type::dimensionality(), "kdtree::write_snapshot requires points that store their coordinates without padding" );
+		kdtree::snapshot_header header;
+		std::memset( &header, 0, sizeof( header ) );
+		std::memcpy( header.magic, "KDTSNAP", 8 );
+		header.version = kdtree::snapshot_version;
+		header.byte_order = kdtree::snapshot_byte_order;
+		header.dimensionality = static_cast<std::uint32_t>( point_type::dimensionality() );
+		header.coordinate = static_cast<std::uint8_t>( kdtree::snapshot_coordinate_of<coordinate_type>::value );
+		header.layout = static_cast<std::uint8_t>( layout );
+		header.rule = static_cast<std::uint8_t>( rule );
+		header.leaf = leaf;
+		header.count = static_cast<std::uint64_t>( end - begin );
+		header.points_offset = sizeof( header );
+		header.splits_offset = snapshot_align( header.points_offset + header.count * sizeof( point_type ) );
+		header.split_count = split_count;
+		header.dimensions_offset = snapshot_align( header.splits_offset + split_count * sizeof( coordinate_type ) );
+		header.dimension_count = dimension_count;
+		os.write( reinterpret_cast<char const *>( &header ), sizeof( header ) );
+		// points are written a block at a time, since the iterators need not be contiguous
+		std::vector<point_type> block;
+		block.reserve( 4096 );
+		for( RandomAccessIterator it = begin; it != end; ) {
+			block.clear();
+			for( ; it != end && block.size() < block.capacity(); ++it ) {
+				block.push_back( *it );
+			}
+			os.write( reinterpret_cast<char const *>( block.data() ), static_cast<std::streamsize>( block.size() * sizeof( point_type ) ) );
+		}
+		std::uint64_t offset = header.points_offset + header.count * sizeof( point_type );
+		write_snapshot_padding( os, offset, header.splits_offset );
+		os.write( static_cast<char const *>( splits ), static_cast<std::streamsize>( split_count * sizeof( coordinate_type ) ) );
+		offset += split_count * sizeof( coordinate_type );
+		write_snapshot_padding( os, offset, header.dimensions_offset );
+		os.write( reinterpret_cast<char const *>( dimensions ), static_cast<std::streamsize>( dimension_count * sizeof( std::uint16_t ) ) );
+		if( !os ) {
+			throw std::runtime_error( "kdtree::write_snapshot failed to write the snapshot" );
+		}
+	}
+
+}
+
+namespace kdtree {
+
+	/*
+	Writes a tree built by make_kdtree with the given layout, or with the given skeleton, whose
+	coordinate type must be the one of the points. The stream should be opened in binary mode.
+	*/
+	template <class RandomAccessIterator>
+	void write_snapshot( std::ostream & os, RandomAccessIterator begin, RandomAccessIterator end, kdtree::leaf_size leaf = kdtree::leaf_size() ) {
+		write_snapshot_helper( os, begin, end, snapshot_layout::inorder, leaf.value(), split_rule::round_robin, nullptr, 0, nullptr, 0 );
+	}
+
+	template <class RandomAccessIterator>
+	void write_snapshot( std::ostream & os, RandomAccessIterator begin, RandomAccessIterator end, kdtree::eytzinger_layout ) {
+		write_snapshot_helper( os, begin, end, snapshot_layout::breadth_first, 1, split_rule::round_robin, nullptr, 0, nullptr, 0 );
+	}
+
+	template <class RandomAccessIterator, class Coordinate>
+	void write_snapshot( std::ostream & os, RandomAccessIterator begin, RandomAccessIterator end, kdtree::split_skeleton<Coordinate> const & skeleton ) {
+		static_assert( std::is_same< Coordinate, typename std::iterator_traits<RandomAccessIterator>::value_type::coordinate_type >::value, "kdtree::write_snapshot( std::ostream & os, RandomAccessIterator begin, RandomAccessIterator end, split_skeleton<Coordinate> const & skeleton ) requires the skeleton to use the coordinate type of the points.\n" );
+		write_snapshot_helper( os, begin, end, snapshot_layout::skeleton, skeleton.leaf().value(), skeleton.rule(), skeleton.splits().data(), skeleton.splits().size(), skeleton.dimensions().data(), skeleton.dimensions().size() );
+	}
+
+	/*
+	A snapshot of a tree of kdtree::point<T,d>, mapped read-only into memory. Opening checks the
+	header against T and d and the sizes of the arrays against the file, and throws
+	std::runtime_error on any mismatch. begin() and end() point into the mapping, and search() calls
+	a function with them and the layout the tree was built with, so that one call site serves every
+	layout:
+
+		snapshot.search( [ & ]( auto begin, auto end, auto layout ) { return kdtree::nnsearch_kdtree( begin, end, q, layout ) - begin; } )
+	*/
+	template <class T, std::size_t d>
+	class mapped_snapshot {
+		private:
+			using point_type = kdtree::point<T,d>;
+			void * _mapping;
+			std::size_t _length;
+			snapshot_header _header;
+			void unmap() noexcept {
+				if( _mapping != nullptr ) {
+					::munmap( _mapping, _length );
+					_mapping = nullptr;
+				}
+			}
+			unsigned char const * bytes() const noexcept { return static_cast<unsigned char const *>( _mapping ); }
+			void validate( std::string const & path ) const;
+		public:
+			explicit mapped_snapshot( std::string const & path );
+			mapped_snapshot( mapped_snapshot const & ) = delete;
+			mapped_snapshot & operator=( mapped_snapshot const & ) = delete;
+			mapped_snapshot( mapped_snapshot && other ) noexcept : _mapping( other._mapping ), _length( other._length ), _header( other._header ) { other._mapping = nullptr; }
+			mapped_snapshot & operator=( mapped_snapshot && other ) noexcept {
+				if( this != &other ) {
+					unmap();
+					_mapping = other._mapping;
+					_length = other._length;
+					_header = other._header;
+					other._mapping = nullptr;
+				}
+				return *this;
+			}
+			~mapped_snapshot() { unmap(); }
+			snapshot_header const & header() const noexcept { return _header; }
+			snapshot_layout layout() const noexcept { return static_cast<snapshot_layout>( _header.layout ); }
+			std::size_t size() const noexcept { return static_cast<std::size_t>( _header.count ); }
+			point_type const * begin() const noexcept { return reinterpret_cast<point_type const *>( bytes() + _header.points_offset ); }
+			point_type const * end() const noexcept { return begin() + size(); }
+			kdtree::leaf_size leaf() const noexcept { return kdtree::leaf_size( static_cast<std::size_t>( _header.leaf ) ); }
+			kdtree::skeleton_view<T> view() const noexcept {
+				return kdtree::skeleton_view<T>( reinterpret_cast<T const *>( bytes() + _header.splits_offset ), _header.dimension_count > 0 ? reinterpret_cast<std::uint16_t const *>( bytes() + _header.dimensions_offset ) : nullptr, leaf() );
+			}
+			template <class Function> auto search( Function function ) const {
+				switch( layout() ) {
+					case snapshot_layout::breadth_first:
+						return function( begin(), end(), kdtree::eytzinger_layout() );
+					case snapshot_layout::skeleton:
+						return function( begin(), end(), view() );
+					default:
+						return function( begin(), end(), leaf() );
+				}
+			}
+	};
+
+	template <class T, std::size_t d>
+	mapped_snapshot<T,d>::mapped_snapshot( std::string const & path ) : _mapping( nullptr ), _length( 0 ) {
+		static_assert( sizeof( point_type ) == sizeof( T ) * d, "kdtree::mapped_snapshot<T,d> requires points that store their coordinates without padding" );
+		int fd = ::open( path.c_str(), O_RDONLY );
+		if( fd < 0 ) {
+			throw std::runtime_error( "kdtree::mapped_snapshot cannot open " + path );
+		}
+		struct stat status;
+		if( ::fstat( fd, &status ) != 0 || static_cast<std::size_t>( status.st_size ) < sizeof( snapshot_header ) ) {
+			::close( fd );
+			throw std::runtime_error( "kdtree::mapped_snapshot found no snapshot header in " + path );
+		}
+		_length = static_cast<std::size_t>( status.st_size );
+		void * mapping = ::mmap( nullptr, _length, PROT_READ, MAP_SHARED, fd, 0 );
+		::close( fd );
+		if( mapping == MAP_FAILED ) {
+			throw std::runtime_error( "kdtree::mapped_snapshot cannot map " + path );
+		}
+		_mapping = mapping;
+		std::memcpy( &_header, _mapping, sizeof( _header ) );
+		try {
+			validate( path );
+		} catch( ... ) {
+			unmap();
+			throw;
+		}
+	}
+
+	template <class T, std::size_t d>
+	void mapped_snapshot<T,d>::validate( std::string const & path ) const {
+		auto fail = [ &path ]( char const * reason ) { throw std::runtime_error( "kdtree::mapped_snapshot: " + path + ": " + reason ); };
+		if( std::memcmp( _header.magic, "KDTSNAP", 8 ) != 0 ) {
+			fail( "not a snapshot" );
+		}
+		if( _header.byte_order != snapshot_byte_order ) {
+			fail( "written on a machine of different byte order" );
+		}
+		if( _header.version != snapshot_version ) {
+			fail( "unsupported snapshot version" );
+		}
+		if( _header.dimensionality != d || _header.coordinate != static_cast<std::uint8_t>( snapshot_coordinate_of<T>::value ) ) {
+			fail( "points of a different dimensionality or coordinate type" );
+		}
+		if( _header.layout > static_cast<std::uint8_t>( snapshot_layout::skeleton ) || _header.leaf == 0 ) {
+			fail( "unknown layout" );
+		}
+		auto fits = [ this ]( std::uint64_t offset, std::uint64_t count, std::uint64_t size ) { return offset % 64 == 0 && offset <= _length && count <= (_length - offset) / size; };
+		if( !fits( _header.points_offset, _header.count, sizeof( point_type ) ) || !fits( _header.splits_offset, _header.split_count, sizeof( T ) ) || !fits( _header.dimensions_offset, _header.dimension_count, sizeof( std::uint16_t ) ) ) {
+			fail( "truncated" );
+		}
+		if( layout() == snapshot_layout::skeleton ) {
+			std::size_t expected = skeleton_size( size(), static_cast<std::size_t>( _header.leaf ) );
+			if( _header.split_count != expected || (_header.dimension_count != 0 && _header.dimension_count != expected) ) {
+				fail( "split arrays do not match the tree" );
+			}
+			for( std::uint64_t i = 0; i < _header.dimension_count; ++i ) {
+				if( reinterpret_cast<std::uint16_t const *>( bytes() + _header.dimensions_offset )[ i ] >= d ) {
+					fail( "split dimension out of range" );
+				}
+			}
+		}
+	}
+
+}
+
+#endif
@@ -0,0 +1,243 @@
+#ifndef KDTREE_THREAD_POOL_HPP
+#define KDTREE_THREAD_POOL_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace kdtree {
+
+	/*
+	A small work-stealing thread pool. Each worker owns a deque: it pushes and pops its own tasks at
+	the back and steals from the front of the other deques when its own runs dry. Threads that are
+	not part of the pool submit into an additional shared deque. Threads waiting on a task_group run
+	pending tasks instead of blocking, so nested fork-join parallelism cannot deadlock, and a pool
+	with zero workers simply runs everything on the waiting thread.
+	*/
+	class thread_pool {
+		private:
+			using task_type = std::function<void()>;
+			struct task_queue {
+				std::mutex mutex;
+				std::deque<task_type> tasks;
+			};
+			std::vector<std::unique_ptr<task_queue>> _queues;
+			std::vector<std::thread> _workers;
+			std::mutex _sleep_mutex;
+			std::condition_variable _sleep_condition;
+			std::atomic<std::size_t> _queued;
+			std::atomic<std::size_t> _steal_start;
+			bool _stopping;
+			static std::pair<thread_pool const *, std::size_t> & current_worker() noexcept;
+			std::size_t local_queue() const noexcept;
+			bool pop_task( task_type & task );
+			void worker_loop( std::size_t index );
+		public:
+			explicit thread_pool( std::size_t workers = std::thread::hardware_concurrency() > 0 ? std::thread::hardware_concurrency() - 1 : 0 );
+			thread_pool( thread_pool const & ) = delete;
+			thread_pool & operator=( thread_pool const & ) = delete;
+			~thread_pool();
+			std::size_t size() const noexcept { return _workers.size(); }
+			std::size_t concurrency() const noexcept { return _workers.size() + 1; }
+			void submit( task_type task );
+			bool run_pending_task();
+	};
+
+	class task_group {
+		private:
+			thread_pool & _pool;
+			std::atomic<std::size_t> _pending;
+			std::mutex _exception_mutex;
+			std::exception_ptr _exception;
+		public:
+			explicit task_group( thread_pool & pool ) : _pool( pool ), _pending( 0 ) {}
+			task_group( task_group const & ) = delete;
+			task_group & operator=( task_group const & ) = delete;
+			~task_group();
+			template <class Function> void run( Function function );
+			void wait();
+	};
+
+	struct sequential_policy {};
+
+	/*
+	Requests parallel execution. Either names a thread count, in which case a transient pool is
+	created for the duration of each call, or borrows an existing pool so that repeated calls do not
+	pay for thread creation. The cutoff is the problem size below which work is no longer split.
+	*/
+	class parallel_policy {
+		private:
+			thread_pool * _pool;
+			std::size_t _threads;
+			std::size_t _cutoff;
+		public:
+			explicit parallel_policy( std::size_t threads = std::thread::hardware_concurrency(), std::size_t cutoff = 16384 ) : _pool( nullptr ), _threads( threads > 0 ? threads : 1 ), _cutoff( cutoff > 0 ? cutoff : 1 ) {}
+			explicit parallel_policy( thread_pool & pool, std::size_t cutoff = 16384 ) : _pool( &pool ), _threads( pool.concurrency() ), _cutoff( cutoff > 0 ? cutoff : 1 ) {}
+			thread_pool * pool() const noexcept { return _pool; }
+			std::size_t threads() const noexcept { return _threads; }
+			std::size_t cutoff() const noexcept { return _cutoff; }
+	};
+
+	template <class Function>
+	void with_thread_pool( parallel_policy const & policy, Function function ) {
+		if( policy.pool() != nullptr ) {
+			function( *policy.pool() );
+		} else {
+			// the calling thread participates while waiting, so it counts toward the requested threads
+			thread_pool pool( policy.threads() - 1 );
+			function( pool );
+		}
+	}
+
+	inline std::pair<thread_pool const *, std::size_t> & thread_pool::current_worker() noexcept {
+		static thread_local std::pair<thread_pool const *, std::size_t> worker( nullptr, 0 );
+		return worker;
+	}
+
+	inline std::size_t thread_pool::local_queue() const noexcept {
+		auto const & worker = current_worker();
+		return worker.first == this ? worker.second : _workers.size();
+	}
+
+	inline thread_pool::thread_pool( std::size_t workers ) : _queued( 0 ), _steal_start( 0 ), _stopping( false ) {
+		_queues.reserve( workers + 1 );
+		for( std::size_t i = 0; i <= workers; ++i ) {
+			_queues.emplace_back( new task_queue );
+		}
+		_workers.reserve( workers );
+		for( std::size_t i = 0; i < workers; ++i ) {
+			_workers.emplace_back( [ this, i ]() { worker_loop( i ); } );
+		}
+	}
+
+	inline thread_pool::~thread_pool() {
+		{
+			std::lock_guard<std::mutex> lock( _sleep_mutex );
+			_stopping = true;
+		}
+		_sleep_condition.notify_all();
+		for( auto & worker : _workers ) {
+			worker.join();
+		}
+	}
+
+	inline void thread_pool::submit( task_type task ) {
+		task_queue & queue = *_queues[ local_queue() ];
+		{
+			std::lock_guard<std::mutex> lock( queue.mutex );
+			queue.tasks.emplace_back( std::move( task ) );
+		}
+		++_queued;
+		// taking the sleep mutex orders this submission against a worker that is about to sleep
+		{
+			std::lock_guard<std::mutex> lock( _sleep_mutex );
+		}
+		_sleep_condition.notify_one();
+	}
+
+	inline bool thread_pool::pop_task( task_type & task ) {
+		if( _queued.load() == 0 ) {
+			return false;
+		}
+		std::size_t own = local_queue();
+		{
+			task_queue & queue = *_queues[ own ];
+			std::lock_guard<std::mutex> lock( queue.mutex );
+			if( !queue.tasks.empty() ) {
+				task = std::move( queue.tasks.back() );
+				queue.tasks.pop_back();
+				--_queued;
+				return true;
+			}
+		}
+		std::size_t count = _queues.size();
+		std::size_t start = _steal_start++;
+		for( std::size_t i = 0; i < count; ++i ) {
+			std::size_t victim = (start + i) % count;
+			if( victim == own ) {
+				continue;
+			}
+			task_queue & queue = *_queues[ victim ];
+			std::lock_guard<std::mutex> lock( queue.mutex );
+			if( !queue.tasks.empty() ) {
+				task = std::move( queue.tasks.front() );
+				queue.tasks.pop_front();
+				--_queued;
+				return true;
+			}
+		}
+		return false;
+	}
+
+	inline bool thread_pool::run_pending_task() {
+		task_type task;
+		if( pop_task( task ) ) {
+			task();
+			return true;
+		}
+		return false;
+	}
+
+	inline void thread_pool::worker_loop( std::size_t index ) {
+		current_worker() = std::make_pair( this, index );
+		while( true ) {
+			if( run_pending_task() ) {
+				continue;
+			}
+			std::unique_lock<std::mutex> lock( _sleep_mutex );
+			_sleep_condition.wait( lock, [ this ]() { return _stopping || _queued.load() > 0; } );
+			if( _stopping && _queued.load() == 0 ) {
+				break;
+			}
+		}
+		current_worker() = std::make_pair( nullptr, 0 );
+	}
+
+	inline task_group::~task_group() {
+		while( _pending.load() > 0 ) {
+			if( !_pool.run_pending_task() ) {
+				std::this_thread::yield();
+			}
+		}
+	}
+
+	template <class Function>
+	void task_group::run( Function function ) {
+		++_pending;
+		_pool.submit( [ this, function ]() mutable {
+					try {
+						function();
+					} catch( ... ) {
+						std::lock_guard<std::mutex> lock( _exception_mutex );
+						if( !_exception ) {
+							_exception = std::current_exception();
+						}
+					}
+					--_pending;
+				} );
+	}
+
+	inline void task_group::wait() {
+		while( _pending.load() > 0 ) {
+			if( !_pool.run_pending_task() ) {
+				std::this_thread::yield();
+			}
+		}
+		if( _exception ) {
+			std::exception_ptr exception = _exception;
+			_exception = nullptr;
+			std::rethrow_exception( exception );
+		}
+	}
+
+}
+
+#endif
@@ -1,21 +1,28 @@
+#include <algorithm>
 #include <chrono>
 #include <cmath>
+#include <cstdio>
 #include <cstdlib>
 #include <cstring>
 #include <ctime>
 #include <errno.h>
+#include <fcntl.h>
 #include <getopt.h>
 #include <fstream>
 #include <iomanip>
 #include <iostream>
 #include <limits>
 #include <list>
+#include <memory>
 #include <stack>
 #include <string>
+#include <thread>
 #include <utility>
 #include <vector>
 #include "../include/kdtree.hpp"
+#include "../include/parse.hpp"
 #include "../include/point.hpp"
+#include "../include/snapshot.hpp"
 
 std::string VERSION_STRING = "0.1 (beta)";
 
@@ -35,17 +42,56 @@ enum message_type : char {
 char DELIMITER = '\t';
 verbosity_level VERBOSITY = WARNING;
 
+enum query_command : char {
+	BUILD = 0,
+	NN = 1,
+	KNN = 2,
+	RANGE = 3,
+	RADIUS = 4,
+	EXACT = 5
+};
+
 void short_usage( char const * program ) {
-	std::cerr << "Usage: " << program << " [OPTION]... [FILE]                                     \n";
+	std::cerr << "Usage: " << program << " [COMMAND] [OPTION]... [FILE]                           \n";
 	std::cerr << "Try '" << program << " --help' for more information.                            \n";
 }
 
 void usage( char const * program ) {
-	std::cerr << "Usage: " << program << " [OPTION]... [FILE]                                     \n";
-	std::cerr << "Currently, generate k-d tree from input file of points in format (x1,x2,...xn). \n";
-	std::cerr << "Accepts either standard input or reads from a file. Named pipes and process     \n";
-	std::cerr << "substitution may also be used as the file argument.                             \n";
+	std::cerr << "Usage: " << program << " [COMMAND] [OPTION]... [FILE]                           \n";
+	std::cerr << "Generate k-d tree from input file of points, one per line, with coordinates     \n";
+	std::cerr << "separated by the delimiter or by commas, optionally enclosed in parentheses as  \n";
+	std::cerr << "in (x1,x2,...xn), and print it or answer queries against it. Accepts either     \n";
+	std::cerr << "standard input or reads from a file. Named pipes and process substitution may   \n";
+	std::cerr << "also be used as the file argument.                                              \n";
+	std::cerr << "                                                                                \n";
+	std::cerr << "Commands:                                                                       \n";
+	std::cerr << "  build                     print the tree or write its snapshot (the default)  \n";
+	std::cerr << "  nn                        nearest neighbor of each query point                \n";
+	std::cerr << "  knn                       k nearest neighbors of each query point, nearest    \n";
+	std::cerr << "                            first                                               \n";
+	std::cerr << "  range                     points within each box, given as min then max       \n";
+	std::cerr << "                            coordinates                                         \n";
+	std::cerr << "  radius                    points within each ball, given as the center        \n";
+	std::cerr << "                            coordinates then the radius                         \n";
+	std::cerr << "  exact                     1 if each query point is in the tree, otherwise 0   \n";
+	std::cerr << "Query commands build the tree once, or map it with --load, then read query      \n";
+	std::cerr << "records as they arrive and write one line per record, in input order, with the  \n";
+	std::cerr << "points found separated by the delimiter.                                        \n";
 	std::cerr << "                                                                                \n";
+	std::cerr << "  -s, --snapshot=FILE       write the tree as a binary snapshot to FILE instead  \n";
+	std::cerr << "                            of printing it                                      \n";
+	std::cerr << "  -l, --load=FILE           answer queries against the snapshot in FILE instead \n";
+	std::cerr << "                            of building a tree                                  \n";
+	std::cerr << "  -q, --queries=FILE        read query records from FILE; defaults to standard  \n";
+	std::cerr << "                            input                                               \n";
+	std::cerr << "  -k, --neighbors=N         number of neighbors for knn; defaults to 1          \n";
+	std::cerr << "  -c, --count               print the number of points found by range and       \n";
+	std::cerr << "                            radius instead of the points                        \n";
+	std::cerr << "      --stats               print the nodes visited, branches pruned, distances  \n";
+	std::cerr << "                            computed, results and maximum depth of the queries  \n";
+	std::cerr << "                            to standard error when they are answered            \n";
+	std::cerr << "  -j, --threads=N           parse input and answer queries with N threads;      \n";
+	std::cerr << "                            defaults to the number of hardware threads          \n";
 	std::cerr << "  -t, --delimiter=CHAR      use CHAR for field separator                        \n";
 	std::cerr << "                            defaults to TAB if not provided                     \n";
 	std::cerr << "  -v, --verbosity=VALUE     one of {0,1,2,3,quiet,warning,info,debug};          \n";
@@ -82,26 +128,295 @@ void log_message( char const * message, verbosity_level verbosity, message_type
 	}
 }
 
+/*
+Appends x to out in a form that reads back as exactly x. Numbers of up to 15 significant digits,
+which covers coordinates that were written as text in the first place, are scaled to an integer
+and checked by converting back, which is exact because both the integer and the power of ten are
+exact doubles; anything else is printed with 17 digits by snprintf, which is several times slower.
+*/
+void append_number( std::string & out, double x ) {
+	static double const powers[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+	double magnitude = std::fabs( x );
+	if( magnitude == 0 ) {
+		out += '0';
+		return;
+	}
+	if( magnitude >= 1e-8 && magnitude < 1e15 ) {
+		int scale = 14 - static_cast<int>( std::floor( std::log10( magnitude ) ) );
+		if( scale >= 0 && scale <= 22 ) {
+			double scaled = std::nearbyint( magnitude * powers[ scale ] );
+			if( scaled < 9007199254740992.0 && scaled / powers[ scale ] == magnitude ) {
+				unsigned long long digits = static_cast<unsigned long long>( scaled );
+				while( scale > 0 && digits % 10 == 0 ) {
+					digits /= 10;
+					--scale;
+				}
+				char buffer[ 48 ];
+				char * first = buffer + sizeof( buffer );
+				for( int written = 0; digits > 0 || written <= scale; ++written ) {
+					if( written == scale && scale > 0 ) {
+						*--first = '.';
+					}
+					*--first = static_cast<char>( '0' + digits % 10 );
+					digits /= 10;
+				}
+				if( x < 0 ) {
+					*--first = '-';
+				}
+				out.append( first, buffer + sizeof( buffer ) );
+				return;
+			}
+		}
+	}
+	char buffer[ 32 ];
+	int length = std::snprintf( buffer, sizeof( buffer ), "%.17g", x );
+	out.append( buffer, static_cast<std::size_t>( length ) );
+}
+
+template <class Point>
+void append_point( std::string & out, Point const & p ) {
+	out += '(';
+	for( auto it = p.begin(); it != p.end(); ++it ) {
+		if( it != p.begin() ) {
+			out += ',';
+		}
+		append_number( out, *it );
+	}
+	out += ')';
+}
+
+/*
+Reads query records of n numbers, one per line, from fd as they arrive and writes one line per
+record to standard output. Whatever complete lines a read returns form a batch, which is parsed,
+answered and formatted in parallel chunks, then written in input order and flushed, so a client
+writing one query at a time into a pipe gets each answer right away, while a file is answered in
+large batches. Every chunk records its traversal statistics separately, and they are merged
+into stats when the batch is done.
+*/
+template <std::size_t n, class Answer>
+void stream_records( int fd, kdtree::thread_pool & pool, kdtree::query_stats & stats, Answer answer ) {
+	kdtree::parallel_policy policy( pool );
+	std::vector<char> buffer( std::size_t( 1 ) << 22 );
+	std::size_t filled = 0;
+	std::size_t line = 1;
+	bool done = false;
+	while( !done ) {
+		if( filled == buffer.size() ) {
+			buffer.resize( 2 * buffer.size() );
+		}
+		ssize_t count = read( fd, buffer.data() + filled, buffer.size() - filled );
+		if( count < 0 ) {
+			if( errno == EINTR ) {
+				continue;
+			}
+			throw std::runtime_error( strerror( errno ) );
+		}
+		filled += static_cast<std::size_t>( count );
+		done = count == 0;
+		char const * complete = buffer.data() + filled;
+		while( !done && complete != buffer.data() && *(complete - 1) != '\n' ) {
+			--complete;
+		}
+		if( complete == buffer.data() ) {
+			continue;
+		}
+		auto records = kdtree::parse_points<double,n>( buffer.data(), complete, DELIMITER, policy, line );
+		line += static_cast<std::size_t>( std::count( static_cast<char const *>( buffer.data() ), complete, '\n' ) );
+		std::size_t chunk_size = std::max<std::size_t>( 64, records.size() / (4 * pool.concurrency()) + 1 );
+		std::vector<std::string> outputs( (records.size() + chunk_size - 1) / chunk_size );
+		std::vector<kdtree::query_stats> chunk_stats( outputs.size() );
+		{
+			kdtree::task_group group( pool );
+			for( std::size_t chunk = 0; chunk < outputs.size(); ++chunk ) {
+				group.run( [ &, chunk ]() {
+							std::string & output = outputs[ chunk ];
+							for( std::size_t i = chunk * chunk_size; i < std::min( records.size(), (chunk + 1) * chunk_size ); ++i ) {
+								answer( records[ i ], output, chunk_stats[ chunk ] );
+								output += '\n';
+							}
+						} );
+			}
+			group.wait();
+		}
+		for( auto const & chunk : chunk_stats ) {
+			stats.merge( chunk );
+		}
+		for( auto const & output : outputs ) {
+			std::cout.write( output.data(), static_cast<std::streamsize>( output.size() ) );
+		}
+		std::cout.flush();
+		std::size_t rest = buffer.data() + filled - complete;
+		std::memmove( buffer.data(), complete, rest );
+		filled = rest;
+	}
+}
+
+// writes the points that a search reports through a visitor, separated by the delimiter
+template <class RandomAccessIterator>
+auto delimited_output( std::string & out ) {
+	return [ &out, first = true ]( RandomAccessIterator it ) mutable {
+		if( !first ) {
+			out += DELIMITER;
+		}
+		first = false;
+		append_point( out, *it );
+	};
+}
+
+/*
+Answers the queries of a command, searching each chunk of them in the layout that chunk_layout
+makes from the statistics of the chunk.
+*/
+template <class RandomAccessIterator, class ChunkLayout>
+void answer_queries_with( query_command command, RandomAccessIterator begin, RandomAccessIterator end, ChunkLayout chunk_layout, int fd, kdtree::thread_pool & pool, std::size_t k, bool count, kdtree::query_stats & stats ) {
+	using point = kdtree::point<double,2>;
+	switch( command ) {
+		case NN:
+			stream_records<2>( fd, pool, stats, [ & ]( point const & query, std::string & out, kdtree::query_stats & chunk ) {
+						RandomAccessIterator it = kdtree::nnsearch_kdtree( begin, end, query, chunk_layout( chunk ) );
+						if( it != end ) {
+							append_point( out, *it );
+						}
+					} );
+			break;
+		case KNN:
+			stream_records<2>( fd, pool, stats, [ & ]( point const & query, std::string & out, kdtree::query_stats & chunk ) { kdtree::nnsearch_kdtree( begin, end, query, k, delimited_output<RandomAccessIterator>( out ), chunk_layout( chunk ) ); } );
+			break;
+		case RANGE:
+			stream_records<4>( fd, pool, stats, [ & ]( kdtree::point<double,4> const & record, std::string & out, kdtree::query_stats & chunk ) {
+						point min( record[ 0 ], record[ 1 ] );
+						point max( record[ 2 ], record[ 3 ] );
+						if( count ) {
+							out += std::to_string( kdtree::rangecount_kdtree( begin, end, min, max, chunk_layout( chunk ) ) );
+						} else {
+							kdtree::rangequery_kdtree( begin, end, min, max, delimited_output<RandomAccessIterator>( out ), chunk_layout( chunk ) );
+						}
+					} );
+			break;
+		case RADIUS:
+			stream_records<3>( fd, pool, stats, [ & ]( kdtree::point<double,3> const & record, std::string & out, kdtree::query_stats & chunk ) {
+						point center( record[ 0 ], record[ 1 ] );
+						if( count ) {
+							out += std::to_string( kdtree::radiuscount_kdtree( begin, end, center, record[ 2 ], chunk_layout( chunk ) ) );
+						} else {
+							kdtree::radiusquery_kdtree( begin, end, center, record[ 2 ], delimited_output<RandomAccessIterator>( out ), chunk_layout( chunk ) );
+						}
+					} );
+			break;
+		case EXACT:
+			stream_records<2>( fd, pool, stats, [ & ]( point const & query, std::string & out, kdtree::query_stats & chunk ) { out += kdtree::search_kdtree( begin, end, query, chunk_layout( chunk ) ) != end ? '1' : '0'; } );
+			break;
+		case BUILD:
+			break;
+	}
+}
+
+// searches record their statistics only with --stats, so that the plain searches stay uninstrumented
+template <class RandomAccessIterator, class Layout>
+void answer_queries( query_command command, RandomAccessIterator begin, RandomAccessIterator end, Layout layout, int fd, kdtree::thread_pool & pool, std::size_t k, bool count, kdtree::query_stats * stats ) {
+	kdtree::query_stats unused;
+	if( stats != nullptr ) {
+		answer_queries_with( command, begin, end, [ layout ]( kdtree::query_stats & chunk ) { return kdtree::with_stats( layout, chunk ); }, fd, pool, k, count, *stats );
+	} else {
+		answer_queries_with( command, begin, end, [ layout ]( kdtree::query_stats & ) { return layout; }, fd, pool, k, count, unused );
+	}
+}
+
+void print_stats( std::ostream & os, kdtree::query_stats const & stats ) {
+	double queries = static_cast<double>( std::max<std::size_t>( stats.queries(), 1 ) );
+	auto line = [ &os, queries ]( char const * name, std::size_t value ) {
+		os << std::left << std::setw( 16 ) << name << std::right << std::setw( 14 ) << value << std::fixed << std::setprecision( 2 ) << std::setw( 14 ) << static_cast<double>( value ) / queries << " per query\n";
+	};
+	os << std::left << std::setw( 16 ) << "queries" << std::right << std::setw( 14 ) << stats.queries() << "\n";
+	line( "nodes visited", stats.nodes_visited() );
+	line( "pruned", stats.pruned() );
+	line( "distances", stats.distances() );
+	line( "results", stats.results() );
+	os << std::left << std::setw( 16 ) << "max depth" << std::right << std::setw( 14 ) << stats.max_depth() << "\n";
+}
+
 int main( int argc, char* argv[] ) {
 	// disable I/O sychronization for better I/O performance
 	std::ios_base::sync_with_stdio( false );
 
-	std::ifstream ifs;
+	std::string input_path;
+	std::string snapshot_path;
+	std::string load_path;
+	std::string queries_path;
+	// hardware_concurrency() is 0 when unknown, and the pool below takes threads - 1 workers
+	std::size_t threads = std::max<std::size_t>( std::thread::hardware_concurrency(), 1 );
+	std::size_t neighbors = 1;
+	bool count = false;
+	bool record_stats = false;
+
+	// the command, if any, comes first, and options are parsed after it
+	query_command command = BUILD;
+	if( argc > 1 ) {
+		static std::pair<char const *, query_command> const commands[] = { { "build", BUILD }, { "nn", NN }, { "knn", KNN }, { "range", RANGE }, { "radius", RADIUS }, { "exact", EXACT } };
+		for( auto const & candidate : commands ) {
+			if( strcmp( argv[1], candidate.first ) == 0 ) {
+				command = candidate.second;
+				optind = 2;
+			}
+		}
+	}
 
 	int c;
 	int option_index = 0;
 	while( true ) {
 		static struct option long_options[] = {
+				{ "snapshot", required_argument, 0, 's' },
+				{ "load", required_argument, 0, 'l' },
+				{ "queries", required_argument, 0, 'q' },
+				{ "neighbors", required_argument, 0, 'k' },
+				{ "count", no_argument, 0, 'c' },
+				{ "stats", no_argument, 0, 'S' },
+				{ "threads", required_argument, 0, 'j' },
 				{ "delimiter", required_argument, 0, 't' },
 				{ "verbosity", required_argument, 0, 'v' },
 				{ "help", no_argument, 0, 'h' },
 				{ "version", no_argument, 0, 'V' }
 				};
-		c = getopt_long( argc, argv, "t:v:whV", long_options, &option_index );
+		c = getopt_long( argc, argv, "s:l:q:k:cj:t:v:whV", long_options, &option_index );
 		if( c == -1 ) {
 			break;
 		}
 		switch( c ) {
+			case 's':
+				snapshot_path = optarg;
+				break;
+			case 'l':
+				load_path = optarg;
+				break;
+			case 'q':
+				queries_path = optarg;
+				break;
+			case 'k': {
+				char * last = nullptr;
+				long value = strtol( optarg, &last, 10 );
+				if( *last != '\0' || value < 1 ) {
+					std::cerr << argv[0] << ":  -k, --neighbors=N  must be a positive integer\n";
+					return 1;
+				}
+				neighbors = static_cast<std::size_t>( value );
+				break;
+			}
+			case 'c':
+				count = true;
+				break;
+			case 'S':
+				record_stats = true;
+				break;
+			case 'j': {
+				char * last = nullptr;
+				long value = strtol( optarg, &last, 10 );
+				if( *last != '\0' || value < 1 ) {
+					std::cerr << argv[0] << ":  -j, --threads=N  must be a positive integer\n";
+					return 1;
+				}
+				threads = static_cast<std::size_t>( value );
+				break;
+			}
 			case 't':
 				if( strcmp( optarg, "\\t" ) == 0 ) {
 					DELIMITER = '\t';
@@ -140,7 +455,7 @@ int main( int argc, char* argv[] ) {
 	}
 	if( optind < argc ) {
 		if( optind == argc - 1 ) {
-			ifs = std::ifstream( argv[optind] );
+			input_path = argv[optind];
 			log_message( (std::string( "FILE = " ) + std::string( argv[optind] )).c_str(), DEBUG, STANDARD );
 		} else {
 			std::cerr << argv[0] << ": " << "too many arguments\n";
@@ -149,35 +464,127 @@ int main( int argc, char* argv[] ) {
 		}
 	}
 
+	if( command == BUILD && (!load_path.empty() || !queries_path.empty() || record_stats) ) {
+		std::cerr << argv[0] << ": " << "--load, --queries and --stats only apply to query commands\n";
+		short_usage( argv[0] );
+		return 1;
+	}
+	if( command != BUILD && !snapshot_path.empty() ) {
+		std::cerr << argv[0] << ": " << "--snapshot only applies to the build command\n";
+		short_usage( argv[0] );
+		return 1;
+	}
+	if( !load_path.empty() && !input_path.empty() ) {
+		std::cerr << argv[0] << ": " << "--load replaces the input file\n";
+		short_usage( argv[0] );
+		return 1;
+	}
+	if( command != BUILD && load_path.empty() && input_path.empty() && queries_path.empty() ) {
+		std::cerr << argv[0] << ": " << "the points and the queries cannot both come from standard input\n";
+		short_usage( argv[0] );
+		return 1;
+	}
+
+	kdtree::thread_pool pool( threads - 1 );
+	kdtree::parallel_policy policy( pool );
+
+	int queries_fd = STDIN_FILENO;
+	if( !queries_path.empty() ) {
+		queries_fd = open( queries_path.c_str(), O_RDONLY );
+		if( queries_fd < 0 ) {
+			std::cerr << argv[0] << ": cannot open " << queries_path << "\n";
+			return 1;
+		}
+	}
+	std::string queries_name = queries_path.empty() ? std::string( "standard input" ) : queries_path;
+	kdtree::query_stats stats;
+
+	if( !load_path.empty() ) {
+		log_message( "Mapping snapshot...", INFO, START );
+		std::unique_ptr< kdtree::mapped_snapshot<double,2> > snapshot;
+		try {
+			snapshot.reset( new kdtree::mapped_snapshot<double,2>( load_path ) );
+		} catch( std::runtime_error const & error ) {
+			std::cerr << argv[0] << ": " << load_path << ": " << error.what() << "\n";
+			return 1;
+		}
+		log_message( "DONE", INFO, FINISH );
+		log_message( "Answering queries...", INFO, START );
+		try {
+			snapshot->search( [ & ]( auto begin, auto end, auto layout ) { answer_queries( command, begin, end, layout, queries_fd, pool, neighbors, count, record_stats ? &stats : nullptr ); } );
+		} catch( std::runtime_error const & error ) {
+			std::cerr << argv[0] << ": " << queries_name << ": " << error.what() << "\n";
+			return 1;
+		}
+		log_message( "DONE", INFO, FINISH );
+		if( record_stats ) {
+			print_stats( std::cerr, stats );
+		}
+		return 0;
+	}
+
 	using point = kdtree::point<double,2>;
 
 	// read data
 	std::vector< point > points;
 	log_message( "Reading points...", INFO, START );
-	point p;
-	if( ifs.is_open() ) {
-		log_message( "Reading from file...", DEBUG, STANDARD );
-		while( ifs.good() ) {
-			ifs >> p;
-			points.push_back( p );
-		}
-	} else {
-		log_message( "Reading from standard input...", DEBUG, STANDARD );
-		while( std::cin.good() ) {
-			std::cin >> p;
-			points.push_back( p );
-			std::cin >> std::ws;
+	try {
+		if( !input_path.empty() ) {
+			log_message( "Reading from file...", DEBUG, STANDARD );
+			points = kdtree::read_points<double,2>( input_path, DELIMITER, policy );
+		} else {
+			log_message( "Reading from standard input...", DEBUG, STANDARD );
+			points = kdtree::read_points<double,2>( STDIN_FILENO, DELIMITER, policy );
 		}
+	} catch( std::runtime_error const & error ) {
+		std::cerr << argv[0] << ": " << (input_path.empty() ? std::string( "standard input" ) : input_path) << ": " << error.what() << "\n";
+		return 1;
 	}
 	log_message( "DONE", INFO, FINISH );
 
 	// generate k-d tree data structure
 	log_message( "Constructing k-d tree...", INFO, START );
-	kdtree::make_kdtree( points.begin(), points.end() );
+	kdtree::make_kdtree( policy, points.begin(), points.end() );
 	log_message( "DONE", INFO, FINISH );
 
+	if( command != BUILD ) {
+		log_message( "Answering queries...", INFO, START );
+		try {
+			answer_queries( command, points.cbegin(), points.cend(), kdtree::leaf_size(), queries_fd, pool, neighbors, count, record_stats ? &stats : nullptr );
+		} catch( std::runtime_error const & error ) {
+			std::cerr << argv[0] << ": " << queries_name << ": " << error.what() << "\n";
+			return 1;
+		}
+		log_message( "DONE", INFO, FINISH );
+		if( record_stats ) {
+			print_stats( std::cerr, stats );
+		}
+		return 0;
+	}
 
-	kdtree::print_kdtree( std::cout, points.begin(), points.end() );
+	if( !snapshot_path.empty() ) {
+		log_message( "Writing snapshot...", INFO, START );
+		std::ofstream ofs( snapshot_path, std::ios::binary );
+		if( !ofs.is_open() ) {
+			std::cerr << argv[0] << ": cannot open " << snapshot_path << " for writing\n";
+			return 1;
+		}
+		try {
+			kdtree::write_snapshot( ofs, points.cbegin(), points.cend() );
+		} catch( std::runtime_error const & error ) {
+			std::cerr << argv[0] << ": " << snapshot_path << ": " << error.what() << "\n";
+			return 1;
+		}
+		// the last buffered block is only written, and can only fail, when the stream is flushed
+		ofs.close();
+		if( ofs.fail() ) {
+			std::cerr << argv[0] << ": failed to write " << snapshot_path << "\n";
+			return 1;
+		}
+		log_message( "DONE", INFO, FINISH );
+	} else {
+		kdtree::print_kdtree( std::cout, points.begin(), points.end() );
+	}
 
 	return 0;
 }
@@ -0,0 +1,64 @@
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+#include "../include/distance.hpp"
+#include "../include/point.hpp"
+
+// small integer-valued coordinates keep every partial sum exact even in float, so all kernels must agree bit for bit
+template <typename T>
+void test_kernels( std::string const & name ) {
+	std::mt19937 generator( 3 );
+	std::size_t const count = 9;
+	std::size_t const max_d = 70;
+	bool matches = true;
+	for( std::size_t d = 1; d <= max_d; ++d ) {
+		std::vector<T> query( d );
+		std::vector<T> points( count * (d + 1) );
+		for( auto & x : query ) {
+			x = static_cast<T>( static_cast<int>( generator() % 201 ) - 100 );
+		}
+		for( auto & x : points ) {
+			x = static_cast<T>( static_cast<int>( generator() % 201 ) - 100 );
+		}
+		std::vector<typename kdtree::distance_traits<T>::type> distances( count );
+		kdtree::squared_euclidean_distances( query.data(), points.data(), count, d + 1, d, distances.data() );
+		for( std::size_t i = 0; i < count; ++i ) {
+			auto expected = kdtree::squared_euclidean_distance_scalar( query.data(), points.data() + i * (d + 1), d );
+			matches = matches && kdtree::squared_euclidean_distance( query.data(), points.data() + i * (d + 1), d ) == expected;
+			matches = matches && distances[ i ] == expected;
+		}
+	}
+	std::cout << name << " kernels match scalar reference for d=1.." << max_d << ": " << (matches ? "yes" : "no") << '\n';
+}
+
+int main( int argc, char* argv[] ) {
+	(void)argc;
+	(void)argv;
+
+	test_kernels<float>( "float" );
+	test_kernels<double>( "double" );
+	test_kernels<std::int32_t>( "int32" );
+	test_kernels<short>( "short" );
+
+	kdtree::point<int,2> a( 1, 2 );
+	kdtree::point<int,2> b( 4, -2 );
+	std::cout << "squared distance between " << a << " and " << b << ": " << kdtree::squared_euclidean_distance( a, b ) << '\n';
+
+	kdtree::point<float,2> c( 0.5f, 1.5f );
+	kdtree::point<float,2> e( -1.5f, 0.0f );
+	std::cout << "squared distance between " << c << " and " << e << ": " << kdtree::squared_euclidean_distance( c, e ) << '\n';
+
+	using widepoint = kdtree::point<double,32>;
+	widepoint f;
+	widepoint g;
+	for( std::size_t i = 0; i < widepoint::dimensionality(); ++i ) {
+		f[ i ] = static_cast<double>( i );
+		g[ i ] = static_cast<double>( i ) + 0.5;
+	}
+	std::cout << "squared distance between 32-dimensional points offset by 0.5: " << kdtree::squared_euclidean_distance( f, g ) << '\n';
+
+	return 0;
+}
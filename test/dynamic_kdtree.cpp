@@ -0,0 +1,116 @@
+#include <algorithm>
+#include <cstddef>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+#include "../include/dynamic_kdtree.hpp"
+#include "../include/metric.hpp"
+#include "../include/point.hpp"
+
+using intpoint = kdtree::point<int,3>;
+
+// applies the same random inserts and erases to a dynamic tree and to a plain vector, and compares every query against a linear scan of the vector
+template <class Layout>
+void test_dynamic( std::string const & name, Layout layout ) {
+	std::mt19937 generator( 23 );
+	// a small coordinate range makes duplicates common
+	auto random_point = [ &generator ]() { return intpoint( static_cast<int>( generator() % 60 ), static_cast<int>( generator() % 60 ), static_cast<int>( generator() % 60 ) ); };
+	kdtree::dynamic_kdtree<intpoint,Layout> tree( layout );
+	std::vector<intpoint> reference;
+	bool sizes_match = true;
+	bool erase_matches = true;
+	bool range_matches = true;
+	bool count_matches = true;
+	bool radius_matches = true;
+	bool knn_matches = true;
+	for( std::size_t step = 0; step < 6000; ++step ) {
+		// inserts outweigh erases at first, and erases catch up later so that compaction kicks in
+		if( generator() % 10 < (step < 4000 ? 7u : 2u) || reference.empty() ) {
+			intpoint p = random_point();
+			tree.insert( p );
+			reference.push_back( p );
+		} else {
+			intpoint p = generator() % 4 == 0 ? random_point() : reference[ generator() % reference.size() ];
+			auto found = std::find( reference.begin(), reference.end(), p );
+			bool expected = found != reference.end();
+			if( expected ) {
+				reference.erase( found );
+			}
+			erase_matches = erase_matches && tree.erase( p ) == expected;
+		}
+		sizes_match = sizes_match && tree.size() == reference.size();
+		if( step % 50 == 0 ) {
+			intpoint q = random_point();
+			intpoint upper = q + intpoint( 15, 15, 15 );
+			auto in_box = [ & ]( intpoint const & p ) { return q[ 0 ] <= p[ 0 ] && p[ 0 ] <= upper[ 0 ] && q[ 1 ] <= p[ 1 ] && p[ 1 ] <= upper[ 1 ] && q[ 2 ] <= p[ 2 ] && p[ 2 ] <= upper[ 2 ]; };
+			std::vector<intpoint> expected;
+			std::copy_if( reference.begin(), reference.end(), std::back_inserter( expected ), in_box );
+			std::sort( expected.begin(), expected.end() );
+			std::vector<intpoint> found = tree.rangequery( q, upper );
+			std::sort( found.begin(), found.end() );
+			range_matches = range_matches && found == expected;
+			count_matches = count_matches && tree.rangecount( q, upper ) == expected.size();
+			auto distance = [ &q ]( intpoint const & p ) { return kdtree::reduced_distance<double>( kdtree::manhattan_metric(), p, q ); };
+			expected.clear();
+			std::copy_if( reference.begin(), reference.end(), std::back_inserter( expected ), [ & ]( intpoint const & p ) { return distance( p ) <= 20.0; } );
+			std::sort( expected.begin(), expected.end() );
+			found = tree.radiusquery( q, 20.0, kdtree::manhattan_metric() );
+			std::sort( found.begin(), found.end() );
+			radius_matches = radius_matches && found == expected;
+			std::vector<double> distances;
+			for( auto const & p : reference ) {
+				distances.push_back( distance( p ) );
+			}
+			std::sort( distances.begin(), distances.end() );
+			std::vector<intpoint> neighbors = tree.nnsearch( q, 12, kdtree::manhattan_metric() );
+			knn_matches = knn_matches && neighbors.size() == std::min<std::size_t>( 12, reference.size() );
+			for( std::size_t i = 0; knn_matches && i < neighbors.size(); ++i ) {
+				knn_matches = distance( neighbors[ i ] ) == distances[ i ];
+			}
+		}
+	}
+	std::cout << name << " size follows inserts and erases: " << (sizes_match ? "yes" : "no") << "\n";
+	std::cout << name << " erase finds exactly the present points: " << (erase_matches ? "yes" : "no") << "\n";
+	std::cout << name << " range queries match a linear scan: " << (range_matches ? "yes" : "no") << "\n";
+	std::cout << name << " range counts match a linear scan: " << (count_matches ? "yes" : "no") << "\n";
+	std::cout << name << " radius queries match a linear scan: " << (radius_matches ? "yes" : "no") << "\n";
+	std::cout << name << " k nearest neighbors match a linear scan: " << (knn_matches ? "yes" : "no") << "\n";
+}
+
+int main( int argc, char* argv[] ) {
+	(void)argc;
+	(void)argv;
+
+	std::cout << "Testing the forest structure:\n\n";
+
+	{
+		kdtree::dynamic_kdtree<intpoint> tree;
+		for( int i = 0; i < 11; ++i ) {
+			tree.insert( intpoint( i, i, i ) );
+		}
+		// 11 = 1011 in binary, so trees 0, 1 and 3 hold 1, 2 and 8 points
+		std::cout << "trees after 11 inserts: " << tree.tree_count() << "\n";
+		std::cout << "points in the unit cube around (5,5,5): " << tree.rangecount( intpoint( 4, 4, 4 ), intpoint( 6, 6, 6 ) ) << "\n";
+		for( int i = 0; i < 6; ++i ) {
+			tree.erase( intpoint( i, i, i ) );
+		}
+		std::cout << "size after erasing 6: " << tree.size() << "\n";
+		tree.compact();
+		// the 5 remaining points fit in tree 3, which holds up to 8
+		std::cout << "trees after compaction: " << tree.tree_count() << "\n";
+		std::cout << "erasing a missing point: " << (tree.erase( intpoint( 0, 0, 0 ) ) ? "found" : "not found") << "\n";
+		std::vector<intpoint> nearest = tree.nnsearch( intpoint( 0, 0, 0 ), 2 );
+		std::cout << "two nearest live points to the origin: " << nearest[ 0 ] << " " << nearest[ 1 ] << "\n";
+		tree.clear();
+		std::cout << "size after clear: " << tree.size() << ", nearest neighbors found: " << tree.nnsearch( intpoint( 0, 0, 0 ), 3 ).size() << "\n";
+	}
+
+	std::cout << "\n\nTesting inserts and erases against a linear scan:\n\n";
+
+	test_dynamic( "leaf size 1", kdtree::leaf_size() );
+	test_dynamic( "leaf size 8", kdtree::leaf_size( 8 ) );
+	test_dynamic( "breadth-first layout", kdtree::eytzinger_layout() );
+
+	return 0;
+}
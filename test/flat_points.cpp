@@ -0,0 +1,283 @@
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+#include <random>
+#include <string>
+#include <vector>
+#include "../include/flat_points.hpp"
+#include "../include/kdtree.hpp"
+#include "../include/point.hpp"
+
+// counts allocations, to check that searches of rows reuse their per-axis state
+static std::atomic<std::size_t> allocations( 0 );
+
+void * operator new( std::size_t size ) {
+	++allocations;
+	if( void * p = std::malloc( size > 0 ? size : 1 ) ) {
+		return p;
+	}
+	throw std::bad_alloc();
+}
+
+void operator delete( void * p ) noexcept {
+	std::free( p );
+}
+
+void operator delete( void * p, std::size_t ) noexcept {
+	std::free( p );
+}
+
+template <class T, std::size_t d>
+bool same_points( kdtree::flat_points<T> const & rows, std::vector< kdtree::point<T,d> > const & points ) {
+	if( rows.size() != points.size() ) {
+		return false;
+	}
+	for( std::size_t i = 0; i < points.size(); ++i ) {
+		if( !std::equal( points[ i ].cbegin(), points[ i ].cend(), rows[ i ].begin(), rows[ i ].end() ) ) {
+			return false;
+		}
+	}
+	return true;
+}
+
+template <class RowIterator, class PointIterator>
+bool same_positions( std::vector<RowIterator> const & rows, RowIterator row_begin, std::vector<PointIterator> const & points, PointIterator point_begin ) {
+	return std::equal( rows.cbegin(), rows.cend(), points.cbegin(), points.cend(), [ & ]( RowIterator lhs, PointIterator rhs ) { return lhs - row_begin == rhs - point_begin; } );
+}
+
+// builds the same data as rows and as kdtree::point and checks that every search agrees
+template <std::size_t d>
+void test_against_points( std::size_t n, float scale ) {
+	using point_type = kdtree::point<float,d>;
+	std::mt19937 generator( static_cast<std::uint32_t>( d ) );
+	std::uniform_real_distribution<float> coordinate( 0.0f, scale );
+	kdtree::flat_points<float> data( n, d );
+	std::vector<point_type> points( n );
+	for( std::size_t i = 0; i < n; ++i ) {
+		for( std::size_t dim = 0; dim < d; ++dim ) {
+			data[ i ][ dim ] = points[ i ][ dim ] = coordinate( generator );
+		}
+	}
+	kdtree::flat_points<float> queries( 200, d );
+	kdtree::flat_points<float> uppers( queries.size(), d );
+	std::vector<point_type> point_queries( queries.size() );
+	std::vector<point_type> point_uppers( queries.size() );
+	for( std::size_t i = 0; i < queries.size(); ++i ) {
+		for( std::size_t dim = 0; dim < d; ++dim ) {
+			queries[ i ][ dim ] = point_queries[ i ][ dim ] = coordinate( generator );
+			uppers[ i ][ dim ] = point_uppers[ i ][ dim ] = queries[ i ][ dim ] + scale / 2;
+		}
+	}
+	double radius = scale * 0.3 * std::sqrt( static_cast<double>( d ) );
+
+	std::cout << "d=" << d << ":\n";
+	kdtree::leaf_size leaf( 6 );
+	kdtree::flat_points<float> tree( data );
+	std::vector<point_type> point_tree( points );
+	kdtree::make_kdtree( tree.begin(), tree.end(), leaf );
+	kdtree::make_kdtree( point_tree.begin(), point_tree.end(), leaf );
+	std::cout << "rows are laid out as points: " << (same_points( tree, point_tree ) ? "yes" : "no") << "\n";
+
+	auto begin = tree.cbegin();
+	auto end = tree.cend();
+	auto point_begin = point_tree.cbegin();
+	auto point_end = point_tree.cend();
+	bool exact_matches = true;
+	bool nn_matches = true;
+	bool knn_matches = true;
+	bool approximate_matches = true;
+	bool range_matches = true;
+	bool radius_matches = true;
+	bool count_matches = true;
+	bool aggregate_matches = true;
+	for( std::size_t i = 0; i < queries.size(); ++i ) {
+		auto q = queries[ i ];
+		auto const & p = point_queries[ i ];
+		exact_matches = exact_matches && kdtree::search_kdtree( begin, end, tree[ i * 7 ], leaf ) - begin == kdtree::search_kdtree( point_begin, point_end, point_tree[ i * 7 ], leaf ) - point_begin;
+		nn_matches = nn_matches && kdtree::nnsearch_kdtree( begin, end, q, leaf ) - begin == kdtree::nnsearch_kdtree( point_begin, point_end, p, leaf ) - point_begin;
+		knn_matches = knn_matches && same_positions( kdtree::nnsearch_kdtree( begin, end, q, 8, leaf ), begin, kdtree::nnsearch_kdtree( point_begin, point_end, p, 8, leaf ), point_begin );
+		approximate_matches = approximate_matches && same_positions( kdtree::nnsearch_kdtree( begin, end, q, 8, kdtree::approximation( 0.5, 200 ), leaf ), begin, kdtree::nnsearch_kdtree( point_begin, point_end, p, 8, kdtree::approximation( 0.5, 200 ), leaf ), point_begin );
+		range_matches = range_matches && same_positions( kdtree::rangequery_kdtree( begin, end, q, uppers[ i ], leaf ), begin, kdtree::rangequery_kdtree( point_begin, point_end, p, point_uppers[ i ], leaf ), point_begin );
+		radius_matches = radius_matches && same_positions( kdtree::radiusquery_kdtree( begin, end, q, radius, leaf ), begin, kdtree::radiusquery_kdtree( point_begin, point_end, p, radius, leaf ), point_begin );
+		count_matches = count_matches && kdtree::rangecount_kdtree( begin, end, q, uppers[ i ], leaf ) == kdtree::rangecount_kdtree( point_begin, point_end, p, point_uppers[ i ], leaf );
+		count_matches = count_matches && kdtree::radiuscount_kdtree( begin, end, q, radius, leaf ) == kdtree::radiuscount_kdtree( point_begin, point_end, p, radius, leaf );
+		auto aggregate = kdtree::radiusaggregate_kdtree( begin, end, q, radius, leaf );
+		auto point_aggregate = kdtree::radiusaggregate_kdtree( point_begin, point_end, p, radius, leaf );
+		aggregate_matches = aggregate_matches && aggregate.dimensionality() == d && aggregate.count() == point_aggregate.count();
+		for( std::size_t dim = 0; dim < d; ++dim ) {
+			aggregate_matches = aggregate_matches && aggregate.sum( dim ) == point_aggregate.sum( dim );
+		}
+	}
+	std::cout << "exact search matches points: " << (exact_matches ? "yes" : "no") << "\n";
+	std::cout << "nearest neighbor matches points: " << (nn_matches ? "yes" : "no") << "\n";
+	std::cout << "k nearest neighbors match points: " << (knn_matches ? "yes" : "no") << "\n";
+	std::cout << "approximate k nearest neighbors match points: " << (approximate_matches ? "yes" : "no") << "\n";
+	std::cout << "range query matches points: " << (range_matches ? "yes" : "no") << "\n";
+	std::cout << "radius query matches points: " << (radius_matches ? "yes" : "no") << "\n";
+	std::cout << "count queries match points: " << (count_matches ? "yes" : "no") << "\n";
+	std::cout << "aggregate queries match points: " << (aggregate_matches ? "yes" : "no") << "\n";
+
+	kdtree::flat_points<float> presorted( data );
+	kdtree::make_kdtree( presorted.begin(), presorted.end(), leaf, kdtree::presorted_construction() );
+	kdtree::flat_points<float> sampled( data );
+	kdtree::make_kdtree( sampled.begin(), sampled.end(), leaf, kdtree::sampled_construction( 64 ) );
+	kdtree::flat_points<float> parallel( data );
+	kdtree::make_kdtree( kdtree::parallel_policy( 4, 500 ), parallel.begin(), parallel.end(), leaf );
+	std::cout << "presorted, sampled and parallel construction lay rows out as points: " << (same_points( presorted, point_tree ) && same_points( sampled, point_tree ) && same_points( parallel, point_tree ) ? "yes" : "no") << "\n";
+
+	kdtree::flat_points<float> eytzinger( data );
+	std::vector<point_type> point_eytzinger( points );
+	kdtree::make_kdtree( eytzinger.begin(), eytzinger.end(), kdtree::eytzinger_layout() );
+	kdtree::make_kdtree( point_eytzinger.begin(), point_eytzinger.end(), kdtree::eytzinger_layout() );
+	kdtree::flat_points<float> parallel_eytzinger( data );
+	kdtree::make_kdtree( kdtree::parallel_policy( 4, 500 ), parallel_eytzinger.begin(), parallel_eytzinger.end(), kdtree::eytzinger_layout() );
+	bool eytzinger_matches = same_points( eytzinger, point_eytzinger ) && same_points( parallel_eytzinger, point_eytzinger );
+	for( std::size_t i = 0; i < queries.size(); ++i ) {
+		eytzinger_matches = eytzinger_matches && kdtree::nnsearch_kdtree( eytzinger.cbegin(), eytzinger.cend(), queries[ i ], kdtree::eytzinger_layout() ) - eytzinger.cbegin() == kdtree::nnsearch_kdtree( point_eytzinger.cbegin(), point_eytzinger.cend(), point_queries[ i ], kdtree::eytzinger_layout() ) - point_eytzinger.cbegin();
+	}
+	std::cout << "breadth-first layout matches points: " << (eytzinger_matches ? "yes" : "no") << "\n";
+
+	kdtree::split_skeleton<float> skeleton( leaf, kdtree::split_rule::widest_spread );
+	kdtree::flat_points<float> skeleton_tree( data );
+	kdtree::make_kdtree( skeleton_tree.begin(), skeleton_tree.end(), skeleton );
+	kdtree::split_skeleton<float> point_skeleton( leaf, kdtree::split_rule::widest_spread );
+	std::vector<point_type> point_skeleton_tree( points );
+	kdtree::make_kdtree( point_skeleton_tree.begin(), point_skeleton_tree.end(), point_skeleton );
+	kdtree::split_skeleton<float> parallel_skeleton( leaf, kdtree::split_rule::widest_spread );
+	kdtree::flat_points<float> parallel_skeleton_tree( data );
+	kdtree::make_kdtree( kdtree::parallel_policy( 4, 500 ), parallel_skeleton_tree.begin(), parallel_skeleton_tree.end(), parallel_skeleton );
+	bool skeleton_matches = same_points( skeleton_tree, point_skeleton_tree ) && skeleton.splits() == point_skeleton.splits() && same_points( parallel_skeleton_tree, point_skeleton_tree ) && parallel_skeleton.splits() == skeleton.splits();
+	for( std::size_t i = 0; i < queries.size(); ++i ) {
+		skeleton_matches = skeleton_matches && same_positions( kdtree::nnsearch_kdtree( skeleton_tree.cbegin(), skeleton_tree.cend(), queries[ i ], 8, skeleton.view() ), skeleton_tree.cbegin(), kdtree::nnsearch_kdtree( point_skeleton_tree.cbegin(), point_skeleton_tree.cend(), point_queries[ i ], 8, point_skeleton.view() ), point_skeleton_tree.cbegin() );
+	}
+	std::cout << "split skeleton matches points: " << (skeleton_matches ? "yes" : "no") << "\n";
+
+	kdtree::parallel_policy policy( 4 );
+	std::vector<std::size_t> nearest( queries.size() );
+	std::vector<std::size_t> point_nearest( queries.size() );
+	kdtree::nnsearch_kdtree_batch( policy, begin, end, queries.cbegin(), queries.cend(), nearest.begin(), leaf );
+	kdtree::nnsearch_kdtree_batch( policy, point_begin, point_end, point_queries.cbegin(), point_queries.cend(), point_nearest.begin(), leaf );
+	bool batch_matches = nearest == point_nearest;
+	std::vector<std::size_t> offsets( queries.size() + 1 );
+	std::vector<std::size_t> point_offsets( queries.size() + 1 );
+	std::vector<std::size_t> indices;
+	std::vector<std::size_t> point_indices;
+	kdtree::nnsearch_kdtree_batch( policy, begin, end, queries.cbegin(), queries.cend(), 8, offsets.begin(), indices, leaf );
+	kdtree::nnsearch_kdtree_batch( policy, point_begin, point_end, point_queries.cbegin(), point_queries.cend(), 8, point_offsets.begin(), point_indices, leaf );
+	batch_matches = batch_matches && offsets == point_offsets && indices == point_indices;
+	kdtree::rangequery_kdtree_batch( policy, begin, end, queries.cbegin(), queries.cend(), uppers.cbegin(), offsets.begin(), indices, leaf );
+	kdtree::rangequery_kdtree_batch( policy, point_begin, point_end, point_queries.cbegin(), point_queries.cend(), point_uppers.cbegin(), point_offsets.begin(), point_indices, leaf );
+	batch_matches = batch_matches && offsets == point_offsets && indices == point_indices;
+	kdtree::radiusquery_kdtree_batch( policy, begin, end, queries.cbegin(), queries.cend(), radius, offsets.begin(), indices, leaf );
+	kdtree::radiusquery_kdtree_batch( policy, point_begin, point_end, point_queries.cbegin(), point_queries.cend(), radius, point_offsets.begin(), point_indices, leaf );
+	batch_matches = batch_matches && offsets == point_offsets && indices == point_indices;
+	std::cout << "batch queries match points: " << (batch_matches ? "yes" : "no") << "\n";
+}
+
+int main( int argc, char* argv[] ) {
+	(void)argc;
+	(void)argv;
+
+	std::cout << "Testing storage:\n\n";
+
+	{
+		kdtree::flat_points<float> low( 5, 3 );
+		kdtree::flat_points<float> high( 5, 20 );
+		kdtree::flat_points<double> wide( 5, 20 );
+		std::cout << "short rows are packed: " << (low.stride() == 3 ? "yes" : "no") << "\n";
+		std::cout << "long rows are padded to the alignment: " << (high.stride() == 32 && wide.stride() == 24 ? "yes" : "no") << "\n";
+		std::cout << "rows are aligned: " << (reinterpret_cast<std::uintptr_t>( high.data() ) % kdtree::row_alignment == 0 && reinterpret_cast<std::uintptr_t>( wide[ 3 ].data() ) % kdtree::row_alignment == 0 ? "yes" : "no") << "\n";
+
+		float packed[] = { 1, 2, 3, 4, 5, 6 };
+		kdtree::flat_points<float> rows( packed, 2, 3 );
+		rows[ 1 ][ 2 ] = 7;
+		std::cout << "rows read back: " << rows[ 0 ] << " " << rows[ 1 ] << "\n";
+		std::cout << "iterators step by rows: " << (rows.end() - rows.begin() == 2 && *(rows.cbegin() + 1) == rows[ 1 ] ? "yes" : "no") << "\n";
+
+		kdtree::flat_points<float> padded( high );
+		high[ 4 ][ 19 ] = 1;
+		bool zero_padding = true;
+		for( std::size_t i = 0; i < padded.size(); ++i ) {
+			zero_padding = zero_padding && std::all_of( padded.data() + i * padded.stride(), padded.data() + (i + 1) * padded.stride(), []( float x ) { return x == 0; } );
+		}
+		std::cout << "copies are deep and padding is zero: " << (zero_padding ? "yes" : "no") << "\n";
+
+		kdtree::flat_points<float> empty;
+		kdtree::make_kdtree( empty.begin(), empty.end() );
+		std::cout << "empty storage has no rows: " << (empty.begin() == empty.end() && kdtree::nnsearch_kdtree( empty.cbegin(), empty.cend(), rows[ 0 ] ) == empty.cend() ? "yes" : "no") << "\n";
+	}
+
+	std::cout << "\n\nTesting searches against points:\n\n";
+
+	test_against_points<3>( 5000, 100.0f );
+	test_against_points<20>( 5000, 1.0f );
+
+	std::cout << "\n\nTesting runtime dimensionality:\n\n";
+
+	{
+		std::mt19937 generator( 5 );
+		std::uniform_real_distribution<double> coordinate( 0.0, 1.0 );
+		for( std::size_t d : { std::size_t( 1 ), std::size_t( 7 ), std::size_t( 33 ) } ) {
+			kdtree::flat_points<double> data( 3000, d );
+			for( std::size_t i = 0; i < data.size(); ++i ) {
+				for( std::size_t dim = 0; dim < d; ++dim ) {
+					data[ i ][ dim ] = coordinate( generator );
+				}
+			}
+			kdtree::flat_points<double> tree( data );
+			kdtree::make_kdtree( tree.begin(), tree.end() );
+			bool matches = true;
+			for( std::size_t i = 0; i < data.size(); i += 37 ) {
+				auto q = data[ i ];
+				auto nearest = kdtree::nnsearch_kdtree( tree.cbegin(), tree.cend(), q );
+				matches = matches && *nearest == q;
+				auto neighbors = kdtree::nnsearch_kdtree( tree.cbegin(), tree.cend(), q, 5 );
+				double kth = kdtree::squared_euclidean_distance( neighbors.back()[ 0 ].data(), q.data(), d );
+				std::size_t closer = 0;
+				for( auto row : tree ) {
+					closer += kdtree::squared_euclidean_distance( row.data(), q.data(), d ) < kth ? 1 : 0;
+				}
+				matches = matches && closer < 5;
+			}
+			std::cout << "d=" << d << " nearest neighbors match a linear scan: " << (matches ? "yes" : "no") << "\n";
+		}
+	}
+
+	std::cout << "\n\nTesting allocation:\n\n";
+
+	{
+		std::size_t const d = 40;
+		std::mt19937 generator( 23 );
+		std::uniform_real_distribution<float> coordinate( 0.0f, 1.0f );
+		kdtree::flat_points<float> tree( 3000, d );
+		kdtree::flat_points<float> queries( 50, d );
+		kdtree::flat_points<float> upper( 50, d );
+		for( auto row : tree ) {
+			std::generate( row.begin(), row.end(), [ & ]() { return coordinate( generator ); } );
+		}
+		for( std::size_t i = 0; i < queries.size(); ++i ) {
+			std::generate( queries[ i ].begin(), queries[ i ].end(), [ & ]() { return coordinate( generator ); } );
+			std::transform( queries[ i ].begin(), queries[ i ].end(), upper[ i ].begin(), []( float x ) { return x + 0.8f; } );
+		}
+		kdtree::make_kdtree( tree.begin(), tree.end(), kdtree::leaf_size( 4 ) );
+		std::size_t found = 0;
+		auto search = [ & ]( std::size_t i ) {
+					found += kdtree::nnsearch_kdtree( tree.cbegin(), tree.cend(), queries[ i ], kdtree::leaf_size( 4 ) ) - tree.cbegin();
+					found += kdtree::rangecount_kdtree( tree.cbegin(), tree.cend(), queries[ i ], upper[ i ], kdtree::leaf_size( 4 ) );
+					found += kdtree::radiuscount_kdtree( tree.cbegin(), tree.cend(), queries[ i ], 1.5, kdtree::leaf_size( 4 ) );
+				};
+		search( 0 );
+		std::size_t before = allocations;
+		for( std::size_t i = 0; i < queries.size(); ++i ) {
+			search( i );
+		}
+		std::cout << "nearest neighbor, range count and radius count searches of rows do not allocate: " << (allocations == before && found > 0 ? "yes" : "no") << "\n";
+	}
+
+	return 0;
+}
@@ -1,6 +1,13 @@
+#include <algorithm>
 #include <array>
+#include <cmath>
 #include <cstddef>
+#include <cstdint>
 #include <iostream>
+#include <iterator>
+#include <limits>
+#include <numeric>
+#include <random>
 #include <regex>
 #include <sstream>
 #include <string>
@@ -13,6 +20,51 @@ using intpoint = kdtree::point<int,2>;
 using floatpoint = kdtree::point<float,2>;
 using highdpoint = kdtree::point<int,3>;
 
+// searches of points with fixed axes step their split axes themselves, while skeleton views read them from the skeleton
+template <std::size_t d>
+void test_fixed_axes( std::mt19937 & generator ) {
+	using point = kdtree::point<float,d>;
+	std::vector<point> data( 8000 );
+	for( auto & p : data ) {
+		for( auto & x : p ) {
+			x = static_cast<float>( generator() % 200 );
+		}
+	}
+	std::vector<point> queries( 300 );
+	for( auto & q : queries ) {
+		for( auto & x : q ) {
+			x = static_cast<float>( generator() % 220 ) - 10.0f;
+		}
+	}
+	kdtree::leaf_size leaf( 5 );
+	kdtree::split_skeleton<float> skeleton( leaf );
+	kdtree::make_kdtree( data.begin(), data.end(), skeleton );
+	auto view = skeleton.view();
+	std::vector<point> breadth_first( data );
+	kdtree::make_kdtree( breadth_first.begin(), breadth_first.end(), kdtree::eytzinger_layout() );
+	bool nn_matches = true;
+	bool knn_matches = true;
+	bool range_matches = true;
+	bool radius_matches = true;
+	bool eytzinger_matches = true;
+	for( auto const & q : queries ) {
+		point upper = q;
+		for( auto & x : upper ) {
+			x += 15.0f;
+		}
+		auto nearest = std::min_element( data.cbegin(), data.cend(), [ &q ]( auto const & lhs, auto const & rhs ) { return kdtree::squared_euclidean_distance( lhs, q ) < kdtree::squared_euclidean_distance( rhs, q ); } );
+		nn_matches = nn_matches && kdtree::nnsearch_kdtree( data.cbegin(), data.cend(), q, leaf ) == kdtree::nnsearch_kdtree( data.cbegin(), data.cend(), q, view );
+		nn_matches = nn_matches && kdtree::squared_euclidean_distance( *kdtree::nnsearch_kdtree( data.cbegin(), data.cend(), q, leaf ), q ) == kdtree::squared_euclidean_distance( *nearest, q );
+		knn_matches = knn_matches && kdtree::nnsearch_kdtree( data.cbegin(), data.cend(), q, 9, leaf ) == kdtree::nnsearch_kdtree( data.cbegin(), data.cend(), q, 9, view );
+		range_matches = range_matches && kdtree::rangequery_kdtree( data.cbegin(), data.cend(), q, upper, leaf ) == kdtree::rangequery_kdtree( data.cbegin(), data.cend(), q, upper, view );
+		range_matches = range_matches && kdtree::rangecount_kdtree( data.cbegin(), data.cend(), q, upper, leaf ) == static_cast<std::size_t>( std::count_if( data.cbegin(), data.cend(), [ & ]( point const & p ) { return std::equal( p.cbegin(), p.cend(), q.cbegin(), []( float x, float lower ) { return x >= lower; } ) && std::equal( p.cbegin(), p.cend(), upper.cbegin(), []( float x, float bound ) { return x <= bound; } ); } ) );
+		radius_matches = radius_matches && kdtree::radiusquery_kdtree( data.cbegin(), data.cend(), q, 12.0, leaf ) == kdtree::radiusquery_kdtree( data.cbegin(), data.cend(), q, 12.0, view );
+		eytzinger_matches = eytzinger_matches && kdtree::squared_euclidean_distance( *kdtree::nnsearch_kdtree( breadth_first.cbegin(), breadth_first.cend(), q, kdtree::eytzinger_layout() ), q ) == kdtree::squared_euclidean_distance( *nearest, q );
+		eytzinger_matches = eytzinger_matches && kdtree::rangecount_kdtree( breadth_first.cbegin(), breadth_first.cend(), q, upper, kdtree::eytzinger_layout() ) == kdtree::rangecount_kdtree( data.cbegin(), data.cend(), q, upper, leaf );
+	}
+	std::cout << "d=" << d << ": nearest neighbor " << (nn_matches ? "yes" : "no") << ", k nearest neighbors " << (knn_matches ? "yes" : "no") << ", range query " << (range_matches ? "yes" : "no") << ", radius query " << (radius_matches ? "yes" : "no") << ", breadth-first layout " << (eytzinger_matches ? "yes" : "no") << "\n";
+}
+
 int main( int argc, char* argv[] ) {
 	(void)argc;
 	(void)argv;
@@ -192,6 +244,830 @@ int main( int argc, char* argv[] ) {
 		}
 	}
 
+	std::cout << "\n\nTesting leaf size 3:\n\n";
+
+	{
+		std::vector<intpoint> data = { {1, 3}, {2, 7}, {-3, 6}, {-2, -1}, {-7, 4}, {2, 3}, {-5, 2}, {-1, 9}, {6, -3}, {-4, 0}, {0, -1}, {-2, -1}, {3, 3} };
+		kdtree::leaf_size leaf( 3 );
+		kdtree::make_kdtree( data.begin(), data.end(), leaf );
+		kdtree::print_kdtree( std::cout, data.cbegin(), data.cend(), leaf );
+
+		intpoint exact = {-5, 2};
+		auto exact_match_location = kdtree::search_kdtree( data.cbegin(), data.cend(), exact, leaf );
+		std::cout << "\nExact match for " << exact << ":\n";
+		std::cout << *exact_match_location << "\n";
+
+		intpoint p = {-1,-1};
+		auto nn_location = kdtree::nnsearch_kdtree( data.cbegin(), data.cend(), p, leaf );
+		std::cout << "\nNearest neighbor of " << p << ":\n";
+		std::cout << *nn_location << "\n";
+
+		intpoint lower = {-2,-3};
+		intpoint upper = {3,3};
+		auto range_locations = kdtree::rangequery_kdtree( data.cbegin(), data.cend(), lower, upper, leaf );
+		std::cout << "\nRange query within [" << lower << "," << upper << "]:\n";
+		for( auto location : range_locations ) {
+			std::cout << *location << "\n";
+		}
+
+		intpoint center = {-2, -3};
+		double radius = 4.9;
+		auto radius_locations = kdtree::radiusquery_kdtree( data.cbegin(), data.cend(), center, radius, leaf );
+		std::cout << "\nRadius query within " << radius << " units of " << center << ":\n";
+		for( auto location : radius_locations ) {
+			std::cout << *location << "\n";
+		}
+	}
+
+	std::cout << "\n\nTesting leaf sizes against a linear scan:\n\n";
+
+	{
+		std::mt19937 generator( 11 );
+		std::vector<highdpoint> points( 5000 );
+		for( auto & p : points ) {
+			p = highdpoint( static_cast<int>( generator() % 1000 ), static_cast<int>( generator() % 1000 ), static_cast<int>( generator() % 1000 ) );
+		}
+		std::vector<highdpoint> queries( 200 );
+		for( auto & p : queries ) {
+			p = highdpoint( static_cast<int>( generator() % 1000 ), static_cast<int>( generator() % 1000 ), static_cast<int>( generator() % 1000 ) );
+		}
+		for( std::size_t size : { 1, 8, 32, 10000 } ) {
+			std::vector<highdpoint> data( points );
+			kdtree::leaf_size leaf( size );
+			kdtree::make_kdtree( data.begin(), data.end(), leaf );
+			bool matches = true;
+			for( auto const & q : queries ) {
+				auto nearest = std::min_element( data.cbegin(), data.cend(), [ &q ]( auto const & lhs, auto const & rhs ) { return kdtree::squared_euclidean_distance( lhs, q ) < kdtree::squared_euclidean_distance( rhs, q ); } );
+				auto location = kdtree::nnsearch_kdtree( data.cbegin(), data.cend(), q, leaf );
+				matches = matches && kdtree::squared_euclidean_distance( *location, q ) == kdtree::squared_euclidean_distance( *nearest, q );
+				highdpoint upper = q + highdpoint( 100, 100, 100 );
+				auto in_range = kdtree::rangequery_kdtree( data.cbegin(), data.cend(), q, upper, leaf );
+				auto expected = std::count_if( data.cbegin(), data.cend(), [ &q, &upper ]( auto const & p ) { return p[ 0 ] >= q[ 0 ] && p[ 1 ] >= q[ 1 ] && p[ 2 ] >= q[ 2 ] && p[ 0 ] <= upper[ 0 ] && p[ 1 ] <= upper[ 1 ] && p[ 2 ] <= upper[ 2 ]; } );
+				matches = matches && static_cast<std::ptrdiff_t>( in_range.size() ) == expected;
+			}
+			std::vector<highdpoint> parallel( points );
+			kdtree::make_kdtree( kdtree::parallel_policy( 4, 100 ), parallel.begin(), parallel.end(), leaf );
+			std::cout << "leaf size " << size << " matches linear scan: " << (matches ? "yes" : "no") << ", parallel construction identical: " << (parallel == data ? "yes" : "no") << "\n";
+		}
+	}
+
+	std::cout << "\n\nTesting searches at distances below one unit:\n\n";
+
+	{
+		// in the unit square squared distances are smaller than the coordinate offsets they come from
+		std::mt19937 generator( 5 );
+		std::uniform_real_distribution<float> unit( 0.0f, 1.0f );
+		std::vector<floatpoint> data( 4000 );
+		for( auto & p : data ) {
+			p = floatpoint( unit( generator ), unit( generator ) );
+		}
+		std::vector<floatpoint> queries( 500 );
+		for( auto & p : queries ) {
+			p = floatpoint( unit( generator ), unit( generator ) );
+		}
+		for( std::size_t size : { 1, 16 } ) {
+			kdtree::leaf_size leaf( size );
+			kdtree::make_kdtree( data.begin(), data.end(), leaf );
+			bool nn_matches = true;
+			bool knn_matches = true;
+			for( auto const & q : queries ) {
+				std::vector<float> distances;
+				for( auto const & p : data ) {
+					distances.push_back( kdtree::squared_euclidean_distance( p, q ) );
+				}
+				std::sort( distances.begin(), distances.end() );
+				auto location = kdtree::nnsearch_kdtree( data.cbegin(), data.cend(), q, leaf );
+				nn_matches = nn_matches && kdtree::squared_euclidean_distance( *location, q ) == distances.front();
+				auto locations = kdtree::nnsearch_kdtree( data.cbegin(), data.cend(), q, 10, leaf );
+				knn_matches = knn_matches && locations.size() == 10;
+				for( std::size_t j = 0; knn_matches && j < locations.size(); ++j ) {
+					knn_matches = kdtree::squared_euclidean_distance( *locations[ j ], q ) == distances[ j ];
+				}
+			}
+			std::cout << "leaf size " << size << " nearest neighbor matches linear scan: " << (nn_matches ? "yes" : "no") << ", k nearest neighbors match in order: " << (knn_matches ? "yes" : "no") << "\n";
+		}
+		std::vector<floatpoint> few( data.begin(), data.begin() + 3 );
+		kdtree::make_kdtree( few.begin(), few.end() );
+		auto locations = kdtree::nnsearch_kdtree( few.cbegin(), few.cend(), queries.front(), 5 );
+		bool valid = locations.size() == 3 && std::none_of( locations.cbegin(), locations.cend(), [ &few ]( auto it ) { return it == few.cend(); } );
+		std::cout << "k larger than the tree returns every point: " << (valid ? "yes" : "no") << "\n";
+		std::cout << "k of zero returns nothing: " << (kdtree::nnsearch_kdtree( few.cbegin(), few.cend(), queries.front(), 0 ).empty() ? "yes" : "no") << "\n";
+	}
+
+	std::cout << "\n\nTesting approximate k nearest neighbors:\n\n";
+
+	{
+		using embedding = kdtree::point<float,16>;
+		std::mt19937 generator( 23 );
+		std::normal_distribution<float> normal( 0.0f, 1.0f );
+		std::vector<embedding> data( 8000 );
+		std::vector<embedding> queries( 100 );
+		for( auto * points : { &data, &queries } ) {
+			for( auto & p : *points ) {
+				for( auto & x : p ) {
+					x = normal( generator );
+				}
+			}
+		}
+		kdtree::leaf_size leaf( 8 );
+		kdtree::make_kdtree( data.begin(), data.end(), leaf );
+		std::size_t const k = 5;
+		float const epsilon = 0.5f;
+		bool exact_matches = true;
+		bool within_epsilon = true;
+		bool budget_complete = true;
+		std::size_t budget_hits = 0;
+		for( auto const & q : queries ) {
+			auto distance = [ &q ]( auto it ) { return kdtree::squared_euclidean_distance( *it, q ); };
+			auto exact = kdtree::nnsearch_kdtree( data.cbegin(), data.cend(), q, k, leaf );
+			auto unbounded = kdtree::nnsearch_kdtree( data.cbegin(), data.cend(), q, k, kdtree::approximation(), leaf );
+			auto approximate = kdtree::nnsearch_kdtree( data.cbegin(), data.cend(), q, k, kdtree::approximation( epsilon ), leaf );
+			auto budgeted = kdtree::nnsearch_kdtree( data.cbegin(), data.cend(), q, k, kdtree::approximation( 0, 200 ), leaf );
+			exact_matches = exact_matches && unbounded.size() == k;
+			within_epsilon = within_epsilon && approximate.size() == k;
+			budget_complete = budget_complete && budgeted.size() == k;
+			for( std::size_t j = 0; j < k && exact_matches && within_epsilon && budget_complete; ++j ) {
+				exact_matches = distance( unbounded[ j ] ) == distance( exact[ j ] );
+				within_epsilon = distance( approximate[ j ] ) <= (1 + epsilon) * (1 + epsilon) * distance( exact[ j ] );
+				budget_complete = j == 0 || distance( budgeted[ j - 1 ] ) <= distance( budgeted[ j ] );
+			}
+			budget_hits += budgeted.front() == exact.front() ? 1 : 0;
+		}
+		std::cout << "default approximation matches exact search: " << (exact_matches ? "yes" : "no") << "\n";
+		std::cout << "epsilon=" << epsilon << " neighbors within 1+epsilon of exact: " << (within_epsilon ? "yes" : "no") << "\n";
+		std::cout << "max_checks=200 returns k ordered neighbors: " << (budget_complete ? "yes" : "no") << ", finds the nearest for at least half the queries: " << (2 * budget_hits >= queries.size() ? "yes" : "no") << "\n";
+
+		std::vector<std::size_t> offsets( queries.size() + 1 );
+		std::vector<std::size_t> indices;
+		kdtree::nnsearch_kdtree_batch( kdtree::parallel_policy( 4 ), data.cbegin(), data.cend(), queries.cbegin(), queries.cend(), k, kdtree::approximation( epsilon, 500 ), offsets.begin(), indices, leaf );
+		bool matches = offsets.back() == indices.size();
+		for( std::size_t i = 0; matches && i < queries.size(); ++i ) {
+			auto locations = kdtree::nnsearch_kdtree( data.cbegin(), data.cend(), queries[ i ], k, kdtree::approximation( epsilon, 500 ), leaf );
+			matches = locations.size() == offsets[ i + 1 ] - offsets[ i ] && std::equal( locations.cbegin(), locations.cend(), indices.cbegin() + offsets[ i ], [ &data ]( auto it, std::size_t index ) { return it == data.cbegin() + index; } );
+		}
+		std::cout << "approximate batch matches single queries: " << (matches ? "yes" : "no") << "\n";
+	}
+
+	std::cout << "\n\nTesting parallel construction:\n\n";
+
+	{
+		// narrow coordinate ranges force many ties on the splitting coordinate
+		std::mt19937 generator( 42 );
+		std::vector<highdpoint> data( 300000 );
+		for( auto & p : data ) {
+			p = highdpoint( static_cast<int>( generator() % 64 ), static_cast<int>( generator() % 1024 ), static_cast<int>( generator() % 8 ) );
+		}
+		std::vector<highdpoint> sequential( data );
+		kdtree::make_kdtree( sequential.begin(), sequential.end() );
+		for( std::size_t threads : { 1, 2, 4, 8 } ) {
+			std::vector<highdpoint> parallel( data );
+			kdtree::make_kdtree( kdtree::parallel_policy( threads, 1000 ), parallel.begin(), parallel.end() );
+			std::cout << "threads=" << threads << " matches sequential construction: " << (parallel == sequential ? "yes" : "no") << "\n";
+		}
+		kdtree::thread_pool pool( 3 );
+		std::vector<highdpoint> pooled( data );
+		kdtree::make_kdtree( kdtree::parallel_policy( pool ), pooled.begin(), pooled.end() );
+		std::cout << "shared pool matches sequential construction: " << (pooled == sequential ? "yes" : "no") << "\n";
+	}
+	std::cout << "\n\nTesting range queries reporting contained subtrees:\n\n";
+
+	{
+		// a coarse grid puts many points exactly on split values and query boundaries
+		std::mt19937 generator( 31 );
+		std::vector<highdpoint> data( 40000 );
+		for( auto & p : data ) {
+			p = highdpoint( static_cast<int>( generator() % 100 ), static_cast<int>( generator() % 100 ), static_cast<int>( generator() % 10 ) );
+		}
+		std::vector<std::pair<highdpoint,highdpoint>> boxes;
+		for( std::size_t i = 0; i < 200; ++i ) {
+			highdpoint lower( static_cast<int>( generator() % 110 ) - 10, static_cast<int>( generator() % 110 ) - 10, static_cast<int>( generator() % 12 ) - 1 );
+			boxes.emplace_back( lower, lower + highdpoint( static_cast<int>( generator() % 80 ), static_cast<int>( generator() % 80 ), static_cast<int>( generator() % 10 ) ) );
+		}
+		boxes.emplace_back( highdpoint( std::numeric_limits<int>::lowest(), std::numeric_limits<int>::lowest(), std::numeric_limits<int>::lowest() ), highdpoint( std::numeric_limits<int>::max(), std::numeric_limits<int>::max(), std::numeric_limits<int>::max() ) );
+		auto scan = [ &data ]( highdpoint const & lower, highdpoint const & upper ) {
+			std::vector<highdpoint> points;
+			std::copy_if( data.cbegin(), data.cend(), std::back_inserter( points ), [ & ]( highdpoint const & p ) { return lower[ 0 ] <= p[ 0 ] && p[ 0 ] <= upper[ 0 ] && lower[ 1 ] <= p[ 1 ] && p[ 1 ] <= upper[ 1 ] && lower[ 2 ] <= p[ 2 ] && p[ 2 ] <= upper[ 2 ]; } );
+			std::sort( points.begin(), points.end() );
+			return points;
+		};
+		auto found = []( auto const & locations ) {
+			std::vector<highdpoint> points;
+			for( auto it : locations ) {
+				points.push_back( *it );
+			}
+			std::sort( points.begin(), points.end() );
+			return points;
+		};
+		auto check = [ & ]( char const * name, auto query ) {
+			bool matches = true;
+			for( auto const & box : boxes ) {
+				matches = matches && found( query( box.first, box.second ) ) == scan( box.first, box.second );
+			}
+			std::cout << name << " matches a linear scan: " << (matches ? "yes" : "no") << "\n";
+		};
+		std::vector<highdpoint> inorder( data );
+		kdtree::make_kdtree( inorder.begin(), inorder.end(), kdtree::leaf_size( 7 ) );
+		check( "in-order layout", [ & ]( highdpoint const & lower, highdpoint const & upper ) { return kdtree::rangequery_kdtree( inorder.cbegin(), inorder.cend(), lower, upper, kdtree::leaf_size( 7 ) ); } );
+		std::vector<highdpoint> eytzinger( data );
+		kdtree::make_kdtree( eytzinger.begin(), eytzinger.end(), kdtree::eytzinger_layout() );
+		check( "breadth-first layout", [ & ]( highdpoint const & lower, highdpoint const & upper ) { return kdtree::rangequery_kdtree( eytzinger.cbegin(), eytzinger.cend(), lower, upper, kdtree::eytzinger_layout() ); } );
+		std::vector<highdpoint> adaptive( data );
+		kdtree::split_skeleton<int> skeleton( kdtree::leaf_size( 3 ), kdtree::split_rule::widest_spread );
+		kdtree::make_kdtree( adaptive.begin(), adaptive.end(), skeleton );
+		check( "adaptive skeleton", [ & ]( highdpoint const & lower, highdpoint const & upper ) { return kdtree::rangequery_kdtree( adaptive.cbegin(), adaptive.cend(), lower, upper, skeleton.view() ); } );
+		std::vector<std::size_t> indices( data.size() );
+		std::iota( indices.begin(), indices.end(), 0 );
+		kdtree::make_kdtree( kdtree::make_index_iterator( indices.begin(), data.cbegin() ), kdtree::make_index_iterator( indices.end(), data.cbegin() ) );
+		check( "index tree", [ & ]( highdpoint const & lower, highdpoint const & upper ) { return kdtree::rangequery_kdtree( kdtree::make_index_iterator( indices.cbegin(), data.cbegin() ), kdtree::make_index_iterator( indices.cend(), data.cbegin() ), lower, upper ); } );
+		auto everything = kdtree::rangequery_kdtree( inorder.cbegin(), inorder.cend(), boxes.back().first, boxes.back().second, kdtree::leaf_size( 7 ) );
+		bool in_order = everything.size() == inorder.size();
+		for( std::size_t i = 0; in_order && i < everything.size(); ++i ) {
+			in_order = everything[ i ] == inorder.cbegin() + i;
+		}
+		std::cout << "a box containing the tree reports it in storage order: " << (in_order ? "yes" : "no") << "\n";
+	}
+
+	std::cout << "\n\nTesting count and aggregate queries:\n\n";
+
+	{
+		// integer coordinates keep the sums exact whatever order the points are added in
+		std::mt19937 generator( 37 );
+		std::vector<highdpoint> data( 30000 );
+		for( auto & p : data ) {
+			p = highdpoint( static_cast<int>( generator() % 200 ), static_cast<int>( generator() % 200 ), static_cast<int>( generator() % 20 ) );
+		}
+		std::vector<highdpoint> queries( 100 );
+		for( auto & q : queries ) {
+			q = highdpoint( static_cast<int>( generator() % 220 ) - 10, static_cast<int>( generator() % 220 ) - 10, static_cast<int>( generator() % 24 ) - 2 );
+		}
+		auto summarize = [ &data ]( auto inside ) {
+			kdtree::point_aggregate<3> aggregate;
+			for( auto const & p : data ) {
+				if( inside( p ) ) {
+					aggregate.add( p );
+				}
+			}
+			return aggregate;
+		};
+		auto same = []( kdtree::point_aggregate<3> const & lhs, kdtree::point_aggregate<3> const & rhs ) {
+			return lhs.count() == rhs.count() && lhs.sum( 0 ) == rhs.sum( 0 ) && lhs.sum( 1 ) == rhs.sum( 1 ) && lhs.sum( 2 ) == rhs.sum( 2 );
+		};
+		auto check = [ & ]( char const * name, auto begin, auto end, auto layout ) {
+			bool range_matches = true;
+			bool radius_matches = true;
+			bool chebyshev_matches = true;
+			for( std::size_t i = 0; i < queries.size(); ++i ) {
+				highdpoint const & q = queries[ i ];
+				highdpoint upper = q + highdpoint( static_cast<int>( i % 90 ), static_cast<int>( (7 * i) % 90 ), static_cast<int>( i % 12 ) );
+				auto in_box = [ & ]( highdpoint const & p ) { return q[ 0 ] <= p[ 0 ] && p[ 0 ] <= upper[ 0 ] && q[ 1 ] <= p[ 1 ] && p[ 1 ] <= upper[ 1 ] && q[ 2 ] <= p[ 2 ] && p[ 2 ] <= upper[ 2 ]; };
+				kdtree::point_aggregate<3> expected = summarize( in_box );
+				range_matches = range_matches && kdtree::rangecount_kdtree( begin, end, q, upper, layout ) == expected.count() && same( kdtree::rangeaggregate_kdtree( begin, end, q, upper, layout ), expected );
+				double radius = static_cast<double>( 5 + i % 60 );
+				auto in_ball = [ & ]( highdpoint const & p ) { return kdtree::reduced_distance<double>( kdtree::euclidean_metric(), p, q ) <= radius * radius; };
+				expected = summarize( in_ball );
+				radius_matches = radius_matches && kdtree::radiuscount_kdtree( begin, end, q, radius, layout ) == expected.count() && same( kdtree::radiusaggregate_kdtree( begin, end, q, radius, layout ), expected ) && kdtree::radiusquery_kdtree( begin, end, q, radius, layout ).size() == expected.count();
+				auto in_cube = [ & ]( highdpoint const & p ) { return kdtree::reduced_distance<double>( kdtree::chebyshev_metric(), p, q ) <= radius; };
+				chebyshev_matches = chebyshev_matches && kdtree::radiuscount_kdtree( begin, end, q, radius, layout, kdtree::chebyshev_metric() ) == summarize( in_cube ).count();
+			}
+			std::cout << name << " range counts and sums match a linear scan: " << (range_matches ? "yes" : "no") << "\n";
+			std::cout << name << " radius counts and sums match a linear scan: " << (radius_matches ? "yes" : "no") << "\n";
+			std::cout << name << " Chebyshev radius counts match a linear scan: " << (chebyshev_matches ? "yes" : "no") << "\n";
+		};
+		std::vector<highdpoint> inorder( data );
+		kdtree::make_kdtree( inorder.begin(), inorder.end(), kdtree::leaf_size( 5 ) );
+		check( "in-order layout", inorder.cbegin(), inorder.cend(), kdtree::leaf_size( 5 ) );
+		std::vector<highdpoint> eytzinger( data );
+		kdtree::make_kdtree( eytzinger.begin(), eytzinger.end(), kdtree::eytzinger_layout() );
+		check( "breadth-first layout", eytzinger.cbegin(), eytzinger.cend(), kdtree::eytzinger_layout() );
+		std::vector<highdpoint> adaptive( data );
+		kdtree::split_skeleton<int> skeleton( kdtree::leaf_size( 4 ), kdtree::split_rule::max_variance );
+		kdtree::make_kdtree( adaptive.begin(), adaptive.end(), skeleton );
+		check( "adaptive skeleton", adaptive.cbegin(), adaptive.cend(), skeleton.view() );
+		kdtree::point_aggregate<3> all = kdtree::rangeaggregate_kdtree( inorder.cbegin(), inorder.cend(), highdpoint( 0, 0, 0 ), highdpoint( 199, 199, 19 ) );
+		kdtree::point_aggregate<3> expected = summarize( []( highdpoint const & ) { return true; } );
+		std::cout << "centroid of the whole tree: " << (all.count() == data.size() && all.centroid() == expected.centroid() ? "yes" : "no") << "\n";
+		std::cout << "empty tree counts nothing: " << (kdtree::rangecount_kdtree( inorder.cbegin(), inorder.cbegin(), queries[ 0 ], queries[ 1 ] ) == 0 && kdtree::radiuscount_kdtree( inorder.cbegin(), inorder.cbegin(), queries[ 0 ], 10.0 ) == 0 ? "yes" : "no") << "\n";
+	}
+
+	std::cout << "\n\nTesting query visitors and output iterators:\n\n";
+
+	{
+		std::mt19937 generator( 41 );
+		std::vector<highdpoint> data( 20000 );
+		for( auto & p : data ) {
+			p = highdpoint( static_cast<int>( generator() % 100 ), static_cast<int>( generator() % 100 ), static_cast<int>( generator() % 10 ) );
+		}
+		std::vector<highdpoint> queries( 50 );
+		for( auto & q : queries ) {
+			q = highdpoint( static_cast<int>( generator() % 100 ), static_cast<int>( generator() % 100 ), static_cast<int>( generator() % 10 ) );
+		}
+		using iterator = std::vector<highdpoint>::const_iterator;
+		// runs a search through every interface and compares each with the vector it returns
+		auto check = [ & ]( char const * name, auto expected_of, auto search ) {
+			bool output_matches = true;
+			bool visitor_matches = true;
+			bool stops_early = true;
+			std::vector<iterator> buffer( data.size() );
+			for( auto const & q : queries ) {
+				std::vector<iterator> expected = expected_of( q );
+				auto last = search( q, buffer.begin() );
+				output_matches = output_matches && std::vector<iterator>( buffer.begin(), last ) == expected;
+				std::vector<iterator> visited;
+				bool completed = search( q, [ &visited ]( iterator it ) { visited.push_back( it ); } );
+				visitor_matches = visitor_matches && completed && visited == expected;
+				std::size_t limit = expected.size() / 3;
+				std::vector<iterator> first;
+				completed = search( q, [ &first, limit ]( iterator it ) { first.push_back( it ); return first.size() < limit; } );
+				stops_early = stops_early && (limit == 0 || (!completed && first.size() == limit && std::equal( first.begin(), first.end(), expected.begin() )));
+			}
+			std::cout << name << " output iterator matches the returned vector: " << (output_matches ? "yes" : "no") << "\n";
+			std::cout << name << " visitor matches the returned vector: " << (visitor_matches ? "yes" : "no") << "\n";
+			std::cout << name << " visitor stops early: " << (stops_early ? "yes" : "no") << "\n";
+		};
+		std::vector<highdpoint> inorder( data );
+		kdtree::make_kdtree( inorder.begin(), inorder.end(), kdtree::leaf_size( 6 ) );
+		std::vector<highdpoint> eytzinger( data );
+		kdtree::make_kdtree( eytzinger.begin(), eytzinger.end(), kdtree::eytzinger_layout() );
+		for( auto layout : { 0, 1 } ) {
+			std::vector<highdpoint> const & tree = layout == 0 ? inorder : eytzinger;
+			std::string prefix = layout == 0 ? "in-order " : "breadth-first ";
+			auto run = [ & ]( auto search ) { return layout == 0 ? search( kdtree::leaf_size( 6 ) ) : search( kdtree::eytzinger_layout() ); };
+			highdpoint extent( 30, 20, 5 );
+			check( (prefix + "range query").c_str(),
+					[ & ]( highdpoint const & q ) { return run( [ & ]( auto l ) { return kdtree::rangequery_kdtree( tree.cbegin(), tree.cend(), q, q + extent, l ); } ); },
+					[ & ]( highdpoint const & q, auto target ) { return run( [ & ]( auto l ) { return kdtree::rangequery_kdtree( tree.cbegin(), tree.cend(), q, q + extent, target, l ); } ); } );
+			check( (prefix + "radius query").c_str(),
+					[ & ]( highdpoint const & q ) { return run( [ & ]( auto l ) { return kdtree::radiusquery_kdtree( tree.cbegin(), tree.cend(), q, 15.0, l, kdtree::manhattan_metric() ); } ); },
+					[ & ]( highdpoint const & q, auto target ) { return run( [ & ]( auto l ) { return kdtree::radiusquery_kdtree( tree.cbegin(), tree.cend(), q, 15.0, target, l, kdtree::manhattan_metric() ); } ); } );
+			check( (prefix + "k nearest neighbors").c_str(),
+					[ & ]( highdpoint const & q ) { return run( [ & ]( auto l ) { return kdtree::nnsearch_kdtree( tree.cbegin(), tree.cend(), q, 40, l ); } ); },
+					[ & ]( highdpoint const & q, auto target ) { return run( [ & ]( auto l ) { return kdtree::nnsearch_kdtree( tree.cbegin(), tree.cend(), q, 40, target, l ); } ); } );
+			check( (prefix + "approximate k nearest neighbors").c_str(),
+					[ & ]( highdpoint const & q ) { return run( [ & ]( auto l ) { return kdtree::nnsearch_kdtree( tree.cbegin(), tree.cend(), q, 40, kdtree::approximation( 0.5 ), l ); } ); },
+					[ & ]( highdpoint const & q, auto target ) { return run( [ & ]( auto l ) { return kdtree::nnsearch_kdtree( tree.cbegin(), tree.cend(), q, 40, kdtree::approximation( 0.5 ), target, l ); } ); } );
+		}
+		std::vector<iterator> appended;
+		kdtree::rangequery_kdtree( inorder.cbegin(), inorder.cend(), queries[ 0 ], queries[ 0 ] + highdpoint( 10, 10, 3 ), std::back_inserter( appended ) );
+		kdtree::rangequery_kdtree( inorder.cbegin(), inorder.cend(), queries[ 1 ], queries[ 1 ] + highdpoint( 10, 10, 3 ), std::back_inserter( appended ) );
+		std::vector<iterator> expected = kdtree::rangequery_kdtree( inorder.cbegin(), inorder.cend(), queries[ 0 ], queries[ 0 ] + highdpoint( 10, 10, 3 ) );
+		std::vector<iterator> second = kdtree::rangequery_kdtree( inorder.cbegin(), inorder.cend(), queries[ 1 ], queries[ 1 ] + highdpoint( 10, 10, 3 ) );
+		expected.insert( expected.end(), second.begin(), second.end() );
+		std::cout << "back inserter appends to a reused buffer: " << (appended == expected ? "yes" : "no") << "\n";
+	}
+
+	std::cout << "\n\nTesting radius query early exits:\n\n";
+
+	{
+		using tenpoint = kdtree::point<double,10>;
+		std::mt19937 generator( 43 );
+		std::normal_distribution<double> normal( 0, 1 );
+		std::vector<tenpoint> data( 20000 );
+		for( auto & p : data ) {
+			std::generate( p.begin(), p.end(), [ & ]() { return normal( generator ); } );
+		}
+		std::vector<tenpoint> queries( 60 );
+		for( auto & q : queries ) {
+			std::generate( q.begin(), q.end(), [ & ]() { return 1.5 * normal( generator ); } );
+		}
+		std::vector<tenpoint> tree( data );
+		kdtree::make_kdtree( tree.begin(), tree.end(), kdtree::leaf_size( 8 ) );
+		bool radius_matches = true;
+		bool first_matches = true;
+		bool any_matches = true;
+		std::size_t hits = 0;
+		for( std::size_t i = 0; i < queries.size(); ++i ) {
+			tenpoint const & q = queries[ i ];
+			double radius = 1.0 + 0.1 * static_cast<double>( i % 30 );
+			std::size_t expected = static_cast<std::size_t>( std::count_if( data.cbegin(), data.cend(), [ & ]( tenpoint const & p ) { return kdtree::reduced_distance<double>( kdtree::euclidean_metric(), p, q ) <= radius * radius; } ) );
+			auto within = kdtree::radiusquery_kdtree( tree.cbegin(), tree.cend(), q, radius, kdtree::leaf_size( 8 ) );
+			radius_matches = radius_matches && within.size() == expected;
+			for( std::size_t n : { std::size_t( 0 ), std::size_t( 1 ), std::size_t( 5 ), std::size_t( 100 ) } ) {
+				auto first = kdtree::radiusquery_kdtree_first( tree.cbegin(), tree.cend(), q, radius, n, kdtree::leaf_size( 8 ) );
+				first_matches = first_matches && first.size() == std::min( n, expected ) && std::equal( first.begin(), first.end(), within.begin() );
+			}
+			any_matches = any_matches && kdtree::radiusquery_kdtree_any( tree.cbegin(), tree.cend(), q, radius, kdtree::leaf_size( 8 ) ) == (expected > 0);
+			hits += expected > 0 ? 1 : 0;
+		}
+		std::cout << "10-dimensional radius queries match a linear scan: " << (radius_matches ? "yes" : "no") << "\n";
+		std::cout << "first n within radius are the first n results: " << (first_matches ? "yes" : "no") << "\n";
+		std::cout << "any within radius matches a linear scan: " << (any_matches ? "yes" : "no") << "\n";
+		std::cout << "queries with and without points in range: " << (hits > 0 && hits < queries.size() ? "yes" : "no") << "\n";
+		tenpoint origin;
+		std::fill( origin.begin(), origin.end(), 0.0 );
+		std::cout << "a ball around the whole tree has a point: " << (kdtree::radiusquery_kdtree_any( tree.cbegin(), tree.cend(), origin, 100.0 ) ? "yes" : "no") << "\n";
+		std::cout << "empty tree has none: " << (!kdtree::radiusquery_kdtree_any( tree.cbegin(), tree.cbegin(), origin, 100.0 ) && kdtree::radiusquery_kdtree_first( tree.cbegin(), tree.cbegin(), origin, 100.0, 3 ).empty() ? "yes" : "no") << "\n";
+	}
+
+	std::cout << "\n\nTesting construction strategies:\n\n";
+
+	{
+		std::mt19937 generator( 29 );
+		std::vector<highdpoint> data( 100000 );
+		for( auto & p : data ) {
+			p = highdpoint( static_cast<int>( generator() % 256 ), static_cast<int>( generator() % 4096 ), static_cast<int>( generator() % 4 ) );
+		}
+		for( std::size_t size : { 1, 5 } ) {
+			kdtree::leaf_size leaf( size );
+			std::vector<highdpoint> expected( data );
+			kdtree::make_kdtree( expected.begin(), expected.end(), leaf );
+			std::vector<highdpoint> presorted( data );
+			kdtree::make_kdtree( presorted.begin(), presorted.end(), leaf, kdtree::presorted_construction() );
+			std::cout << "leaf size " << size << " presorted construction matches selection: " << (presorted == expected ? "yes" : "no") << "\n";
+			for( std::size_t sample_size : { 16, 1024 } ) {
+				std::vector<highdpoint> sampled( data );
+				kdtree::make_kdtree( sampled.begin(), sampled.end(), leaf, kdtree::sampled_construction( sample_size ) );
+				std::cout << "leaf size " << size << " sampled construction with " << sample_size << " samples matches selection: " << (sampled == expected ? "yes" : "no") << "\n";
+			}
+			std::vector<std::uint32_t> indices( data.size() );
+			std::iota( indices.begin(), indices.end(), 0 );
+			kdtree::make_kdtree( kdtree::make_index_iterator( indices.begin(), data.cbegin() ), kdtree::make_index_iterator( indices.end(), data.cbegin() ), leaf, kdtree::presorted_construction() );
+			std::cout << "leaf size " << size << " presorted index construction matches selection: " << (std::equal( expected.cbegin(), expected.cend(), kdtree::make_index_iterator( indices.cbegin(), data.cbegin() ) ) ? "yes" : "no") << "\n";
+		}
+		std::vector<highdpoint> single( 1, data.front() );
+		kdtree::make_kdtree( single.begin(), single.end(), kdtree::leaf_size(), kdtree::presorted_construction() );
+		std::vector<highdpoint> none;
+		kdtree::make_kdtree( none.begin(), none.end(), kdtree::leaf_size(), kdtree::sampled_construction() );
+		std::cout << "tiny inputs are left as they are: " << (single.front() == data.front() && none.empty() ? "yes" : "no") << "\n";
+	}
+
+	std::cout << "\n\nTesting batch queries:\n\n";
+
+	{
+		std::mt19937 generator( 7 );
+		std::vector<floatpoint> data( 20000 );
+		for( auto & p : data ) {
+			p = floatpoint( static_cast<float>( generator() % 10000 ) / 100.0f, static_cast<float>( generator() % 10000 ) / 100.0f );
+		}
+		kdtree::make_kdtree( data.begin(), data.end() );
+		std::vector<floatpoint> queries( 1000 );
+		std::vector<floatpoint> uppers( queries.size() );
+		for( std::size_t i = 0; i < queries.size(); ++i ) {
+			queries[ i ] = floatpoint( static_cast<float>( generator() % 10000 ) / 100.0f, static_cast<float>( generator() % 10000 ) / 100.0f );
+			uppers[ i ] = queries[ i ] + floatpoint( 2.5f, 1.5f );
+		}
+		kdtree::parallel_policy policy( 4 );
+		std::vector<std::size_t> offsets( queries.size() + 1 );
+		std::vector<std::size_t> indices;
+
+		std::vector<std::size_t> nearest( queries.size() );
+		kdtree::nnsearch_kdtree_batch( policy, data.cbegin(), data.cend(), queries.cbegin(), queries.cend(), nearest.begin() );
+		bool matches = true;
+		for( std::size_t i = 0; i < queries.size(); ++i ) {
+			matches = matches && data.cbegin() + nearest[ i ] == kdtree::nnsearch_kdtree( data.cbegin(), data.cend(), queries[ i ] );
+		}
+		std::cout << "nearest neighbor batch matches single queries: " << (matches ? "yes" : "no") << "\n";
+
+		kdtree::nnsearch_kdtree_batch( policy, data.cbegin(), data.cend(), queries.cbegin(), queries.cend(), 5, offsets.begin(), indices );
+		matches = offsets.back() == indices.size();
+		for( std::size_t i = 0; i < queries.size(); ++i ) {
+			auto locations = kdtree::nnsearch_kdtree( data.cbegin(), data.cend(), queries[ i ], 5 );
+			matches = matches && locations.size() == offsets[ i + 1 ] - offsets[ i ];
+			for( std::size_t j = 0; matches && j < locations.size(); ++j ) {
+				matches = data.cbegin() + indices[ offsets[ i ] + j ] == locations[ j ];
+			}
+		}
+		std::cout << "k nearest neighbor batch matches single queries: " << (matches ? "yes" : "no") << "\n";
+
+		kdtree::rangequery_kdtree_batch( policy, data.cbegin(), data.cend(), queries.cbegin(), queries.cend(), uppers.cbegin(), offsets.begin(), indices );
+		matches = offsets.back() == indices.size();
+		for( std::size_t i = 0; i < queries.size(); ++i ) {
+			auto locations = kdtree::rangequery_kdtree( data.cbegin(), data.cend(), queries[ i ], uppers[ i ] );
+			matches = matches && locations.size() == offsets[ i + 1 ] - offsets[ i ];
+			for( std::size_t j = 0; matches && j < locations.size(); ++j ) {
+				matches = data.cbegin() + indices[ offsets[ i ] + j ] == locations[ j ];
+			}
+		}
+		std::cout << "range query batch matches single queries: " << (matches ? "yes" : "no") << "\n";
+
+		kdtree::radiusquery_kdtree_batch( policy, data.cbegin(), data.cend(), queries.cbegin(), queries.cend(), 1.75, offsets.begin(), indices );
+		matches = offsets.back() == indices.size();
+		for( std::size_t i = 0; i < queries.size(); ++i ) {
+			auto locations = kdtree::radiusquery_kdtree( data.cbegin(), data.cend(), queries[ i ], 1.75 );
+			matches = matches && locations.size() == offsets[ i + 1 ] - offsets[ i ];
+			for( std::size_t j = 0; matches && j < locations.size(); ++j ) {
+				matches = data.cbegin() + indices[ offsets[ i ] + j ] == locations[ j ];
+			}
+		}
+		std::cout << "radius query batch matches single queries: " << (matches ? "yes" : "no") << "\n";
+		std::cout << "radius query batch result count: " << indices.size() << "\n";
+	}
+
+	std::cout << "\n\nTesting breadth-first layout:\n\n";
+
+	{
+		std::mt19937 generator( 11 );
+		std::vector<highdpoint> data( 50000 );
+		for( auto & p : data ) {
+			p = highdpoint( static_cast<int>( generator() % 2000 ) - 1000, static_cast<int>( generator() % 2000 ) - 1000, static_cast<int>( generator() % 64 ) );
+		}
+		std::vector<highdpoint> inorder( data );
+		kdtree::make_kdtree( inorder.begin(), inorder.end() );
+		std::vector<highdpoint> eytzinger( data );
+		kdtree::eytzinger_layout layout;
+		kdtree::make_kdtree( eytzinger.begin(), eytzinger.end(), layout );
+		std::vector<highdpoint> sorted_data( data );
+		std::vector<highdpoint> sorted_eytzinger( eytzinger );
+		std::sort( sorted_data.begin(), sorted_data.end() );
+		std::sort( sorted_eytzinger.begin(), sorted_eytzinger.end() );
+		std::cout << "layout is a permutation of the input: " << (sorted_data == sorted_eytzinger ? "yes" : "no") << "\n";
+		for( std::size_t threads : { 1, 4 } ) {
+			std::vector<highdpoint> parallel( data );
+			kdtree::make_kdtree( kdtree::parallel_policy( threads, 1000 ), parallel.begin(), parallel.end(), layout );
+			std::cout << "threads=" << threads << " matches sequential construction: " << (parallel == eytzinger ? "yes" : "no") << "\n";
+		}
+		bool found = std::all_of( data.cbegin(), data.cbegin() + 1000, [ & ]( highdpoint const & p ) { return kdtree::search_kdtree( eytzinger.cbegin(), eytzinger.cend(), p, layout ) != eytzinger.cend(); } );
+		std::cout << "search finds stored points: " << (found ? "yes" : "no") << "\n";
+
+		auto sorted_points = []( auto const & locations ) {
+			std::vector<highdpoint> points;
+			for( auto it : locations ) {
+				points.push_back( *it );
+			}
+			std::sort( points.begin(), points.end() );
+			return points;
+		};
+		std::vector<highdpoint> queries( 500 );
+		for( auto & q : queries ) {
+			q = highdpoint( static_cast<int>( generator() % 2200 ) - 1100, static_cast<int>( generator() % 2200 ) - 1100, static_cast<int>( generator() % 80 ) - 8 );
+		}
+		bool nn_matches = true;
+		bool knn_matches = true;
+		bool approximate_matches = true;
+		bool radius_matches = true;
+		bool range_matches = true;
+		std::size_t const k = 8;
+		for( auto const & q : queries ) {
+			auto distance = [ &q ]( auto it ) { return kdtree::squared_euclidean_distance( *it, q ); };
+			nn_matches = nn_matches && distance( kdtree::nnsearch_kdtree( eytzinger.cbegin(), eytzinger.cend(), q, layout ) ) == distance( kdtree::nnsearch_kdtree( inorder.cbegin(), inorder.cend(), q ) );
+			auto expected = kdtree::nnsearch_kdtree( inorder.cbegin(), inorder.cend(), q, k );
+			auto neighbors = kdtree::nnsearch_kdtree( eytzinger.cbegin(), eytzinger.cend(), q, k, layout );
+			auto approximate = kdtree::nnsearch_kdtree( eytzinger.cbegin(), eytzinger.cend(), q, k, kdtree::approximation( 0, 100000 ), layout );
+			knn_matches = knn_matches && neighbors.size() == k && std::equal( neighbors.cbegin(), neighbors.cend(), expected.cbegin(), [ & ]( auto a, auto b ) { return distance( a ) == distance( b ); } );
+			approximate_matches = approximate_matches && approximate.size() == k && std::equal( approximate.cbegin(), approximate.cend(), expected.cbegin(), [ & ]( auto a, auto b ) { return distance( a ) == distance( b ); } );
+			radius_matches = radius_matches && sorted_points( kdtree::radiusquery_kdtree( eytzinger.cbegin(), eytzinger.cend(), q, 40, layout ) ) == sorted_points( kdtree::radiusquery_kdtree( inorder.cbegin(), inorder.cend(), q, 40 ) );
+			highdpoint upper = q + highdpoint( 60, 40, 5 );
+			range_matches = range_matches && sorted_points( kdtree::rangequery_kdtree( eytzinger.cbegin(), eytzinger.cend(), q, upper, layout ) ) == sorted_points( kdtree::rangequery_kdtree( inorder.cbegin(), inorder.cend(), q, upper ) );
+		}
+		std::cout << "nearest neighbor matches in-order layout: " << (nn_matches ? "yes" : "no") << "\n";
+		std::cout << "k nearest neighbors match in-order layout: " << (knn_matches ? "yes" : "no") << "\n";
+		std::cout << "best-bin-first search with a generous budget is exact: " << (approximate_matches ? "yes" : "no") << "\n";
+		std::cout << "radius query matches in-order layout: " << (radius_matches ? "yes" : "no") << "\n";
+		std::cout << "range query matches in-order layout: " << (range_matches ? "yes" : "no") << "\n";
+
+		std::vector<std::size_t> results( queries.size() );
+		kdtree::nnsearch_kdtree_batch( kdtree::parallel_policy( 4 ), eytzinger.cbegin(), eytzinger.cend(), queries.cbegin(), queries.cend(), results.begin(), layout );
+		bool matches = true;
+		for( std::size_t i = 0; matches && i < queries.size(); ++i ) {
+			matches = eytzinger.cbegin() + results[ i ] == kdtree::nnsearch_kdtree( eytzinger.cbegin(), eytzinger.cend(), queries[ i ], layout );
+		}
+		std::cout << "batch nearest neighbor matches single queries: " << (matches ? "yes" : "no") << "\n";
+	}
+
+	std::cout << "\n\nTesting split skeleton:\n\n";
+
+	{
+		using widepoint = kdtree::point<double,16>;
+		std::mt19937 generator( 13 );
+		std::normal_distribution<double> normal( 0.0, 1.0 );
+		std::vector<widepoint> data( 20000 );
+		std::vector<widepoint> queries( 200 );
+		for( auto * points : { &data, &queries } ) {
+			for( auto & p : *points ) {
+				for( auto & x : p ) {
+					x = normal( generator );
+				}
+			}
+		}
+		kdtree::leaf_size leaf( 4 );
+		std::vector<widepoint> tree( data );
+		kdtree::make_kdtree( tree.begin(), tree.end(), leaf );
+		kdtree::split_skeleton<double> skeleton( leaf );
+		std::vector<widepoint> skeleton_tree( data );
+		kdtree::make_kdtree( skeleton_tree.begin(), skeleton_tree.end(), skeleton );
+		std::cout << "points are laid out as without a skeleton: " << (tree == skeleton_tree ? "yes" : "no") << "\n";
+		std::cout << "skeleton holds " << skeleton.splits().size() << " split values\n";
+		kdtree::split_skeleton<double> parallel_skeleton( leaf );
+		std::vector<widepoint> parallel_tree( data );
+		kdtree::make_kdtree( kdtree::parallel_policy( 4, 1000 ), parallel_tree.begin(), parallel_tree.end(), parallel_skeleton );
+		std::cout << "parallel construction matches sequential construction: " << (parallel_tree == tree && parallel_skeleton.splits() == skeleton.splits() ? "yes" : "no") << "\n";
+
+		auto view = skeleton.view();
+		bool nn_matches = true;
+		bool knn_matches = true;
+		bool approximate_matches = true;
+		bool radius_matches = true;
+		bool range_matches = true;
+		for( auto const & q : queries ) {
+			nn_matches = nn_matches && kdtree::nnsearch_kdtree( tree.cbegin(), tree.cend(), q, view ) == kdtree::nnsearch_kdtree( tree.cbegin(), tree.cend(), q, leaf );
+			knn_matches = knn_matches && kdtree::nnsearch_kdtree( tree.cbegin(), tree.cend(), q, 10, view, kdtree::manhattan_metric() ) == kdtree::nnsearch_kdtree( tree.cbegin(), tree.cend(), q, 10, leaf, kdtree::manhattan_metric() );
+			approximate_matches = approximate_matches && kdtree::nnsearch_kdtree( tree.cbegin(), tree.cend(), q, 10, kdtree::approximation( 0.5, 300 ), view ) == kdtree::nnsearch_kdtree( tree.cbegin(), tree.cend(), q, 10, kdtree::approximation( 0.5, 300 ), leaf );
+			radius_matches = radius_matches && kdtree::radiusquery_kdtree( tree.cbegin(), tree.cend(), q, 4.0, view ) == kdtree::radiusquery_kdtree( tree.cbegin(), tree.cend(), q, 4.0, leaf );
+			widepoint upper = q;
+			for( auto & x : upper ) {
+				x += 1.5;
+			}
+			range_matches = range_matches && kdtree::rangequery_kdtree( tree.cbegin(), tree.cend(), q, upper, view ) == kdtree::rangequery_kdtree( tree.cbegin(), tree.cend(), q, upper, leaf );
+		}
+		std::cout << "nearest neighbor matches search without skeleton: " << (nn_matches ? "yes" : "no") << "\n";
+		std::cout << "k nearest neighbors match search without skeleton: " << (knn_matches ? "yes" : "no") << "\n";
+		std::cout << "approximate k nearest neighbors match search without skeleton: " << (approximate_matches ? "yes" : "no") << "\n";
+		std::cout << "radius query matches search without skeleton: " << (radius_matches ? "yes" : "no") << "\n";
+		std::cout << "range query matches search without skeleton: " << (range_matches ? "yes" : "no") << "\n";
+	}
+
+	std::cout << "\n\nTesting adaptive split dimensions:\n\n";
+
+	{
+		// thin clusters stretched along the first axis, where cycling through the axes shapes cells poorly
+		std::mt19937 generator( 19 );
+		std::normal_distribution<float> normal( 0.0f, 1.0f );
+		std::vector<floatpoint> data( 30000 );
+		for( std::size_t i = 0; i < data.size(); ++i ) {
+			float offset = static_cast<float>( i % 5 ) * 4.0f;
+			data[ i ] = floatpoint( 1000.0f * normal( generator ), offset + 0.5f * normal( generator ) );
+		}
+		std::vector<floatpoint> queries( 300 );
+		for( auto & q : queries ) {
+			q = floatpoint( 1000.0f * normal( generator ), 20.0f * std::abs( normal( generator ) ) );
+		}
+		for( kdtree::split_rule rule : { kdtree::split_rule::widest_spread, kdtree::split_rule::max_variance } ) {
+			std::cout << (rule == kdtree::split_rule::widest_spread ? "widest spread" : "max variance") << ":\n";
+			kdtree::split_skeleton<float> skeleton( kdtree::leaf_size( 4 ), rule );
+			std::vector<floatpoint> tree( data );
+			kdtree::make_kdtree( tree.begin(), tree.end(), skeleton );
+			std::size_t first_axis = std::count( skeleton.dimensions().cbegin(), skeleton.dimensions().cend(), 0 );
+			std::cout << "splits along the stretched axis outnumber the others: " << (2 * first_axis > skeleton.dimensions().size() ? "yes" : "no") << "\n";
+			kdtree::split_skeleton<float> parallel_skeleton( kdtree::leaf_size( 4 ), rule );
+			std::vector<floatpoint> parallel_tree( data );
+			kdtree::make_kdtree( kdtree::parallel_policy( 4, 1000 ), parallel_tree.begin(), parallel_tree.end(), parallel_skeleton );
+			std::cout << "parallel construction matches sequential construction: " << (parallel_tree == tree && parallel_skeleton.splits() == skeleton.splits() && parallel_skeleton.dimensions() == skeleton.dimensions() ? "yes" : "no") << "\n";
+			auto view = skeleton.view();
+			bool nn_matches = true;
+			bool knn_matches = true;
+			bool radius_matches = true;
+			bool range_matches = true;
+			for( auto const & q : queries ) {
+				auto distance = [ &q ]( floatpoint const & p ) { return kdtree::squared_euclidean_distance( p, q ); };
+				auto closer = [ &distance ]( floatpoint const & lhs, floatpoint const & rhs ) { return distance( lhs ) < distance( rhs ); };
+				std::vector<floatpoint> expected( data );
+				std::sort( expected.begin(), expected.end(), closer );
+				nn_matches = nn_matches && distance( *kdtree::nnsearch_kdtree( tree.cbegin(), tree.cend(), q, view ) ) == distance( expected.front() );
+				auto neighbors = kdtree::nnsearch_kdtree( tree.cbegin(), tree.cend(), q, 6, view );
+				knn_matches = knn_matches && std::equal( neighbors.cbegin(), neighbors.cend(), expected.cbegin(), expected.cbegin() + 6, [ &distance ]( auto it, floatpoint const & p ) { return distance( *it ) == distance( p ); } );
+				radius_matches = radius_matches && kdtree::radiusquery_kdtree( tree.cbegin(), tree.cend(), q, 30.0, view ).size() == static_cast<std::size_t>( std::count_if( data.cbegin(), data.cend(), [ & ]( floatpoint const & p ) { return distance( p ) <= 900.0f; } ) );
+				floatpoint upper = q + floatpoint( 200.0f, 3.0f );
+				range_matches = range_matches && kdtree::rangequery_kdtree( tree.cbegin(), tree.cend(), q, upper, view ).size() == static_cast<std::size_t>( std::count_if( data.cbegin(), data.cend(), [ & ]( floatpoint const & p ) { return q[ 0 ] <= p[ 0 ] && p[ 0 ] <= upper[ 0 ] && q[ 1 ] <= p[ 1 ] && p[ 1 ] <= upper[ 1 ]; } ) );
+			}
+			std::cout << "nearest neighbor matches a linear scan: " << (nn_matches ? "yes" : "no") << "\n";
+			std::cout << "k nearest neighbors match a linear scan: " << (knn_matches ? "yes" : "no") << "\n";
+			std::cout << "radius query matches a linear scan: " << (radius_matches ? "yes" : "no") << "\n";
+			std::cout << "range query matches a linear scan: " << (range_matches ? "yes" : "no") << "\n";
+		}
+	}
+
+	std::cout << "\n\nTesting index trees:\n\n";
+
+	{
+		std::mt19937 generator( 17 );
+		std::vector<highdpoint> storage( 30000 );
+		for( auto & p : storage ) {
+			p = highdpoint( static_cast<int>( generator() % 500 ), static_cast<int>( generator() % 500 ), static_cast<int>( generator() % 16 ) );
+		}
+		std::vector<highdpoint> const points( storage );
+		kdtree::leaf_size leaf( 6 );
+		kdtree::make_kdtree( storage.begin(), storage.end(), leaf );
+
+		std::vector<std::uint32_t> indices( points.size() );
+		std::iota( indices.begin(), indices.end(), 0 );
+		auto begin = kdtree::make_index_iterator( indices.begin(), points.cbegin() );
+		auto end = kdtree::make_index_iterator( indices.end(), points.cbegin() );
+		kdtree::make_kdtree( begin, end, leaf );
+		std::cout << "indexed points are laid out as a tree built by value: " << (std::equal( begin, end, storage.cbegin() ) ? "yes" : "no") << "\n";
+
+		std::vector<std::uint64_t> parallel_indices( points.size() );
+		std::iota( parallel_indices.begin(), parallel_indices.end(), 0 );
+		kdtree::make_kdtree( kdtree::parallel_policy( 4, 1000 ), kdtree::make_index_iterator( parallel_indices.begin(), points.cbegin() ), kdtree::make_index_iterator( parallel_indices.end(), points.cbegin() ), leaf );
+		std::cout << "parallel construction matches sequential construction: " << (std::equal( indices.cbegin(), indices.cend(), parallel_indices.cbegin() ) ? "yes" : "no") << "\n";
+
+		std::vector<std::uint32_t> eytzinger_indices( points.size() );
+		std::iota( eytzinger_indices.begin(), eytzinger_indices.end(), 0 );
+		std::vector<highdpoint> eytzinger( points );
+		kdtree::make_kdtree( eytzinger.begin(), eytzinger.end(), kdtree::eytzinger_layout() );
+		kdtree::make_kdtree( kdtree::make_index_iterator( eytzinger_indices.begin(), points.cbegin() ), kdtree::make_index_iterator( eytzinger_indices.end(), points.cbegin() ), kdtree::eytzinger_layout() );
+		std::cout << "breadth-first layout matches a tree built by value: " << (std::equal( kdtree::make_index_iterator( eytzinger_indices.cbegin(), points.cbegin() ), kdtree::make_index_iterator( eytzinger_indices.cend(), points.cbegin() ), eytzinger.cbegin() ) ? "yes" : "no") << "\n";
+
+		bool nn_matches = true;
+		bool knn_matches = true;
+		bool radius_matches = true;
+		for( std::size_t i = 0; i < 300; ++i ) {
+			highdpoint q( static_cast<int>( generator() % 520 ) - 10, static_cast<int>( generator() % 520 ) - 10, static_cast<int>( generator() % 20 ) - 2 );
+			auto nearest = kdtree::nnsearch_kdtree( begin, end, q, leaf );
+			nn_matches = nn_matches && points[ nearest.index() ] == *kdtree::nnsearch_kdtree( storage.cbegin(), storage.cend(), q, leaf );
+			auto neighbors = kdtree::nnsearch_kdtree( begin, end, q, 7, leaf );
+			auto expected = kdtree::nnsearch_kdtree( storage.cbegin(), storage.cend(), q, 7, leaf );
+			knn_matches = knn_matches && std::equal( neighbors.cbegin(), neighbors.cend(), expected.cbegin(), expected.cend(), [ & ]( auto lhs, auto rhs ) { return points[ lhs.index() ] == *rhs; } );
+			auto within = kdtree::radiusquery_kdtree( begin, end, q, 12, leaf );
+			auto expected_within = kdtree::radiusquery_kdtree( storage.cbegin(), storage.cend(), q, 12, leaf );
+			radius_matches = radius_matches && std::equal( within.cbegin(), within.cend(), expected_within.cbegin(), expected_within.cend(), [ & ]( auto lhs, auto rhs ) { return points[ lhs.index() ] == *rhs; } );
+		}
+		std::cout << "nearest neighbor index matches search by value: " << (nn_matches ? "yes" : "no") << "\n";
+		std::cout << "k nearest neighbor indices match search by value: " << (knn_matches ? "yes" : "no") << "\n";
+		std::cout << "radius query indices match search by value: " << (radius_matches ? "yes" : "no") << "\n";
+	}
+
+	std::cout << "\n\nTesting traversal statistics:\n\n";
+
+	{
+		std::mt19937 generator( 19 );
+		std::vector<floatpoint> data( 20000 );
+		for( auto & p : data ) {
+			p = floatpoint( static_cast<float>( generator() % 10000 ) / 100.0f, static_cast<float>( generator() % 10000 ) / 100.0f );
+		}
+		kdtree::leaf_size leaf( 4 );
+		kdtree::make_kdtree( data.begin(), data.end(), leaf );
+		std::vector<floatpoint> queries( 500 );
+		std::vector<floatpoint> uppers( queries.size() );
+		for( std::size_t i = 0; i < queries.size(); ++i ) {
+			queries[ i ] = floatpoint( static_cast<float>( generator() % 10000 ) / 100.0f, static_cast<float>( generator() % 10000 ) / 100.0f );
+			uppers[ i ] = queries[ i ] + floatpoint( 3.5f, 2.5f );
+		}
+		auto same_stats = []( kdtree::query_stats const & lhs, kdtree::query_stats const & rhs ) {
+			return lhs.queries() == rhs.queries() && lhs.nodes_visited() == rhs.nodes_visited() && lhs.pruned() == rhs.pruned() && lhs.distances() == rhs.distances() && lhs.max_depth() == rhs.max_depth() && lhs.results() == rhs.results();
+		};
+
+		kdtree::query_stats nn_stats;
+		bool unchanged = true;
+		for( auto const & q : queries ) {
+			unchanged = unchanged && kdtree::nnsearch_kdtree( data.cbegin(), data.cend(), q, kdtree::with_stats( leaf, nn_stats ) ) == kdtree::nnsearch_kdtree( data.cbegin(), data.cend(), q, leaf );
+		}
+		std::cout << "recording does not change nearest neighbors: " << (unchanged ? "yes" : "no") << "\n";
+		std::cout << "one nearest neighbor result per query: " << (nn_stats.queries() == queries.size() && nn_stats.results() == queries.size() ? "yes" : "no") << "\n";
+		std::cout << "nearest neighbor searches prune most of the tree: " << (nn_stats.pruned() > 0 && nn_stats.distances() < queries.size() * data.size() / 100 ? "yes" : "no") << "\n";
+		std::cout << "maximum depth is that of the deepest leaf: " << (nn_stats.max_depth() == 12 ? "yes" : "no") << "\n";
+
+		kdtree::query_stats knn_stats;
+		for( auto const & q : queries ) {
+			kdtree::nnsearch_kdtree( data.cbegin(), data.cend(), q, 5, kdtree::with_stats( leaf, knn_stats ) );
+		}
+		std::cout << "k nearest neighbor results counted: " << (knn_stats.results() == 5 * queries.size() ? "yes" : "no") << "\n";
+		std::cout << "k nearest neighbor searches compute more distances: " << (knn_stats.distances() > nn_stats.distances() ? "yes" : "no") << "\n";
+
+		kdtree::query_stats range_stats;
+		kdtree::query_stats count_stats;
+		std::size_t found = 0;
+		for( std::size_t i = 0; i < queries.size(); ++i ) {
+			found += kdtree::rangequery_kdtree( data.cbegin(), data.cend(), queries[ i ], uppers[ i ], kdtree::with_stats( leaf, range_stats ) ).size();
+			kdtree::rangecount_kdtree( data.cbegin(), data.cend(), queries[ i ], uppers[ i ], kdtree::with_stats( leaf, count_stats ) );
+		}
+		std::cout << "range results counted, including contained subtrees: " << (range_stats.results() == found ? "yes" : "no") << "\n";
+		std::cout << "range counts traverse like range queries: " << (same_stats( range_stats, count_stats ) ? "yes" : "no") << "\n";
+
+		kdtree::query_stats radius_stats;
+		kdtree::query_stats any_stats;
+		found = 0;
+		for( auto const & q : queries ) {
+			found += kdtree::radiusquery_kdtree( data.cbegin(), data.cend(), q, 2.0, kdtree::with_stats( leaf, radius_stats ) ).size();
+			kdtree::radiusquery_kdtree_any( data.cbegin(), data.cend(), q, 2.0, kdtree::with_stats( leaf, any_stats ) );
+		}
+		std::cout << "radius results counted: " << (radius_stats.results() == found ? "yes" : "no") << "\n";
+		std::cout << "early exits visit fewer nodes: " << (any_stats.nodes_visited() < radius_stats.nodes_visited() ? "yes" : "no") << "\n";
+
+		kdtree::eytzinger_layout eytzinger;
+		std::vector<floatpoint> breadth_first( data );
+		kdtree::make_kdtree( breadth_first.begin(), breadth_first.end(), eytzinger );
+		kdtree::query_stats eytzinger_stats;
+		for( auto const & q : queries ) {
+			kdtree::nnsearch_kdtree( breadth_first.cbegin(), breadth_first.cend(), q, kdtree::with_stats( eytzinger, eytzinger_stats ) );
+		}
+		std::cout << "breadth-first layout records statistics: " << (eytzinger_stats.results() == queries.size() && eytzinger_stats.nodes_visited() > 0 ? "yes" : "no") << "\n";
+
+		kdtree::parallel_policy policy( 4 );
+		std::vector<std::size_t> offsets( queries.size() + 1 );
+		std::vector<std::size_t> indices;
+		std::vector<std::size_t> nearest( queries.size() );
+		kdtree::query_stats batch_stats;
+		kdtree::nnsearch_kdtree_batch( policy, data.cbegin(), data.cend(), queries.cbegin(), queries.cend(), nearest.begin(), kdtree::with_stats( leaf, batch_stats ) );
+		std::cout << "nearest neighbor batch totals match single queries: " << (same_stats( batch_stats, nn_stats ) ? "yes" : "no") << "\n";
+		batch_stats = kdtree::query_stats();
+		kdtree::nnsearch_kdtree_batch( policy, data.cbegin(), data.cend(), queries.cbegin(), queries.cend(), 5, offsets.begin(), indices, kdtree::with_stats( leaf, batch_stats ) );
+		std::cout << "k nearest neighbor batch totals match single queries: " << (same_stats( batch_stats, knn_stats ) ? "yes" : "no") << "\n";
+		batch_stats = kdtree::query_stats();
+		kdtree::rangequery_kdtree_batch( policy, data.cbegin(), data.cend(), queries.cbegin(), queries.cend(), uppers.cbegin(), offsets.begin(), indices, kdtree::with_stats( leaf, batch_stats ) );
+		std::cout << "range query batch totals match single queries: " << (same_stats( batch_stats, range_stats ) ? "yes" : "no") << "\n";
+		batch_stats = kdtree::query_stats();
+		kdtree::radiusquery_kdtree_batch( policy, data.cbegin(), data.cend(), queries.cbegin(), queries.cend(), 2.0, offsets.begin(), indices, kdtree::with_stats( leaf, batch_stats ) );
+		std::cout << "radius query batch totals match single queries: " << (same_stats( batch_stats, radius_stats ) ? "yes" : "no") << "\n";
+		std::cout << "empty sink has no size: " << (std::is_empty<kdtree::no_stats>::value ? "yes" : "no") << "\n";
+	}
+
+	std::cout << "\n\nTesting searches with fixed axes:\n\n";
+
+	{
+		std::mt19937 generator( 29 );
+		test_fixed_axes<1>( generator );
+		test_fixed_axes<2>( generator );
+		test_fixed_axes<3>( generator );
+	}
 
 /*
 	std::string line;
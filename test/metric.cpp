@@ -0,0 +1,112 @@
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <iostream>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "../include/kdtree.hpp"
+#include "../include/metric.hpp"
+#include "../include/point.hpp"
+
+using intpoint = kdtree::point<int,3>;
+using floatpoint = kdtree::point<float,2>;
+
+// compares every metric-aware search against a linear scan using the same reduced distances
+template <class Point, class Metric, class Generate>
+void test_searches( std::string const & name, Metric metric, double radius, Generate generate ) {
+	using distance_type = typename kdtree::distance_traits<typename Point::coordinate_type>::type;
+	std::mt19937 generator( 17 );
+	std::vector<Point> data( 3000 );
+	for( auto & p : data ) {
+		p = generate( generator );
+	}
+	std::vector<Point> queries( 200 );
+	for( auto & p : queries ) {
+		p = generate( generator );
+	}
+	for( std::size_t size : { 1, 8 } ) {
+		kdtree::leaf_size leaf( size );
+		kdtree::make_kdtree( data.begin(), data.end(), leaf );
+		bool nn_matches = true;
+		bool knn_matches = true;
+		bool radius_matches = true;
+		distance_type reduced_radius = metric.reduce( static_cast<distance_type>( radius ) );
+		for( auto const & q : queries ) {
+			std::vector<distance_type> distances;
+			std::size_t within = 0;
+			for( auto const & p : data ) {
+				distances.push_back( kdtree::reduced_distance<distance_type>( metric, p, q ) );
+				within += distances.back() <= reduced_radius ? 1 : 0;
+			}
+			std::sort( distances.begin(), distances.end() );
+			auto location = kdtree::nnsearch_kdtree( data.cbegin(), data.cend(), q, leaf, metric );
+			nn_matches = nn_matches && kdtree::reduced_distance<distance_type>( metric, *location, q ) == distances.front();
+			auto locations = kdtree::nnsearch_kdtree( data.cbegin(), data.cend(), q, 7, leaf, metric );
+			knn_matches = knn_matches && locations.size() == 7;
+			for( std::size_t j = 0; knn_matches && j < locations.size(); ++j ) {
+				knn_matches = kdtree::reduced_distance<distance_type>( metric, *locations[ j ], q ) == distances[ j ];
+			}
+			auto in_radius = kdtree::radiusquery_kdtree( data.cbegin(), data.cend(), q, radius, leaf, metric );
+			radius_matches = radius_matches && in_radius.size() == within;
+			for( auto it : in_radius ) {
+				radius_matches = radius_matches && kdtree::reduced_distance<distance_type>( metric, *it, q ) <= reduced_radius;
+			}
+		}
+		std::vector<std::size_t> offsets( queries.size() + 1 );
+		std::vector<std::size_t> indices;
+		kdtree::nnsearch_kdtree_batch( kdtree::parallel_policy( 3 ), data.cbegin(), data.cend(), queries.cbegin(), queries.cend(), 7, offsets.begin(), indices, leaf, metric );
+		bool batch_matches = offsets.back() == indices.size();
+		for( std::size_t i = 0; batch_matches && i < queries.size(); ++i ) {
+			auto locations = kdtree::nnsearch_kdtree( data.cbegin(), data.cend(), queries[ i ], 7, leaf, metric );
+			batch_matches = locations.size() == offsets[ i + 1 ] - offsets[ i ] && std::equal( locations.cbegin(), locations.cend(), indices.cbegin() + offsets[ i ], [ &data ]( auto it, std::size_t index ) { return it == data.cbegin() + index; } );
+		}
+		std::cout << name << " leaf size " << size << ": nearest neighbor " << (nn_matches ? "yes" : "no") << ", k nearest neighbors " << (knn_matches ? "yes" : "no") << ", radius " << (radius_matches ? "yes" : "no") << ", batch " << (batch_matches ? "yes" : "no") << "\n";
+	}
+}
+
+int main( int argc, char* argv[] ) {
+	(void)argc;
+	(void)argv;
+
+	std::cout << "Testing reduced distances between (1,-2,3) and (4,2,-9):\n\n";
+
+	{
+		intpoint p1( 1, -2, 3 );
+		intpoint p2( 4, 2, -9 );
+		std::cout << "euclidean: " << kdtree::reduced_distance<double>( kdtree::euclidean_metric(), p1, p2 ) << "\n";
+		std::cout << "manhattan: " << kdtree::reduced_distance<double>( kdtree::manhattan_metric(), p1, p2 ) << "\n";
+		std::cout << "chebyshev: " << kdtree::reduced_distance<double>( kdtree::chebyshev_metric(), p1, p2 ) << "\n";
+		std::cout << "minkowski<3>: " << kdtree::reduced_distance<double>( kdtree::minkowski_metric<3>(), p1, p2 ) << "\n";
+		std::cout << "minkowski 3: " << kdtree::reduced_distance<double>( kdtree::real_minkowski_metric( 3.0 ), p1, p2 ) << "\n";
+		std::cout << "weighted euclidean (1,0.5,0.25): " << kdtree::reduced_distance<double>( kdtree::weighted_euclidean_metric<double,3>( std::array<double,3>{ { 1.0, 0.5, 0.25 } } ), p1, p2 ) << "\n";
+	}
+
+	std::cout << "\n\nTesting searches against a linear scan:\n\n";
+
+	auto integers = []( std::mt19937 & generator ) { return intpoint( static_cast<int>( generator() % 1000 ), static_cast<int>( generator() % 1000 ), static_cast<int>( generator() % 1000 ) ); };
+	test_searches<intpoint>( "euclidean", kdtree::euclidean_metric(), 60.0, integers );
+	test_searches<intpoint>( "manhattan", kdtree::manhattan_metric(), 90.0, integers );
+	test_searches<intpoint>( "chebyshev", kdtree::chebyshev_metric(), 40.0, integers );
+	test_searches<intpoint>( "minkowski<3>", kdtree::minkowski_metric<3>(), 50.0, integers );
+	test_searches<intpoint>( "minkowski 2.5", kdtree::real_minkowski_metric( 2.5 ), 55.0, integers );
+	test_searches<intpoint>( "weighted euclidean", kdtree::weighted_euclidean_metric<double,3>( std::array<double,3>{ { 1.0, 4.0, 0.25 } } ), 60.0, integers );
+
+	std::uniform_real_distribution<float> unit( 0.0f, 1.0f );
+	auto floats = [ &unit ]( std::mt19937 & generator ) { return floatpoint( unit( generator ), unit( generator ) ); };
+	test_searches<floatpoint>( "float manhattan", kdtree::manhattan_metric(), 0.03, floats );
+	test_searches<floatpoint>( "float chebyshev", kdtree::chebyshev_metric(), 0.02, floats );
+	test_searches<floatpoint>( "float minkowski 1.5", kdtree::real_minkowski_metric( 1.5 ), 0.025, floats );
+
+	std::cout << "\n\nTesting Minkowski orders below one:\n\n";
+
+	try {
+		(void)kdtree::real_minkowski_metric( 0.5 );
+		std::cout << "order 0.5 rejected: no\n";
+	} catch( std::domain_error const & ) {
+		std::cout << "order 0.5 rejected: yes\n";
+	}
+
+	return 0;
+}
@@ -0,0 +1,144 @@
+#include <cmath>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include "../include/parse.hpp"
+#include "../include/point.hpp"
+
+std::string const PATH = "parse_test.txt";
+
+template <class T, std::size_t d>
+std::string parse_error( std::string const & text, char delimiter = '\t' ) {
+	try {
+		kdtree::parse_points<T,d>( text.data(), text.data() + text.size(), delimiter );
+	} catch( std::runtime_error const & error ) {
+		return error.what();
+	}
+	return "accepted";
+}
+
+template <class T, std::size_t d>
+void print_points( std::string const & name, std::string const & text, char delimiter = '\t' ) {
+	std::cout << name << ":";
+	for( auto const & p : kdtree::parse_points<T,d>( text.data(), text.data() + text.size(), delimiter ) ) {
+		std::cout << " " << p;
+	}
+	std::cout << "\n";
+}
+
+int main( int argc, char* argv[] ) {
+	(void)argc;
+	(void)argv;
+
+	std::cout << "Testing line formats:\n\n";
+
+	print_points<double,2>( "tab delimited", "1\t2\n3.5\t-4\n" );
+	print_points<double,2>( "parenthesized", "(1,2)\n(3.5,-4)\n" );
+	print_points<double,2>( "custom delimiter", "1;2\n3.5;-4", ';' );
+	print_points<double,2>( "space delimiter with padding", "  1 2 \r\n\n 3.5   -4\n", ' ' );
+	print_points<double,3>( "blank lines and no final newline", "\n\n1,2,3\n\n\t\n4,5,6" );
+	print_points<int,2>( "integers", "-2147483648\t2147483647\n0\t+7\n" );
+	print_points<double,2>( "exponents and special values", "1e3\t-2.5E-2\n.5\t5.\ninf\t-1e-320\n" );
+	std::cout << "empty input: " << kdtree::parse_points<double,2>( nullptr, nullptr ).size() << " points\n";
+
+	std::cout << "\n\nTesting malformed input:\n\n";
+
+	std::cout << "too few coordinates: " << parse_error<double,3>( "1\t2\t3\n4\t5\n" ) << "\n";
+	std::cout << "too many coordinates: " << parse_error<double,2>( "1\t2\n\n3\t4\t5\n" ) << "\n";
+	std::cout << "not a number: " << parse_error<double,2>( "1\tx\n" ) << "\n";
+	std::cout << "unclosed parenthesis: " << parse_error<double,2>( "(1,2\n" ) << "\n";
+	std::cout << "wrong delimiter: " << parse_error<double,2>( "1;2\n" ) << "\n";
+	std::cout << "integer overflow: " << parse_error<int,2>( "1\t2147483648\n" ) << "\n";
+	std::cout << "negative unsigned: " << parse_error<unsigned,2>( "1\t-1\n" ) << "\n";
+	std::cout << "numbered from a later line: " << [](){
+				std::string text( "1\t2\n3\n" );
+				try {
+					kdtree::parse_points<double,2>( text.data(), text.data() + text.size(), '\t', kdtree::parallel_policy(), 41 );
+				} catch( std::runtime_error const & error ) {
+					return std::string( error.what() );
+				}
+				return std::string( "accepted" );
+			}() << "\n";
+	std::cout << "fraction in an integer: " << parse_error<int,2>( "1\t2.5\n" ) << "\n";
+	std::cout << "out of range: " << parse_error<float,2>( "1\t1e60\n" ) << "\n";
+
+	std::cout << "\n\nTesting conversions against strtod:\n\n";
+
+	{
+		// random decimal strings of every length, half of them beyond the exact fast path
+		std::mt19937_64 generator( 31 );
+		std::string text;
+		std::vector<std::string> tokens;
+		for( std::size_t i = 0; i < 200000; ++i ) {
+			std::ostringstream token;
+			std::uniform_real_distribution<double> unit( -1.0, 1.0 );
+			double value = unit( generator ) * std::pow( 10.0, static_cast<int>( generator() % 60 ) - 30 );
+			token << std::setprecision( 1 + static_cast<int>( generator() % 20 ) ) << value;
+			tokens.push_back( token.str() );
+			text += tokens.back() + (i % 2 == 0 ? "\t" : "\n");
+		}
+		auto doubles = kdtree::parse_points<double,2>( text.data(), text.data() + text.size() );
+		auto floats = kdtree::parse_points<float,2>( text.data(), text.data() + text.size() );
+		bool doubles_match = doubles.size() == tokens.size() / 2;
+		bool floats_match = floats.size() == tokens.size() / 2;
+		for( std::size_t i = 0; doubles_match && floats_match && i < tokens.size(); ++i ) {
+			doubles_match = doubles[ i / 2 ][ i % 2 ] == std::strtod( tokens[ i ].c_str(), nullptr );
+			floats_match = floats[ i / 2 ][ i % 2 ] == std::strtof( tokens[ i ].c_str(), nullptr );
+		}
+		std::cout << "doubles are correctly rounded: " << (doubles_match ? "yes" : "no") << "\n";
+		std::cout << "floats are correctly rounded: " << (floats_match ? "yes" : "no") << "\n";
+	}
+
+	std::cout << "\n\nTesting parallel reads:\n\n";
+
+	{
+		std::mt19937 generator( 37 );
+		std::uniform_int_distribution<int> coordinate( -1000000, 1000000 );
+		std::vector< kdtree::point<int,3> > expected( 500000 );
+		{
+			std::ofstream ofs( PATH );
+			for( auto & p : expected ) {
+				p = kdtree::point<int,3>( coordinate( generator ), coordinate( generator ), coordinate( generator ) );
+				ofs << p[ 0 ] << "\t" << p[ 1 ] << "\t" << p[ 2 ] << "\n";
+			}
+		}
+		for( std::size_t threads : { 1, 3, 8 } ) {
+			auto points = kdtree::read_points<int,3>( PATH, '\t', kdtree::parallel_policy( threads ) );
+			std::cout << threads << " threads, mapped file keeps every point in order: " << (points == expected ? "yes" : "no") << "\n";
+		}
+		// a pipe cannot be mapped and is read in blocks instead
+		FILE * pipe = popen( ("cat " + PATH).c_str(), "r" );
+		auto piped = kdtree::read_points<int,3>( fileno( pipe ), '\t', kdtree::parallel_policy( 4 ) );
+		pclose( pipe );
+		std::cout << "pipe keeps every point in order: " << (piped == expected ? "yes" : "no") << "\n";
+		{
+			std::ofstream ofs( PATH, std::ios::app );
+			ofs << "1\t2\n";
+		}
+		try {
+			kdtree::read_points<int,3>( PATH );
+			std::cout << "malformed last line: accepted\n";
+		} catch( std::runtime_error const & error ) {
+			std::cout << "malformed last line: " << error.what() << "\n";
+		}
+		std::remove( PATH.c_str() );
+		try {
+			kdtree::read_points<int,3>( PATH );
+			std::cout << "missing file: accepted\n";
+		} catch( std::runtime_error const & error ) {
+			std::cout << "missing file: rejected\n";
+		}
+	}
+
+	return 0;
+}
@@ -0,0 +1,150 @@
+#include <algorithm>
+#include <cstddef>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "../include/kdtree.hpp"
+#include "../include/point.hpp"
+#include "../include/snapshot.hpp"
+
+using floatpoint = kdtree::point<float,3>;
+
+std::string const PATH = "snapshot_test.kdt";
+
+template <class Write>
+void write_file( Write write ) {
+	std::ofstream ofs( PATH, std::ios::binary );
+	write( ofs );
+}
+
+template <class Snapshot>
+std::string open_error() {
+	try {
+		Snapshot snapshot( PATH );
+	} catch( std::runtime_error const & error ) {
+		return "rejected";
+	}
+	return "accepted";
+}
+
+// runs the same searches over a tree in memory and over its mapped snapshot
+template <class Layout>
+void test_roundtrip( std::string const & name, std::vector<floatpoint> const & tree, std::vector<floatpoint> const & queries, Layout layout ) {
+	kdtree::mapped_snapshot<float,3> snapshot( PATH );
+	bool points_match = snapshot.size() == tree.size() && std::equal( tree.cbegin(), tree.cend(), snapshot.begin() );
+	bool nn_matches = true;
+	bool knn_matches = true;
+	bool range_matches = true;
+	for( auto const & q : queries ) {
+		std::size_t expected = kdtree::nnsearch_kdtree( tree.cbegin(), tree.cend(), q, layout ) - tree.cbegin();
+		nn_matches = nn_matches && snapshot.search( [ & ]( auto begin, auto end, auto l ) { return static_cast<std::size_t>( kdtree::nnsearch_kdtree( begin, end, q, l ) - begin ); } ) == expected;
+		auto neighbors = kdtree::nnsearch_kdtree( tree.cbegin(), tree.cend(), q, 9, layout );
+		auto mapped = snapshot.search( [ & ]( auto begin, auto end, auto l ) {
+					std::vector<std::size_t> positions;
+					for( auto it : kdtree::nnsearch_kdtree( begin, end, q, 9, l ) ) {
+						positions.push_back( it - begin );
+					}
+					return positions;
+				} );
+		knn_matches = knn_matches && mapped.size() == neighbors.size() && std::equal( mapped.begin(), mapped.end(), neighbors.begin(), [ &tree ]( std::size_t position, auto it ) { return tree.cbegin() + position == it; } );
+		floatpoint upper = q + floatpoint( 0.1f, 0.1f, 0.1f );
+		range_matches = range_matches && snapshot.search( [ & ]( auto begin, auto end, auto l ) { return kdtree::rangecount_kdtree( begin, end, q, upper, l ); } ) == kdtree::rangecount_kdtree( tree.cbegin(), tree.cend(), q, upper, layout );
+	}
+	std::cout << name << ": points " << (points_match ? "yes" : "no") << ", nearest neighbor " << (nn_matches ? "yes" : "no") << ", k nearest neighbors " << (knn_matches ? "yes" : "no") << ", range count " << (range_matches ? "yes" : "no") << "\n";
+}
+
+int main( int argc, char* argv[] ) {
+	(void)argc;
+	(void)argv;
+
+	std::mt19937 generator( 29 );
+	std::uniform_real_distribution<float> unit( 0.0f, 1.0f );
+	std::vector<floatpoint> data( 50000 );
+	for( auto & p : data ) {
+		p = floatpoint( unit( generator ), unit( generator ), 0.1f * unit( generator ) );
+	}
+	std::vector<floatpoint> queries( 300 );
+	for( auto & q : queries ) {
+		q = floatpoint( unit( generator ), unit( generator ), 0.1f * unit( generator ) );
+	}
+
+	std::cout << "Testing snapshot round trips:\n\n";
+
+	{
+		std::vector<floatpoint> tree( data );
+		kdtree::make_kdtree( tree.begin(), tree.end(), kdtree::leaf_size( 8 ) );
+		write_file( [ & ]( std::ostream & os ) { kdtree::write_snapshot( os, tree.cbegin(), tree.cend(), kdtree::leaf_size( 8 ) ); } );
+		test_roundtrip( "in-order layout", tree, queries, kdtree::leaf_size( 8 ) );
+	}
+	{
+		std::vector<floatpoint> tree( data );
+		kdtree::make_kdtree( tree.begin(), tree.end(), kdtree::eytzinger_layout() );
+		write_file( [ & ]( std::ostream & os ) { kdtree::write_snapshot( os, tree.cbegin(), tree.cend(), kdtree::eytzinger_layout() ); } );
+		test_roundtrip( "breadth-first layout", tree, queries, kdtree::eytzinger_layout() );
+	}
+	for( auto rule : { kdtree::split_rule::round_robin, kdtree::split_rule::widest_spread } ) {
+		std::vector<floatpoint> tree( data );
+		kdtree::split_skeleton<float> skeleton( kdtree::leaf_size( 6 ), rule );
+		kdtree::make_kdtree( tree.begin(), tree.end(), skeleton );
+		write_file( [ & ]( std::ostream & os ) { kdtree::write_snapshot( os, tree.cbegin(), tree.cend(), skeleton ); } );
+		test_roundtrip( rule == kdtree::split_rule::round_robin ? "skeleton" : "adaptive skeleton", tree, queries, skeleton.view() );
+	}
+	{
+		// an index tree is written in the order of its indices
+		std::vector<std::size_t> indices( data.size() );
+		for( std::size_t i = 0; i < indices.size(); ++i ) {
+			indices[ i ] = i;
+		}
+		auto begin = kdtree::make_index_iterator( indices.begin(), data.cbegin() );
+		auto end = kdtree::make_index_iterator( indices.end(), data.cbegin() );
+		kdtree::make_kdtree( begin, end, kdtree::leaf_size( 8 ) );
+		write_file( [ & ]( std::ostream & os ) { kdtree::write_snapshot( os, begin, end, kdtree::leaf_size( 8 ) ); } );
+		std::vector<floatpoint> tree( begin, end );
+		test_roundtrip( "index tree", tree, queries, kdtree::leaf_size( 8 ) );
+	}
+
+	std::cout << "\n\nTesting snapshot validation:\n\n";
+
+	{
+		std::vector<floatpoint> tree( data.begin(), data.begin() + 1000 );
+		kdtree::split_skeleton<float> skeleton( kdtree::leaf_size( 4 ), kdtree::split_rule::max_variance );
+		kdtree::make_kdtree( tree.begin(), tree.end(), skeleton );
+		write_file( [ & ]( std::ostream & os ) { kdtree::write_snapshot( os, tree.cbegin(), tree.cend(), skeleton ); } );
+		std::cout << "matching point type: " << open_error< kdtree::mapped_snapshot<float,3> >() << "\n";
+		std::cout << "different dimensionality: " << open_error< kdtree::mapped_snapshot<float,2> >() << "\n";
+		std::cout << "different coordinate type: " << open_error< kdtree::mapped_snapshot<double,3> >() << "\n";
+		std::string contents;
+		{
+			std::ifstream ifs( PATH, std::ios::binary );
+			contents.assign( std::istreambuf_iterator<char>( ifs ), std::istreambuf_iterator<char>() );
+		}
+		write_file( [ & ]( std::ostream & os ) { os.write( contents.data(), static_cast<std::streamsize>( contents.size() - 100 ) ); } );
+		std::cout << "truncated file: " << open_error< kdtree::mapped_snapshot<float,3> >() << "\n";
+		std::string corrupt( contents );
+		corrupt[ 8 ] = 2;
+		write_file( [ & ]( std::ostream & os ) { os.write( corrupt.data(), static_cast<std::streamsize>( corrupt.size() ) ); } );
+		std::cout << "future version: " << open_error< kdtree::mapped_snapshot<float,3> >() << "\n";
+		corrupt = contents;
+		corrupt[ 0 ] = 'X';
+		write_file( [ & ]( std::ostream & os ) { os.write( corrupt.data(), static_cast<std::streamsize>( corrupt.size() ) ); } );
+		std::cout << "wrong magic: " << open_error< kdtree::mapped_snapshot<float,3> >() << "\n";
+		write_file( [ & ]( std::ostream & os ) { os.write( contents.data(), 64 ); } );
+		std::cout << "header only in part: " << open_error< kdtree::mapped_snapshot<float,3> >() << "\n";
+		std::remove( PATH.c_str() );
+		std::cout << "missing file: " << open_error< kdtree::mapped_snapshot<float,3> >() << "\n";
+	}
+
+	{
+		std::vector<floatpoint> empty;
+		write_file( [ & ]( std::ostream & os ) { kdtree::write_snapshot( os, empty.cbegin(), empty.cend() ); } );
+		kdtree::mapped_snapshot<float,3> snapshot( PATH );
+		std::cout << "empty tree: " << snapshot.size() << " points, nearest neighbor is end: " << (snapshot.search( [ & ]( auto begin, auto end, auto l ) { return kdtree::nnsearch_kdtree( begin, end, queries[ 0 ], l ) == end; } ) ? "yes" : "no") << "\n";
+		std::remove( PATH.c_str() );
+	}
+
+	return 0;
+}
@@ -0,0 +1,57 @@
+#include <atomic>
+#include <cstddef>
+#include <iostream>
+#include <numeric>
+#include <vector>
+#include "../include/thread_pool.hpp"
+
+std::size_t parallel_sum( kdtree::thread_pool & pool, std::vector<std::size_t> const & values, std::size_t begin, std::size_t end ) {
+	if( end - begin <= 1000 ) {
+		return std::accumulate( values.begin() + begin, values.begin() + end, std::size_t( 0 ) );
+	}
+	std::size_t middle = begin + (end - begin) / 2;
+	std::size_t right = 0;
+	kdtree::task_group group( pool );
+	group.run( [ &, middle, end ]() { right = parallel_sum( pool, values, middle, end ); } );
+	std::size_t left = parallel_sum( pool, values, begin, middle );
+	group.wait();
+	return left + right;
+}
+
+int main( int argc, char* argv[] ) {
+	(void)argc;
+	(void)argv;
+
+	std::vector<std::size_t> values( 1000000 );
+	std::iota( values.begin(), values.end(), 0 );
+
+	for( std::size_t workers : { 0, 1, 3, 7 } ) {
+		kdtree::thread_pool pool( workers );
+		std::cout << "nested sum with " << workers << " workers: " << parallel_sum( pool, values, 0, values.size() ) << '\n';
+	}
+
+	{
+		kdtree::thread_pool pool( 3 );
+		std::atomic<std::size_t> count( 0 );
+		kdtree::task_group group( pool );
+		for( std::size_t i = 0; i < 1000; ++i ) {
+			group.run( [ &count ]() { ++count; } );
+		}
+		group.wait();
+		std::cout << "flat tasks completed: " << count.load() << '\n';
+	}
+
+	{
+		kdtree::thread_pool pool( 2 );
+		kdtree::task_group group( pool );
+		group.run( []() { throw std::runtime_error( "task failure" ); } );
+		try {
+			group.wait();
+			std::cout << "exception propagated: no\n";
+		} catch( std::runtime_error const & e ) {
+			std::cout << "exception propagated: " << e.what() << '\n';
+		}
+	}
+
+	return 0;
+}